@@ -0,0 +1,320 @@
+/**
+  ******************************************************************************
+  * @file    audio_asrc.c
+  * @brief   Streaming asynchronous sample rate converter used to absorb the
+  *          drift between the USB host clock and the I2S clock.
+  *
+  *          The converter reads interleaved 16-bit or 32-bit stereo frames
+  *          (24-bit samples are carried MSB-justified in 32 bits) and emits
+  *          frames at a ratio of (ratio + adjust) input frames per output
+  *          frame, ratio being the nominal ratio of the input and output
+  *          sampling frequencies, 1.0 unless Audio_ASRC_SetRatio() is
+  *          called. Output samples are computed with a 4-point cubic Hermite
+  *          interpolator in fixed point. At a ratio of exactly 1.0 and a
+  *          phase of 0 the interpolator returns its input unchanged, so the
+  *          stage is bit-transparent until drift has to be corrected. Once
+  *          the ratio is back at 1.0, the phase left by the correction is
+  *          brought back to 0, the ratio moving by at most
+  *          AUDIO_ASRC_SETTLE_PPM towards the nearest input frame, so that
+  *          the stage becomes bit-transparent again.
+  *
+  *          The ratio is steered from the FIFO fill error: the error is low
+  *          pass filtered, ignored inside a small dead band, scaled and
+  *          clamped to +/-AUDIO_ASRC_MAX_PPM, and the ratio slews towards
+  *          the resulting target so that corrections are inaudible.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "audio_asrc.h"
+#include "audio_dsp.h"
+
+/* Private define ------------------------------------------------------------*/
+#define ASRC_PHASE_MASK                 (AUDIO_ASRC_ONE - 1)
+
+/* Largest phase correction per output frame once the ratio is 1.0 (Q30) */
+#define ASRC_SETTLE_STEP                ((uint32_t)AUDIO_ASRC_PPM(AUDIO_ASRC_SETTLE_PPM))
+
+/* Bits dropped from the Q30 phase to get the Q16 interpolation position */
+#define ASRC_PHASE_SHIFT                14
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Cubic Hermite interpolation between x0 and x1.
+  * @param  xm1, x0, x1, x2: four consecutive samples.
+  * @param  t: position between x0 and x1 in Q16.
+  * @retval Interpolated sample, saturated to 16 bits.
+  */
+static inline int16_t ASRC_Interpolate(int32_t xm1, int32_t x0, int32_t x1,
+                                       int32_t x2, int32_t t)
+{
+  /* Twice the polynomial coefficients, so that they stay integers */
+  int32_t c1 = x1 - xm1;
+  int32_t c2 = 2 * xm1 - 5 * x0 + 4 * x1 - x2;
+  int32_t c3 = (x2 - xm1) + 3 * (x0 - x1);
+  int32_t y;
+
+  y = (int32_t)(((int64_t)c3 * t) >> 16) + c2;
+  y = (int32_t)(((int64_t)y * t) >> 16) + c1;
+  y = (int32_t)(((int64_t)y * t) >> 17) + x0;
+
+  return (int16_t)AUDIO_DSP_SSAT(y, 16);
+}
+
+/**
+  * @brief  Cubic Hermite interpolation between x0 and x1, 32-bit samples.
+  * @param  xm1, x0, x1, x2: four consecutive samples.
+  * @param  t: position between x0 and x1 in Q16.
+  * @retval Interpolated sample, saturated to 32 bits.
+  */
+static inline int32_t ASRC_Interpolate32(int64_t xm1, int64_t x0, int64_t x1,
+                                         int64_t x2, int64_t t)
+{
+  int64_t c1 = x1 - xm1;
+  int64_t c2 = 2 * xm1 - 5 * x0 + 4 * x1 - x2;
+  int64_t c3 = (x2 - xm1) + 3 * (x0 - x1);
+  int64_t y;
+
+  y = ((c3 * t) >> 16) + c2;
+  y = ((y * t) >> 16) + c1;
+  y = ((y * t) >> 17) + x0;
+
+  if (y > INT32_MAX)
+  {
+    return INT32_MAX;
+  }
+  if (y < INT32_MIN)
+  {
+    return INT32_MIN;
+  }
+  return (int32_t)y;
+}
+
+/**
+  * @brief  Phase increment of the next output frame: the ratio, or at a
+  *         ratio of 1.0 a step bringing a fractional phase back to 0.
+  * @param  phase: current phase (Q30).
+  * @param  step: ratio with its deviation (Q30).
+  * @retval Phase increment (Q30).
+  */
+static inline uint32_t ASRC_Step(uint32_t phase, uint32_t step)
+{
+  uint32_t frac = phase & ASRC_PHASE_MASK;
+
+  if ((step != AUDIO_ASRC_ONE) || (frac == 0))
+  {
+    return step;
+  }
+  if (frac < (AUDIO_ASRC_ONE / 2))
+  {
+    /* Back to the frame before */
+    return AUDIO_ASRC_ONE - ((frac < ASRC_SETTLE_STEP) ? frac : ASRC_SETTLE_STEP);
+  }
+  /* On to the frame after */
+  frac = AUDIO_ASRC_ONE - frac;
+  return AUDIO_ASRC_ONE + ((frac < ASRC_SETTLE_STEP) ? frac : ASRC_SETTLE_STEP);
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Reset the converter to a ratio of 1.0 with silent history.
+  * @param  asrc: converter state.
+  * @retval None
+  */
+void Audio_ASRC_Init(AUDIO_ASRC_TypeDef *asrc)
+{
+  uint32_t i, ch;
+
+  for (i = 0; i < 4; i++)
+  {
+    for (ch = 0; ch < AUDIO_ASRC_CHANNELS; ch++)
+    {
+      asrc->hist[i][ch] = 0;
+    }
+  }
+  asrc->phase = 0;
+  asrc->ratio = AUDIO_ASRC_ONE;
+  asrc->adjust = 0;
+  asrc->error = 0;
+}
+
+/**
+  * @brief  Set the nominal ratio from the input and output sampling
+  *         frequencies, the fill error steering around it. The ratio must
+  *         stay below 3.0 for the Q2.30 phase not to overflow.
+  * @param  asrc: converter state.
+  * @param  InFreq: input sampling frequency (Hz).
+  * @param  OutFreq: output sampling frequency (Hz).
+  * @retval None
+  */
+void Audio_ASRC_SetRatio(AUDIO_ASRC_TypeDef *asrc, uint32_t InFreq, uint32_t OutFreq)
+{
+  asrc->ratio = (uint32_t)(((uint64_t)InFreq << 30) / OutFreq);
+}
+
+/**
+  * @brief  Update the conversion ratio from the FIFO fill error.
+  *         Call once per rendered block.
+  * @param  asrc: converter state.
+  * @param  FillError: FIFO fill minus target fill, in frames.
+  * @retval None
+  */
+void Audio_ASRC_Steer(AUDIO_ASRC_TypeDef *asrc, int32_t FillError)
+{
+  int32_t error, target, delta;
+
+  /* Packet arrival makes the fill jitter by a whole packet: filter it */
+  asrc->error += ((FillError << 8) - asrc->error) / 64;
+  error = asrc->error / 256;
+
+  if (error > AUDIO_ASRC_DEADBAND)
+  {
+    target = (error - AUDIO_ASRC_DEADBAND) * AUDIO_ASRC_PPM(AUDIO_ASRC_GAIN_PPM);
+  }
+  else if (error < -AUDIO_ASRC_DEADBAND)
+  {
+    target = (error + AUDIO_ASRC_DEADBAND) * AUDIO_ASRC_PPM(AUDIO_ASRC_GAIN_PPM);
+  }
+  else
+  {
+    target = 0;
+  }
+
+  if (target > AUDIO_ASRC_PPM(AUDIO_ASRC_MAX_PPM))
+  {
+    target = AUDIO_ASRC_PPM(AUDIO_ASRC_MAX_PPM);
+  }
+  else if (target < -AUDIO_ASRC_PPM(AUDIO_ASRC_MAX_PPM))
+  {
+    target = -AUDIO_ASRC_PPM(AUDIO_ASRC_MAX_PPM);
+  }
+
+  /* Slew the ratio so that the pitch never jumps */
+  delta = target - asrc->adjust;
+  if ((delta < 16) && (delta > -16))
+  {
+    asrc->adjust = target;
+  }
+  else
+  {
+    asrc->adjust += delta / 16;
+  }
+}
+
+/**
+  * @brief  Convert interleaved frames until either the input is exhausted or
+  *         the output block is full.
+  * @param  asrc: converter state.
+  * @param  pIn: input frames.
+  * @param  pInFrames: in: frames available at pIn; out: frames consumed.
+  * @param  pOut: output frames.
+  * @param  pOutFrames: in: room at pOut in frames; out: frames produced.
+  * @retval None
+  */
+void Audio_ASRC_Process(AUDIO_ASRC_TypeDef *asrc,
+                        const int16_t *pIn, uint32_t *pInFrames,
+                        int16_t *pOut, uint32_t *pOutFrames)
+{
+  uint32_t in_avail = *pInFrames;
+  uint32_t out_room = *pOutFrames;
+  uint32_t in_used = 0;
+  uint32_t out_done = 0;
+  uint32_t phase = asrc->phase;
+  uint32_t step = asrc->ratio + (uint32_t)asrc->adjust;
+  uint32_t ch;
+  int32_t t;
+
+  while (out_done < out_room)
+  {
+    /* Shift in as many input frames as the phase has moved past */
+    while (phase >= AUDIO_ASRC_ONE)
+    {
+      if (in_used == in_avail)
+      {
+        goto done;
+      }
+      for (ch = 0; ch < AUDIO_ASRC_CHANNELS; ch++)
+      {
+        asrc->hist[0][ch] = asrc->hist[1][ch];
+        asrc->hist[1][ch] = asrc->hist[2][ch];
+        asrc->hist[2][ch] = asrc->hist[3][ch];
+        asrc->hist[3][ch] = *pIn++;
+      }
+      in_used++;
+      phase -= AUDIO_ASRC_ONE;
+    }
+
+    t = (int32_t)((phase & ASRC_PHASE_MASK) >> ASRC_PHASE_SHIFT);
+    for (ch = 0; ch < AUDIO_ASRC_CHANNELS; ch++)
+    {
+      *pOut++ = ASRC_Interpolate(asrc->hist[0][ch], asrc->hist[1][ch],
+                                 asrc->hist[2][ch], asrc->hist[3][ch], t);
+    }
+    out_done++;
+    phase += ASRC_Step(phase, step);
+  }
+
+done:
+  asrc->phase = phase;
+  *pInFrames = in_used;
+  *pOutFrames = out_done;
+}
+
+/**
+  * @brief  Same as Audio_ASRC_Process() for 32-bit samples.
+  * @param  asrc: converter state.
+  * @param  pIn: input frames.
+  * @param  pInFrames: in: frames available at pIn; out: frames consumed.
+  * @param  pOut: output frames.
+  * @param  pOutFrames: in: room at pOut in frames; out: frames produced.
+  * @retval None
+  */
+void Audio_ASRC_Process32(AUDIO_ASRC_TypeDef *asrc,
+                          const int32_t *pIn, uint32_t *pInFrames,
+                          int32_t *pOut, uint32_t *pOutFrames)
+{
+  uint32_t in_avail = *pInFrames;
+  uint32_t out_room = *pOutFrames;
+  uint32_t in_used = 0;
+  uint32_t out_done = 0;
+  uint32_t phase = asrc->phase;
+  uint32_t step = asrc->ratio + (uint32_t)asrc->adjust;
+  uint32_t ch;
+  int32_t t;
+
+  while (out_done < out_room)
+  {
+    while (phase >= AUDIO_ASRC_ONE)
+    {
+      if (in_used == in_avail)
+      {
+        goto done;
+      }
+      for (ch = 0; ch < AUDIO_ASRC_CHANNELS; ch++)
+      {
+        asrc->hist[0][ch] = asrc->hist[1][ch];
+        asrc->hist[1][ch] = asrc->hist[2][ch];
+        asrc->hist[2][ch] = asrc->hist[3][ch];
+        asrc->hist[3][ch] = *pIn++;
+      }
+      in_used++;
+      phase -= AUDIO_ASRC_ONE;
+    }
+
+    t = (int32_t)((phase & ASRC_PHASE_MASK) >> ASRC_PHASE_SHIFT);
+    for (ch = 0; ch < AUDIO_ASRC_CHANNELS; ch++)
+    {
+      *pOut++ = ASRC_Interpolate32(asrc->hist[0][ch], asrc->hist[1][ch],
+                                   asrc->hist[2][ch], asrc->hist[3][ch], t);
+    }
+    out_done++;
+    phase += ASRC_Step(phase, step);
+  }
+
+done:
+  asrc->phase = phase;
+  *pInFrames = in_used;
+  *pOutFrames = out_done;
+}
@@ -0,0 +1,59 @@
+/**
+  ******************************************************************************
+  * @file    audio_asrc.h
+  * @brief   Header file for the audio_asrc.c streaming sample rate converter.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_ASRC_H
+#define __AUDIO_ASRC_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Number of interleaved channels processed by the converter */
+#define AUDIO_ASRC_CHANNELS             2
+
+/* Input/output ratio is stored in Q2.30: 1.0 = AUDIO_ASRC_ONE */
+#define AUDIO_ASRC_ONE                  ((uint32_t)1 << 30)
+
+/* Ratio deviation in Q30 for a value in ppm (2^30 / 10^6 ~= 1074) */
+#define AUDIO_ASRC_PPM(ppm)             ((int32_t)(ppm) * 1074)
+
+/* Largest deviation of the conversion ratio from 1.0 */
+#define AUDIO_ASRC_MAX_PPM              1000
+
+/* Ratio correction per frame of filtered fill error */
+#define AUDIO_ASRC_GAIN_PPM             20
+
+/* Fill errors smaller than this (in frames) leave the ratio at exactly 1.0 */
+#define AUDIO_ASRC_DEADBAND             8
+
+/* Largest ratio deviation used to bring the phase back to 0 once the ratio
+   is back at 1.0 */
+#define AUDIO_ASRC_SETTLE_PPM           100
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  int32_t  hist[4][AUDIO_ASRC_CHANNELS]; /* x[-1], x[0], x[1], x[2] */
+  uint32_t phase;                        /* Position between x[0] and x[1] (Q30) */
+  uint32_t ratio;                        /* Nominal input/output ratio (Q30) */
+  int32_t  adjust;                       /* Current ratio deviation (Q30) */
+  int32_t  error;                        /* Filtered fill error (frames, Q8) */
+} AUDIO_ASRC_TypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void Audio_ASRC_Init(AUDIO_ASRC_TypeDef *asrc);
+void Audio_ASRC_SetRatio(AUDIO_ASRC_TypeDef *asrc, uint32_t InFreq, uint32_t OutFreq);
+void Audio_ASRC_Steer(AUDIO_ASRC_TypeDef *asrc, int32_t FillError);
+void Audio_ASRC_Process(AUDIO_ASRC_TypeDef *asrc,
+                        const int16_t *pIn, uint32_t *pInFrames,
+                        int16_t *pOut, uint32_t *pOutFrames);
+void Audio_ASRC_Process32(AUDIO_ASRC_TypeDef *asrc,
+                          const int32_t *pIn, uint32_t *pInFrames,
+                          int32_t *pOut, uint32_t *pOutFrames);
+
+#endif /* __AUDIO_ASRC_H */
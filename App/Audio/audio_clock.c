@@ -0,0 +1,111 @@
+/**
+  ******************************************************************************
+  * @file    audio_clock.c
+  * @brief   I2S clock planner.
+  *
+  *          The I2S sampling frequency is derived from the PLLI2S through
+  *          two dividers:
+  *            I2SCLK = PLL input * PLLI2SN / PLLI2SR
+  *            Fs     = I2SCLK / (256 * (2 * I2SDIV + ODD))     MCLK enabled
+  *            Fs     = I2SCLK / (2 * ChannelBits * (2 * I2SDIV + ODD))
+  *                                                          MCLK disabled
+  *          Audio_Clock_Plan() tries every valid PLLI2SN/PLLI2SR pair with
+  *          the two prescalers closest to the target, and keeps the one with
+  *          the lowest frequency error. It has no side effect: applying the
+  *          plan to RCC and SPI is up to the caller.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "audio_clock.h"
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Absolute value of a 64-bit signed integer.
+  */
+static inline uint64_t CLOCK_Abs64(int64_t x)
+{
+  return (uint64_t)((x < 0) ? -x : x);
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Searches the PLLI2S and I2S prescaler settings giving the closest
+  *         sampling frequency to the target.
+  * @param  PllInputFreq: PLL input frequency in Hz (HSE or HSI / PLLM).
+  * @param  AudioFreq: target sampling frequency in Hz.
+  * @param  ChannelBits: 16 or 32, length of each channel in the I2S frame.
+  * @param  MCLKOutput: 1 to output MCLK (256 * Fs), 0 otherwise.
+  * @param  plan: filled with the best settings found.
+  * @retval 0 if a setting has been found, 1 otherwise.
+  */
+uint32_t Audio_Clock_Plan(uint32_t PllInputFreq, uint32_t AudioFreq,
+                          uint32_t ChannelBits, uint32_t MCLKOutput,
+                          AUDIO_ClockPlanTypeDef *plan)
+{
+  uint32_t n, r, k, i;
+  uint32_t vco, i2sclk, bitdiv, kcand;
+  uint64_t den, err, best_err = 0, best_den = 1;
+  int64_t  diff;
+  uint32_t found = 0;
+
+  if ((AudioFreq == 0) || (PllInputFreq == 0))
+  {
+    return 1;
+  }
+
+  /* Ratio between I2SCLK / (2 * I2SDIV + ODD) and the sampling frequency */
+  bitdiv = MCLKOutput ? 256 : (2 * ChannelBits);
+
+  for (r = AUDIO_CLOCK_PLLI2SR_MIN; r <= AUDIO_CLOCK_PLLI2SR_MAX; r++)
+  {
+    for (n = AUDIO_CLOCK_PLLI2SN_MIN; n <= AUDIO_CLOCK_PLLI2SN_MAX; n++)
+    {
+      vco = PllInputFreq * n;
+      if ((vco < AUDIO_CLOCK_VCO_MIN) || (vco > AUDIO_CLOCK_VCO_MAX))
+      {
+        continue;
+      }
+      i2sclk = vco / r;
+      if (i2sclk > AUDIO_CLOCK_I2SCLK_MAX)
+      {
+        continue;
+      }
+
+      /* Only the two prescalers around the ideal one can be the best */
+      kcand = vco / (AudioFreq * bitdiv * r);
+      for (i = 0; i < 2; i++)
+      {
+        k = kcand + i;
+        if ((k < (2 * AUDIO_CLOCK_I2SDIV_MIN)) ||
+            (k > ((2 * AUDIO_CLOCK_I2SDIV_MAX) + 1)))
+        {
+          continue;
+        }
+
+        /* Fs = vco / den: compare |vco - AudioFreq * den| / den exactly */
+        den = (uint64_t)r * bitdiv * k;
+        diff = (int64_t)vco - ((int64_t)AudioFreq * (int64_t)den);
+        err = CLOCK_Abs64(diff);
+        if (!found || ((err * best_den) < (best_err * den)))
+        {
+          found = 1;
+          best_err = err;
+          best_den = den;
+          plan->PLLI2SN = (uint16_t)n;
+          plan->PLLI2SR = (uint8_t)r;
+          plan->I2SDIV = (uint8_t)(k / 2);
+          plan->I2SODD = (uint8_t)(k & 1);
+          plan->MCLKOutput = MCLKOutput ? 1 : 0;
+          plan->AchievedFreq = (uint32_t)(((uint64_t)vco + (den / 2)) / den);
+          plan->ErrorPpb = (int32_t)((diff * 1000000000LL) /
+                                     ((int64_t)AudioFreq * (int64_t)den));
+        }
+      }
+    }
+  }
+
+  return found ? 0 : 1;
+}
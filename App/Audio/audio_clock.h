@@ -0,0 +1,46 @@
+/**
+  ******************************************************************************
+  * @file    audio_clock.h
+  * @brief   Header file for the audio_clock.c I2S clock planner.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_CLOCK_H
+#define __AUDIO_CLOCK_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* PLLI2S limits (STM32F401xx) */
+#define AUDIO_CLOCK_PLLI2SN_MIN         50
+#define AUDIO_CLOCK_PLLI2SN_MAX         432
+#define AUDIO_CLOCK_PLLI2SR_MIN         2
+#define AUDIO_CLOCK_PLLI2SR_MAX         7
+#define AUDIO_CLOCK_VCO_MIN             100000000
+#define AUDIO_CLOCK_VCO_MAX             432000000
+#define AUDIO_CLOCK_I2SCLK_MAX          192000000
+
+/* I2S prescaler limits: I2SDIV = 0 or 1 are forbidden values */
+#define AUDIO_CLOCK_I2SDIV_MIN          2
+#define AUDIO_CLOCK_I2SDIV_MAX          255
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint16_t PLLI2SN;             /* PLLI2S multiplication factor */
+  uint8_t  PLLI2SR;             /* PLLI2S division factor for the I2S clock */
+  uint8_t  I2SDIV;              /* I2S linear prescaler */
+  uint8_t  I2SODD;              /* I2S odd factor for the prescaler */
+  uint8_t  MCLKOutput;          /* 1 if the plan drives MCLK at 256 * Fs */
+  uint32_t AchievedFreq;        /* Resulting sampling frequency in Hz, rounded */
+  int32_t  ErrorPpb;            /* (achieved - target) / target, in 1e-9 */
+} AUDIO_ClockPlanTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+uint32_t Audio_Clock_Plan(uint32_t PllInputFreq, uint32_t AudioFreq,
+                          uint32_t ChannelBits, uint32_t MCLKOutput,
+                          AUDIO_ClockPlanTypeDef *plan);
+
+#endif /* __AUDIO_CLOCK_H */
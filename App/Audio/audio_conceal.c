@@ -0,0 +1,432 @@
+/**
+  ******************************************************************************
+  * @file    audio_conceal.c
+  * @brief   Concealment of the USB stream underruns and overruns.
+  *
+  *          Host hiccups are hidden in the sample domain, so the I2S DMA and
+  *          the codec keep running whatever the host does:
+  *
+  *          - Underrun: the last frames played are repeated back and forth
+  *            (time-reversed first, so that the repetition starts without a
+  *            discontinuity) under an envelope fading to silence. Once the
+  *            stream is back the new samples fade in from silence. The
+  *            envelope has the shape of the stream ramps (audio_ramp.c).
+  *
+  *          - Overrun: the packet that does not fit is dropped, and its head
+  *            is crossfaded into the next accepted packet. The dropped packet
+  *            continues the previous one, so the crossfade hides the gap.
+  *
+  *          - Missing packet: a packet the host sent but the device did not
+  *            receive is synthesized from the tail of the previous packet,
+  *            played back and forth, so that the stream keeps its length.
+  *            The walk continues into xfade, crossfaded into the next packet.
+  *
+  *          Frames are interleaved stereo, 16-bit or 32-bit. The producer
+  *          side (packets queued into the ring) and the consumer side
+  *          (render of the next I2S DMA half) both run in the audio task;
+  *          each side still only writes its own fields.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "audio_conceal.h"
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Copies one frame applying a gain.
+  * @param  pDst: destination frame.
+  * @param  pSrc: source frame.
+  * @param  frameSize: 4 for 16-bit samples, 8 for 32-bit samples.
+  * @param  gain: gain in Q16, at most AUDIO_CONCEAL_UNITY.
+  * @retval None
+  */
+static inline void CONCEAL_ScaleFrame(uint8_t *pDst, const uint8_t *pSrc,
+                                      uint32_t frameSize, int32_t gain)
+{
+  if (frameSize == 4)
+  {
+    const int16_t *s = (const int16_t*)pSrc;
+    int16_t *d = (int16_t*)pDst;
+
+    d[0] = (int16_t)(((int32_t)s[0] * gain) >> 16);
+    d[1] = (int16_t)(((int32_t)s[1] * gain) >> 16);
+  }
+  else
+  {
+    const int32_t *s = (const int32_t*)pSrc;
+    int32_t *d = (int32_t*)pDst;
+
+    d[0] = (int32_t)(((int64_t)s[0] * gain) >> 16);
+    d[1] = (int32_t)(((int64_t)s[1] * gain) >> 16);
+  }
+}
+
+/**
+  * @brief  Mixes two frames: a * (1 - w) + b * w.
+  * @param  pDst: destination frame, may be pB.
+  * @param  pA, pB: source frames.
+  * @param  frameSize: 4 for 16-bit samples, 8 for 32-bit samples.
+  * @param  w: weight of pB in Q16.
+  * @retval None
+  */
+static inline void CONCEAL_MixFrame(uint8_t *pDst, const uint8_t *pA,
+                                    const uint8_t *pB, uint32_t frameSize,
+                                    int32_t w)
+{
+  uint32_t ch;
+
+  for (ch = 0; ch < 2; ch++)
+  {
+    if (frameSize == 4)
+    {
+      int32_t a = ((const int16_t*)pA)[ch];
+      int32_t b = ((const int16_t*)pB)[ch];
+
+      /* |b - a| * w needs up to 33 bits */
+      ((int16_t*)pDst)[ch] = (int16_t)(a + (int32_t)(((int64_t)(b - a) * w) >> 16));
+    }
+    else
+    {
+      int64_t a = ((const int32_t*)pA)[ch];
+      int64_t b = ((const int32_t*)pB)[ch];
+
+      ((int32_t*)pDst)[ch] = (int32_t)(a + (((b - a) * w) >> 16));
+    }
+  }
+}
+
+/**
+  * @brief  Copies frames walking back and forth through a block of frames.
+  * @param  pDst: destination frames.
+  * @param  pSrc: block of frames.
+  * @param  count: frames in the block, at least 2.
+  * @param  frameSize: 4 for 16-bit samples, 8 for 32-bit samples.
+  * @param  pIndex: current frame in the block, updated.
+  * @param  pDir: 1 walking towards the first frame, 0 towards the last one,
+  *         updated.
+  * @param  frames: number of frames to copy.
+  * @retval None
+  */
+static void CONCEAL_Walk(uint8_t *pDst, const uint8_t *pSrc, uint32_t count,
+                         uint32_t frameSize, uint32_t *pIndex, uint32_t *pDir,
+                         uint32_t frames)
+{
+  uint32_t i;
+
+  for (i = 0; i < frames; i++)
+  {
+    if (*pDir)
+    {
+      (*pIndex)--;
+      if (*pIndex == 0)
+      {
+        *pDir = 0;
+      }
+    }
+    else
+    {
+      (*pIndex)++;
+      if (*pIndex == (count - 1))
+      {
+        *pDir = 1;
+      }
+    }
+    memcpy(pDst + (i * frameSize), pSrc + (*pIndex * frameSize), frameSize);
+  }
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Resets the concealment for a new stream format.
+  * @param  conceal: concealment state.
+  * @param  frameSize: 4 for 16-bit samples, 8 for 32-bit samples.
+  * @param  fadeFrames: length of the fades in frames.
+  * @param  fadeShape: shape of the fades, AUDIO_RAMP_LINEAR or
+  *         AUDIO_RAMP_COSINE.
+  * @retval None
+  */
+void Audio_Conceal_Init(AUDIO_ConcealTypeDef *conceal, uint32_t frameSize,
+                        uint32_t fadeFrames, uint8_t fadeShape)
+{
+  conceal->frameSize = frameSize;
+  conceal->fadeFrames = (fadeFrames != 0) ? fadeFrames : 1;
+  conceal->fadeShape = fadeShape;
+  conceal->histPos = 0;
+  conceal->histCount = 0;
+  conceal->readBack = 0;
+  conceal->readDir = 1;
+  conceal->gain = AUDIO_CONCEAL_UNITY;
+  conceal->active = 0;
+  conceal->xfadeLen = 0;
+  conceal->prevLen = 0;
+  conceal->missing = 0;
+  conceal->underruns = 0;
+  conceal->recoveries = 0;
+  conceal->drops = 0;
+  conceal->crossfades = 0;
+}
+
+/**
+  * @brief  Records frames that have been played, to be repeated on the next
+  *         underrun. Consumer side only.
+  * @param  conceal: concealment state.
+  * @param  pSrc: frames played.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Conceal_Save(AUDIO_ConcealTypeDef *conceal, const uint8_t *pSrc,
+                        uint32_t frames)
+{
+  uint32_t size = conceal->frameSize;
+  uint32_t chunk;
+
+  /* Only the newest frames are kept */
+  if (frames > AUDIO_CONCEAL_HISTORY_FRAMES)
+  {
+    pSrc += (frames - AUDIO_CONCEAL_HISTORY_FRAMES) * size;
+    frames = AUDIO_CONCEAL_HISTORY_FRAMES;
+  }
+
+  while (frames != 0)
+  {
+    chunk = AUDIO_CONCEAL_HISTORY_FRAMES - conceal->histPos;
+    if (chunk > frames)
+    {
+      chunk = frames;
+    }
+    memcpy(conceal->hist + (conceal->histPos * size), pSrc, chunk * size);
+    conceal->histPos = (conceal->histPos + chunk) % AUDIO_CONCEAL_HISTORY_FRAMES;
+    conceal->histCount += chunk;
+    pSrc += chunk * size;
+    frames -= chunk;
+  }
+
+  if (conceal->histCount > AUDIO_CONCEAL_HISTORY_FRAMES)
+  {
+    conceal->histCount = AUDIO_CONCEAL_HISTORY_FRAMES;
+  }
+}
+
+/**
+  * @brief  Produces frames when the stream has run dry: the history is
+  *         repeated under a fade to silence. Consumer side only.
+  * @param  conceal: concealment state.
+  * @param  pDst: frames to produce.
+  * @param  frames: number of frames.
+  * @retval 1 while the fade out is in progress, 0 once the output is silent.
+  */
+uint32_t Audio_Conceal_Underrun(AUDIO_ConcealTypeDef *conceal, uint8_t *pDst,
+                                uint32_t frames)
+{
+  uint32_t size = conceal->frameSize;
+  int32_t step = (AUDIO_CONCEAL_UNITY + (int32_t)conceal->fadeFrames - 1) /
+                 (int32_t)conceal->fadeFrames;
+  uint32_t newest, index, i;
+
+  if (!conceal->active)
+  {
+    /* New underrun: the repetition starts just before the newest frame */
+    conceal->active = 1;
+    conceal->underruns++;
+    conceal->readBack = 0;
+    conceal->readDir = 1;
+  }
+
+  if (conceal->histCount < 2)
+  {
+    conceal->gain = 0;
+  }
+
+  newest = conceal->histPos + AUDIO_CONCEAL_HISTORY_FRAMES - 1;
+  for (i = 0; i < frames; i++)
+  {
+    if (conceal->gain <= 0)
+    {
+      conceal->gain = 0;
+      memset(pDst + (i * size), 0, (frames - i) * size);
+      break;
+    }
+
+    /* Walk back and forth through the history */
+    if (conceal->readDir)
+    {
+      conceal->readBack++;
+      if (conceal->readBack == (conceal->histCount - 1))
+      {
+        conceal->readDir = 0;
+      }
+    }
+    else
+    {
+      conceal->readBack--;
+      if (conceal->readBack == 0)
+      {
+        conceal->readDir = 1;
+      }
+    }
+
+    conceal->gain -= step;
+    if (conceal->gain < 0)
+    {
+      conceal->gain = 0;
+    }
+
+    index = (newest - conceal->readBack) % AUDIO_CONCEAL_HISTORY_FRAMES;
+    CONCEAL_ScaleFrame(pDst + (i * size), conceal->hist + (index * size), size,
+                       Audio_Ramp_Curve(conceal->fadeShape, conceal->gain));
+  }
+
+  return (conceal->gain != 0) ? 1 : 0;
+}
+
+/**
+  * @brief  Fades the first frames of the stream back in after an underrun.
+  *         Has no effect if no underrun is being concealed. Consumer side only.
+  * @param  conceal: concealment state.
+  * @param  pBuf: frames, processed in place.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Conceal_FadeIn(AUDIO_ConcealTypeDef *conceal, uint8_t *pBuf,
+                          uint32_t frames)
+{
+  uint32_t size = conceal->frameSize;
+  int32_t step = (AUDIO_CONCEAL_UNITY + (int32_t)conceal->fadeFrames - 1) /
+                 (int32_t)conceal->fadeFrames;
+  uint32_t i;
+
+  if (!conceal->active)
+  {
+    return;
+  }
+
+  for (i = 0; (i < frames) && (conceal->gain < AUDIO_CONCEAL_UNITY); i++)
+  {
+    CONCEAL_ScaleFrame(pBuf + (i * size), pBuf + (i * size), size,
+                       Audio_Ramp_Curve(conceal->fadeShape, conceal->gain));
+    conceal->gain += step;
+  }
+
+  if (conceal->gain >= AUDIO_CONCEAL_UNITY)
+  {
+    conceal->gain = AUDIO_CONCEAL_UNITY;
+    conceal->active = 0;
+    conceal->recoveries++;
+  }
+}
+
+/**
+  * @brief  Records a packet dropped because the ring was full. Producer side
+  *         only.
+  * @param  conceal: concealment state.
+  * @param  pPacket: dropped packet.
+  * @param  len: packet length in bytes.
+  * @retval None
+  */
+void Audio_Conceal_Overrun(AUDIO_ConcealTypeDef *conceal, const uint8_t *pPacket,
+                           uint32_t len)
+{
+  conceal->drops++;
+
+  /* Only the first dropped packet continues the samples already queued */
+  if (conceal->xfadeLen == 0)
+  {
+    if (len > sizeof(conceal->xfade))
+    {
+      len = sizeof(conceal->xfade);
+    }
+    len -= len % conceal->frameSize;
+    memcpy(conceal->xfade, pPacket, len);
+    conceal->xfadeLen = len;
+  }
+}
+
+/**
+  * @brief  Crossfades the head of the last dropped packet into a packet about
+  *         to be queued. Has no effect if no packet has been dropped. Producer
+  *         side only.
+  * @param  conceal: concealment state.
+  * @param  pPacket: packet to be queued, modified in place.
+  * @param  len: packet length in bytes.
+  * @retval None
+  */
+void Audio_Conceal_Resume(AUDIO_ConcealTypeDef *conceal, uint8_t *pPacket,
+                          uint32_t len)
+{
+  uint32_t size = conceal->frameSize;
+  uint32_t frames, i;
+
+  if (conceal->xfadeLen == 0)
+  {
+    return;
+  }
+
+  frames = ((len < conceal->xfadeLen) ? len : conceal->xfadeLen) / size;
+  for (i = 0; i < frames; i++)
+  {
+    CONCEAL_MixFrame(pPacket + (i * size), conceal->xfade + (i * size),
+                     pPacket + (i * size), size,
+                     (int32_t)((i * AUDIO_CONCEAL_UNITY) / frames));
+  }
+
+  conceal->xfadeLen = 0;
+  conceal->crossfades++;
+}
+
+/**
+  * @brief  Records the tail of a packet queued into the stream, from which a
+  *         missing packet would be synthesized. Producer side only.
+  * @param  conceal: concealment state.
+  * @param  pPacket: packet queued.
+  * @param  len: packet length in bytes.
+  * @retval None
+  */
+void Audio_Conceal_Queued(AUDIO_ConcealTypeDef *conceal, const uint8_t *pPacket,
+                          uint32_t len)
+{
+  len -= len % conceal->frameSize;
+  if (len > sizeof(conceal->prev))
+  {
+    pPacket += len - sizeof(conceal->prev);
+    len = sizeof(conceal->prev);
+  }
+  memcpy(conceal->prev, pPacket, len);
+  conceal->prevLen = len;
+}
+
+/**
+  * @brief  Synthesizes a packet the device did not receive. The walk through
+  *         the previous packet starts backwards from its last frame, so that
+  *         the packet continues it, and goes on into xfade to be crossfaded
+  *         into the next packet. Producer side only.
+  * @param  conceal: concealment state.
+  * @param  pPacket: packet to produce.
+  * @param  len: packet length in bytes, a multiple of the frame size.
+  * @retval None
+  */
+void Audio_Conceal_Missing(AUDIO_ConcealTypeDef *conceal, uint8_t *pPacket,
+                           uint32_t len)
+{
+  uint32_t size = conceal->frameSize;
+  uint32_t count = conceal->prevLen / size;
+  uint32_t index, dir;
+
+  conceal->missing++;
+
+  if (count < 2)
+  {
+    memset(pPacket, 0, len);
+    conceal->xfadeLen = 0;
+    return;
+  }
+
+  index = count - 1;
+  dir = 1;
+  CONCEAL_Walk(pPacket, conceal->prev, count, size, &index, &dir, len / size);
+  CONCEAL_Walk(conceal->xfade, conceal->prev, count, size, &index, &dir,
+               AUDIO_CONCEAL_XFADE_FRAMES);
+  conceal->xfadeLen = AUDIO_CONCEAL_XFADE_FRAMES * size;
+}
@@ -0,0 +1,85 @@
+/**
+  ******************************************************************************
+  * @file    audio_conceal.h
+  * @brief   Header file for the audio_conceal.c underrun/overrun concealment.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_CONCEAL_H
+#define __AUDIO_CONCEAL_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "audio_ramp.h"
+
+/* Exported constants --------------------------------------------------------*/
+/* Largest frame: stereo, 32-bit samples */
+#define AUDIO_CONCEAL_FRAME_MAX         8
+
+/* Frames kept to be repeated on an underrun */
+#define AUDIO_CONCEAL_HISTORY_FRAMES    96
+
+/* Frames of a dropped packet crossfaded into the next accepted one */
+#define AUDIO_CONCEAL_XFADE_FRAMES      48
+
+/* Envelope gain in Q16: 1.0 */
+#define AUDIO_CONCEAL_UNITY             ((int32_t)1 << 16)
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  /* Sample buffers first, so that they are word aligned */
+  uint8_t           hist[AUDIO_CONCEAL_HISTORY_FRAMES * AUDIO_CONCEAL_FRAME_MAX];
+  uint8_t           xfade[AUDIO_CONCEAL_XFADE_FRAMES * AUDIO_CONCEAL_FRAME_MAX];
+  uint8_t           prev[AUDIO_CONCEAL_HISTORY_FRAMES * AUDIO_CONCEAL_FRAME_MAX];
+
+  uint32_t          frameSize;  /* 4 (16-bit) or 8 (24/32-bit) bytes */
+  uint32_t          fadeFrames; /* Length of the fade out and fade in */
+  uint8_t           fadeShape;  /* AUDIO_RAMP_LINEAR or AUDIO_RAMP_COSINE */
+
+  /* Consumer side: last frames played (hist) and the concealment envelope */
+  uint32_t          histPos;    /* Next frame written in hist */
+  uint32_t          histCount;  /* Valid frames in hist */
+  uint32_t          readBack;   /* Repeated frame, counted back from the newest */
+  uint32_t          readDir;    /* 1 going back in time, 0 going forward */
+  int32_t           gain;       /* Envelope gain (Q16) */
+  uint8_t           active;     /* An underrun is being concealed */
+
+  /* Producer side: length of the head of the dropped packet, or of the
+     continuation of the synthesized one, kept in xfade, and the tail of the
+     last packet queued, kept in prev */
+  uint32_t          xfadeLen;
+  uint32_t          prevLen;
+
+  /* Diagnostics */
+  volatile uint32_t underruns;  /* Underruns concealed */
+  volatile uint32_t recoveries; /* Fade ins after an underrun */
+  volatile uint32_t drops;      /* Packets dropped on an overrun */
+  volatile uint32_t crossfades; /* Dropped packets crossfaded into the stream */
+  volatile uint32_t missing;    /* Packets never received, synthesized */
+} AUDIO_ConcealTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void     Audio_Conceal_Init(AUDIO_ConcealTypeDef *conceal, uint32_t frameSize,
+                            uint32_t fadeFrames, uint8_t fadeShape);
+
+/* Consumer side */
+void     Audio_Conceal_Save(AUDIO_ConcealTypeDef *conceal, const uint8_t *pSrc,
+                            uint32_t frames);
+uint32_t Audio_Conceal_Underrun(AUDIO_ConcealTypeDef *conceal, uint8_t *pDst,
+                                uint32_t frames);
+void     Audio_Conceal_FadeIn(AUDIO_ConcealTypeDef *conceal, uint8_t *pBuf,
+                              uint32_t frames);
+
+/* Producer side */
+void     Audio_Conceal_Overrun(AUDIO_ConcealTypeDef *conceal, const uint8_t *pPacket,
+                               uint32_t len);
+void     Audio_Conceal_Resume(AUDIO_ConcealTypeDef *conceal, uint8_t *pPacket,
+                              uint32_t len);
+void     Audio_Conceal_Queued(AUDIO_ConcealTypeDef *conceal, const uint8_t *pPacket,
+                              uint32_t len);
+void     Audio_Conceal_Missing(AUDIO_ConcealTypeDef *conceal, uint8_t *pPacket,
+                               uint32_t len);
+
+#endif /* __AUDIO_CONCEAL_H */
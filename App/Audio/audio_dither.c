@@ -0,0 +1,202 @@
+/**
+  ******************************************************************************
+  * @file    audio_dither.c
+  * @brief   Requantisation of the Q27 processing format to 16-bit samples,
+  *          with TPDF dither and optional noise shaping.
+  *
+  *          Each sample gets a triangular dither of +/-1 LSB, the difference
+  *          of the two half-words of a xorshift32 random number, before it
+  *          is rounded: the requantisation error becomes a signal
+  *          independent noise instead of the harmonics of a truncation.
+  *
+  *          The noise shaping feeds the error of the last 2 to 5 samples
+  *          back into the sample being quantized:
+  *            v[n] = x[n] - sum(c[k] e[n-k]),  e[n] = y[n] - v[n]
+  *          so that the output noise is shaped by 1 - sum(c[k] z^-k). The
+  *          filters minimise the noise weighted by the threshold of hearing:
+  *          15 to 23 dB less noise from 1 to 6 kHz at 48 kHz, at the cost
+  *          of more above 12 kHz; 26 to 40 dB less at 96 kHz, at the cost of
+  *          more above 20 kHz.
+  *
+  *          The requantisation is bypassed for the blocks whose samples all
+  *          fall on the 16-bit grid: at unity gain, with the EQ off and the
+  *          limiter idle, the stream plays bit-perfect, and digital silence
+  *          stays silent.
+  *
+  *          Cycle budget at 84 MHz, counted from the instructions of the
+  *          loop: about 32 cycles per sample whatever the order, plus 2 for
+  *          the bypass test. A 1 ms block takes 6.5k cycles at 96 kHz (7.7%
+  *          of the 84k cycles of the block), 3.3k at 48 kHz. The load is
+  *          measured on the target with AUDIO_VENDOR_REQ_GET_DITHER_LOAD, and
+  *          Tools/audio_dither_check.c measures the noise spectrum and the
+  *          THD on a host.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "audio_dither.h"
+#include "audio_format.h"
+#include "audio_dsp.h"
+
+/* Private define ------------------------------------------------------------*/
+/* One 16-bit LSB in Q27 */
+#define DITHER_LSB_BITS                 (AUDIO_FORMAT_Q27_BITS - 15)
+#define DITHER_LSB_MASK                 ((1UL << DITHER_LSB_BITS) - 1)
+
+/* Errors fed back are saturated to +/-4 LSB: the dither and the rounding
+   stay within 1.5 LSB, unless the output saturates */
+#define DITHER_ERR_BITS                 (DITHER_LSB_BITS + 3)
+
+/* Sets of coefficients: up to 48 kHz, and above */
+#define DITHER_RATE_NUM                 2
+
+/* Private variables ---------------------------------------------------------*/
+/* Error feedback filters in Q12, by rate and order */
+static const int32_t DITHER_Coef[DITHER_RATE_NUM]
+                                [AUDIO_DITHER_ORDER_MAX - AUDIO_DITHER_ORDER_MIN + 1]
+                                [AUDIO_DITHER_ORDER_MAX] =
+{
+  { /* 44.1 and 48 kHz */
+    {  6324,  -3445,     0,     0,     0 },
+    {  8574,  -7575,  2675,     0,     0 },
+    { 10682, -13545,  9432, -3228,     0 },
+    { 12629, -19233, 17600, -9669,  2470 },
+  },
+  { /* 96 kHz */
+    {  7678,  -3920,     0,     0,     0 },
+    { 11208, -10834,  3689,     0,     0 },
+    { 14288, -19882, 13049, -3421,     0 },
+    { 13544, -17041,  8719,  -309,  -892 },
+  },
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Requantises one channel of a block.
+  * @param  dither: requantiser.
+  * @param  err: error history of the channel.
+  * @param  pSrc: first Q27 sample of the channel.
+  * @param  pDst: first 16-bit sample of the channel.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+static void DITHER_Channel(AUDIO_DitherTypeDef *dither, int32_t *err,
+                           const int32_t *pSrc, int16_t *pDst, uint32_t frames)
+{
+  const int32_t c1 = dither->coef[0], c2 = dither->coef[1], c3 = dither->coef[2];
+  const int32_t c4 = dither->coef[3], c5 = dither->coef[4];
+  int32_t e1 = err[0], e2 = err[1], e3 = err[2], e4 = err[3], e5 = err[4];
+  uint32_t seed = dither->seed;
+  int32_t v, y, tpdf;
+
+  while (frames != 0)
+  {
+    /* Error feedback */
+    v = *pSrc - (((c1 * e1) + (c2 * e2) + (c3 * e3) + (c4 * e4) + (c5 * e5)) >> 12);
+
+    /* Triangular dither of +/-1 LSB */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    tpdf = ((int32_t)(seed & 0xFFFF) - (int32_t)(seed >> 16)) >> (16 - DITHER_LSB_BITS);
+
+    y = AUDIO_DSP_SSAT((v + tpdf + (1 << (DITHER_LSB_BITS - 1))) >> DITHER_LSB_BITS, 16);
+    *pDst = (int16_t)y;
+
+    e5 = e4;
+    e4 = e3;
+    e3 = e2;
+    e2 = e1;
+    e1 = AUDIO_DSP_SSAT((y * (1 << DITHER_LSB_BITS)) - v, DITHER_ERR_BITS);
+
+    pSrc += 2;
+    pDst += 2;
+    frames--;
+  }
+
+  err[0] = e1;
+  err[1] = e2;
+  err[2] = e3;
+  err[3] = e4;
+  err[4] = e5;
+  dither->seed = seed;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Resets the requantiser.
+  * @param  dither: requantiser.
+  * @param  order: AUDIO_DITHER_FLAT, or the noise shaping order from
+  *         AUDIO_DITHER_ORDER_MIN to AUDIO_DITHER_ORDER_MAX.
+  * @param  fs: sampling frequency (Hz).
+  * @retval None
+  */
+void Audio_Dither_Init(AUDIO_DitherTypeDef *dither, uint8_t order, uint32_t fs)
+{
+  memset(dither, 0, sizeof(AUDIO_DitherTypeDef));
+  if ((order >= AUDIO_DITHER_ORDER_MIN) && (order <= AUDIO_DITHER_ORDER_MAX))
+  {
+    dither->order = order;
+  }
+  dither->seed = 0x12345678;
+  Audio_Dither_SetRate(dither, fs);
+}
+
+/**
+  * @brief  Selects the noise shaping filter of a new sampling frequency.
+  * @param  dither: requantiser.
+  * @param  fs: sampling frequency (Hz).
+  * @retval None
+  */
+void Audio_Dither_SetRate(AUDIO_DitherTypeDef *dither, uint32_t fs)
+{
+  memset(dither->coef, 0, sizeof(dither->coef));
+  memset(dither->err, 0, sizeof(dither->err));
+  if (dither->order != AUDIO_DITHER_FLAT)
+  {
+    memcpy(dither->coef,
+           DITHER_Coef[(fs > 48000) ? 1 : 0][dither->order - AUDIO_DITHER_ORDER_MIN],
+           sizeof(dither->coef));
+  }
+}
+
+/**
+  * @brief  Requantises a block of interleaved Q27 stereo frames to 16 bits.
+  *         A block already on the 16-bit grid is converted as is.
+  * @param  dither: requantiser.
+  * @param  pSrc: Q27 frames.
+  * @param  pDst: 16-bit frames.
+  * @param  frames: number of frames.
+  * @retval 1 if the block was dithered, 0 if it was bypassed.
+  */
+uint32_t Audio_Dither_Process(AUDIO_DitherTypeDef *dither, const int32_t *pSrc,
+                              int16_t *pDst, uint32_t frames)
+{
+  uint32_t bits = 0;
+  uint32_t i;
+
+  for (i = 0; i < (frames * 2); i++)
+  {
+    bits |= (uint32_t)pSrc[i];
+  }
+
+  if ((bits & DITHER_LSB_MASK) == 0)
+  {
+    /* Nothing to requantise: the errors fed back restart from zero */
+    if (dither->bypass == 0)
+    {
+      memset(dither->err, 0, sizeof(dither->err));
+      dither->bypass = 1;
+    }
+    Audio_Format_Q27_S16_Stereo(pSrc, pDst, frames);
+    return 0;
+  }
+
+  dither->bypass = 0;
+  DITHER_Channel(dither, dither->err[0], pSrc, pDst, frames);
+  DITHER_Channel(dither, dither->err[1], pSrc + 1, pDst + 1, frames);
+  return 1;
+}
@@ -0,0 +1,38 @@
+/**
+  ******************************************************************************
+  * @file    audio_dither.h
+  * @brief   Header file for the audio_dither.c requantisation to 16 bits.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_DITHER_H
+#define __AUDIO_DITHER_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Noise shaping: AUDIO_DITHER_FLAT, or the order of the error feedback
+   filter from AUDIO_DITHER_ORDER_MIN to AUDIO_DITHER_ORDER_MAX */
+#define AUDIO_DITHER_FLAT               0
+#define AUDIO_DITHER_ORDER_MIN          2
+#define AUDIO_DITHER_ORDER_MAX          5
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint8_t  order;               /* AUDIO_DITHER_FLAT or shaping order */
+  uint32_t seed;                /* Random generator state, never 0 */
+  int32_t  coef[AUDIO_DITHER_ORDER_MAX];       /* Error feedback (Q12) */
+  int32_t  err[2][AUDIO_DITHER_ORDER_MAX];     /* Last errors of each channel (Q27) */
+  uint32_t bypass;              /* Last block converted without dither */
+} AUDIO_DitherTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void     Audio_Dither_Init(AUDIO_DitherTypeDef *dither, uint8_t order, uint32_t fs);
+void     Audio_Dither_SetRate(AUDIO_DitherTypeDef *dither, uint32_t fs);
+uint32_t Audio_Dither_Process(AUDIO_DitherTypeDef *dither, const int32_t *pSrc,
+                              int16_t *pDst, uint32_t frames);
+
+#endif /* __AUDIO_DITHER_H */
@@ -0,0 +1,152 @@
+/**
+  ******************************************************************************
+  * @file    audio_drift.c
+  * @brief   Clock drift estimator.
+  *
+  *          A free running timer is captured by a periodic reference event,
+  *          the USB SOF. The number of timer ticks between two captures,
+  *          compared with the nominal one, gives the drift of the timer clock
+  *          against the reference in ppm:
+  *
+  *            x = (ticks - nominal) / nominal * 1e6
+  *
+  *          One capture is only accurate to a timer tick (about 1.5 ppm for
+  *          8 SOFs at 84 MHz), so the samples go through a first order loop
+  *          filter. The filter starts as a running mean, then becomes an
+  *          exponential average with a time constant of
+  *          2^AUDIO_DRIFT_FILTER_LOG2 captures, which follows the slow thermal
+  *          drift of the crystals. The spread of the samples around the
+  *          estimate gives a 2-sigma confidence bound on it.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "audio_drift.h"
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Integer square root.
+  * @param  x: value.
+  * @retval floor(sqrt(x)).
+  */
+static uint32_t DRIFT_Sqrt(uint64_t x)
+{
+  uint64_t root = 0;
+  uint64_t bit = (uint64_t)1 << 62;
+
+  while (bit > x)
+  {
+    bit >>= 2;
+  }
+  while (bit != 0)
+  {
+    if (x >= (root + bit))
+    {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+    {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+
+  return (uint32_t)root;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Resets the estimator.
+  * @param  drift: estimator state.
+  * @param  nominal: timer ticks expected between two captures.
+  * @retval None
+  */
+void Audio_Drift_Init(AUDIO_DriftTypeDef *drift, uint32_t nominal)
+{
+  drift->nominal = (nominal != 0) ? nominal : 1;
+  drift->last = 0;
+  drift->lastValid = 0;
+  drift->ppm = 0;
+  drift->var = 0;
+  drift->samples = 0;
+  drift->rejects = 0;
+}
+
+/**
+  * @brief  Feeds a timer capture to the estimator.
+  * @param  drift: estimator state.
+  * @param  capture: timer value latched by the reference event.
+  * @retval 1 if the capture has updated the estimate, 0 otherwise.
+  */
+uint32_t Audio_Drift_Update(AUDIO_DriftTypeDef *drift, uint32_t capture)
+{
+  int32_t  error;
+  int64_t  x;
+  int64_t  dev;
+  uint32_t weight;
+
+  if (!drift->lastValid)
+  {
+    drift->last = capture;
+    drift->lastValid = 1;
+    return 0;
+  }
+
+  /* Period error, the counter wrapping around */
+  error = (int32_t)(capture - drift->last - drift->nominal);
+  drift->last = capture;
+
+  if ((((int64_t)error * 1000000) > ((int64_t)drift->nominal * AUDIO_DRIFT_OUTLIER_PPM)) ||
+      (((int64_t)error * -1000000) > ((int64_t)drift->nominal * AUDIO_DRIFT_OUTLIER_PPM)))
+  {
+    drift->rejects++;
+    return 0;
+  }
+  x = ((int64_t)error * 1000000 * 65536) / (int64_t)drift->nominal;
+
+  /* Running mean until the filter has settled, then exponential average */
+  drift->samples++;
+  weight = drift->samples;
+  if (weight > (1U << AUDIO_DRIFT_FILTER_LOG2))
+  {
+    weight = 1U << AUDIO_DRIFT_FILTER_LOG2;
+  }
+
+  dev = x - drift->ppm;
+  drift->ppm += (int32_t)(dev / (int64_t)weight);
+  if (drift->samples > 1)
+  {
+    drift->var += (((uint64_t)(dev * dev)) / weight) - (drift->var / weight);
+  }
+
+  return 1;
+}
+
+/**
+  * @brief  Reads the drift estimate.
+  * @param  drift: estimator state.
+  * @param  pPpm: drift of the timer clock against the reference (ppm, Q16):
+  *         positive when the timer runs fast.
+  * @param  pBound: 2-sigma confidence bound of the estimate (ppm, Q16).
+  * @retval 1 once the loop filter has settled, 0 before.
+  */
+uint32_t Audio_Drift_Get(const AUDIO_DriftTypeDef *drift, int32_t *pPpm,
+                         int32_t *pBound)
+{
+  uint32_t n = drift->samples;
+
+  /* Equivalent number of samples averaged by the filter */
+  if (n > ((2U << AUDIO_DRIFT_FILTER_LOG2) - 1))
+  {
+    n = (2U << AUDIO_DRIFT_FILTER_LOG2) - 1;
+  }
+
+  *pPpm = drift->ppm;
+  *pBound = (n != 0) ? (int32_t)(2 * DRIFT_Sqrt(drift->var / n)) :
+                       AUDIO_DRIFT_PPM(AUDIO_DRIFT_OUTLIER_PPM);
+
+  return (drift->samples >= (1U << AUDIO_DRIFT_FILTER_LOG2)) ? 1 : 0;
+}
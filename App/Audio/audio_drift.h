@@ -0,0 +1,48 @@
+/**
+  ******************************************************************************
+  * @file    audio_drift.h
+  * @brief   Header file for the audio_drift.c clock drift estimator.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_DRIFT_H
+#define __AUDIO_DRIFT_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Loop filter time constant: 2^AUDIO_DRIFT_FILTER_LOG2 captures */
+#define AUDIO_DRIFT_FILTER_LOG2         6
+
+/* Captures further than this from the nominal period are rejected (missed
+   SOFs, suspend, bus reset) */
+#define AUDIO_DRIFT_OUTLIER_PPM         1000
+
+/* Drift and bounds are in ppm, Q16 */
+#define AUDIO_DRIFT_PPM(x)              ((int32_t)((x) * 65536))
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t nominal;             /* Timer ticks expected between two captures */
+  uint32_t last;                /* Previous capture */
+  uint8_t  lastValid;           /* last holds a capture */
+
+  /* Loop filter state */
+  int32_t  ppm;                 /* Drift estimate (ppm, Q16) */
+  uint64_t var;                 /* Variance of the captures around it (ppm^2, Q32) */
+
+  /* Diagnostics */
+  uint32_t samples;             /* Captures accepted */
+  uint32_t rejects;             /* Captures rejected as outliers */
+} AUDIO_DriftTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void     Audio_Drift_Init(AUDIO_DriftTypeDef *drift, uint32_t nominal);
+uint32_t Audio_Drift_Update(AUDIO_DriftTypeDef *drift, uint32_t capture);
+uint32_t Audio_Drift_Get(const AUDIO_DriftTypeDef *drift, int32_t *pPpm,
+                         int32_t *pBound);
+
+#endif /* __AUDIO_DRIFT_H */
@@ -0,0 +1,105 @@
+/**
+  ******************************************************************************
+  * @file    audio_dsp.h
+  * @brief   Cortex-M4 DSP instructions shared by the sample kernels: the
+  *          intrinsics when ARM_MATH_CM4 is defined, their C equivalents on
+  *          a host otherwise, bit for bit.
+  *
+  *          When ARM_MATH_CM4 is not defined, the modules of App/Audio only
+  *          depend on the C library and on each other, so that the checks
+  *          and benches of Tools/ compile them on a host with the build line
+  *          given at the top of each tool.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_DSP_H
+#define __AUDIO_DSP_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#if defined(ARM_MATH_CM4)
+#include "stm32f4xx.h"
+#endif
+
+/* Exported macro ------------------------------------------------------------*/
+#if defined(ARM_MATH_CM4)
+/* x saturated to a signed field of bits (constant) */
+#define AUDIO_DSP_SSAT(x, bits)         __SSAT((x), (bits))
+
+/* a + b saturated to 32 bits */
+#define AUDIO_DSP_QADD(a, b)            __QADD((a), (b))
+
+/* Half-word sums of a and b, each saturated to 16 bits */
+#define AUDIO_DSP_QADD16(a, b)          __QADD16((a), (b))
+
+/* Bottom half-words of lo and hi packed into one word */
+#define AUDIO_DSP_PACK(lo, hi)          __PKHBT((lo), (hi), 16)
+
+/* Exported functions ------------------------------------------------------- */
+
+/**
+  * @brief  (gain * bottom half-word of x) >> 16.
+  */
+static inline int32_t AUDIO_DSP_SMULWB(int32_t gain, uint32_t x)
+{
+  int32_t result;
+
+  __ASM volatile ("smulwb %0, %1, %2" : "=r" (result) : "r" (gain), "r" (x));
+  return result;
+}
+
+/**
+  * @brief  (gain * top half-word of x) >> 16.
+  */
+static inline int32_t AUDIO_DSP_SMULWT(int32_t gain, uint32_t x)
+{
+  int32_t result;
+
+  __ASM volatile ("smulwt %0, %1, %2" : "=r" (result) : "r" (gain), "r" (x));
+  return result;
+}
+
+#else
+
+/* Exported functions ------------------------------------------------------- */
+
+static inline int32_t AUDIO_DSP_SSAT(int32_t x, uint32_t bits)
+{
+  int32_t max = (int32_t)((1UL << (bits - 1)) - 1);
+
+  return (x > max) ? max : ((x < -max - 1) ? (-max - 1) : x);
+}
+
+static inline int32_t AUDIO_DSP_QADD(int32_t a, int32_t b)
+{
+  int64_t s = (int64_t)a + b;
+
+  return (s > INT32_MAX) ? INT32_MAX : ((s < INT32_MIN) ? INT32_MIN : (int32_t)s);
+}
+
+static inline uint32_t AUDIO_DSP_PACK(int32_t lo, int32_t hi)
+{
+  return ((uint32_t)lo & 0xFFFF) | ((uint32_t)hi << 16);
+}
+
+static inline uint32_t AUDIO_DSP_QADD16(uint32_t a, uint32_t b)
+{
+  int32_t lo = (int32_t)(int16_t)(a & 0xFFFF) + (int16_t)(b & 0xFFFF);
+  int32_t hi = (int32_t)(int16_t)(a >> 16) + (int16_t)(b >> 16);
+
+  return AUDIO_DSP_PACK(AUDIO_DSP_SSAT(lo, 16), AUDIO_DSP_SSAT(hi, 16));
+}
+
+static inline int32_t AUDIO_DSP_SMULWB(int32_t gain, uint32_t x)
+{
+  return (int32_t)(((int64_t)gain * (int16_t)(x & 0xFFFF)) >> 16);
+}
+
+static inline int32_t AUDIO_DSP_SMULWT(int32_t gain, uint32_t x)
+{
+  return (int32_t)(((int64_t)gain * (int16_t)(x >> 16)) >> 16);
+}
+#endif /* ARM_MATH_CM4 */
+
+#endif /* __AUDIO_DSP_H */
@@ -0,0 +1,418 @@
+/**
+  ******************************************************************************
+  * @file    audio_eq.c
+  * @brief   Parametric equalizer: per channel cascades of up to
+  *          AUDIO_EQ_BANDS_MAX biquads (peak, low shelf, high shelf).
+  *
+  *          The biquads run in direct form 1 on Q31 samples with Q28
+  *          coefficients and 64-bit accumulators (SMLAL), the output of each
+  *          stage being rounded and saturated to Q31. Direct form 1 keeps
+  *          its state in the signal domain, so that the coefficients can be
+  *          swapped while the stream runs without a transient.
+  *
+  *          The coefficients are computed on the control side (RBJ audio EQ
+  *          cookbook, single precision) when a band is set, outside of the
+  *          audio path. Audio_Eq_Commit() builds the cascades of the enabled
+  *          bands into the set the audio path does not use, then swaps the
+  *          sets with a single write between two blocks.
+  *
+  *          Each stage runs over the whole block with its coefficients and
+  *          state in registers: 5 SMLAL per sample. The dual 16-bit MACs
+  *          (SMLALD) do not apply, the coefficients needing more than 16 bits
+  *          at low frequencies.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include <math.h>
+#include "audio_eq.h"
+#include "audio_dsp.h"
+
+/* Private define ------------------------------------------------------------*/
+#define EQ_PI                           3.14159265f
+
+/* Rounding of the accumulator before the post shift */
+#define EQ_ROUND                        ((int64_t)1 << (31 - AUDIO_EQ_POST_SHIFT - 1))
+
+/* Private functions ---------------------------------------------------------*/
+
+#if defined(ARM_MATH_CM4)
+/**
+  * @brief  acc + a * b, 32 x 32 + 64 bits.
+  */
+static inline int64_t EQ_SMLAL(int64_t acc, int32_t a, int32_t b)
+{
+  uint32_t lo = (uint32_t)acc;
+  uint32_t hi = (uint32_t)((uint64_t)acc >> 32);
+
+  __ASM volatile ("smlal %0, %1, %2, %3" : "+r" (lo), "+r" (hi) : "r" (a), "r" (b));
+  return (int64_t)(((uint64_t)hi << 32) | lo);
+}
+
+#else
+
+static inline int64_t EQ_SMLAL(int64_t acc, int32_t a, int32_t b)
+{
+  return acc + ((int64_t)a * b);
+}
+#endif /* ARM_MATH_CM4 */
+
+/**
+  * @brief  Converts an accumulator to a Q31 sample, with saturation.
+  * @param  acc: accumulator, coefficients in Q(31 - AUDIO_EQ_POST_SHIFT).
+  * @retval Q31 sample.
+  */
+static inline int32_t EQ_Output(int64_t acc)
+{
+  acc >>= (31 - AUDIO_EQ_POST_SHIFT);
+  if (acc > INT32_MAX)
+  {
+    return INT32_MAX;
+  }
+  if (acc < INT32_MIN)
+  {
+    return INT32_MIN;
+  }
+  return (int32_t)acc;
+}
+
+/**
+  * @brief  Converts a coefficient to Q(31 - AUDIO_EQ_POST_SHIFT).
+  * @param  x: coefficient, magnitude below 2^AUDIO_EQ_POST_SHIFT.
+  * @retval Fixed-point coefficient.
+  */
+static int32_t EQ_Fixed(float x)
+{
+  float y = x * (float)(1UL << (31 - AUDIO_EQ_POST_SHIFT));
+
+  if (y >= 2147483520.0f)
+  {
+    return INT32_MAX;
+  }
+  if (y <= -2147483648.0f)
+  {
+    return INT32_MIN;
+  }
+  return (int32_t)((y >= 0.0f) ? (y + 0.5f) : (y - 0.5f));
+}
+
+/**
+  * @brief  Runs one biquad over one channel of a block of interleaved Q31
+  *         frames, in place.
+  * @param  c: coefficients.
+  * @param  st: state, x[n-1], x[n-2], y[n-1], y[n-2].
+  * @param  p: first sample of the channel.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+static void EQ_Biquad(const AUDIO_EqCoefTypeDef *c, int32_t *st, int32_t *p,
+                      uint32_t frames)
+{
+  int32_t b0 = c->b0, b1 = c->b1, b2 = c->b2, a1 = c->a1, a2 = c->a2;
+  int32_t x1 = st[0], x2 = st[1], y1 = st[2], y2 = st[3];
+  int32_t x0, y0;
+  int64_t acc;
+
+  while (frames != 0)
+  {
+    x0 = *p;
+    acc = EQ_SMLAL(EQ_ROUND, b0, x0);
+    acc = EQ_SMLAL(acc, b1, x1);
+    acc = EQ_SMLAL(acc, b2, x2);
+    acc = EQ_SMLAL(acc, a1, y1);
+    acc = EQ_SMLAL(acc, a2, y2);
+    y0 = EQ_Output(acc);
+
+    x2 = x1;
+    x1 = x0;
+    y2 = y1;
+    y1 = y0;
+    *p = y0;
+    p += AUDIO_EQ_CHANNELS;
+    frames--;
+  }
+
+  st[0] = x1;
+  st[1] = x2;
+  st[2] = y1;
+  st[3] = y2;
+}
+
+/**
+  * @brief  Runs the active cascades over a block of interleaved Q31 frames.
+  * @param  eq: equalizer.
+  * @param  set: active cascades.
+  * @param  pBuf: frames, processed in place.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+static void EQ_Cascade(AUDIO_EqTypeDef *eq, const AUDIO_EqSetTypeDef *set,
+                       int32_t *pBuf, uint32_t frames)
+{
+  uint32_t ch, s;
+
+  for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+  {
+    for (s = 0; s < set->stages[ch]; s++)
+    {
+      EQ_Biquad(&set->coef[ch][s], eq->state[ch][set->band[ch][s]],
+                pBuf + ch, frames);
+    }
+  }
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Resets the equalizer with all the bands off.
+  * @param  eq: equalizer.
+  * @param  fs: sampling frequency (Hz).
+  * @retval None
+  */
+void Audio_Eq_Init(AUDIO_EqTypeDef *eq, uint32_t fs)
+{
+  memset(eq, 0, sizeof(AUDIO_EqTypeDef));
+  eq->fs = fs;
+}
+
+/**
+  * @brief  Computes the coefficients of a band (RBJ audio EQ cookbook).
+  * @param  band: band parameters, within the AUDIO_EQ_xxx ranges.
+  * @param  fs: sampling frequency (Hz).
+  * @param  coef: coefficients, a1 and a2 negated.
+  * @retval None
+  */
+void Audio_Eq_Design(const AUDIO_EqBandTypeDef *band, uint32_t fs,
+                     AUDIO_EqCoefTypeDef *coef)
+{
+  float w0 = 2.0f * EQ_PI * (float)band->freq / (float)fs;
+  float cs = cosf(w0);
+  float alpha = sinf(w0) * 128.0f / (float)band->q;      /* sin(w0) / 2Q */
+  float A = powf(10.0f, (float)band->gain / (256.0f * 40.0f));
+  float sa = 2.0f * sqrtf(A) * alpha;
+  float b0, b1, b2, a0, a1, a2;
+
+  switch (band->type)
+  {
+  case AUDIO_EQ_PEAK:
+    b0 = 1.0f + (alpha * A);
+    b1 = -2.0f * cs;
+    b2 = 1.0f - (alpha * A);
+    a0 = 1.0f + (alpha / A);
+    a1 = -2.0f * cs;
+    a2 = 1.0f - (alpha / A);
+    break;
+
+  case AUDIO_EQ_LOW_SHELF:
+    b0 = A * ((A + 1.0f) - ((A - 1.0f) * cs) + sa);
+    b1 = 2.0f * A * ((A - 1.0f) - ((A + 1.0f) * cs));
+    b2 = A * ((A + 1.0f) - ((A - 1.0f) * cs) - sa);
+    a0 = (A + 1.0f) + ((A - 1.0f) * cs) + sa;
+    a1 = -2.0f * ((A - 1.0f) + ((A + 1.0f) * cs));
+    a2 = (A + 1.0f) + ((A - 1.0f) * cs) - sa;
+    break;
+
+  case AUDIO_EQ_HIGH_SHELF:
+    b0 = A * ((A + 1.0f) + ((A - 1.0f) * cs) + sa);
+    b1 = -2.0f * A * ((A - 1.0f) + ((A + 1.0f) * cs));
+    b2 = A * ((A + 1.0f) + ((A - 1.0f) * cs) - sa);
+    a0 = (A + 1.0f) - ((A - 1.0f) * cs) + sa;
+    a1 = 2.0f * ((A - 1.0f) - ((A + 1.0f) * cs));
+    a2 = (A + 1.0f) - ((A - 1.0f) * cs) - sa;
+    break;
+
+  default:
+    /* Identity */
+    b0 = 1.0f;
+    b1 = b2 = a1 = a2 = 0.0f;
+    a0 = 1.0f;
+    break;
+  }
+
+  coef->b0 = EQ_Fixed(b0 / a0);
+  coef->b1 = EQ_Fixed(b1 / a0);
+  coef->b2 = EQ_Fixed(b2 / a0);
+  coef->a1 = EQ_Fixed(-a1 / a0);
+  coef->a2 = EQ_Fixed(-a2 / a0);
+}
+
+/**
+  * @brief  Sets a band and computes its coefficients. Control side: the
+  *         audio path keeps the previous cascades until Audio_Eq_Commit().
+  * @param  eq: equalizer.
+  * @param  channel: channel, from 0 to AUDIO_EQ_CHANNELS - 1.
+  * @param  index: band, from 0 to AUDIO_EQ_BANDS_MAX - 1.
+  * @param  band: band parameters. The gain and the quality factor are
+  *         clamped to their range; a band at or above the Nyquist frequency
+  *         is turned off.
+  * @retval 0 if the band has been set, 1 if the channel, the band or the
+  *         type is invalid.
+  */
+uint32_t Audio_Eq_SetBand(AUDIO_EqTypeDef *eq, uint32_t channel, uint32_t index,
+                          const AUDIO_EqBandTypeDef *band)
+{
+  AUDIO_EqBandTypeDef *b;
+
+  if ((channel >= AUDIO_EQ_CHANNELS) || (index >= AUDIO_EQ_BANDS_MAX) ||
+      (band->type >= AUDIO_EQ_TYPE_NUM))
+  {
+    return 1;
+  }
+
+  b = &eq->bands[channel][index];
+  *b = *band;
+  if (b->gain > AUDIO_EQ_GAIN_MAX)
+  {
+    b->gain = AUDIO_EQ_GAIN_MAX;
+  }
+  else if (b->gain < AUDIO_EQ_GAIN_MIN)
+  {
+    b->gain = AUDIO_EQ_GAIN_MIN;
+  }
+  if (b->q < AUDIO_EQ_Q_MIN)
+  {
+    b->q = AUDIO_EQ_Q_MIN;
+  }
+  else if (b->q > AUDIO_EQ_Q_MAX)
+  {
+    b->q = AUDIO_EQ_Q_MAX;
+  }
+  if (b->freq < AUDIO_EQ_FREQ_MIN)
+  {
+    b->freq = AUDIO_EQ_FREQ_MIN;
+  }
+
+  Audio_Eq_Design(b, eq->fs, &eq->coef[channel][index]);
+  return 0;
+}
+
+/**
+  * @brief  Computes the coefficients of all the bands for a new sampling
+  *         frequency. Control side, followed by Audio_Eq_Commit().
+  * @param  eq: equalizer.
+  * @param  fs: sampling frequency (Hz).
+  * @retval None
+  */
+void Audio_Eq_SetRate(AUDIO_EqTypeDef *eq, uint32_t fs)
+{
+  uint32_t ch, i;
+
+  eq->fs = fs;
+  for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+  {
+    for (i = 0; i < AUDIO_EQ_BANDS_MAX; i++)
+    {
+      if (eq->bands[ch][i].type != AUDIO_EQ_OFF)
+      {
+        Audio_Eq_Design(&eq->bands[ch][i], fs, &eq->coef[ch][i]);
+      }
+    }
+  }
+}
+
+/**
+  * @brief  Builds the cascades of the enabled bands and swaps them in. Must
+  *         not be called concurrently with Audio_Eq_Process(): the swap
+  *         then takes place between two blocks.
+  * @param  eq: equalizer.
+  * @retval None
+  */
+void Audio_Eq_Commit(AUDIO_EqTypeDef *eq)
+{
+  uint32_t next = eq->active ^ 1;
+  AUDIO_EqSetTypeDef *set = &eq->set[next];
+  const AUDIO_EqBandTypeDef *b;
+  uint32_t ch, i, n;
+
+  for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+  {
+    n = 0;
+    for (i = 0; i < AUDIO_EQ_BANDS_MAX; i++)
+    {
+      b = &eq->bands[ch][i];
+
+      /* Bands off, flat or beyond the Nyquist frequency are skipped */
+      if ((b->type == AUDIO_EQ_OFF) || (b->gain == 0) ||
+          ((2 * (uint32_t)b->freq) >= eq->fs))
+      {
+        continue;
+      }
+
+      /* A band enabled again starts from silence */
+      if ((eq->set[eq->active].stages[ch] == 0) ||
+          !memchr(eq->set[eq->active].band[ch], (int)i, eq->set[eq->active].stages[ch]))
+      {
+        memset(eq->state[ch][i], 0, sizeof(eq->state[ch][i]));
+      }
+
+      set->band[ch][n] = (uint8_t)i;
+      set->coef[ch][n] = eq->coef[ch][i];
+      n++;
+    }
+    set->stages[ch] = n;
+  }
+
+  eq->active = next;
+}
+
+/**
+  * @brief  Equalizes a block of interleaved 16-bit stereo frames.
+  * @param  eq: equalizer.
+  * @param  pBuf: frames, processed in place.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Eq_Process(AUDIO_EqTypeDef *eq, int16_t *pBuf, uint32_t frames)
+{
+  const AUDIO_EqSetTypeDef *set = &eq->set[eq->active];
+  uint32_t n, i;
+  int32_t y;
+
+  if ((set->stages[0] == 0) && (set->stages[1] == 0))
+  {
+    return;
+  }
+
+  while (frames != 0)
+  {
+    n = (frames < AUDIO_EQ_BLOCK_MAX) ? frames : AUDIO_EQ_BLOCK_MAX;
+
+    for (i = 0; i < (n * AUDIO_EQ_CHANNELS); i++)
+    {
+      eq->work[i] = (int32_t)pBuf[i] << 16;
+    }
+
+    EQ_Cascade(eq, set, eq->work, n);
+
+    /* Round to 16 bits */
+    for (i = 0; i < (n * AUDIO_EQ_CHANNELS); i++)
+    {
+      y = (int32_t)(((int64_t)eq->work[i] + 0x8000) >> 16);
+      pBuf[i] = (int16_t)AUDIO_DSP_SSAT(y, 16);
+    }
+
+    pBuf += n * AUDIO_EQ_CHANNELS;
+    frames -= n;
+  }
+}
+
+/**
+  * @brief  Same as Audio_Eq_Process() for 32-bit samples, processed in
+  *         place as Q31.
+  * @param  eq: equalizer.
+  * @param  pBuf: frames, processed in place.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Eq_Process32(AUDIO_EqTypeDef *eq, int32_t *pBuf, uint32_t frames)
+{
+  const AUDIO_EqSetTypeDef *set = &eq->set[eq->active];
+
+  if ((set->stages[0] == 0) && (set->stages[1] == 0))
+  {
+    return;
+  }
+
+  EQ_Cascade(eq, set, pBuf, frames);
+}
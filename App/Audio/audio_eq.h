@@ -0,0 +1,97 @@
+/**
+  ******************************************************************************
+  * @file    audio_eq.h
+  * @brief   Header file for the audio_eq.c parametric equalizer.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_EQ_H
+#define __AUDIO_EQ_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Channels of the interleaved frames, each with its own bands */
+#define AUDIO_EQ_CHANNELS               2
+
+/* Bands per channel */
+#define AUDIO_EQ_BANDS_MAX              10
+
+/* Largest block processed at once, in frames (1 ms at 96 kHz). Longer
+   blocks are processed in several passes. */
+#define AUDIO_EQ_BLOCK_MAX              96
+
+/* Band types */
+#define AUDIO_EQ_OFF                    0
+#define AUDIO_EQ_PEAK                   1
+#define AUDIO_EQ_LOW_SHELF              2
+#define AUDIO_EQ_HIGH_SHELF             3
+#define AUDIO_EQ_TYPE_NUM               4
+
+/* Band parameter ranges: gain in 1/256 dB, quality factor in 1/256 */
+#define AUDIO_EQ_GAIN_MAX               ((int16_t)0x0C00)  /* +12 dB */
+#define AUDIO_EQ_GAIN_MIN               ((int16_t)-0x0C00) /* -12 dB */
+#define AUDIO_EQ_Q_MIN                  ((uint16_t)0x0019) /* 0.1 */
+#define AUDIO_EQ_Q_MAX                  ((uint16_t)0x1400) /* 20 */
+#define AUDIO_EQ_FREQ_MIN               ((uint16_t)10)     /* Hz */
+
+/* Coefficients are stored in Q(31 - AUDIO_EQ_POST_SHIFT): the biquads of
+   the bands above reach a magnitude of 4 */
+#define AUDIO_EQ_POST_SHIFT             3
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint8_t  type;                /* AUDIO_EQ_xxx */
+  uint16_t freq;                /* Center or corner frequency (Hz) */
+  int16_t  gain;                /* Gain (1/256 dB) */
+  uint16_t q;                   /* Quality factor, or shelf slope (1/256) */
+} AUDIO_EqBandTypeDef;
+
+/* Biquad coefficients, a1 and a2 negated:
+   y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] + a1 y[n-1] + a2 y[n-2] */
+typedef struct
+{
+  int32_t b0, b1, b2, a1, a2;
+} AUDIO_EqCoefTypeDef;
+
+/* Cascades run by the audio path: the active bands of each channel */
+typedef struct
+{
+  uint32_t            stages[AUDIO_EQ_CHANNELS];
+  uint8_t             band[AUDIO_EQ_CHANNELS][AUDIO_EQ_BANDS_MAX];
+  AUDIO_EqCoefTypeDef coef[AUDIO_EQ_CHANNELS][AUDIO_EQ_BANDS_MAX];
+} AUDIO_EqSetTypeDef;
+
+typedef struct
+{
+  /* Control side: band parameters and their coefficients */
+  AUDIO_EqBandTypeDef bands[AUDIO_EQ_CHANNELS][AUDIO_EQ_BANDS_MAX];
+  AUDIO_EqCoefTypeDef coef[AUDIO_EQ_CHANNELS][AUDIO_EQ_BANDS_MAX];
+  uint32_t            fs;       /* Sampling frequency (Hz) */
+
+  /* Cascades: the audio path runs set[active], the other one is rebuilt
+     by Audio_Eq_Commit() and swapped in between two blocks */
+  AUDIO_EqSetTypeDef  set[2];
+  volatile uint32_t   active;
+
+  /* Audio path: DF1 state of each band (x[n-1], x[n-2], y[n-1], y[n-2]),
+     kept across coefficient swaps, and the Q31 work buffer */
+  int32_t             state[AUDIO_EQ_CHANNELS][AUDIO_EQ_BANDS_MAX][4];
+  int32_t             work[AUDIO_EQ_BLOCK_MAX * AUDIO_EQ_CHANNELS];
+} AUDIO_EqTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void     Audio_Eq_Init(AUDIO_EqTypeDef *eq, uint32_t fs);
+uint32_t Audio_Eq_SetBand(AUDIO_EqTypeDef *eq, uint32_t channel, uint32_t index,
+                          const AUDIO_EqBandTypeDef *band);
+void     Audio_Eq_SetRate(AUDIO_EqTypeDef *eq, uint32_t fs);
+void     Audio_Eq_Commit(AUDIO_EqTypeDef *eq);
+void     Audio_Eq_Design(const AUDIO_EqBandTypeDef *band, uint32_t fs,
+                         AUDIO_EqCoefTypeDef *coef);
+void     Audio_Eq_Process(AUDIO_EqTypeDef *eq, int16_t *pBuf, uint32_t frames);
+void     Audio_Eq_Process32(AUDIO_EqTypeDef *eq, int32_t *pBuf, uint32_t frames);
+
+#endif /* __AUDIO_EQ_H */
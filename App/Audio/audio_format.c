@@ -0,0 +1,290 @@
+/**
+  ******************************************************************************
+  * @file    audio_format.c
+  * @brief   Sample format conversion and interleave kernels between the USB
+  *          subframes, the 32-bit processing format and the I2S words.
+  *
+  *          Each kernel is generated by a macro for one combination of input
+  *          format, output format, byte order and channel count. These are
+  *          compile-time constants of the generated function: the tests on
+  *          them fold away and the inner loops have no branch. Mono sources
+  *          are duplicated on both channels of the output frames.
+  *
+  *          The USB subframes are read by words through FORMAT_Load32(), a
+  *          memcpy() the compiler turns into a single LDR: the Cortex-M4
+  *          handles unaligned LDR/STR, and the ring hands out packets at
+  *          any byte offset. Packed 24-bit subframes are read 4 samples (3
+  *          words) at a time and spread by shifts into left-justified
+  *          32-bit samples. Big-endian sources are swapped with REV/REV16.
+  *
+  *          Tools/audio_format_bench.c checks every kernel against scalar
+  *          byte-by-byte code and compares their throughput on a host.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "audio_format.h"
+#include "audio_dsp.h"
+
+/* Private macro -------------------------------------------------------------*/
+#if defined(ARM_MATH_CM4)
+#define FORMAT_REV(x)                   __REV(x)
+#define FORMAT_REV16(x)                 __REV16(x)
+#define FORMAT_ROR16(x)                 __ROR((x), 16)
+#else
+#define FORMAT_REV(x)                   __builtin_bswap32(x)
+#define FORMAT_REV16(x)                 ((((x) & 0x00FF00FFUL) << 8) | (((x) >> 8) & 0x00FF00FFUL))
+#define FORMAT_ROR16(x)                 (((x) << 16) | ((x) >> 16))
+#endif /* ARM_MATH_CM4 */
+
+/* Stores a converted sample of input sample i: mono samples go to both
+   channels of frame i */
+#define FORMAT_PUT(CH, p, i, s)                                                \
+  do                                                                           \
+  {                                                                            \
+    if ((CH) == 1)                                                             \
+    {                                                                          \
+      (p)[2 * (i)] = (int32_t)(s);                                             \
+      (p)[(2 * (i)) + 1] = (int32_t)(s);                                       \
+    }                                                                          \
+    else                                                                       \
+    {                                                                          \
+      (p)[i] = (int32_t)(s);                                                   \
+    }                                                                          \
+  } while (0)
+
+/**
+  * @brief  16-bit subframes, little (BE = 0) or big (BE = 1) endian, to
+  *         32-bit samples with their full scale at 2^(15 + SHIFT).
+  *         Two samples per word.
+  */
+#define FORMAT_S16_TO_32(name, BE, CH, SHIFT)                                  \
+void name(const void *pSrc, int32_t *pDst, uint32_t frames)                    \
+{                                                                              \
+  const uint8_t *p = (const uint8_t*)pSrc;                                     \
+  uint32_t samples = frames * (CH);                                            \
+  uint32_t w;                                                                  \
+                                                                               \
+  for (; samples >= 2; samples -= 2)                                           \
+  {                                                                            \
+    w = FORMAT_Load32(p);                                                      \
+    if (BE)                                                                    \
+    {                                                                          \
+      w = FORMAT_REV16(w);                                                     \
+    }                                                                          \
+    FORMAT_PUT(CH, pDst, 0, (int32_t)(w << 16) >> (16 - (SHIFT)));             \
+    FORMAT_PUT(CH, pDst, 1, (int32_t)(w & 0xFFFF0000UL) >> (16 - (SHIFT)));    \
+    p += 4;                                                                    \
+    pDst += 4 / (CH);                                                          \
+  }                                                                            \
+                                                                               \
+  /* Odd mono frame */                                                         \
+  if (samples != 0)                                                            \
+  {                                                                            \
+    w = (BE) ? (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16))               \
+             : (((uint32_t)p[1] << 24) | ((uint32_t)p[0] << 16));              \
+    FORMAT_PUT(CH, pDst, 0, (int32_t)w >> (16 - (SHIFT)));                     \
+  }                                                                            \
+}
+
+/**
+  * @brief  Packed 24-bit subframes, little (BE = 0) or big (BE = 1) endian,
+  *         to left-justified 32-bit samples. Four samples per three words.
+  */
+#define FORMAT_S24P_TO_S32(name, BE, CH)                                       \
+void name(const void *pSrc, int32_t *pDst, uint32_t frames)                    \
+{                                                                              \
+  const uint8_t *p = (const uint8_t*)pSrc;                                     \
+  uint32_t samples = frames * (CH);                                            \
+  uint32_t w0, w1, w2;                                                         \
+                                                                               \
+  for (; samples >= 4; samples -= 4)                                           \
+  {                                                                            \
+    w0 = FORMAT_Load32(p);                                                     \
+    w1 = FORMAT_Load32(p + 4);                                                 \
+    w2 = FORMAT_Load32(p + 8);                                                 \
+    if (BE)                                                                    \
+    {                                                                          \
+      w0 = FORMAT_REV(w0);                                                     \
+      w1 = FORMAT_REV(w1);                                                     \
+      w2 = FORMAT_REV(w2);                                                     \
+      FORMAT_PUT(CH, pDst, 0, w0 & 0xFFFFFF00UL);                              \
+      FORMAT_PUT(CH, pDst, 1, (w0 << 24) | ((w1 >> 8) & 0x00FFFF00UL));        \
+      FORMAT_PUT(CH, pDst, 2, (w1 << 16) | ((w2 >> 16) & 0x0000FF00UL));       \
+      FORMAT_PUT(CH, pDst, 3, w2 << 8);                                        \
+    }                                                                          \
+    else                                                                       \
+    {                                                                          \
+      FORMAT_PUT(CH, pDst, 0, w0 << 8);                                        \
+      FORMAT_PUT(CH, pDst, 1, ((w0 >> 16) & 0x0000FF00UL) | (w1 << 16));       \
+      FORMAT_PUT(CH, pDst, 2, ((w1 >> 8) & 0x00FFFF00UL) | (w2 << 24));        \
+      FORMAT_PUT(CH, pDst, 3, w2 & 0xFFFFFF00UL);                              \
+    }                                                                          \
+    p += 12;                                                                   \
+    pDst += 8 / (CH);                                                          \
+  }                                                                            \
+                                                                               \
+  /* Last stereo frame, or last mono frames */                                 \
+  for (; samples != 0; samples--)                                              \
+  {                                                                            \
+    w0 = (BE) ? (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |             \
+                 ((uint32_t)p[2] << 8))                                        \
+              : (((uint32_t)p[2] << 24) | ((uint32_t)p[1] << 16) |             \
+                 ((uint32_t)p[0] << 8));                                       \
+    FORMAT_PUT(CH, pDst, 0, w0);                                               \
+    p += 3;                                                                    \
+    pDst += 2 / (CH);                                                          \
+  }                                                                            \
+}
+
+/**
+  * @brief  32-bit samples with their full scale at 2^(15 + SHIFT) to 16-bit
+  *         samples, rounded and saturated. Two samples per word.
+  */
+#define FORMAT_32_TO_S16(name, SHIFT)                                          \
+void name(const int32_t *pSrc, void *pDst, uint32_t frames)                    \
+{                                                                              \
+  uint8_t *p = (uint8_t*)pDst;                                                 \
+  int32_t l, r;                                                                \
+                                                                               \
+  for (; frames != 0; frames--)                                                \
+  {                                                                            \
+    l = AUDIO_DSP_QADD(pSrc[0], 1 << ((SHIFT) - 1)) >> (SHIFT);                \
+    r = AUDIO_DSP_QADD(pSrc[1], 1 << ((SHIFT) - 1)) >> (SHIFT);                \
+    l = AUDIO_DSP_SSAT(l, 16);                                                 \
+    r = AUDIO_DSP_SSAT(r, 16);                                                 \
+    FORMAT_Store32(p, AUDIO_DSP_PACK(l, r));                                   \
+    pSrc += 2;                                                                 \
+    p += 4;                                                                    \
+  }                                                                            \
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Word load from any address.
+  */
+static inline uint32_t FORMAT_Load32(const uint8_t *p)
+{
+  uint32_t w;
+
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+/**
+  * @brief  Word store to any address.
+  */
+static inline void FORMAT_Store32(uint8_t *p, uint32_t w)
+{
+  memcpy(p, &w, sizeof(w));
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  16-bit subframes to Q31 samples.
+  * @param  pSrc: subframes, any alignment.
+  * @param  pDst: interleaved stereo frames.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+FORMAT_S16_TO_32(Audio_Format_S16_Q31_Mono,     0, 1, 16)
+FORMAT_S16_TO_32(Audio_Format_S16_Q31_Stereo,   0, 2, 16)
+FORMAT_S16_TO_32(Audio_Format_S16BE_Q31_Mono,   1, 1, 16)
+FORMAT_S16_TO_32(Audio_Format_S16BE_Q31_Stereo, 1, 2, 16)
+
+/**
+  * @brief  16-bit subframes to the Q27 processing format.
+  * @param  pSrc: subframes, any alignment.
+  * @param  pDst: interleaved stereo frames.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+FORMAT_S16_TO_32(Audio_Format_S16_Q27_Stereo, 0, 2, AUDIO_FORMAT_Q27_BITS - 15)
+
+/**
+  * @brief  Packed 24-bit subframes to left-justified 32-bit samples, the
+  *         layout of the I2S words.
+  * @param  pSrc: subframes, any alignment.
+  * @param  pDst: interleaved stereo frames.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+FORMAT_S24P_TO_S32(Audio_Format_S24P_S32_Mono,     0, 1)
+FORMAT_S24P_TO_S32(Audio_Format_S24P_S32_Stereo,   0, 2)
+FORMAT_S24P_TO_S32(Audio_Format_S24PBE_S32_Mono,   1, 1)
+FORMAT_S24P_TO_S32(Audio_Format_S24PBE_S32_Stereo, 1, 2)
+
+/**
+  * @brief  Q31 or Q27 samples to 16-bit samples, rounded and saturated.
+  * @param  pSrc: interleaved stereo frames.
+  * @param  pDst: 16-bit frames, any alignment. May be pSrc.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+FORMAT_32_TO_S16(Audio_Format_Q31_S16_Stereo, 16)
+FORMAT_32_TO_S16(Audio_Format_Q27_S16_Stereo, AUDIO_FORMAT_Q27_BITS - 15)
+
+/**
+  * @brief  32-bit samples to the Q27 processing format. The 24-bit samples
+  *         keep all their bits.
+  * @param  pSrc: interleaved stereo frames.
+  * @param  pDst: converted frames. May be pSrc.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Format_S32_Q27_Stereo(const int32_t *pSrc, int32_t *pDst, uint32_t frames)
+{
+  for (; frames != 0; frames--)
+  {
+    pDst[0] = pSrc[0] >> (31 - AUDIO_FORMAT_Q27_BITS);
+    pDst[1] = pSrc[1] >> (31 - AUDIO_FORMAT_Q27_BITS);
+    pSrc += 2;
+    pDst += 2;
+  }
+}
+
+/**
+  * @brief  Q27 samples back to 32-bit samples, saturated to full scale.
+  * @param  pSrc: interleaved stereo frames.
+  * @param  pDst: converted frames. May be pSrc.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Format_Q27_S32_Stereo(const int32_t *pSrc, int32_t *pDst, uint32_t frames)
+{
+  for (; frames != 0; frames--)
+  {
+    pDst[0] = (int32_t)((uint32_t)AUDIO_DSP_SSAT(pSrc[0], AUDIO_FORMAT_Q27_BITS + 1) <<
+                        (31 - AUDIO_FORMAT_Q27_BITS));
+    pDst[1] = (int32_t)((uint32_t)AUDIO_DSP_SSAT(pSrc[1], AUDIO_FORMAT_Q27_BITS + 1) <<
+                        (31 - AUDIO_FORMAT_Q27_BITS));
+    pSrc += 2;
+    pDst += 2;
+  }
+}
+
+/**
+  * @brief  32-bit samples to I2S words: the half-words are swapped so that
+  *         the I2S receives the most significant half first.
+  * @param  pSrc: interleaved stereo frames.
+  * @param  pDst: DMA buffer. May be pSrc.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Format_S32_I2S_Stereo(const int32_t *pSrc, uint32_t *pDst, uint32_t frames)
+{
+  uint32_t l, r;
+
+  for (; frames != 0; frames--)
+  {
+    l = (uint32_t)pSrc[0];
+    r = (uint32_t)pSrc[1];
+    pDst[0] = FORMAT_ROR16(l);
+    pDst[1] = FORMAT_ROR16(r);
+    pSrc += 2;
+    pDst += 2;
+  }
+}
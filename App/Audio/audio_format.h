@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file    audio_format.h
+  * @brief   Header file for the audio_format.c sample format conversions.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_FORMAT_H
+#define __AUDIO_FORMAT_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Processing format of the render path: 32-bit samples with their full
+   scale at 2^27 (Q27), 4 bits of headroom for the EQ boosts and the volume */
+#define AUDIO_FORMAT_Q27_BITS           27
+
+/* Exported functions ------------------------------------------------------- */
+/* Conversions of USB subframes, mono or stereo, to interleaved stereo frames
+   of 32-bit samples. The source may have any alignment. */
+void Audio_Format_S16_Q31_Mono(const void *pSrc, int32_t *pDst, uint32_t frames);
+void Audio_Format_S16_Q31_Stereo(const void *pSrc, int32_t *pDst, uint32_t frames);
+void Audio_Format_S16BE_Q31_Mono(const void *pSrc, int32_t *pDst, uint32_t frames);
+void Audio_Format_S16BE_Q31_Stereo(const void *pSrc, int32_t *pDst, uint32_t frames);
+void Audio_Format_S16_Q27_Stereo(const void *pSrc, int32_t *pDst, uint32_t frames);
+void Audio_Format_S24P_S32_Mono(const void *pSrc, int32_t *pDst, uint32_t frames);
+void Audio_Format_S24P_S32_Stereo(const void *pSrc, int32_t *pDst, uint32_t frames);
+void Audio_Format_S24PBE_S32_Mono(const void *pSrc, int32_t *pDst, uint32_t frames);
+void Audio_Format_S24PBE_S32_Stereo(const void *pSrc, int32_t *pDst, uint32_t frames);
+
+/* Conversions of interleaved stereo frames of 32-bit samples, in place or
+   not. The 16-bit outputs are rounded and saturated. */
+void Audio_Format_Q31_S16_Stereo(const int32_t *pSrc, void *pDst, uint32_t frames);
+void Audio_Format_Q27_S16_Stereo(const int32_t *pSrc, void *pDst, uint32_t frames);
+void Audio_Format_S32_Q27_Stereo(const int32_t *pSrc, int32_t *pDst, uint32_t frames);
+void Audio_Format_Q27_S32_Stereo(const int32_t *pSrc, int32_t *pDst, uint32_t frames);
+
+/* 32-bit samples to I2S words: the DMA sends the low half-word first */
+void Audio_Format_S32_I2S_Stereo(const int32_t *pSrc, uint32_t *pDst, uint32_t frames);
+
+#endif /* __AUDIO_FORMAT_H */
@@ -0,0 +1,189 @@
+/**
+  ******************************************************************************
+  * @file    audio_jitter.c
+  * @brief   Adaptive depth of the jitter buffer.
+  *
+  *          The host sends one packet per USB frame, but a busy host delays
+  *          or skips some of them. The buffer must hold enough samples to
+  *          play through the longest delay, and no more: every sample it
+  *          holds adds to the latency.
+  *
+  *          The lateness of each packet against the nominal period is peak
+  *          held, and decays once no new peak has been seen for
+  *          AUDIO_JITTER_HOLD_PACKETS packets. The target depth is the
+  *          minimum of the selected profile plus twice that peak, bounded
+  *          by the maximum of the profile. An underrun raises the peak by a
+  *          whole period.
+  *
+  *          The module only computes the target depth: the stream path moves
+  *          the fill level towards it through the resampler and the
+  *          feedback, or through the concealment after an underrun.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "audio_jitter.h"
+
+/* Private variables ---------------------------------------------------------*/
+static const AUDIO_JitterProfileTypeDef JitterProfiles[AUDIO_JITTER_PROFILE_NUM] =
+{
+  {  2000,  4000 },             /* AUDIO_JITTER_PROFILE_LOW_LATENCY */
+  {  4000,  8000 },             /* AUDIO_JITTER_PROFILE_BALANCED */
+  { 10000, AUDIO_JITTER_DEPTH_MAX_US }, /* AUDIO_JITTER_PROFILE_ROBUST */
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Recomputes the target depth from the jitter peak.
+  * @param  jitter: jitter buffer state.
+  * @retval None
+  */
+static void JITTER_UpdateTarget(AUDIO_JitterTypeDef *jitter)
+{
+  uint32_t target;
+  uint32_t limit;
+
+  /* A peak beyond the one giving the maximum depth would only slow down
+     the decay */
+  limit = (uint32_t)(((uint64_t)jitter->period *
+                      (jitter->profile->maxUs - jitter->profile->minUs)) / 2000);
+  if (jitter->peak > limit)
+  {
+    jitter->peak = limit;
+  }
+
+  /* Peak in microseconds, one period being 1 ms */
+  target = (uint32_t)(((uint64_t)jitter->peak * 1000) / jitter->period);
+  target = jitter->profile->minUs + (2 * target);
+  if (target > jitter->profile->maxUs)
+  {
+    target = jitter->profile->maxUs;
+  }
+
+  jitter->targetUs = target;
+  if (target > jitter->targetMaxUs)
+  {
+    jitter->targetMaxUs = target;
+  }
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Initializes the jitter buffer state.
+  * @param  jitter: jitter buffer state.
+  * @param  profile: AUDIO_JITTER_PROFILE_xxx.
+  * @param  period: time stamp ticks in one packet period (1 ms).
+  * @retval None
+  */
+void Audio_Jitter_Init(AUDIO_JitterTypeDef *jitter, uint32_t profile,
+                       uint32_t period)
+{
+  jitter->period = (period != 0) ? period : 1;
+  jitter->lastValid = 0;
+  jitter->peak = 0;
+  jitter->hold = 0;
+  jitter->underruns = 0;
+  jitter->targetMaxUs = 0;
+  if (Audio_Jitter_SetProfile(jitter, profile) != 0)
+  {
+    Audio_Jitter_SetProfile(jitter, AUDIO_JITTER_PROFILE_BALANCED);
+  }
+}
+
+/**
+  * @brief  Selects a latency profile. The jitter measured so far is kept.
+  * @param  jitter: jitter buffer state.
+  * @param  profile: AUDIO_JITTER_PROFILE_xxx.
+  * @retval 0 if the profile exists, 1 otherwise.
+  */
+uint32_t Audio_Jitter_SetProfile(AUDIO_JitterTypeDef *jitter, uint32_t profile)
+{
+  if (profile >= AUDIO_JITTER_PROFILE_NUM)
+  {
+    return 1;
+  }
+
+  jitter->profile = &JitterProfiles[profile];
+  jitter->profileIndex = profile;
+  jitter->targetMaxUs = 0;
+  JITTER_UpdateTarget(jitter);
+
+  return 0;
+}
+
+/**
+  * @brief  Forgets the previous arrival: the next packet starts a new stream.
+  * @param  jitter: jitter buffer state.
+  * @retval None
+  */
+void Audio_Jitter_Restart(AUDIO_JitterTypeDef *jitter)
+{
+  jitter->lastValid = 0;
+}
+
+/**
+  * @brief  Records the arrival of a packet.
+  * @param  jitter: jitter buffer state.
+  * @param  stamp: arrival time, in ticks of a free running counter.
+  * @retval None
+  */
+void Audio_Jitter_Arrival(AUDIO_JitterTypeDef *jitter, uint32_t stamp)
+{
+  uint32_t gap;
+  uint32_t late;
+
+  gap = stamp - jitter->lastStamp;
+  jitter->lastStamp = stamp;
+  if (!jitter->lastValid)
+  {
+    jitter->lastValid = 1;
+    return;
+  }
+  if ((gap / AUDIO_JITTER_GAP_MAX_MS) > jitter->period)
+  {
+    return;
+  }
+
+  late = (gap > jitter->period) ? (gap - jitter->period) : 0;
+  if (late > jitter->peak)
+  {
+    jitter->peak = late;
+    jitter->hold = 0;
+    JITTER_UpdateTarget(jitter);
+  }
+  else if (jitter->hold < AUDIO_JITTER_HOLD_PACKETS)
+  {
+    jitter->hold++;
+  }
+  else if (jitter->peak != 0)
+  {
+    /* Quiet host: decay by about 1/512 per packet */
+    jitter->peak -= (jitter->peak >> 9) + 1;
+    JITTER_UpdateTarget(jitter);
+  }
+}
+
+/**
+  * @brief  Records an underrun: the buffer was too shallow for the host.
+  * @param  jitter: jitter buffer state.
+  * @retval None
+  */
+void Audio_Jitter_Underrun(AUDIO_JitterTypeDef *jitter)
+{
+  jitter->underruns++;
+  jitter->peak += jitter->period;
+  jitter->hold = 0;
+  JITTER_UpdateTarget(jitter);
+}
+
+/**
+  * @brief  Returns the target depth of the jitter buffer.
+  * @param  jitter: jitter buffer state.
+  * @retval Depth in microseconds.
+  */
+uint32_t Audio_Jitter_Target(const AUDIO_JitterTypeDef *jitter)
+{
+  return jitter->targetUs;
+}
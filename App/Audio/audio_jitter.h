@@ -0,0 +1,63 @@
+/**
+  ******************************************************************************
+  * @file    audio_jitter.h
+  * @brief   Header file for the audio_jitter.c adaptive jitter buffer depth.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_JITTER_H
+#define __AUDIO_JITTER_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Latency profiles: bounds of the jitter buffer depth */
+#define AUDIO_JITTER_PROFILE_LOW_LATENCY  0  /* 2 to 4 ms */
+#define AUDIO_JITTER_PROFILE_BALANCED     1  /* 4 to 8 ms */
+#define AUDIO_JITTER_PROFILE_ROBUST       2  /* 10 to 16 ms */
+#define AUDIO_JITTER_PROFILE_NUM          3
+
+/* Largest depth of all the profiles (us), the one the buffers are sized for */
+#define AUDIO_JITTER_DEPTH_MAX_US       16000
+
+/* Packets without a new jitter peak before the peak starts to decay */
+#define AUDIO_JITTER_HOLD_PACKETS       5000
+
+/* Gaps longer than this (ms) are stream restarts, not jitter */
+#define AUDIO_JITTER_GAP_MAX_MS         20
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint16_t minUs;               /* Depth on a regular host */
+  uint16_t maxUs;               /* Largest depth */
+} AUDIO_JitterProfileTypeDef;
+
+typedef struct
+{
+  const AUDIO_JitterProfileTypeDef *profile;
+  uint32_t profileIndex;        /* AUDIO_JITTER_PROFILE_xxx */
+  uint32_t period;              /* Time stamp ticks between two packets */
+  uint32_t lastStamp;           /* Arrival of the previous packet */
+  uint8_t  lastValid;           /* lastStamp holds an arrival */
+  uint32_t peak;                /* Largest lateness of a packet (ticks) */
+  uint32_t hold;                /* Packets since the peak was raised */
+  uint32_t targetUs;            /* Depth of the jitter buffer */
+
+  /* Diagnostics */
+  uint32_t underruns;           /* Underruns that raised the depth */
+  uint32_t targetMaxUs;         /* Deepest target reached */
+} AUDIO_JitterTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void     Audio_Jitter_Init(AUDIO_JitterTypeDef *jitter, uint32_t profile,
+                           uint32_t period);
+uint32_t Audio_Jitter_SetProfile(AUDIO_JitterTypeDef *jitter, uint32_t profile);
+void     Audio_Jitter_Restart(AUDIO_JitterTypeDef *jitter);
+void     Audio_Jitter_Arrival(AUDIO_JitterTypeDef *jitter, uint32_t stamp);
+void     Audio_Jitter_Underrun(AUDIO_JitterTypeDef *jitter);
+uint32_t Audio_Jitter_Target(const AUDIO_JitterTypeDef *jitter);
+
+#endif /* __AUDIO_JITTER_H */
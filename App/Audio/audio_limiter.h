@@ -0,0 +1,80 @@
+/**
+  ******************************************************************************
+  * @file    audio_limiter.h
+  * @brief   Header file for the audio_limiter.c look-ahead limiter.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_LIMITER_H
+#define __AUDIO_LIMITER_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* The processed samples are 32-bit with their full scale at
+   2^AUDIO_LIMITER_FULL_SCALE_BITS: the stages ahead of the limiter (EQ
+   boosts, volume) have AUDIO_LIMITER_HEADROOM_BITS of headroom above it */
+#define AUDIO_LIMITER_FULL_SCALE_BITS   27
+#define AUDIO_LIMITER_HEADROOM_BITS     (31 - AUDIO_LIMITER_FULL_SCALE_BITS)
+
+/* Look-ahead delay line, in frames: 2 ms at 96 kHz */
+#define AUDIO_LIMITER_DELAY_MAX         192
+
+/* Gain in Q16: 1.0 */
+#define AUDIO_LIMITER_UNITY             ((int32_t)1 << 16)
+
+/* Parameter ranges: threshold in 1/256 dBFS, ratio in 1/256 */
+#define AUDIO_LIMITER_THRESHOLD_MIN     ((int16_t)-0x1800) /* -24 dBFS */
+#define AUDIO_LIMITER_THRESHOLD_MAX     ((int16_t)0)       /* 0 dBFS */
+#define AUDIO_LIMITER_RATIO_MIN         ((uint16_t)0x0100) /* 1:1 */
+#define AUDIO_LIMITER_RATIO_MAX         ((uint16_t)0x1400) /* 20:1 */
+#define AUDIO_LIMITER_RATIO_INF         ((uint16_t)0)      /* Limiter */
+#define AUDIO_LIMITER_ATTACK_MIN_US     10
+#define AUDIO_LIMITER_RELEASE_MIN_MS    1
+#define AUDIO_LIMITER_RELEASE_MAX_MS    2000
+#define AUDIO_LIMITER_LOOKAHEAD_MIN_US  1000
+#define AUDIO_LIMITER_LOOKAHEAD_MAX_US  2000
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  int16_t  threshold;           /* Threshold (1/256 dBFS) */
+  uint16_t ratio;               /* Ratio (1/256), or AUDIO_LIMITER_RATIO_INF */
+  uint16_t attackUs;            /* Attack time constant (us), at most the look-ahead */
+  uint16_t releaseMs;           /* Release time constant (ms) */
+  uint16_t lookaheadUs;         /* Look-ahead delay (us) */
+} AUDIO_LimiterConfigTypeDef;
+
+typedef struct
+{
+  /* Control side: parameters and their fixed-point form */
+  AUDIO_LimiterConfigTypeDef cfg;
+  uint32_t fs;                  /* Sampling frequency (Hz) */
+  int32_t  thrLin;              /* Threshold, linear */
+  int32_t  thrLog;              /* Threshold, log2 relative to 2^31 (Q16) */
+  int32_t  slope;               /* 1 - 1 / ratio (Q16) */
+  int32_t  attack;              /* Gain smoothing coefficient (Q31) */
+  int32_t  release;             /* Envelope decay coefficient (Q31) */
+  uint32_t delayFrames;         /* Look-ahead in frames */
+
+  /* Audio path: peak envelope of both channels, gain applied to the last
+     frame and smallest gain since Audio_Limiter_GainMin() was called */
+  int32_t  env;
+  int32_t  gain;
+  int32_t  gainMin;
+  uint32_t pos;
+  int32_t  delay[AUDIO_LIMITER_DELAY_MAX * 2];
+} AUDIO_LimiterTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+uint32_t Audio_Limiter_Init(AUDIO_LimiterTypeDef *lim,
+                            const AUDIO_LimiterConfigTypeDef *cfg, uint32_t fs);
+uint32_t Audio_Limiter_Config(AUDIO_LimiterTypeDef *lim,
+                              const AUDIO_LimiterConfigTypeDef *cfg);
+void     Audio_Limiter_SetRate(AUDIO_LimiterTypeDef *lim, uint32_t fs);
+int32_t  Audio_Limiter_GainMin(AUDIO_LimiterTypeDef *lim);
+void     Audio_Limiter_Process(AUDIO_LimiterTypeDef *lim, int32_t *pBuf, uint32_t frames);
+
+#endif /* __AUDIO_LIMITER_H */
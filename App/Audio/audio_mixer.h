@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file    audio_mixer.h
+  * @brief   Header file for the audio_mixer.c mixer of the streaming
+  *          interfaces.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_MIXER_H
+#define __AUDIO_MIXER_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "audio_volume.h"
+
+/* Exported constants --------------------------------------------------------*/
+/* Streams mixed into the output */
+#define AUDIO_MIXER_MEDIA               0
+#define AUDIO_MIXER_VOICE               1
+#define AUDIO_MIXER_STREAMS             2
+
+/* Depth by which a playing stream ducks the others, in 1/256 dB */
+#define AUDIO_MIXER_DUCK_NONE           ((int16_t)0)
+#define AUDIO_MIXER_DUCK_MIN            ((int16_t)-0x3000) /* -48 dB */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  AUDIO_VolumeTypeDef duckGain[AUDIO_MIXER_STREAMS]; /* Gain of each stream ducked by the others */
+  volatile int16_t    duck[AUDIO_MIXER_STREAMS];     /* Depth each stream ducks the others by (1/256 dB) */
+  uint8_t             active[AUDIO_MIXER_STREAMS];   /* Streams playing */
+} AUDIO_MixerTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void Audio_Mixer_Init(AUDIO_MixerTypeDef *mixer, uint32_t frames);
+void Audio_Mixer_SetRamp(AUDIO_MixerTypeDef *mixer, uint32_t frames);
+void Audio_Mixer_SetDuck(AUDIO_MixerTypeDef *mixer, uint32_t stream, int16_t duck);
+void Audio_Mixer_SetActive(AUDIO_MixerTypeDef *mixer, uint32_t stream, uint32_t active);
+void Audio_Mixer_Process(AUDIO_MixerTypeDef *mixer, int32_t *pMedia, int16_t *pVoice,
+                         uint32_t frames);
+
+#endif /* __AUDIO_MIXER_H */
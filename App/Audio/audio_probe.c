@@ -0,0 +1,175 @@
+/**
+  ******************************************************************************
+  * @file    audio_probe.c
+  * @brief   Latency statistics of the audio path.
+  *
+  *          Each stage accumulates the count, minimum, maximum and sum of the
+  *          latencies recorded for it, and a histogram with 4 logarithmic bins
+  *          per octave (about 19% wide) from which the 99th percentile is
+  *          estimated. Latencies are in cycles of the time stamping counter.
+  *
+  *          The statistics live in a single AUDIO_ProbeTypeDef that can be
+  *          read at runtime or dumped from the target by a debugger; the same
+  *          file is built on the host by the decoder in Tools/.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "audio_probe.h"
+#if defined(ARM_MATH_CM4)
+#include "stm32f4xx.h"
+#endif
+
+/* Private macro -------------------------------------------------------------*/
+#if defined(ARM_MATH_CM4)
+#define PROBE_CLZ(x)                    __CLZ(x)
+#else
+#define PROBE_CLZ(x)                    ((uint32_t)__builtin_clz(x))
+#endif
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Histogram bin of a latency.
+  * @param  cycles: latency.
+  * @retval Bin index.
+  */
+static uint32_t PROBE_Bin(uint32_t cycles)
+{
+  uint32_t octave, bin;
+
+  if (cycles < 4)
+  {
+    return cycles;
+  }
+
+  /* Octave of the leading one, then the two bits that follow it */
+  octave = 31 - PROBE_CLZ(cycles);
+  bin = ((octave - 1) * 4) + ((cycles >> (octave - 2)) & 3);
+
+  return (bin < AUDIO_PROBE_BINS) ? bin : (AUDIO_PROBE_BINS - 1);
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Clears the statistics of every stage.
+  * @param  probe: statistics.
+  * @param  cpuFreq: frequency of the time stamping counter in Hz.
+  * @retval None
+  */
+void Audio_Probe_Init(AUDIO_ProbeTypeDef *probe, uint32_t cpuFreq)
+{
+  uint32_t i;
+
+  memset(probe, 0, sizeof(*probe));
+  probe->magic = AUDIO_PROBE_MAGIC;
+  probe->version = AUDIO_PROBE_VERSION;
+  probe->cpuFreq = cpuFreq;
+  probe->stages = AUDIO_PROBE_STAGES;
+  for (i = 0; i < AUDIO_PROBE_STAGES; i++)
+  {
+    probe->stage[i].min = 0xFFFFFFFF;
+  }
+}
+
+/**
+  * @brief  Adds a latency to the statistics of a stage. Not reentrant: all
+  *         the stages must be recorded from the same context.
+  * @param  probe: statistics.
+  * @param  stage: AUDIO_PROBE_xxx stage.
+  * @param  cycles: latency.
+  * @retval None
+  */
+void Audio_Probe_Record(AUDIO_ProbeTypeDef *probe, uint32_t stage, uint32_t cycles)
+{
+  AUDIO_ProbeStageTypeDef *s;
+
+  if (stage >= AUDIO_PROBE_STAGES)
+  {
+    return;
+  }
+
+  s = &probe->stage[stage];
+  s->count++;
+  s->sum += cycles;
+  if (cycles < s->min)
+  {
+    s->min = cycles;
+  }
+  if (cycles > s->max)
+  {
+    s->max = cycles;
+  }
+  s->hist[PROBE_Bin(cycles)]++;
+}
+
+/**
+  * @brief  Summarizes the statistics of a stage.
+  * @param  probe: statistics.
+  * @param  stage: AUDIO_PROBE_xxx stage.
+  * @param  report: filled with the summary, in cycles.
+  * @retval 0 if the stage has samples, 1 otherwise.
+  */
+uint32_t Audio_Probe_Report(const AUDIO_ProbeTypeDef *probe, uint32_t stage,
+                            AUDIO_ProbeReportTypeDef *report)
+{
+  const AUDIO_ProbeStageTypeDef *s;
+  uint32_t target, total, bin;
+
+  memset(report, 0, sizeof(*report));
+  if ((stage >= AUDIO_PROBE_STAGES) || (probe->stage[stage].count == 0))
+  {
+    return 1;
+  }
+
+  s = &probe->stage[stage];
+  report->count = s->count;
+  report->min = s->min;
+  report->max = s->max;
+  report->avg = (uint32_t)(s->sum / s->count);
+
+  /* First bin reaching 99% of the samples, bounded by the maximum */
+  target = s->count - (s->count / 100);
+  total = 0;
+  for (bin = 0; bin < AUDIO_PROBE_BINS; bin++)
+  {
+    total += s->hist[bin];
+    if (total >= target)
+    {
+      break;
+    }
+  }
+  report->p99 = Audio_Probe_BinLimit(bin);
+  if (report->p99 > s->max)
+  {
+    report->p99 = s->max;
+  }
+
+  return 0;
+}
+
+/**
+  * @brief  Largest latency falling in a histogram bin.
+  * @param  bin: bin index.
+  * @retval Upper bound in cycles.
+  */
+uint32_t Audio_Probe_BinLimit(uint32_t bin)
+{
+  uint32_t octave;
+
+  if (bin >= (AUDIO_PROBE_BINS - 1))
+  {
+    return 0xFFFFFFFF;
+  }
+  if (bin < 3)
+  {
+    return bin;
+  }
+
+  /* Lower bound of the next bin, minus one */
+  bin++;
+  octave = (bin / 4) + 1;
+  return ((4 + (bin % 4)) << (octave - 2)) - 1;
+}
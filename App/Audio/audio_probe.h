@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file    audio_probe.h
+  * @brief   Header file for the audio_probe.c latency statistics.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_PROBE_H
+#define __AUDIO_PROBE_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Stages of the path of a packet from the USB FIFO to the I2S pins */
+#define AUDIO_PROBE_FIFO                0  /* USB_OTG_ReadPacket -> usbd_audio_DataOut */
+#define AUDIO_PROBE_HANDOFF             1  /* usbd_audio_DataOut -> queued by the audio task */
+#define AUDIO_PROBE_RING                2  /* Queued -> rendered into the DMA buffer */
+#define AUDIO_PROBE_DMA                 3  /* Rendered -> played out by the I2S */
+#define AUDIO_PROBE_TOTAL               4  /* USB_OTG_ReadPacket -> played out by the I2S */
+#define AUDIO_PROBE_STAGES              5
+
+/* Histogram: 4 bins per octave of cycles, up to 2^25 cycles */
+#define AUDIO_PROBE_BINS                96
+
+/* Identification of a dumped AUDIO_ProbeTypeDef */
+#define AUDIO_PROBE_MAGIC               0x424F5250  /* "PROB" */
+#define AUDIO_PROBE_VERSION             1
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t count;                       /* Number of samples */
+  uint32_t min;                         /* Shortest latency (cycles) */
+  uint32_t max;                         /* Longest latency (cycles) */
+  uint32_t reserved;
+  uint64_t sum;                         /* Sum of the latencies (cycles) */
+  uint32_t hist[AUDIO_PROBE_BINS];      /* Latency histogram */
+} AUDIO_ProbeStageTypeDef;
+
+/* Layout shared with the host decoder: only fixed size fields, the 64-bit
+   one naturally aligned */
+typedef struct
+{
+  uint32_t magic;                       /* AUDIO_PROBE_MAGIC */
+  uint32_t version;                     /* AUDIO_PROBE_VERSION */
+  uint32_t cpuFreq;                     /* Cycle counter frequency (Hz) */
+  uint32_t stages;                      /* AUDIO_PROBE_STAGES */
+  AUDIO_ProbeStageTypeDef stage[AUDIO_PROBE_STAGES];
+} AUDIO_ProbeTypeDef;
+
+typedef struct
+{
+  uint32_t count;                       /* Number of samples */
+  uint32_t min;                         /* Latencies in cycles */
+  uint32_t avg;
+  uint32_t max;
+  uint32_t p99;                         /* Upper bound of the 99th percentile bin */
+} AUDIO_ProbeReportTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void     Audio_Probe_Init(AUDIO_ProbeTypeDef *probe, uint32_t cpuFreq);
+void     Audio_Probe_Record(AUDIO_ProbeTypeDef *probe, uint32_t stage, uint32_t cycles);
+uint32_t Audio_Probe_Report(const AUDIO_ProbeTypeDef *probe, uint32_t stage,
+                            AUDIO_ProbeReportTypeDef *report);
+uint32_t Audio_Probe_BinLimit(uint32_t bin);
+
+#endif /* __AUDIO_PROBE_H */
@@ -0,0 +1,257 @@
+/**
+  ******************************************************************************
+  * @file    audio_ramp.c
+  * @brief   Gain ramp generator applied to the rendered samples on the stream
+  *          transitions: play start, stop, mute and unmute.
+  *
+  *          The ramp moves a level linearly between silence and unity over a
+  *          configurable number of frames, and the gain follows the level
+  *          either linearly or along a raised cosine, whose null slope at
+  *          both ends keeps the spectrum of the transition narrow. A ramp
+  *          can be reversed at any point: it continues from the current
+  *          level. Once the target is reached the stream is either left
+  *          untouched (unity) or held at zero.
+  *
+  *          16-bit frames are processed as one 32-bit word per stereo frame:
+  *          SMULWB/SMULWT scale the two half-words with the Q16 gain and
+  *          PKHBT packs them back, the gain never exceeding unity.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "audio_ramp.h"
+#include "audio_dsp.h"
+
+/* Private define ------------------------------------------------------------*/
+/* The raised cosine is interpolated between 2^RAMP_COSINE_BITS segments */
+#define RAMP_COSINE_BITS                5
+#define RAMP_COSINE_SHIFT               (16 - RAMP_COSINE_BITS)
+
+/* Private variables ---------------------------------------------------------*/
+/* 0.5 - 0.5 * cos(pi * i / 32) in Q16 */
+static const int32_t RAMP_CosineTable[(1 << RAMP_COSINE_BITS) + 1] =
+{
+      0,   158,   630,  1411,  2494,  3869,  5522,  7438,
+   9598, 11980, 14563, 17321, 20228, 23256, 26375, 29556,
+  32768, 35980, 39161, 42280, 45308, 48215, 50973, 53556,
+  55938, 58098, 60014, 61667, 63042, 64125, 64906, 65378,
+  65536,
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Raised cosine gain of a level, interpolated from the table.
+  * @param  level: level in Q16, from 0 to AUDIO_RAMP_UNITY.
+  * @retval Gain in Q16.
+  */
+static inline int32_t RAMP_Cosine(int32_t level)
+{
+  int32_t index = level >> RAMP_COSINE_SHIFT;
+  int32_t frac = level & ((1 << RAMP_COSINE_SHIFT) - 1);
+  int32_t g0;
+
+  if (index >= (1 << RAMP_COSINE_BITS))
+  {
+    return AUDIO_RAMP_UNITY;
+  }
+  g0 = RAMP_CosineTable[index];
+  return g0 + (((RAMP_CosineTable[index + 1] - g0) * frac) >> RAMP_COSINE_SHIFT);
+}
+
+/**
+  * @brief  Number of frames left before the target is reached, at most the
+  *         block length, and the signed level change per frame.
+  * @param  ramp: ramp generator.
+  * @param  target: level to reach.
+  * @param  frames: block length.
+  * @param  pStep: level change per frame.
+  * @retval Number of frames of the block still on the ramp.
+  */
+static uint32_t RAMP_Span(const AUDIO_RampTypeDef *ramp, int32_t target,
+                          uint32_t frames, int32_t *pStep)
+{
+  int32_t dist = target - ramp->level;
+  uint32_t n;
+
+  if (dist < 0)
+  {
+    dist = -dist;
+    *pStep = -ramp->step;
+  }
+  else
+  {
+    *pStep = ramp->step;
+  }
+
+  n = (uint32_t)((dist + ramp->step - 1) / ramp->step);
+  return (n < frames) ? n : frames;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Resets the ramp generator at a level, with no ramp in progress.
+  * @param  ramp: ramp generator.
+  * @param  frames: length of a full ramp in frames.
+  * @param  shape: AUDIO_RAMP_LINEAR or AUDIO_RAMP_COSINE.
+  * @param  level: 0 to start silent, AUDIO_RAMP_UNITY to start untouched.
+  * @retval None
+  */
+void Audio_Ramp_Init(AUDIO_RampTypeDef *ramp, uint32_t frames, uint8_t shape,
+                     int32_t level)
+{
+  ramp->shape = shape;
+  ramp->level = level;
+  ramp->target = level;
+  Audio_Ramp_SetLength(ramp, frames);
+}
+
+/**
+  * @brief  Sets the length of a full ramp, for the sampling frequency of a
+  *         new format.
+  * @param  ramp: ramp generator.
+  * @param  frames: length of a full ramp in frames.
+  * @retval None
+  */
+void Audio_Ramp_SetLength(AUDIO_RampTypeDef *ramp, uint32_t frames)
+{
+  if (frames == 0)
+  {
+    frames = 1;
+  }
+  ramp->step = (AUDIO_RAMP_UNITY + (int32_t)frames - 1) / (int32_t)frames;
+}
+
+/**
+  * @brief  Starts a ramp from the current level. May be called from an
+  *         interrupt: the ramp starts on the next block processed.
+  * @param  ramp: ramp generator.
+  * @param  target: 0 to fade out and hold silence, AUDIO_RAMP_UNITY to fade
+  *         in.
+  * @retval None
+  */
+void Audio_Ramp_Start(AUDIO_RampTypeDef *ramp, int32_t target)
+{
+  ramp->target = (target != 0) ? AUDIO_RAMP_UNITY : 0;
+}
+
+/**
+  * @brief  Tells whether the last ramp started is over.
+  * @param  ramp: ramp generator.
+  * @retval 1 once the target level has been reached, 0 before.
+  */
+uint32_t Audio_Ramp_Done(const AUDIO_RampTypeDef *ramp)
+{
+  return (ramp->level == ramp->target) ? 1 : 0;
+}
+
+/**
+  * @brief  Converts a ramp level into a gain of the given shape, for stages
+  *         running their own envelope.
+  * @param  shape: AUDIO_RAMP_LINEAR or AUDIO_RAMP_COSINE.
+  * @param  level: level in Q16, from 0 to AUDIO_RAMP_UNITY.
+  * @retval Gain in Q16.
+  */
+int32_t Audio_Ramp_Curve(uint8_t shape, int32_t level)
+{
+  return (shape == AUDIO_RAMP_COSINE) ? RAMP_Cosine(level) : level;
+}
+
+/**
+  * @brief  Applies the ramp to a block of interleaved 16-bit stereo frames.
+  * @param  ramp: ramp generator.
+  * @param  pBuf: frames, processed in place. Must be 32-bit aligned.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Ramp_Process(AUDIO_RampTypeDef *ramp, int16_t *pBuf, uint32_t frames)
+{
+  uint32_t *pframe = (uint32_t*)pBuf;
+  int32_t target = ramp->target;
+  int32_t level = ramp->level;
+  int32_t step, gain;
+  uint32_t x, i, n;
+
+  if (level != target)
+  {
+    n = RAMP_Span(ramp, target, frames, &step);
+
+    if (ramp->shape == AUDIO_RAMP_COSINE)
+    {
+      for (i = 0; i < n; i++)
+      {
+        gain = RAMP_Cosine(level);
+        x = pframe[i];
+        pframe[i] = AUDIO_DSP_PACK(AUDIO_DSP_SMULWB(gain, x), AUDIO_DSP_SMULWT(gain, x));
+        level += step;
+      }
+    }
+    else
+    {
+      for (i = 0; i < n; i++)
+      {
+        x = pframe[i];
+        pframe[i] = AUDIO_DSP_PACK(AUDIO_DSP_SMULWB(level, x), AUDIO_DSP_SMULWT(level, x));
+        level += step;
+      }
+    }
+
+    /* The last step may overshoot the target */
+    if (((step > 0) && (level > target)) || ((step < 0) && (level < target)))
+    {
+      level = target;
+    }
+    ramp->level = level;
+    pframe += n;
+    frames -= n;
+  }
+
+  /* Hold: silence after a fade out, untouched after a fade in */
+  if ((level == 0) && (frames != 0))
+  {
+    memset(pframe, 0, frames * sizeof(uint32_t));
+  }
+}
+
+/**
+  * @brief  Same as Audio_Ramp_Process() for 32-bit samples.
+  * @param  ramp: ramp generator.
+  * @param  pBuf: frames, processed in place.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Ramp_Process32(AUDIO_RampTypeDef *ramp, int32_t *pBuf, uint32_t frames)
+{
+  int32_t target = ramp->target;
+  int32_t level = ramp->level;
+  int32_t step, gain;
+  uint32_t i, n;
+
+  if (level != target)
+  {
+    n = RAMP_Span(ramp, target, frames, &step);
+
+    for (i = 0; i < n; i++)
+    {
+      gain = Audio_Ramp_Curve(ramp->shape, level);
+      pBuf[0] = (int32_t)(((int64_t)pBuf[0] * gain) >> 16);
+      pBuf[1] = (int32_t)(((int64_t)pBuf[1] * gain) >> 16);
+      pBuf += 2;
+      level += step;
+    }
+
+    if (((step > 0) && (level > target)) || ((step < 0) && (level < target)))
+    {
+      level = target;
+    }
+    ramp->level = level;
+    frames -= n;
+  }
+
+  if ((level == 0) && (frames != 0))
+  {
+    memset(pBuf, 0, frames * 2 * sizeof(int32_t));
+  }
+}
@@ -0,0 +1,42 @@
+/**
+  ******************************************************************************
+  * @file    audio_ramp.h
+  * @brief   Header file for the audio_ramp.c gain ramp generator.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_RAMP_H
+#define __AUDIO_RAMP_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Ramp shapes */
+#define AUDIO_RAMP_LINEAR               0
+#define AUDIO_RAMP_COSINE               1      /* Raised cosine */
+
+/* Ramp level and gain in Q16: 1.0 */
+#define AUDIO_RAMP_UNITY                ((int32_t)1 << 16)
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  int32_t          level;       /* Position along the ramp (Q16) */
+  int32_t          step;        /* Level change per frame (Q16) */
+  volatile int32_t target;      /* Level to reach: 0 or AUDIO_RAMP_UNITY */
+  uint8_t          shape;       /* AUDIO_RAMP_LINEAR or AUDIO_RAMP_COSINE */
+} AUDIO_RampTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void     Audio_Ramp_Init(AUDIO_RampTypeDef *ramp, uint32_t frames, uint8_t shape,
+                         int32_t level);
+void     Audio_Ramp_SetLength(AUDIO_RampTypeDef *ramp, uint32_t frames);
+void     Audio_Ramp_Start(AUDIO_RampTypeDef *ramp, int32_t target);
+uint32_t Audio_Ramp_Done(const AUDIO_RampTypeDef *ramp);
+int32_t  Audio_Ramp_Curve(uint8_t shape, int32_t level);
+void     Audio_Ramp_Process(AUDIO_RampTypeDef *ramp, int16_t *pBuf, uint32_t frames);
+void     Audio_Ramp_Process32(AUDIO_RampTypeDef *ramp, int32_t *pBuf, uint32_t frames);
+
+#endif /* __AUDIO_RAMP_H */
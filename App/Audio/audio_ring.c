@@ -0,0 +1,250 @@
+/**
+  ******************************************************************************
+  * @file    audio_ring.c
+  * @brief   Lock-free single-producer single-consumer byte ring.
+  *
+  *          The producer (packets queued from the USB OUT endpoint) and the
+  *          consumer (render of the next I2S DMA half) both run in the audio
+  *          task today; the ring does not rely on it. Each side owns one
+  *          free running byte counter: head for the producer and tail for
+  *          the consumer. The ring size is a power of two, so the counters
+  *          wrap naturally and a position in the buffer is the counter
+  *          masked by size - 1.
+  *
+  *          A side publishes its counter only after a memory barrier, so
+  *          the ring stays safe with the two sides in different contexts:
+  *          the other side never sees a counter ahead of the data it covers
+  *          (or of the reads that freed the room).
+  *
+  *          The ring also keeps the telemetry needed to size the jitter
+  *          buffer: lowest and highest fill, overrun and underrun counts and
+  *          a histogram of the fill level seen by the consumer.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "audio_ring.h"
+#if defined(ARM_MATH_CM4)
+#include "stm32f4xx.h"
+#endif
+
+/* Private macro -------------------------------------------------------------*/
+#if defined(ARM_MATH_CM4)
+#define RING_BARRIER()                  __DMB()
+#else
+#define RING_BARRIER()                  __sync_synchronize()
+#endif
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Rounds a size up to a valid ring size.
+  * @param  size: minimum size in bytes.
+  * @retval Smallest power of two >= size and >= AUDIO_RING_SIZE_MIN.
+  */
+uint32_t Audio_Ring_RoundUp(uint32_t size)
+{
+  uint32_t pow2 = AUDIO_RING_SIZE_MIN;
+
+  while (pow2 < size)
+  {
+    pow2 <<= 1;
+  }
+  return pow2;
+}
+
+/**
+  * @brief  Attaches a buffer to the ring and empties it.
+  * @param  ring: ring state.
+  * @param  buffer: storage of at least size bytes.
+  * @param  size: ring size, a power of two >= AUDIO_RING_SIZE_MIN.
+  * @retval 0 if OK, 1 if the size is not valid.
+  */
+uint32_t Audio_Ring_Init(AUDIO_RingTypeDef *ring, uint8_t *buffer, uint32_t size)
+{
+  uint32_t shift = 0;
+
+  if ((size < AUDIO_RING_SIZE_MIN) || ((size & (size - 1)) != 0))
+  {
+    return 1;
+  }
+
+  while ((AUDIO_RING_HIST_BINS << shift) < size)
+  {
+    shift++;
+  }
+
+  ring->buffer = buffer;
+  ring->size = size;
+  ring->mask = size - 1;
+  ring->histShift = shift;
+  ring->head = 0;
+  ring->tail = 0;
+  Audio_Ring_ClearStats(ring);
+
+  return 0;
+}
+
+/**
+  * @brief  Clears the telemetry. Neither side may run concurrently.
+  * @param  ring: ring state.
+  * @retval None
+  */
+void Audio_Ring_ClearStats(AUDIO_RingTypeDef *ring)
+{
+  uint32_t i;
+
+  ring->maxFill = 0;
+  ring->overruns = 0;
+  ring->minFill = ring->size;
+  ring->underruns = 0;
+  for (i = 0; i < AUDIO_RING_HIST_BINS; i++)
+  {
+    ring->histogram[i] = 0;
+  }
+}
+
+/**
+  * @brief  Number of bytes written and not consumed yet.
+  * @param  ring: ring state.
+  * @retval Fill level in bytes.
+  */
+uint32_t Audio_Ring_Fill(AUDIO_RingTypeDef *ring)
+{
+  return ring->head - ring->tail;
+}
+
+/**
+  * @brief  Number of bytes that can be written.
+  * @param  ring: ring state.
+  * @retval Free room in bytes.
+  */
+uint32_t Audio_Ring_Space(AUDIO_RingTypeDef *ring)
+{
+  return ring->size - (ring->head - ring->tail);
+}
+
+/**
+  * @brief  Appends a block to the ring, or drops it entirely if it does not
+  *         fit. Producer side only.
+  * @param  ring: ring state.
+  * @param  pSrc: bytes to write.
+  * @param  len: number of bytes.
+  * @retval Number of bytes written: len or 0.
+  */
+uint32_t Audio_Ring_Write(AUDIO_RingTypeDef *ring, const uint8_t *pSrc, uint32_t len)
+{
+  uint32_t head = ring->head;
+  uint32_t tail = ring->tail;
+  uint32_t offset, chunk, fill;
+
+  if ((ring->size - (head - tail)) < len)
+  {
+    ring->overruns++;
+    return 0;
+  }
+
+  /* The room has been freed before tail was published */
+  RING_BARRIER();
+
+  offset = head & ring->mask;
+  chunk = ring->size - offset;
+  if (chunk > len)
+  {
+    chunk = len;
+  }
+  memcpy(ring->buffer + offset, pSrc, chunk);
+  memcpy(ring->buffer, pSrc + chunk, len - chunk);
+
+  /* Publish the data before the new head */
+  RING_BARRIER();
+  ring->head = head + len;
+
+  fill = (head + len) - tail;
+  if (fill > ring->maxFill)
+  {
+    ring->maxFill = fill;
+  }
+  return len;
+}
+
+/**
+  * @brief  Gives the readable bytes that are contiguous in the buffer.
+  *         Consumer side only.
+  * @param  ring: ring state.
+  * @param  pLen: number of contiguous bytes readable at the returned address.
+  * @retval Read address.
+  */
+uint8_t *Audio_Ring_Peek(AUDIO_RingTypeDef *ring, uint32_t *pLen)
+{
+  uint32_t tail = ring->tail;
+  uint32_t fill = ring->head - tail;
+  uint32_t offset = tail & ring->mask;
+
+  /* Do not read the data before head covers it */
+  RING_BARRIER();
+
+  if (fill > (ring->size - offset))
+  {
+    fill = ring->size - offset;
+  }
+  *pLen = fill;
+  return ring->buffer + offset;
+}
+
+/**
+  * @brief  Releases bytes read through Audio_Ring_Peek(). Consumer side only.
+  * @param  ring: ring state.
+  * @param  len: number of bytes, at most the fill level.
+  * @retval None
+  */
+void Audio_Ring_Consume(AUDIO_RingTypeDef *ring, uint32_t len)
+{
+  /* Finish reading before the producer may overwrite the bytes */
+  RING_BARRIER();
+  ring->tail += len;
+}
+
+/**
+  * @brief  Drops every byte written so far. Consumer side only.
+  * @param  ring: ring state.
+  * @retval None
+  */
+void Audio_Ring_Flush(AUDIO_RingTypeDef *ring)
+{
+  RING_BARRIER();
+  ring->tail = ring->head;
+}
+
+/**
+  * @brief  Records the current fill level in the consumer telemetry. Call
+  *         once per consumed block, before reading it.
+  * @param  ring: ring state.
+  * @retval None
+  */
+void Audio_Ring_Probe(AUDIO_RingTypeDef *ring)
+{
+  uint32_t fill = ring->head - ring->tail;
+  uint32_t bin = fill >> ring->histShift;
+
+  if (fill < ring->minFill)
+  {
+    ring->minFill = fill;
+  }
+  if (bin >= AUDIO_RING_HIST_BINS)
+  {
+    bin = AUDIO_RING_HIST_BINS - 1;
+  }
+  ring->histogram[bin]++;
+}
+
+/**
+  * @brief  Counts a block that could not be read entirely. Consumer side only.
+  * @param  ring: ring state.
+  * @retval None
+  */
+void Audio_Ring_Underrun(AUDIO_RingTypeDef *ring)
+{
+  ring->underruns++;
+}
@@ -0,0 +1,61 @@
+/**
+  ******************************************************************************
+  * @file    audio_ring.h
+  * @brief   Header file for the audio_ring.c single-producer single-consumer
+  *          byte ring.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_RING_H
+#define __AUDIO_RING_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Number of bins of the fill level histogram, each covering size/16 bytes */
+#define AUDIO_RING_HIST_BINS            16U
+
+/* Smallest ring size */
+#define AUDIO_RING_SIZE_MIN             AUDIO_RING_HIST_BINS
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint8_t           *buffer;    /* Storage, size bytes */
+  uint32_t          size;       /* Power of two */
+  uint32_t          mask;       /* size - 1 */
+  uint32_t          histShift;  /* Fill to histogram bin */
+
+  /* Free running byte counts: only the producer writes head, only the
+     consumer writes tail. Their difference is the fill level. */
+  volatile uint32_t head;
+  volatile uint32_t tail;
+
+  /* Telemetry, each field written from one side only */
+  volatile uint32_t maxFill;    /* Producer: highest fill after a write */
+  volatile uint32_t overruns;   /* Producer: writes dropped for lack of room */
+  volatile uint32_t minFill;    /* Consumer: lowest fill seen by Audio_Ring_Probe() */
+  volatile uint32_t underruns;  /* Consumer: reads that found too few bytes */
+  volatile uint32_t histogram[AUDIO_RING_HIST_BINS]; /* Consumer */
+} AUDIO_RingTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+uint32_t Audio_Ring_RoundUp(uint32_t size);
+uint32_t Audio_Ring_Init(AUDIO_RingTypeDef *ring, uint8_t *buffer, uint32_t size);
+void     Audio_Ring_ClearStats(AUDIO_RingTypeDef *ring);
+uint32_t Audio_Ring_Fill(AUDIO_RingTypeDef *ring);
+uint32_t Audio_Ring_Space(AUDIO_RingTypeDef *ring);
+
+/* Producer side */
+uint32_t Audio_Ring_Write(AUDIO_RingTypeDef *ring, const uint8_t *pSrc, uint32_t len);
+
+/* Consumer side */
+uint8_t *Audio_Ring_Peek(AUDIO_RingTypeDef *ring, uint32_t *pLen);
+void     Audio_Ring_Consume(AUDIO_RingTypeDef *ring, uint32_t len);
+void     Audio_Ring_Flush(AUDIO_RingTypeDef *ring);
+void     Audio_Ring_Probe(AUDIO_RingTypeDef *ring);
+void     Audio_Ring_Underrun(AUDIO_RingTypeDef *ring);
+
+#endif /* __AUDIO_RING_H */
@@ -0,0 +1,239 @@
+/**
+  ******************************************************************************
+  * @file    audio_verify.c
+  * @brief   Bit-exact verification of the audio stream.
+  *
+  *          Each packet queued into the stream is given a sequence number and
+  *          the CRC32 of its samples as received from the host. The samples
+  *          handed to the DMA are gathered back into the same packets, by
+  *          stream byte offset, and their CRC32 compared with the one of the
+  *          packet. Mismatches are counted and the last AUDIO_VERIFY_LOG of
+  *          them kept with their sequence numbers.
+  *
+  *          Packets received but not queued (overruns) and packets missed
+  *          by the device only advance the sequence number; the samples
+  *          synthesized in place of the latter are skipped. Samples that do
+  *          not come from the stream, like the underrun concealment, are not
+  *          handed to the verification.
+  *
+  *          The CRC32 is the one of the STM32 CRC unit: polynomial 0x04C11DB7
+  *          over 32-bit words, most significant bit first, initial value
+  *          0xFFFFFFFF, no final inversion. The hardware unit is used when
+  *          ARM_MATH_CM4 is defined, a bitwise software version otherwise so
+  *          that the file can be compiled on a host. The hardware unit is
+  *          not shared: all the functions must be called from one context.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "audio_verify.h"
+#if defined(ARM_MATH_CM4)
+#include "stm32f4xx.h"
+#endif
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Compares the output samples of the packet at the tail with the
+  *         packet as received, and releases it.
+  * @param  verify: verification state.
+  * @retval None
+  */
+static void VERIFY_Check(AUDIO_VerifyTypeDef *verify)
+{
+  AUDIO_VerifyPacketTypeDef *p = &verify->pkt[verify->tail % AUDIO_VERIFY_PACKETS];
+  AUDIO_VerifyMismatchTypeDef *m;
+  uint32_t crc;
+
+  crc = Audio_Verify_Crc32(verify->out, verify->outLen / 4);
+  if (crc == p->crc)
+  {
+    verify->verified++;
+  }
+  else
+  {
+    m = &verify->log[verify->mismatches % AUDIO_VERIFY_LOG];
+    m->seq = p->seq;
+    m->expected = p->crc;
+    m->actual = crc;
+    verify->mismatches++;
+  }
+
+  verify->outLen = 0;
+  verify->tail++;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Initializes the verification, and the CRC unit.
+  * @param  verify: verification state.
+  * @retval None
+  */
+void Audio_Verify_Init(AUDIO_VerifyTypeDef *verify)
+{
+#if defined(ARM_MATH_CM4)
+  RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_CRC, ENABLE);
+#endif
+
+  memset(verify, 0, sizeof(*verify));
+}
+
+/**
+  * @brief  Forgets the packets in flight: the stream has been emptied. The
+  *         sequence numbers and the results are kept.
+  * @param  verify: verification state.
+  * @retval None
+  */
+void Audio_Verify_Flush(AUDIO_VerifyTypeDef *verify)
+{
+  verify->untracked += verify->head - verify->tail;
+  verify->tail = verify->head;
+  verify->inOffset = 0;
+  verify->outOffset = 0;
+  verify->outLen = 0;
+}
+
+/**
+  * @brief  Records a packet queued into the stream.
+  * @param  verify: verification state.
+  * @param  pPacket: packet as received, 4-byte aligned.
+  * @param  len: packet length in bytes, a multiple of 4.
+  * @retval None
+  */
+void Audio_Verify_Input(AUDIO_VerifyTypeDef *verify, const uint8_t *pPacket,
+                        uint32_t len)
+{
+  AUDIO_VerifyPacketTypeDef *p;
+
+  if (((verify->head - verify->tail) < AUDIO_VERIFY_PACKETS) &&
+      (len != 0) && (len <= AUDIO_VERIFY_PACKET_MAX) && ((len % 4) == 0))
+  {
+    p = &verify->pkt[verify->head % AUDIO_VERIFY_PACKETS];
+    p->seq = verify->seq;
+    p->offset = verify->inOffset;
+    p->len = len;
+    p->crc = Audio_Verify_Crc32((const uint32_t*)pPacket, len / 4);
+    verify->head++;
+  }
+  else if (len != 0)
+  {
+    verify->untracked++;
+  }
+
+  verify->seq++;
+  verify->inOffset += len;
+}
+
+/**
+  * @brief  Records a packet received but not queued into the stream.
+  * @param  verify: verification state.
+  * @retval None
+  */
+void Audio_Verify_Drop(AUDIO_VerifyTypeDef *verify)
+{
+  verify->dropped++;
+  verify->seq++;
+}
+
+/**
+  * @brief  Records a packet missed by the device.
+  * @param  verify: verification state.
+  * @param  len: length in bytes synthesized into the stream in its place,
+  *         0 if none.
+  * @retval None
+  */
+void Audio_Verify_Missing(AUDIO_VerifyTypeDef *verify, uint32_t len)
+{
+  verify->missed++;
+  verify->seq++;
+  verify->inOffset += len;
+}
+
+/**
+  * @brief  Verifies stream samples handed to the DMA, in stream order.
+  * @param  verify: verification state.
+  * @param  pData: samples, 4-byte aligned.
+  * @param  len: length in bytes, a multiple of 4.
+  * @param  swapped: 1 if the half-words of each word have been swapped for
+  *         the DMA, 0 otherwise.
+  * @retval None
+  */
+void Audio_Verify_Output(AUDIO_VerifyTypeDef *verify, const uint8_t *pData,
+                         uint32_t len, uint32_t swapped)
+{
+  const uint32_t *pword = (const uint32_t*)pData;
+  AUDIO_VerifyPacketTypeDef *p;
+  uint32_t skip, n, i, w;
+
+  while (len != 0)
+  {
+    if (verify->tail == verify->head)
+    {/* Samples of untracked or synthesized packets */
+      verify->outOffset += len;
+      return;
+    }
+    p = &verify->pkt[verify->tail % AUDIO_VERIFY_PACKETS];
+
+    /* Skip up to the packet */
+    skip = p->offset - verify->outOffset;
+    if ((int32_t)skip > 0)
+    {
+      n = (skip < len) ? skip : len;
+      pword += n / 4;
+      len -= n;
+      verify->outOffset += n;
+      continue;
+    }
+
+    /* Gather its samples, back in the host layout */
+    n = p->len - verify->outLen;
+    if (n > len)
+    {
+      n = len;
+    }
+    for (i = 0; i < (n / 4); i++)
+    {
+      w = pword[i];
+      verify->out[(verify->outLen / 4) + i] = swapped ? ((w << 16) | (w >> 16)) : w;
+    }
+    pword += n / 4;
+    len -= n;
+    verify->outOffset += n;
+    verify->outLen += n;
+
+    if (verify->outLen == p->len)
+    {
+      VERIFY_Check(verify);
+    }
+  }
+}
+
+/**
+  * @brief  Computes the CRC32 of a block of words.
+  * @param  pData: words.
+  * @param  words: number of words.
+  * @retval CRC32.
+  */
+uint32_t Audio_Verify_Crc32(const uint32_t *pData, uint32_t words)
+{
+#if defined(ARM_MATH_CM4)
+  CRC_ResetDR();
+  return CRC_CalcBlockCRC((uint32_t*)pData, words);
+#else
+  uint32_t crc = 0xFFFFFFFF;
+  uint32_t i, bit;
+
+  for (i = 0; i < words; i++)
+  {
+    crc ^= pData[i];
+    for (bit = 0; bit < 32; bit++)
+    {
+      crc = (crc & 0x80000000) ? ((crc << 1) ^ 0x04C11DB7) : (crc << 1);
+    }
+  }
+
+  return crc;
+#endif
+}
@@ -0,0 +1,75 @@
+/**
+  ******************************************************************************
+  * @file    audio_verify.h
+  * @brief   Header file for the audio_verify.c bit-exact stream verification.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_VERIFY_H
+#define __AUDIO_VERIFY_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Packets tracked between the input and the output of the stream */
+#define AUDIO_VERIFY_PACKETS            64
+
+/* Largest packet verified, in bytes (multiple of 4) */
+#define AUDIO_VERIFY_PACKET_MAX         2048
+
+/* Last mismatches kept */
+#define AUDIO_VERIFY_LOG                8
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t seq;                 /* Sequence number of the packet */
+  uint32_t offset;              /* Stream byte offset of its first sample */
+  uint32_t len;                 /* Length in bytes */
+  uint32_t crc;                 /* CRC32 of the packet as received */
+} AUDIO_VerifyPacketTypeDef;
+
+typedef struct
+{
+  uint32_t seq;                 /* Sequence number of the packet */
+  uint32_t expected;            /* CRC32 of the packet as received */
+  uint32_t actual;              /* CRC32 of the samples handed to the DMA */
+} AUDIO_VerifyMismatchTypeDef;
+
+typedef struct
+{
+  /* Packets queued into the stream, from tail to head */
+  AUDIO_VerifyPacketTypeDef pkt[AUDIO_VERIFY_PACKETS];
+  uint32_t head;
+  uint32_t tail;
+  uint32_t seq;                 /* Sequence number of the next packet */
+  uint32_t inOffset;            /* Stream bytes queued */
+  uint32_t outOffset;           /* Stream bytes handed to the DMA */
+
+  /* Output samples of the packet at the tail */
+  uint32_t out[AUDIO_VERIFY_PACKET_MAX / 4];
+  uint32_t outLen;
+
+  /* Results */
+  uint32_t verified;            /* Packets identical at both ends */
+  uint32_t mismatches;          /* Packets altered on the way */
+  uint32_t dropped;             /* Packets received but not queued */
+  uint32_t missed;              /* Packets missed by the device */
+  uint32_t untracked;           /* Packets queued but not verified */
+  AUDIO_VerifyMismatchTypeDef log[AUDIO_VERIFY_LOG];
+} AUDIO_VerifyTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void     Audio_Verify_Init(AUDIO_VerifyTypeDef *verify);
+void     Audio_Verify_Flush(AUDIO_VerifyTypeDef *verify);
+void     Audio_Verify_Input(AUDIO_VerifyTypeDef *verify, const uint8_t *pPacket,
+                            uint32_t len);
+void     Audio_Verify_Drop(AUDIO_VerifyTypeDef *verify);
+void     Audio_Verify_Missing(AUDIO_VerifyTypeDef *verify, uint32_t len);
+void     Audio_Verify_Output(AUDIO_VerifyTypeDef *verify, const uint8_t *pData,
+                             uint32_t len, uint32_t swapped);
+uint32_t Audio_Verify_Crc32(const uint32_t *pData, uint32_t words);
+
+#endif /* __AUDIO_VERIFY_H */
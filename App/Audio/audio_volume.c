@@ -0,0 +1,369 @@
+/**
+  ******************************************************************************
+  * @file    audio_volume.c
+  * @brief   Digital volume and mute stage applied to the rendered samples.
+  *
+  *          The host volume (1/256 dB) is converted once into a linear Q16
+  *          gain. The gain moves linearly from its previous value to the new
+  *          target over the ramp length, whatever the block length, so that
+  *          a volume step or a mute never produces a discontinuity. Once the
+  *          target is reached the gain is constant, and at 0 dB without mute
+  *          the samples are left untouched.
+  *
+  *          16-bit frames are processed as one 32-bit word per stereo frame:
+  *          SMULWB/SMULWT scale the two half-words with a 32-bit gain, and for
+  *          gains above unity the half gain is applied then doubled with
+  *          QADD16, which saturates both channels in one instruction.
+  *          32-bit samples, which carry the Q27 media chain, go through
+  *          SMULL, saturated with a single SSAT test of the high word only
+  *          when the gain is above unity. Each block runs the ramp frames
+  *          first, then a loop at the constant target gain.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "audio_volume.h"
+#include "audio_dsp.h"
+
+/* Private define ------------------------------------------------------------*/
+/* Gains are looked up in 1/64 octave steps (~0.094 dB) */
+#define VOLUME_EXP2_STEPS               64
+
+/* 1/256 dB to 1/64 octave: 64 / (256 * 20 * log10(2)) in Q20 */
+#define VOLUME_DB_TO_EXP2               43541
+
+/* Below this attenuation in octaves the Q16 gain is 0 */
+#define VOLUME_OCTAVE_MAX               17
+
+/* Private variables ---------------------------------------------------------*/
+/* 2^(-i/64) in Q16 */
+static const uint32_t VOLUME_Exp2Table[VOLUME_EXP2_STEPS] =
+{
+  65536, 64830, 64132, 63441, 62757, 62081, 61413, 60751,
+  60097, 59449, 58809, 58176, 57549, 56929, 56316, 55709,
+  55109, 54515, 53928, 53347, 52773, 52204, 51642, 51085,
+  50535, 49991, 49452, 48920, 48393, 47871, 47356, 46846,
+  46341, 45842, 45348, 44859, 44376, 43898, 43425, 42958,
+  42495, 42037, 41584, 41136, 40693, 40255, 39821, 39392,
+  38968, 38548, 38133, 37722, 37316, 36914, 36516, 36123,
+  35734, 35349, 34968, 34591, 34219, 33850, 33486, 33125,
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+#if defined(ARM_MATH_CM4)
+/**
+  * @brief  (x * gain) >> 16 saturated to 32 bits: SMULL, the result fitting
+  *         when SSAT leaves the high word of the product on 16 bits.
+  */
+static inline int32_t VOLUME_MUL32(int32_t x, int32_t gain)
+{
+  int32_t lo, hi;
+
+  __ASM ("smull %0, %1, %2, %3" : "=&r" (lo), "=&r" (hi) : "r" (x), "r" (gain));
+  if (AUDIO_DSP_SSAT(hi, 16) != hi)
+  {
+    return (hi >> 31) ^ INT32_MAX;
+  }
+  return (int32_t)(((uint32_t)hi << 16) | ((uint32_t)lo >> 16));
+}
+
+#else
+
+static inline int32_t VOLUME_MUL32(int32_t x, int32_t gain)
+{
+  int64_t y = ((int64_t)x * gain) >> 16;
+
+  if ((int32_t)y != y)
+  {
+    y = (y >> 63) ^ INT32_MAX;
+  }
+  return (int32_t)y;
+}
+#endif /* ARM_MATH_CM4 */
+
+/**
+  * @brief  Converts a volume in 1/256 dB into a linear gain.
+  * @param  volume: volume in 1/256 dB, at most AUDIO_VOLUME_MAX.
+  * @retval Gain in Q16.
+  */
+static int32_t VOLUME_DbToGain(int16_t volume)
+{
+  int32_t steps, octave;
+
+  if (volume < AUDIO_VOLUME_MIN)
+  {
+    return 0;
+  }
+
+  /* Attenuation in 1/64 octave, rounded */
+  steps = ((-(int32_t)volume * VOLUME_DB_TO_EXP2) + (1 << 19)) >> 20;
+  octave = steps >> 6;
+
+  if (octave >= VOLUME_OCTAVE_MAX)
+  {
+    return 0;
+  }
+  if (octave < 0)
+  {
+    return (int32_t)(VOLUME_Exp2Table[steps & (VOLUME_EXP2_STEPS - 1)] << -octave);
+  }
+  return (int32_t)(VOLUME_Exp2Table[steps & (VOLUME_EXP2_STEPS - 1)] >> octave);
+}
+
+/**
+  * @brief  Starts a new ramp when the target has changed, and returns the
+  *         number of frames of the block on it.
+  * @param  vol: volume stage.
+  * @param  target: target gain read for this block.
+  * @param  frames: block length.
+  * @retval Number of frames of the block still on the ramp.
+  */
+static uint32_t VOLUME_Ramp(AUDIO_VolumeTypeDef *vol, int32_t target, uint32_t frames)
+{
+  int32_t dist;
+  uint32_t n;
+
+  if (target != vol->rampTarget)
+  {
+    vol->rampTarget = target;
+    vol->step = (target - vol->gain) / (int32_t)vol->rampFrames;
+    if (vol->step == 0)
+    {
+      vol->step = (target > vol->gain) ? 1 : -1;
+    }
+  }
+
+  if (target == vol->gain)
+  {
+    return 0;
+  }
+  dist = (target - vol->gain) / vol->step;
+  if (((target - vol->gain) % vol->step) != 0)
+  {
+    dist++;
+  }
+  n = (uint32_t)dist;
+  return (n < frames) ? n : frames;
+}
+
+/**
+  * @brief  Moves the gain one frame along the ramp, the last step stopping
+  *         on the target.
+  * @param  gain: current gain (Q16).
+  * @param  step: gain change per frame (Q16).
+  * @param  target: gain at the end of the ramp (Q16).
+  * @retval New gain (Q16).
+  */
+static inline int32_t VOLUME_Step(int32_t gain, int32_t step, int32_t target)
+{
+  gain += step;
+  if (((step > 0) && (gain > target)) || ((step < 0) && (gain < target)))
+  {
+    gain = target;
+  }
+  return gain;
+}
+
+/**
+  * @brief  Updates the target gain from the volume and mute settings.
+  * @param  vol: volume stage.
+  * @retval None
+  */
+static void VOLUME_Update(AUDIO_VolumeTypeDef *vol)
+{
+  vol->target = vol->mute ? 0 : VOLUME_DbToGain(vol->volume);
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Resets the stage to 0 dB, not muted.
+  * @param  vol: volume stage.
+  * @retval None
+  */
+void Audio_Volume_Init(AUDIO_VolumeTypeDef *vol)
+{
+  vol->volume = 0;
+  vol->mute = 0;
+  vol->gain = AUDIO_VOLUME_UNITY;
+  vol->target = AUDIO_VOLUME_UNITY;
+  vol->rampTarget = AUDIO_VOLUME_UNITY;
+  vol->step = 0;
+  if (vol->rampFrames == 0)
+  {
+    vol->rampFrames = 1;
+  }
+}
+
+/**
+  * @brief  Sets the length of the gain changes, for the sampling frequency
+  *         of a new format. Takes effect on the next change.
+  * @param  vol: volume stage.
+  * @param  frames: length of a gain change in frames.
+  * @retval None
+  */
+void Audio_Volume_SetRamp(AUDIO_VolumeTypeDef *vol, uint32_t frames)
+{
+  vol->rampFrames = (frames != 0) ? frames : 1;
+}
+
+/**
+  * @brief  Sets the volume. The new gain is reached over the ramp length.
+  * @param  vol: volume stage.
+  * @param  volume: volume in 1/256 dB, clamped to the supported range.
+  *         AUDIO_VOLUME_SILENCE gives a null gain.
+  * @retval None
+  */
+void Audio_Volume_Set(AUDIO_VolumeTypeDef *vol, int16_t volume)
+{
+  if (volume > AUDIO_VOLUME_MAX)
+  {
+    volume = AUDIO_VOLUME_MAX;
+  }
+  else if ((volume < AUDIO_VOLUME_MIN) && (volume != AUDIO_VOLUME_SILENCE))
+  {
+    volume = AUDIO_VOLUME_MIN;
+  }
+
+  vol->volume = volume;
+  VOLUME_Update(vol);
+}
+
+/**
+  * @brief  Mutes or unmutes the stage. The gain fades over the ramp length.
+  * @param  vol: volume stage.
+  * @param  mute: 0 to unmute, any other value to mute.
+  * @retval None
+  */
+void Audio_Volume_Mute(AUDIO_VolumeTypeDef *vol, uint8_t mute)
+{
+  vol->mute = mute ? 1 : 0;
+  VOLUME_Update(vol);
+}
+
+/**
+  * @brief  Applies the gain to a block of interleaved 16-bit stereo frames.
+  * @param  vol: volume stage.
+  * @param  pBuf: frames, processed in place. Must be 32-bit aligned.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Volume_Process(AUDIO_VolumeTypeDef *vol, int16_t *pBuf, uint32_t frames)
+{
+  uint32_t *pframe = (uint32_t*)pBuf;
+  int32_t target = vol->target;
+  int32_t gain = vol->gain;
+  int32_t step;
+  uint32_t x, i, n;
+
+  if ((gain == AUDIO_VOLUME_UNITY) && (target == AUDIO_VOLUME_UNITY))
+  {
+    return;
+  }
+
+  /* The gain moves for the first n frames, then stays at the target */
+  n = VOLUME_Ramp(vol, target, frames);
+  step = vol->step;
+
+  if ((gain <= AUDIO_VOLUME_UNITY) && (target <= AUDIO_VOLUME_UNITY))
+  {
+    /* Attenuation: the result always fits in 16 bits */
+    for (i = 0; i < n; i++)
+    {
+      x = pframe[i];
+      pframe[i] = AUDIO_DSP_PACK(AUDIO_DSP_SMULWB(gain, x), AUDIO_DSP_SMULWT(gain, x));
+      gain = VOLUME_Step(gain, step, target);
+    }
+    if (gain != AUDIO_VOLUME_UNITY)
+    {
+      for (; i < frames; i++)
+      {
+        x = pframe[i];
+        pframe[i] = AUDIO_DSP_PACK(AUDIO_DSP_SMULWB(gain, x), AUDIO_DSP_SMULWT(gain, x));
+      }
+    }
+  }
+  else
+  {
+    /* Boost: apply half the gain, then double both channels with saturation */
+    for (i = 0; i < n; i++)
+    {
+      x = pframe[i];
+      x = AUDIO_DSP_PACK(AUDIO_DSP_SMULWB(gain >> 1, x), AUDIO_DSP_SMULWT(gain >> 1, x));
+      pframe[i] = AUDIO_DSP_QADD16(x, x);
+      gain = VOLUME_Step(gain, step, target);
+    }
+    step = gain >> 1;
+    for (; i < frames; i++)
+    {
+      x = pframe[i];
+      x = AUDIO_DSP_PACK(AUDIO_DSP_SMULWB(step, x), AUDIO_DSP_SMULWT(step, x));
+      pframe[i] = AUDIO_DSP_QADD16(x, x);
+    }
+  }
+
+  vol->gain = gain;
+}
+
+/**
+  * @brief  Same as Audio_Volume_Process() for 32-bit samples.
+  * @param  vol: volume stage.
+  * @param  pBuf: frames, processed in place.
+  * @param  frames: number of frames.
+  * @retval None
+  */
+void Audio_Volume_Process32(AUDIO_VolumeTypeDef *vol, int32_t *pBuf, uint32_t frames)
+{
+  int32_t target = vol->target;
+  int32_t gain = vol->gain;
+  int32_t step;
+  uint32_t i, n;
+
+  if ((gain == AUDIO_VOLUME_UNITY) && (target == AUDIO_VOLUME_UNITY))
+  {
+    return;
+  }
+
+  /* Both channels of a frame share the gain, which moves for the first n
+     frames, then stays at the target */
+  n = VOLUME_Ramp(vol, target, frames);
+  step = vol->step;
+
+  if ((gain <= AUDIO_VOLUME_UNITY) && (target <= AUDIO_VOLUME_UNITY))
+  {
+    /* Attenuation: the product always fits, no saturation */
+    for (i = 0; i < (n * 2); i += 2)
+    {
+      pBuf[i] = (int32_t)(((int64_t)pBuf[i] * gain) >> 16);
+      pBuf[i + 1] = (int32_t)(((int64_t)pBuf[i + 1] * gain) >> 16);
+      gain = VOLUME_Step(gain, step, target);
+    }
+  }
+  else
+  {
+    for (i = 0; i < (n * 2); i += 2)
+    {
+      pBuf[i] = VOLUME_MUL32(pBuf[i], gain);
+      pBuf[i + 1] = VOLUME_MUL32(pBuf[i + 1], gain);
+      gain = VOLUME_Step(gain, step, target);
+    }
+  }
+
+  if (gain < AUDIO_VOLUME_UNITY)
+  {
+    for (; i < (frames * 2); i++)
+    {
+      pBuf[i] = (int32_t)(((int64_t)pBuf[i] * gain) >> 16);
+    }
+  }
+  else if (gain > AUDIO_VOLUME_UNITY)
+  {
+    for (; i < (frames * 2); i++)
+    {
+      pBuf[i] = VOLUME_MUL32(pBuf[i], gain);
+    }
+  }
+
+  vol->gain = gain;
+}
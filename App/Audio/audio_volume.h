@@ -0,0 +1,45 @@
+/**
+  ******************************************************************************
+  * @file    audio_volume.h
+  * @brief   Header file for the audio_volume.c digital volume and mute stage.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __AUDIO_VOLUME_H
+#define __AUDIO_VOLUME_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+/* Volume range and step in 1/256 dB, as used by the USB Audio class */
+#define AUDIO_VOLUME_MIN                ((int16_t)0xA000)  /* -96 dB */
+#define AUDIO_VOLUME_MAX                ((int16_t)0x0600)  /* +6 dB */
+#define AUDIO_VOLUME_RES                ((int16_t)0x0080)  /* 0.5 dB */
+#define AUDIO_VOLUME_SILENCE            ((int16_t)0x8000)  /* -infinity */
+
+/* Linear gain in Q16: 0 dB */
+#define AUDIO_VOLUME_UNITY              ((int32_t)1 << 16)
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  int32_t          gain;        /* Linear gain reached at the end of the last block (Q16) */
+  volatile int32_t target;      /* Linear gain to reach over the ramp (Q16) */
+  int32_t          rampTarget;  /* Target of the ramp in progress (Q16) */
+  int32_t          step;        /* Gain change per frame of that ramp (Q16) */
+  uint32_t         rampFrames;  /* Length of a gain change in frames */
+  int16_t          volume;      /* Volume set by the host (1/256 dB) */
+  uint8_t          mute;        /* Mute set by the host */
+} AUDIO_VolumeTypeDef;
+
+/* Exported functions ------------------------------------------------------- */
+void Audio_Volume_Init(AUDIO_VolumeTypeDef *vol);
+void Audio_Volume_SetRamp(AUDIO_VolumeTypeDef *vol, uint32_t frames);
+void Audio_Volume_Set(AUDIO_VolumeTypeDef *vol, int16_t volume);
+void Audio_Volume_Mute(AUDIO_VolumeTypeDef *vol, uint8_t mute);
+void Audio_Volume_Process(AUDIO_VolumeTypeDef *vol, int16_t *pBuf, uint32_t frames);
+void Audio_Volume_Process32(AUDIO_VolumeTypeDef *vol, int32_t *pBuf, uint32_t frames);
+
+#endif /* __AUDIO_VOLUME_H */
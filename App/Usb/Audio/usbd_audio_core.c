@@ -23,15 +23,41 @@
   *             - Device descriptor management
   *             - Configuration descriptor management
   *             - Standard AC Interface Descriptor management
-  *             - 1 Audio Streaming Interface (with single channel, PCM, Stereo mode)
-  *             - 1 Audio Streaming Endpoint
+  *             - 1 media Audio Streaming Interface (PCM, Stereo mode) with 16-bit,
+  *               24-bit (in 32-bit subframes) and 32-bit alternate settings
+  *             - 1 media Audio Streaming Endpoint and its explicit feedback endpoint
+  *             - 1 voice Audio Streaming Interface (PCM, Stereo mode, 16-bit) and
+  *               its adaptive endpoint, mixed with the media stream by a Mixer
+  *               Unit, each stream ducking the other by a depth programmed by
+  *               vendor requests on the AudioControl interface
   *             - 1 Audio Terminal Input (1 channel)
   *             - Audio Class-Specific AC Interfaces
   *             - Audio Class-Specific AS Interfaces
   *             - AudioControl Requests: only SET_CUR and GET_CUR requests are supported (for Mute)
-  *             - Audio Feature Unit (limited to Mute control)
-  *             - Audio Synchronization type: Asynchronous
-  *             - Single fixed audio sampling rate (configurable in usbd_conf.h file)
+  *             - Audio Feature Units (Mute and Volume controls), one per stream
+  *             - Audio Synchronization type: Asynchronous (media), Adaptive (voice)
+  *             - Media clock drift absorbed by the explicit feedback, voice clock
+  *               drift and sampling frequency by a fractional sample rate
+  *               converter
+  *             - Jitter buffer depth adapted to the host, within a latency profile
+  *               selected by a vendor request on the AudioControl interface
+  *             - Incomplete isochronous OUT transfers recovered, the missed
+  *               packets being synthesized into the stream
+  *             - Per channel parametric equalizer of up to 10 bands,
+  *               programmed by vendor requests on the AudioControl interface
+  *             - Stereo-linked look-ahead limiter/compressor at the end of the
+  *               processing chain, which runs with 24 dB of headroom
+  *             - 16-bit output requantised with TPDF dither and optional
+  *               noise shaping, bypassed on the blocks that need no
+  *               requantisation so that unity gain stays bit-perfect
+  *             - Play start, stop and mute ramped in the sample domain
+  *               (linear or raised cosine), as are the volume steps and the
+  *               underrun fades
+  *             - Codec and I2S clocks powered down after an idle timeout on
+  *               the zero bandwidth alternate setting, woken up when a stream
+  *               starts
+  *             - Discrete audio sampling rates selected through the endpoint
+  *               SAMPLING_FREQ control (list configurable in usbd_conf.h file)
   *          
   *           @note
   *            The Audio Class 1.0 is based on USB Specification 1.0 and thus supports only
@@ -46,12 +72,11 @@
   *             - AudioControl Endpoint management
   *             - AudioControl requests other than SET_CUR and GET_CUR
   *             - Abstraction layer for AudioControl requests (only Mute functionality is managed)
-  *             - Audio Synchronization type: Adaptive
   *             - Audio Compression modules and interfaces
   *             - MIDI interfaces and modules
-  *             - Mixer/Selector/Processing/Extension Units (Feature unit is limited to Mute control)
+  *             - Mixer Unit controls, Selector/Processing/Extension Units
   *             - Any other application-specific modules
-  *             - Multiple and Variable audio sampling rates
+  *             - Continuous audio sampling rates
   *             - Out Streaming Endpoint/Interface (microphone)
   *      
   *  @endverbatim
@@ -72,8 +97,27 @@
 
 /* Includes ------------------------------------------------------------------*/
 
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
 #include "usbd_audio_core.h"
 #include "usbd_audio_out_if.h"
+#include "audio_ring.h"
+#include "audio_asrc.h"
+#include "audio_volume.h"
+#include "audio_ramp.h"
+#include "audio_eq.h"
+#include "audio_limiter.h"
+#include "audio_format.h"
+#include "audio_dither.h"
+#include "audio_mixer.h"
+#include "audio_conceal.h"
+#include "audio_probe.h"
+#include "audio_drift.h"
+#include "audio_jitter.h"
+#ifdef USBD_AUDIO_VERIFY
+#include "audio_verify.h"
+#endif
 
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
   * @{
@@ -96,6 +140,32 @@
 /** @defgroup usbd_audio_Private_Defines
   * @{
   */ 
+/* Events notified to the audio task by the interrupt handlers */
+#define AUDIO_EVT_PACKET                ((uint32_t)0x01)  /* OUT packets received */
+#define AUDIO_EVT_DMA_HALF              ((uint32_t)0x02)  /* First DMA half played */
+#define AUDIO_EVT_DMA_FULL              ((uint32_t)0x04)  /* Second DMA half played */
+#define AUDIO_EVT_FORMAT                ((uint32_t)0x08)  /* Stream format requested */
+#define AUDIO_EVT_PROFILE               ((uint32_t)0x10)  /* Latency profile requested */
+#define AUDIO_EVT_STREAM                ((uint32_t)0x20)  /* Alternate setting changed */
+#define AUDIO_EVT_EQ                    ((uint32_t)0x40)  /* Equalizer bands requested */
+#define AUDIO_EVT_LIMITER               ((uint32_t)0x80)  /* Limiter configuration requested */
+#define AUDIO_EVT_VOICE                 ((uint32_t)0x100) /* Voice OUT packets received */
+
+/* Length of a reception slot standing for a packet the device missed */
+#define AUDIO_OUT_RX_MISSING            ((uint32_t)0xFFFFFFFF)
+
+/* Consecutive missed packets synthesized before leaving the gap to the
+   underrun concealment: the host has likely stopped streaming */
+#define AUDIO_OUT_MISSING_MAX           2
+
+/* Longest wait for an iso OUT endpoint left armed for an ended frame to be
+   disabled (us) */
+#define AUDIO_OUT_EPDIS_TIMEOUT_US      10
+
+/* Fade out before a stop: DMA halves (1 ms each) rendered at most, and
+   longest wait for one of them (ms) */
+#define AUDIO_FADE_OUT_PASSES           (USBD_AUDIO_RAMP_MS + 4)
+#define AUDIO_FADE_OUT_WAIT_MS          5
 /**
   * @}
   */ 
@@ -123,13 +193,60 @@ static uint8_t  usbd_audio_EP0_RxReady(void *pdev);
 static uint8_t  usbd_audio_DataIn     (void *pdev, uint8_t epnum);
 static uint8_t  usbd_audio_DataOut    (void *pdev, uint8_t epnum);
 static uint8_t  usbd_audio_SOF        (void *pdev);
+static uint8_t  usbd_audio_IN_Incplt  (void  *pdev);
 static uint8_t  usbd_audio_OUT_Incplt (void  *pdev);
+static uint8_t  AUDIO_OUT_Missed      (USB_OTG_CORE_HANDLE *otg, uint8_t ep, uint32_t frame);
+
+/*********************************************
+   AUDIO feedback management functions
+ *********************************************/
+static uint32_t AUDIO_FB_GetPlayedBytes(void);
+static void AUDIO_FB_Update(void);
+static void AUDIO_FB_Send(void *pdev);
+static uint32_t AUDIO_FB_DriftRate(int32_t ppm);
+
+/*********************************************
+   AUDIO stream rendering functions
+ *********************************************/
+static uint32_t AUDIO_Render(uint8_t *pdst, uint32_t frames);
+#ifndef USBD_AUDIO_VERIFY
+static void AUDIO_Process(uint8_t *pdst, uint32_t frames);
+static void AUDIO_VoiceRender(uint32_t frames);
+#endif
+static void AUDIO_Play(void);
+static void AUDIO_StreamReset(void);
+static void AUDIO_UpdateTarget(void);
+static uint8_t AUDIO_SetFormat(uint32_t freq, uint32_t res);
+static uint8_t AUDIO_RequestFormat(uint32_t freq, uint32_t res);
+
+/*********************************************
+   AUDIO task functions
+ *********************************************/
+static void AUDIO_Task(void *pvParameters);
+static void AUDIO_Notify(uint32_t events);
+static void AUDIO_StreamChange(void);
+static void AUDIO_Idle(void);
+static void AUDIO_RenderEvents(uint32_t events);
+static void AUDIO_RampUpdate(void);
+static void AUDIO_FadeOut(void);
+static void AUDIO_EqRequest(void);
+static void AUDIO_EqUpdate(void);
+static void AUDIO_LimiterRequest(void);
+static void AUDIO_QueuePackets(void);
+static void AUDIO_QueueMissing(uint8_t *pkt);
+static void AUDIO_VoiceQueue(void);
+static void AUDIO_TaskLatency(uint32_t stamp);
+static void AUDIO_ProbeQueue(uint32_t slot, uint32_t queued);
+static void AUDIO_ProbeRender(uint32_t bytes);
+static void AUDIO_ProbeDrain(void);
 
 /*********************************************
    AUDIO Requests management functions
  *********************************************/
 static void AUDIO_Req_GetCurrent(void *pdev, USB_SETUP_REQ *req);
+static void AUDIO_Req_GetRange(void *pdev, USB_SETUP_REQ *req);
 static void AUDIO_Req_SetCurrent(void *pdev, USB_SETUP_REQ *req);
+static void AUDIO_Req_Vendor(void *pdev, USB_SETUP_REQ *req);
 static uint8_t  *USBD_audio_GetCfgDesc (uint8_t speed, uint16_t *length);
 /**
   * @}
@@ -138,18 +255,239 @@ static uint8_t  *USBD_audio_GetCfgDesc (uint8_t speed, uint16_t *length);
 /** @defgroup usbd_audio_Private_Variables
   * @{
   */ 
-/* Main Buffer for Audio Data Out transfers and its relative pointers */
-uint8_t  IsocOutBuff [TOTAL_OUT_BUF_SIZE * 2];
-uint8_t* IsocOutWrPtr = IsocOutBuff;
-uint8_t* IsocOutRdPtr = IsocOutBuff;
+/* Main Buffer for Audio Data Out transfers and the ring managing it.
+   The ring is byte-granular: each packet is copied right after the previous
+   one, whatever its size. It is filled from the OUT endpoint packets and
+   drained into the I2S DMA buffer, both by the audio task. */
+uint8_t  IsocOutBuff [AUDIO_OUT_RING_SIZE_MAX] __attribute__ ((aligned (4)));
+static AUDIO_RingTypeDef IsocOutRing;
+
+/* Reception buffers of the OUT endpoint. The OTG FIFO is read by words, so a
+   packet cannot be received in place at an arbitrary position of the ring.
+   The interrupt receives into slot IsocOutRxHead and hands completed slots
+   to the audio task, which queues them into the ring up to IsocOutRxHead. */
+__ALIGN_BEGIN static uint8_t IsocOutRxBuff [AUDIO_OUT_RX_SLOTS][AUDIO_OUT_PACKET_MAX + 4] __ALIGN_END;
+static uint32_t IsocOutRxLen [AUDIO_OUT_RX_SLOTS];
+static uint32_t IsocOutRxStamp [AUDIO_OUT_RX_SLOTS];
+static uint32_t IsocOutRxFifoStamp [AUDIO_OUT_RX_SLOTS];
+static __IO uint32_t IsocOutRxHead = 0;
+static __IO uint32_t IsocOutRxTail = 0;
+static __IO uint32_t IsocOutRxDrops = 0;
+
+/* Voice stream: reception slots of its OUT endpoint, handed to the audio
+   task like those of the media stream, and the ring they are queued into.
+   The ring holds 16-bit frames of the output sampling frequency, drained by
+   the voice converter at the rate the host sends them: the endpoint is
+   adaptive. */
+__ALIGN_BEGIN static uint8_t VoiceRxBuff [AUDIO_OUT_RX_SLOTS][AUDIO_VOICE_PACKET_MAX + 4] __ALIGN_END;
+static uint32_t VoiceRxLen [AUDIO_OUT_RX_SLOTS];
+static __IO uint32_t VoiceRxHead = 0;
+static __IO uint32_t VoiceRxTail = 0;
+static __IO uint32_t VoiceRxDrops = 0;
+static uint8_t  VoiceBuff [AUDIO_VOICE_RING_SIZE] __attribute__ ((aligned (4)));
+static AUDIO_RingTypeDef VoiceRing;
+
+/* Volume and mute of the voice Feature Unit, sampling frequency of its
+   endpoint, and state of its rendering: VoicePlay is set while the ring
+   plays, cleared from its underruns until it is back at its depth, the gap
+   being concealed like the underruns of the media stream. */
+static AUDIO_VolumeTypeDef VoiceVolume;
+static __IO uint8_t VoiceMute = 0;
+static __IO uint32_t VoiceAltSet = 0;
+static __IO uint32_t VoiceFreq = USBD_AUDIO_FREQ;
+static uint32_t VoicePlay = 0;
+static uint32_t VoiceUnderruns = 0;
+#ifndef USBD_AUDIO_VERIFY
+static AUDIO_ASRC_TypeDef VoiceAsrc;
+static AUDIO_ConcealTypeDef VoiceConceal;
+static int16_t VoiceBlock[AUDIO_DMA_HALF_FRAMES(USBD_AUDIO_FREQ_MAX) * 2] __attribute__ ((aligned (4)));
+#endif
+
+/* Mixer of the voice into the media stream and its ducking gains. Cycles
+   spent on the last 1 ms block and the largest. */
+static AUDIO_MixerTypeDef AudioMixer;
+static uint16_t AudioCtlDuckStream = 0;
+static uint32_t AudioMixerCycles = 0;
+static uint32_t AudioMixerCyclesMax = 0;
+
+/* Incomplete isochronous OUT transfers: packets the host sent in a frame
+   the endpoint was not armed for. Each one is replaced in the ring by a
+   synthesized packet of the length the host would have sent, accumulated
+   from the feedback value in AudioMissingAcc (10.14 frames). */
+__IO uint32_t IsocOutIncompleteCount = 0;
+static uint32_t AudioMissingAcc = 0;
+static uint32_t AudioMissingRun = 0;
+
+/* Buffer played by the I2S DMA in circular mode, refilled one half at a time,
+   and the number of bytes the DMA has played from it. It holds 16-bit frames,
+   or 32-bit words with swapped half-words for the 24/32-bit formats. */
+static uint32_t AudioOutDmaBuff [AUDIO_DMA_BUF_SIZE(USBD_AUDIO_FREQ_MAX, 32) / 4];
+static __IO uint32_t AudioOutPlayCount = 0;
+
+/* Concealment of the host underruns and overruns. AudioRefill is set while
+   an underrun is concealed and the ring fills up again. */
+static AUDIO_ConcealTypeDef AudioConceal;
+static __IO uint32_t AudioRefill = 0;
+
+/* Jitter buffer: depth adapted to the arrival jitter within the bounds of
+   the selected latency profile, and the matching ring fill in bytes. The
+   playback starts, and the resampler and the feedback steer the ring, at
+   this fill level. */
+static AUDIO_JitterTypeDef AudioJitter;
+static __IO uint32_t AudioTargetFill = 0;
+static __IO uint32_t AudioReqProfile = USBD_AUDIO_JITTER_PROFILE;
+static uint8_t AudioProfileCur = USBD_AUDIO_JITTER_PROFILE;
+
+/* Volume and mute of the media Feature Unit, applied to the converted
+   samples before the voice is mixed in. The play start and the stop are
+   ramps of AudioRamp on the mix, whose target is silence while stopping. */
+static AUDIO_VolumeTypeDef AudioVolume;
+static AUDIO_RampTypeDef AudioRamp;
+static __IO uint8_t AudioMute = 0;
+static __IO uint8_t AudioStopping = 0;
+
+/* Parametric equalizer of the converted samples. The bands requested by the
+   host are recorded by the control interrupt in AudioEqReq, one dirty bit
+   per band (bit 16 * channel + band), then designed and swapped in by the
+   audio task. Cycles spent on the last 1 ms block and the largest. */
+static AUDIO_EqTypeDef AudioEq;
+static AUDIO_EqBandTypeDef AudioEqReq[AUDIO_EQ_CHANNELS][AUDIO_EQ_BANDS_MAX];
+static __IO uint32_t AudioEqDirty = 0;
+static uint16_t AudioCtlEqBand = 0;
+static uint32_t AudioEqCycles = 0;
+static uint32_t AudioEqCyclesMax = 0;
+
+/* Limiter at the end of the processing chain, configured by the audio task
+   from the last request recorded by the control interrupt. Cycles spent on
+   the last 1 ms block and the largest. */
+static AUDIO_LimiterTypeDef AudioLimiter;
+static AUDIO_LimiterConfigTypeDef AudioLimiterReq =
+{
+  USBD_AUDIO_LIMITER_THRESHOLD, USBD_AUDIO_LIMITER_RATIO,
+  USBD_AUDIO_LIMITER_ATTACK_US, USBD_AUDIO_LIMITER_RELEASE_MS,
+  USBD_AUDIO_LIMITER_LOOKAHEAD_US
+};
+static uint32_t AudioLimiterCycles = 0;
+static uint32_t AudioLimiterCyclesMax = 0;
+
+/* Requantisation of the processed 16-bit frames. Cycles spent on the last
+   1 ms block and the largest. */
+static AUDIO_DitherTypeDef AudioDither;
+static uint32_t AudioDitherCycles = 0;
+static uint32_t AudioDitherCyclesMax = 0;
+
+/* 16-bit frames are processed as Q27 samples, the full scale of the
+   limiter */
+#ifndef USBD_AUDIO_VERIFY
+static int32_t AudioWork[AUDIO_EQ_BLOCK_MAX * 2];
+#endif
+#if (AUDIO_LIMITER_FULL_SCALE_BITS != AUDIO_FORMAT_Q27_BITS)
+#error "The limiter must run on the Q27 processing format"
+#endif
+
+/* Current sampling frequency and resolution, and the buffer sizes in use
+   for this format. The buffers themselves are allocated for the largest one. */
+static uint32_t usbd_audio_Freq = USBD_AUDIO_FREQ;
+static uint32_t usbd_audio_Resolution = 16;
+static uint32_t AudioFrameSize = AUDIO_FRAME_SIZE(16);
+static uint32_t AudioDmaHalfFrames = AUDIO_DMA_HALF_FRAMES(USBD_AUDIO_FREQ);
+static uint32_t AudioDmaBufSize = AUDIO_DMA_BUF_SIZE(USBD_AUDIO_FREQ, 16);
+
+/* Sample resolution of each alternate setting of the streaming interface */
+static const uint8_t usbd_audio_AltResolution[AUDIO_OUT_ALT_NUM] = {0, 16, 24, 32};
 
 /* Main Buffer for Audio Control Requests transfers and its relative variables */
 uint8_t  AudioCtl[64];
 uint8_t  AudioCtlCmd = 0;
 uint32_t AudioCtlLen = 0;
 uint8_t  AudioCtlUnit = 0;
+uint8_t  AudioCtlEp = 0;
+uint8_t  AudioCtlCS = 0;
+
+/* Streaming state: 0 = prebuffering, 1 = DMA running */
+static __IO uint32_t PlayFlag = 0;
+
+/* Audio task, running the stream processing deferred by the interrupts */
+static StackType_t  AudioTaskStack[AUDIO_TASK_STACK_SIZE];
+static StaticTask_t AudioTaskBuffer;
+static TaskHandle_t AudioTaskHandle = NULL;
 
-static uint32_t PlayFlag = 0;
+/* DMA events: count and time (DWT cycles) of the last one in the interrupt,
+   count handled by the task and number of refill deadlines missed */
+static __IO uint32_t AudioDmaIrqCount = 0;
+static __IO uint32_t AudioDmaStamp = 0;
+static uint32_t AudioDmaDoneCount = 0;
+static __IO uint32_t AudioDmaMissed = 0;
+
+/* Largest delay between an interrupt and the audio task, in DWT cycles */
+static __IO uint32_t AudioTaskLatencyMax = 0;
+
+/* Power management: deadline (ticks) of the idle timeout while the zero
+   bandwidth alternate setting is selected, number of power downs, and time
+   from the start of a stream (SET_INTERFACE, DWT cycles) to the start of
+   the I2S output, last and largest in us */
+static TickType_t AudioIdleDeadline = 0;
+static uint32_t AudioIdleArmed = 0;
+__IO uint32_t AudioPowerDowns = 0;
+static __IO uint32_t AudioWakeStamp = 0;
+static __IO uint32_t AudioWakePending = 0;
+static uint32_t AudioWakeLast = 0;
+static uint32_t AudioWakeMax = 0;
+
+/* Latency probes. Each packet is time stamped (DWT cycles) when the OTG
+   interrupt starts reading it from the Rx FIFO, when its transfer completes
+   in usbd_audio_DataOut, when the task queues it into the ring, when its
+   first sample is rendered into the DMA buffer and when the I2S has played
+   that DMA buffer half. The packets are tracked by the task from the ring
+   to the I2S in AudioProbePkt, indexed by free running counts. */
+typedef struct
+{
+  uint32_t fifo;                        /* Rx FIFO read */
+  uint32_t queued;                      /* Queued into the ring */
+  uint32_t render;                      /* Rendered into the DMA buffer */
+  uint32_t offset;                      /* Stream byte offset of the packet */
+  uint32_t drainEvent;                  /* DMA event ending its playback */
+} AUDIO_ProbePacketTypeDef;
+
+AUDIO_ProbeTypeDef AudioProbe;
+#ifdef USBD_AUDIO_VERIFY
+/* Bit-exact verification of the packets received against the samples
+   handed to the DMA, the stream bypassing the volume */
+AUDIO_VerifyTypeDef AudioVerify;
+#endif
+static AUDIO_ProbePacketTypeDef AudioProbePkt[AUDIO_PROBE_PACKETS];
+static uint32_t AudioProbeHead = 0;     /* Next packet queued */
+static uint32_t AudioProbeRendered = 0; /* Next packet to be rendered */
+static uint32_t AudioProbeTail = 0;     /* Next packet to be played out */
+static uint32_t AudioProbeQueuedBytes = 0;
+static uint32_t AudioProbeRenderedBytes = 0;
+static uint32_t AudioProbeFifoStamp = 0;
+static uint32_t AudioProbeFifoValid = 0;
+
+/* Format requested by the host, applied by the audio task, and number of
+   formats the audio interface failed to apply (I2S clock not locked) */
+static __IO uint32_t AudioReqFreq = USBD_AUDIO_FREQ;
+static __IO uint32_t AudioReqResolution = 16;
+__IO uint32_t AudioFormatErrors = 0;
+
+/* Explicit feedback (10.14 samples per frame) and its measurement state */
+static uint8_t  FeedbackBuf[4];
+static uint32_t FeedbackValue = AUDIO_FB_NOMINAL(USBD_AUDIO_FREQ);
+static uint32_t FeedbackRate = 0;
+static uint32_t FeedbackSofCount = 0;
+static uint32_t FeedbackPlayedRef = 0;
+static uint32_t FeedbackRefValid = 0;
+
+/* Drift of the crystal, hence of the I2S clock, against the host SOFs,
+   estimated from the TIM2 SOF captures, and the error of the I2S frequency
+   programmed for the current format against the nominal one (ppb) */
+static AUDIO_DriftTypeDef AudioDrift;
+static int32_t AudioClockErrorPpb = 0;
+#ifdef USBD_AUDIO_DRIFT_TRACE
+/* First SOF captures, kept to replay the estimator on a host */
+uint32_t AudioDriftTrace[USBD_AUDIO_DRIFT_TRACE];
+uint32_t AudioDriftTraceCount = 0;
+#endif
 
 static __IO uint32_t  usbd_audio_AltSet = 0;
 static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE];
@@ -165,7 +503,7 @@ USBD_Class_cb_TypeDef  AUDIO_cb =
   usbd_audio_DataIn,
   usbd_audio_DataOut,
   usbd_audio_SOF,
-  NULL,
+  usbd_audio_IN_Incplt,
   usbd_audio_OUT_Incplt,   
   USBD_audio_GetCfgDesc,
 #ifdef USB_OTG_HS_CORE  
@@ -179,9 +517,9 @@ static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE] =
   /* Configuration 1 */
   0x09,                                 /* bLength */
   USB_CONFIGURATION_DESCRIPTOR_TYPE,    /* bDescriptorType */
-  LOBYTE(AUDIO_CONFIG_DESC_SIZE),       /* wTotalLength  109 bytes*/
+  LOBYTE(AUDIO_CONFIG_DESC_SIZE),       /* wTotalLength  331 bytes*/
   HIBYTE(AUDIO_CONFIG_DESC_SIZE),      
-  0x02,                                 /* bNumInterfaces */
+  AUDIO_TOTAL_IF_NUM,                   /* bNumInterfaces */
   0x01,                                 /* bConfigurationValue */
   0x00,                                 /* iConfiguration */
   0xC0,                                 /* bmAttributes  BUS Powred*/
@@ -191,7 +529,7 @@ static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE] =
   /* USB Speaker Standard interface descriptor */
   AUDIO_INTERFACE_DESC_SIZE,            /* bLength */
   USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */
-  0x00,                                 /* bInterfaceNumber */
+  AUDIO_CONTROL_INTERFACE,              /* bInterfaceNumber */
   0x00,                                 /* bAlternateSetting */
   0x00,                                 /* bNumEndpoints */
   USB_DEVICE_CLASS_AUDIO,               /* bInterfaceClass */
@@ -201,16 +539,17 @@ static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE] =
   /* 09 byte*/
   
   /* USB Speaker Class-specific AC Interface Descriptor */
-  AUDIO_INTERFACE_DESC_SIZE,            /* bLength */
+  AUDIO_INTERFACE_DESC_SIZE + 1,        /* bLength */
   AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
   AUDIO_CONTROL_HEADER,                 /* bDescriptorSubtype */
   0x00,          /* 1.00 */             /* bcdADC */
   0x01,
-  0x27,                                 /* wTotalLength = 39*/
+  0x4B,                                 /* wTotalLength = 75*/
   0x00,
-  0x01,                                 /* bInCollection */
-  0x01,                                 /* baInterfaceNr */
-  /* 09 byte*/
+  0x02,                                 /* bInCollection */
+  0x01,                                 /* baInterfaceNr(1): media */
+  AUDIO_VOICE_INTERFACE,                /* baInterfaceNr(2): voice */
+  /* 10 byte*/
   
   /* USB Speaker Input Terminal Descriptor */
   AUDIO_INPUT_TERMINAL_DESC_SIZE,       /* bLength */
@@ -234,11 +573,57 @@ static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE] =
   AUDIO_OUT_STREAMING_CTRL,             /* bUnitID */
   0x01,                                 /* bSourceID */
   0x01,                                 /* bControlSize */
-  AUDIO_CONTROL_MUTE,                   /* bmaControls(0) */
+  AUDIO_CONTROL_MUTE |
+  AUDIO_CONTROL_VOLUME,                 /* bmaControls(0) */
   0x00,                                 /* bmaControls(1) */
   0x00,                                 /* iTerminal */
   /* 09 byte*/
   
+  /* USB Speaker Input Terminal Descriptor - Voice */
+  AUDIO_INPUT_TERMINAL_DESC_SIZE,       /* bLength */
+  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
+  AUDIO_CONTROL_INPUT_TERMINAL,         /* bDescriptorSubtype */
+  0x04,                                 /* bTerminalID */
+  0x01,                                 /* wTerminalType AUDIO_TERMINAL_USB_STREAMING   0x0101 */
+  0x01,
+  0x00,                                 /* bAssocTerminal */
+  0x02,                                 /* bNrChannels */
+  0x03,                                 /* wChannelConfig 0x0003  Left, Right */
+  0x00,
+  0x00,                                 /* iChannelNames */
+  0x00,                                 /* iTerminal */
+  /* 12 byte*/
+  
+  /* USB Speaker Audio Feature Unit Descriptor - Voice */
+  0x0A,                                 /* bLength */
+  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
+  AUDIO_CONTROL_FEATURE_UNIT,           /* bDescriptorSubtype */
+  AUDIO_VOICE_STREAMING_CTRL,           /* bUnitID */
+  0x04,                                 /* bSourceID */
+  0x01,                                 /* bControlSize */
+  AUDIO_CONTROL_MUTE |
+  AUDIO_CONTROL_VOLUME,                 /* bmaControls(0) */
+  0x00,                                 /* bmaControls(1) */
+  0x00,                                 /* bmaControls(2) */
+  0x00,                                 /* iTerminal */
+  /* 10 byte*/
+  
+  /* USB Speaker Audio Mixer Unit Descriptor: media and voice summed */
+  AUDIO_MIXER_UNIT_DESC_SIZE,           /* bLength */
+  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
+  AUDIO_CONTROL_MIXER_UNIT,             /* bDescriptorSubtype */
+  AUDIO_OUT_MIXER_UNIT,                 /* bUnitID */
+  0x02,                                 /* bNrInPins */
+  AUDIO_OUT_STREAMING_CTRL,             /* baSourceID(1): media */
+  AUDIO_VOICE_STREAMING_CTRL,           /* baSourceID(2): voice */
+  0x02,                                 /* bNrChannels */
+  0x03,                                 /* wChannelConfig 0x0003  Left, Right */
+  0x00,
+  0x00,                                 /* iChannelNames */
+  0x00,                                 /* bmControls: no programmable control */
+  0x00,                                 /* iMixer */
+  /* 13 byte*/
+  
   /*USB Speaker Output Terminal Descriptor */
   0x09,      /* bLength */
   AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
@@ -247,7 +632,7 @@ static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE] =
   0x01,                                 /* wTerminalType  0x0301*/
   0x03,
   0x00,                                 /* bAssocTerminal */
-  0x02,                                 /* bSourceID */
+  AUDIO_OUT_MIXER_UNIT,                 /* bSourceID */
   0x00,                                 /* iTerminal */
   /* 09 byte*/
   
@@ -265,12 +650,12 @@ static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE] =
   /* 09 byte*/
   
   /* USB Speaker Standard AS Interface Descriptor - Audio Streaming Operational */
-  /* Interface 1, Alternate Setting 1                                           */
+  /* Interface 1, Alternate Setting 1: 16-bit PCM                              */
   AUDIO_INTERFACE_DESC_SIZE,  /* bLength */
   USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */
   0x01,                                 /* bInterfaceNumber */
-  0x01,                                 /* bAlternateSetting */
-  0x01,                                 /* bNumEndpoints */
+  AUDIO_OUT_ALT_16B,                    /* bAlternateSetting */
+  0x02,                                 /* bNumEndpoints: data + feedback */
   USB_DEVICE_CLASS_AUDIO,               /* bInterfaceClass */
   AUDIO_SUBCLASS_AUDIOSTREAMING,        /* bInterfaceSubClass */
   AUDIO_PROTOCOL_UNDEFINED,             /* bInterfaceProtocol */
@@ -288,33 +673,257 @@ static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE] =
   /* 07 byte*/
   
   /* USB Speaker Audio Type III Format Interface Descriptor */
-  0x0B,                                 /* bLength */
+  8 + (3 * USBD_AUDIO_FREQ_NUM),        /* bLength */
   AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
   AUDIO_STREAMING_FORMAT_TYPE,          /* bDescriptorSubtype */
   AUDIO_FORMAT_TYPE_III,                /* bFormatType */ 
   0x02,                                 /* bNrChannels */
   0x02,                                 /* bSubFrameSize :  2 Bytes per frame (16bits) */
   16,                                   /* bBitResolution (16-bits per sample) */ 
-  0x01,                                 /* bSamFreqType only one frequency supported */ 
-  SAMPLE_FREQ(USBD_AUDIO_FREQ),         /* Audio sampling frequency coded on 3 bytes */
-  /* 11 byte*/
+  USBD_AUDIO_FREQ_NUM,                  /* bSamFreqType: number of discrete frequencies */ 
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_1),       /* Audio sampling frequencies coded on 3 bytes */
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_2),
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_3),
+  /* 17 byte*/
+  
+  /* Endpoint 1 - Standard Descriptor */
+  AUDIO_STANDARD_ENDPOINT_DESC_SIZE,    /* bLength */
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */
+  AUDIO_OUT_EP,                         /* bEndpointAddress 1 out endpoint*/
+  USB_ENDPOINT_TYPE_ISOCHRONOUS | USB_ENDPOINT_SYNC_ASYNCHRONOUS, /* bmAttributes */
+  AUDIO_PACKET_SZE(USBD_AUDIO_FREQ_MAX, 16), /* wMaxPacketSize in Bytes ((Freq(Samples)+1)*2(Stereo)*2(HalfWord)) */
+  0x01,                                 /* bInterval */
+  0x00,                                 /* bRefresh */
+  AUDIO_IN_EP,                          /* bSynchAddress: feedback endpoint */
+  /* 09 byte*/
+  
+  /* Endpoint - Audio Streaming Descriptor*/
+  AUDIO_STREAMING_ENDPOINT_DESC_SIZE,   /* bLength */
+  AUDIO_ENDPOINT_DESCRIPTOR_TYPE,       /* bDescriptorType */
+  AUDIO_ENDPOINT_GENERAL,               /* bDescriptor */
+  AUDIO_ENDPOINT_SAMPLING_FREQ,         /* bmAttributes: Sampling Frequency control */
+  0x00,                                 /* bLockDelayUnits */
+  0x00,                                 /* wLockDelay */
+  0x00,
+  /* 07 byte*/
+  
+  /* Endpoint 2 - Standard Descriptor - Feedback */
+  AUDIO_STANDARD_ENDPOINT_DESC_SIZE,    /* bLength */
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */
+  AUDIO_IN_EP,                          /* bEndpointAddress 2 in endpoint*/
+  USB_ENDPOINT_TYPE_ISOCHRONOUS,        /* bmAttributes */
+  AUDIO_FB_PACKET,                      /* wMaxPacketSize in Bytes (10.14 format) */
+  0x00,
+  0x01,                                 /* bInterval */
+  AUDIO_FB_REFRESH,                     /* bRefresh */
+  0x00,                                 /* bSynchAddress */
+  /* 09 byte*/
+  
+  /* USB Speaker Standard AS Interface Descriptor - Audio Streaming Operational */
+  /* Interface 1, Alternate Setting 2: 24-bit PCM in 32-bit subframes          */
+  AUDIO_INTERFACE_DESC_SIZE,  /* bLength */
+  USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */
+  0x01,                                 /* bInterfaceNumber */
+  AUDIO_OUT_ALT_24B,                    /* bAlternateSetting */
+  0x02,                                 /* bNumEndpoints: data + feedback */
+  USB_DEVICE_CLASS_AUDIO,               /* bInterfaceClass */
+  AUDIO_SUBCLASS_AUDIOSTREAMING,        /* bInterfaceSubClass */
+  AUDIO_PROTOCOL_UNDEFINED,             /* bInterfaceProtocol */
+  0x00,                                 /* iInterface */
+  /* 09 byte*/
+  
+  /* USB Speaker Audio Streaming Interface Descriptor */
+  AUDIO_STREAMING_INTERFACE_DESC_SIZE,  /* bLength */
+  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
+  AUDIO_STREAMING_GENERAL,              /* bDescriptorSubtype */
+  0x01,                                 /* bTerminalLink */
+  0x01,                                 /* bDelay */
+  0x01,                                 /* wFormatTag AUDIO_FORMAT_PCM  0x0001*/
+  0x00,
+  /* 07 byte*/
+  
+  /* USB Speaker Audio Type I Format Interface Descriptor */
+  8 + (3 * USBD_AUDIO_FREQ_NUM),        /* bLength */
+  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
+  AUDIO_STREAMING_FORMAT_TYPE,          /* bDescriptorSubtype */
+  AUDIO_FORMAT_TYPE_I,                  /* bFormatType */ 
+  0x02,                                 /* bNrChannels */
+  0x04,                                 /* bSubFrameSize :  4 Bytes per frame */
+  24,                                   /* bBitResolution (24-bits per sample) */ 
+  USBD_AUDIO_FREQ_NUM,                  /* bSamFreqType: number of discrete frequencies */ 
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_1),       /* Audio sampling frequencies coded on 3 bytes */
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_2),
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_3),
+  /* 17 byte*/
   
   /* Endpoint 1 - Standard Descriptor */
   AUDIO_STANDARD_ENDPOINT_DESC_SIZE,    /* bLength */
   USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */
   AUDIO_OUT_EP,                         /* bEndpointAddress 1 out endpoint*/
+  USB_ENDPOINT_TYPE_ISOCHRONOUS | USB_ENDPOINT_SYNC_ASYNCHRONOUS, /* bmAttributes */
+  AUDIO_PACKET_SZE(USBD_AUDIO_FREQ_MAX, 24), /* wMaxPacketSize in Bytes ((Freq(Samples)+1)*2(Stereo)*4(Word)) */
+  0x01,                                 /* bInterval */
+  0x00,                                 /* bRefresh */
+  AUDIO_IN_EP,                          /* bSynchAddress: feedback endpoint */
+  /* 09 byte*/
+  
+  /* Endpoint - Audio Streaming Descriptor*/
+  AUDIO_STREAMING_ENDPOINT_DESC_SIZE,   /* bLength */
+  AUDIO_ENDPOINT_DESCRIPTOR_TYPE,       /* bDescriptorType */
+  AUDIO_ENDPOINT_GENERAL,               /* bDescriptor */
+  AUDIO_ENDPOINT_SAMPLING_FREQ,         /* bmAttributes: Sampling Frequency control */
+  0x00,                                 /* bLockDelayUnits */
+  0x00,                                 /* wLockDelay */
+  0x00,
+  /* 07 byte*/
+  
+  /* Endpoint 2 - Standard Descriptor - Feedback */
+  AUDIO_STANDARD_ENDPOINT_DESC_SIZE,    /* bLength */
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */
+  AUDIO_IN_EP,                          /* bEndpointAddress 2 in endpoint*/
   USB_ENDPOINT_TYPE_ISOCHRONOUS,        /* bmAttributes */
-  AUDIO_PACKET_SZE(USBD_AUDIO_FREQ),    /* wMaxPacketSize in Bytes (Freq(Samples)*2(Stereo)*2(HalfWord)) */
+  AUDIO_FB_PACKET,                      /* wMaxPacketSize in Bytes (10.14 format) */
+  0x00,
+  0x01,                                 /* bInterval */
+  AUDIO_FB_REFRESH,                     /* bRefresh */
+  0x00,                                 /* bSynchAddress */
+  /* 09 byte*/
+  
+  /* USB Speaker Standard AS Interface Descriptor - Audio Streaming Operational */
+  /* Interface 1, Alternate Setting 3: 32-bit PCM                              */
+  AUDIO_INTERFACE_DESC_SIZE,  /* bLength */
+  USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */
+  0x01,                                 /* bInterfaceNumber */
+  AUDIO_OUT_ALT_32B,                    /* bAlternateSetting */
+  0x02,                                 /* bNumEndpoints: data + feedback */
+  USB_DEVICE_CLASS_AUDIO,               /* bInterfaceClass */
+  AUDIO_SUBCLASS_AUDIOSTREAMING,        /* bInterfaceSubClass */
+  AUDIO_PROTOCOL_UNDEFINED,             /* bInterfaceProtocol */
+  0x00,                                 /* iInterface */
+  /* 09 byte*/
+  
+  /* USB Speaker Audio Streaming Interface Descriptor */
+  AUDIO_STREAMING_INTERFACE_DESC_SIZE,  /* bLength */
+  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
+  AUDIO_STREAMING_GENERAL,              /* bDescriptorSubtype */
+  0x01,                                 /* bTerminalLink */
+  0x01,                                 /* bDelay */
+  0x01,                                 /* wFormatTag AUDIO_FORMAT_PCM  0x0001*/
+  0x00,
+  /* 07 byte*/
+  
+  /* USB Speaker Audio Type I Format Interface Descriptor */
+  8 + (3 * USBD_AUDIO_FREQ_NUM),        /* bLength */
+  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
+  AUDIO_STREAMING_FORMAT_TYPE,          /* bDescriptorSubtype */
+  AUDIO_FORMAT_TYPE_I,                  /* bFormatType */ 
+  0x02,                                 /* bNrChannels */
+  0x04,                                 /* bSubFrameSize :  4 Bytes per frame */
+  32,                                   /* bBitResolution (32-bits per sample) */ 
+  USBD_AUDIO_FREQ_NUM,                  /* bSamFreqType: number of discrete frequencies */ 
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_1),       /* Audio sampling frequencies coded on 3 bytes */
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_2),
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_3),
+  /* 17 byte*/
+  
+  /* Endpoint 1 - Standard Descriptor */
+  AUDIO_STANDARD_ENDPOINT_DESC_SIZE,    /* bLength */
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */
+  AUDIO_OUT_EP,                         /* bEndpointAddress 1 out endpoint*/
+  USB_ENDPOINT_TYPE_ISOCHRONOUS | USB_ENDPOINT_SYNC_ASYNCHRONOUS, /* bmAttributes */
+  AUDIO_PACKET_SZE(USBD_AUDIO_FREQ_MAX, 32), /* wMaxPacketSize in Bytes ((Freq(Samples)+1)*2(Stereo)*4(Word)) */
   0x01,                                 /* bInterval */
   0x00,                                 /* bRefresh */
+  AUDIO_IN_EP,                          /* bSynchAddress: feedback endpoint */
+  /* 09 byte*/
+  
+  /* Endpoint - Audio Streaming Descriptor*/
+  AUDIO_STREAMING_ENDPOINT_DESC_SIZE,   /* bLength */
+  AUDIO_ENDPOINT_DESCRIPTOR_TYPE,       /* bDescriptorType */
+  AUDIO_ENDPOINT_GENERAL,               /* bDescriptor */
+  AUDIO_ENDPOINT_SAMPLING_FREQ,         /* bmAttributes: Sampling Frequency control */
+  0x00,                                 /* bLockDelayUnits */
+  0x00,                                 /* wLockDelay */
+  0x00,
+  /* 07 byte*/
+  
+  /* Endpoint 2 - Standard Descriptor - Feedback */
+  AUDIO_STANDARD_ENDPOINT_DESC_SIZE,    /* bLength */
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */
+  AUDIO_IN_EP,                          /* bEndpointAddress 2 in endpoint*/
+  USB_ENDPOINT_TYPE_ISOCHRONOUS,        /* bmAttributes */
+  AUDIO_FB_PACKET,                      /* wMaxPacketSize in Bytes (10.14 format) */
+  0x00,
+  0x01,                                 /* bInterval */
+  AUDIO_FB_REFRESH,                     /* bRefresh */
   0x00,                                 /* bSynchAddress */
   /* 09 byte*/
   
+  /* USB Speaker Standard AS Interface Descriptor - Voice Zero Bandwith */
+  /* Interface 2, Alternate Setting 0                                    */
+  AUDIO_INTERFACE_DESC_SIZE,  /* bLength */
+  USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */
+  AUDIO_VOICE_INTERFACE,                /* bInterfaceNumber */
+  0x00,                                 /* bAlternateSetting */
+  0x00,                                 /* bNumEndpoints */
+  USB_DEVICE_CLASS_AUDIO,               /* bInterfaceClass */
+  AUDIO_SUBCLASS_AUDIOSTREAMING,        /* bInterfaceSubClass */
+  AUDIO_PROTOCOL_UNDEFINED,             /* bInterfaceProtocol */
+  0x00,                                 /* iInterface */
+  /* 09 byte*/
+  
+  /* USB Speaker Standard AS Interface Descriptor - Voice Operational */
+  /* Interface 2, Alternate Setting 1: 16-bit PCM                     */
+  AUDIO_INTERFACE_DESC_SIZE,  /* bLength */
+  USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */
+  AUDIO_VOICE_INTERFACE,                /* bInterfaceNumber */
+  0x01,                                 /* bAlternateSetting */
+  0x01,                                 /* bNumEndpoints: data only */
+  USB_DEVICE_CLASS_AUDIO,               /* bInterfaceClass */
+  AUDIO_SUBCLASS_AUDIOSTREAMING,        /* bInterfaceSubClass */
+  AUDIO_PROTOCOL_UNDEFINED,             /* bInterfaceProtocol */
+  0x00,                                 /* iInterface */
+  /* 09 byte*/
+  
+  /* USB Speaker Audio Streaming Interface Descriptor */
+  AUDIO_STREAMING_INTERFACE_DESC_SIZE,  /* bLength */
+  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
+  AUDIO_STREAMING_GENERAL,              /* bDescriptorSubtype */
+  0x04,                                 /* bTerminalLink */
+  0x01,                                 /* bDelay */
+  0x01,                                 /* wFormatTag AUDIO_FORMAT_PCM  0x0001*/
+  0x00,
+  /* 07 byte*/
+  
+  /* USB Speaker Audio Type I Format Interface Descriptor */
+  8 + (3 * USBD_AUDIO_VOICE_FREQ_NUM),  /* bLength */
+  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
+  AUDIO_STREAMING_FORMAT_TYPE,          /* bDescriptorSubtype */
+  AUDIO_FORMAT_TYPE_I,                  /* bFormatType */ 
+  0x02,                                 /* bNrChannels */
+  0x02,                                 /* bSubFrameSize :  2 Bytes per frame (16bits) */
+  16,                                   /* bBitResolution (16-bits per sample) */ 
+  USBD_AUDIO_VOICE_FREQ_NUM,            /* bSamFreqType: number of discrete frequencies */ 
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_1),       /* Audio sampling frequencies coded on 3 bytes */
+  SAMPLE_FREQ(USBD_AUDIO_FREQ_2),
+  /* 14 byte*/
+  
+  /* Endpoint 2 - Standard Descriptor - Voice */
+  AUDIO_STANDARD_ENDPOINT_DESC_SIZE,    /* bLength */
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */
+  AUDIO_VOICE_OUT_EP,                   /* bEndpointAddress 2 out endpoint*/
+  USB_ENDPOINT_TYPE_ISOCHRONOUS | USB_ENDPOINT_SYNC_ADAPTIVE, /* bmAttributes */
+  AUDIO_PACKET_SZE(USBD_AUDIO_VOICE_FREQ_MAX, 16), /* wMaxPacketSize in Bytes ((Freq(Samples)+1)*2(Stereo)*2(HalfWord)) */
+  0x01,                                 /* bInterval */
+  0x00,                                 /* bRefresh */
+  0x00,                                 /* bSynchAddress: the converter adapts to the host */
+  /* 09 byte*/
+  
   /* Endpoint - Audio Streaming Descriptor*/
   AUDIO_STREAMING_ENDPOINT_DESC_SIZE,   /* bLength */
   AUDIO_ENDPOINT_DESCRIPTOR_TYPE,       /* bDescriptorType */
   AUDIO_ENDPOINT_GENERAL,               /* bDescriptor */
-  0x00,                                 /* bmAttributes */
+  AUDIO_ENDPOINT_SAMPLING_FREQ,         /* bmAttributes: Sampling Frequency control */
   0x00,                                 /* bLockDelayUnits */
   0x00,                                 /* wLockDelay */
   0x00,
@@ -342,20 +951,77 @@ static uint8_t  usbd_audio_Init (void  *pdev,
   /* Open EP OUT */
   DCD_EP_Open(pdev,
               AUDIO_OUT_EP,
-              AUDIO_OUT_PACKET,
+              AUDIO_OUT_PACKET_MAX,
+              USB_OTG_EP_ISOC);
+
+  /* Open EP IN (feedback) */
+  DCD_EP_Open(pdev,
+              AUDIO_IN_EP,
+              AUDIO_FB_PACKET,
+              USB_OTG_EP_ISOC);
+
+  /* Open EP OUT of the voice stream */
+  DCD_EP_Open(pdev,
+              AUDIO_VOICE_OUT_EP,
+              AUDIO_VOICE_PACKET_MAX,
               USB_OTG_EP_ISOC);
 
   /* Initialize the Audio output Hardware layer */
-  if (AUDIO_OUT_fops.Init(USBD_AUDIO_FREQ, DEFAULT_VOLUME, 0) != USBD_OK)
+  if (AUDIO_OUT_fops.Init(usbd_audio_Freq, DEFAULT_VOLUME, 0) != USBD_OK)
   {
     return USBD_FAIL;
   }
+  AudioClockErrorPpb = AUDIO_OUT_fops.GetClockError();
+  
+#ifdef USB_OTG_FS_SOF_OUTPUT_ENABLED
+  Audio_Drift_Init(&AudioDrift, (USB_OTG_BSP_SofTimerFreq() / 1000) * USB_SOF_CAPTURE_DIV);
+#endif
+  
+  /* The ring uses the whole storage: the jitter buffer depth sets the fill */
+  Audio_Ring_Init(&IsocOutRing, IsocOutBuff, AUDIO_OUT_RING_SIZE_MAX);
+  Audio_Conceal_Init(&AudioConceal, AudioFrameSize, AUDIO_RAMP_FRAMES(usbd_audio_Freq),
+                     USBD_AUDIO_RAMP_SHAPE);
+#ifdef USBD_AUDIO_VERIFY
+  Audio_Verify_Flush(&AudioVerify);
+#endif
+  
+  /* Volume and mute are applied in the sample domain, the codec stays at
+     its default volume */
+  Audio_Volume_Init(&AudioVolume);
+  Audio_Volume_SetRamp(&AudioVolume, AUDIO_RAMP_FRAMES(usbd_audio_Freq));
+  Audio_Ramp_Init(&AudioRamp, AUDIO_RAMP_FRAMES(usbd_audio_Freq), USBD_AUDIO_RAMP_SHAPE, 0);
+  AudioMute = 0;
+  
+  /* The voice stream waits in its ring for its depth, at unity gain */
+  Audio_Ring_Init(&VoiceRing, VoiceBuff, AUDIO_VOICE_RING_SIZE);
+  Audio_Volume_Init(&VoiceVolume);
+  Audio_Volume_SetRamp(&VoiceVolume, AUDIO_RAMP_FRAMES(usbd_audio_Freq));
+  VoiceMute = 0;
+  VoicePlay = 0;
+#ifndef USBD_AUDIO_VERIFY
+  Audio_Conceal_Init(&VoiceConceal, AUDIO_FRAME_SIZE(16), AUDIO_RAMP_FRAMES(usbd_audio_Freq),
+                     USBD_AUDIO_RAMP_SHAPE);
+#endif
     
-  /* Prepare Out endpoint to receive audio data */
+  /* Prepare Out endpoints to receive audio data */
+  IsocOutRxHead = 0;
+  IsocOutRxTail = 0;
   DCD_EP_PrepareRx(pdev,
                    AUDIO_OUT_EP,
-                   (uint8_t*)IsocOutBuff,                        
-                   AUDIO_OUT_PACKET);  
+                   (uint8_t*)IsocOutRxBuff[0],                        
+                   AUDIO_OUT_PACKET_MAX);  
+  VoiceRxHead = 0;
+  VoiceRxTail = 0;
+  DCD_EP_PrepareRx(pdev,
+                   AUDIO_VOICE_OUT_EP,
+                   (uint8_t*)VoiceRxBuff[0],
+                   AUDIO_VOICE_PACKET_MAX);
+  
+  /* No stream until the host selects an alternate setting: arm the idle
+     timeout */
+  usbd_audio_AltSet = 0;
+  VoiceAltSet = 0;
+  AUDIO_Notify(AUDIO_EVT_STREAM);
   
   return USBD_OK;
 }
@@ -371,6 +1037,8 @@ static uint8_t  usbd_audio_DeInit (void  *pdev,
                                    uint8_t cfgidx)
 { 
   DCD_EP_Close (pdev , AUDIO_OUT_EP);
+  DCD_EP_Close (pdev , AUDIO_IN_EP);
+  DCD_EP_Close (pdev , AUDIO_VOICE_OUT_EP);
   
   /* DeInitialize the Audio output Hardware layer */
   if (AUDIO_OUT_fops.DeInit(0) != USBD_OK)
@@ -408,12 +1076,23 @@ static uint8_t  usbd_audio_Setup (void  *pdev,
       AUDIO_Req_SetCurrent(pdev, req);   
       break;
 
+    case AUDIO_REQ_GET_MIN:
+    case AUDIO_REQ_GET_MAX:
+    case AUDIO_REQ_GET_RES:
+      AUDIO_Req_GetRange(pdev, req);
+      break;
+
     default:
       USBD_CtlError (pdev, req);
       return USBD_FAIL;
     }
     break;
     
+    /* Vendor Requests -------------------------------*/
+  case USB_REQ_TYPE_VENDOR:
+    AUDIO_Req_Vendor(pdev, req);
+    break;
+    
     /* Standard Requests -------------------------------*/
   case USB_REQ_TYPE_STANDARD:
     switch (req->bRequest)
@@ -436,14 +1115,59 @@ static uint8_t  usbd_audio_Setup (void  *pdev,
       
     case USB_REQ_GET_INTERFACE :
       USBD_CtlSendData (pdev,
-                        (uint8_t *)&usbd_audio_AltSet,
+                        (LOBYTE(req->wIndex) == AUDIO_VOICE_INTERFACE) ?
+                        (uint8_t *)&VoiceAltSet : (uint8_t *)&usbd_audio_AltSet,
                         1);
       break;
       
     case USB_REQ_SET_INTERFACE :
-      if ((uint8_t)(req->wValue) < AUDIO_TOTAL_IF_NUM)
+      if (LOBYTE(req->wIndex) == AUDIO_VOICE_INTERFACE)
+      {
+        if ((uint8_t)(req->wValue) < AUDIO_VOICE_ALT_NUM)
+        {
+          /* The voice stream plays at its own pace from its ring: only the
+             codec may have to be woken up */
+          VoiceAltSet = (uint8_t)(req->wValue);
+          if ((VoiceAltSet != 0) && (usbd_audio_AltSet == 0))
+          {
+            AudioWakeStamp = DWT->CYCCNT;
+            AudioWakePending = 1;
+          }
+          AUDIO_Notify(AUDIO_EVT_STREAM);
+        }
+        else
+        {
+          USBD_CtlError (pdev, req);
+        }
+      }
+      else if ((uint8_t)(req->wValue) < AUDIO_OUT_ALT_NUM)
       {
         usbd_audio_AltSet = (uint8_t)(req->wValue);
+        
+        /* The audio task wakes the codec up or arms the idle timeout */
+        if (usbd_audio_AltSet != 0)
+        {
+          AudioWakeStamp = DWT->CYCCNT;
+          AudioWakePending = 1;
+        }
+        AUDIO_Notify(AUDIO_EVT_STREAM);
+        
+        /* Each operational alternate setting carries its own sample format */
+        if (usbd_audio_AltSet != 0)
+        {
+          AUDIO_RequestFormat(AudioReqFreq, usbd_audio_AltResolution[usbd_audio_AltSet]);
+        }
+        
+        /* Restart the feedback measurement and its transfers on each stream */
+        DCD_EP_Flush(pdev, AUDIO_IN_EP);
+        FeedbackValue = AUDIO_FB_NOMINAL(usbd_audio_Freq);
+        FeedbackRate = 0;
+        FeedbackSofCount = 0;
+        FeedbackRefValid = 0;
+        if (usbd_audio_AltSet != 0)
+        {
+          AUDIO_FB_Send(pdev);
+        }
       }
       else
       {
@@ -464,39 +1188,125 @@ static uint8_t  usbd_audio_Setup (void  *pdev,
   */
 static uint8_t  usbd_audio_EP0_RxReady (void  *pdev)
 { 
+  uint32_t freq;
+  
   /* Check if an AudioControl request has been issued */
   if (AudioCtlCmd == AUDIO_REQ_SET_CUR)
   {/* In this driver, to simplify code, only SET_CUR request is managed */
-    /* Check for which addressed unit the AudioControl request has been issued */
-    if (AudioCtlUnit == AUDIO_OUT_STREAMING_CTRL)
-    {/* In this driver, to simplify code, only one unit is manage */
-      /* Call the audio interface mute function */
-      AUDIO_OUT_fops.MuteCtl(AudioCtl[0]);
+    /* Check for which addressed endpoint or unit the request has been issued */
+    if (AudioCtlEp == AUDIO_OUT_EP)
+    {/* Sampling frequency of the streaming endpoint */
+      AUDIO_RequestFormat((uint32_t)AudioCtl[0] | 
+                          ((uint32_t)AudioCtl[1] << 8) | 
+                          ((uint32_t)AudioCtl[2] << 16),
+                          AudioReqResolution);
       
-      /* Reset the AudioCtlCmd variable to prevent re-entering this function */
       AudioCtlCmd = 0;
       AudioCtlLen = 0;
     }
-  } 
-  
-  return USBD_OK;
-}
-
-/**
-  * @brief  usbd_audio_DataIn
-  *         Handles the audio IN data stage.
-  * @param  pdev: instance
-  * @param  epnum: endpoint number
-  * @retval status
-  */
-static uint8_t  usbd_audio_DataIn (void *pdev, uint8_t epnum)
-{
-  return USBD_OK;
-}
-
+    else if (AudioCtlEp == AUDIO_VOICE_OUT_EP)
+    {/* Sampling frequency of the voice endpoint: the voice is converted to
+        the output frequency, the one of the media stream while it plays.
+        Frequencies the voice endpoint does not advertise are stalled. */
+      freq = (uint32_t)AudioCtl[0] | 
+             ((uint32_t)AudioCtl[1] << 8) | 
+             ((uint32_t)AudioCtl[2] << 16);
+      if ((freq <= USBD_AUDIO_VOICE_FREQ_MAX) &&
+          ((freq == USBD_AUDIO_FREQ_1) || (freq == USBD_AUDIO_FREQ_2) || (freq == USBD_AUDIO_FREQ_3)))
+      {
+        VoiceFreq = freq;
+        AUDIO_Notify(AUDIO_EVT_STREAM);
+      }
+      else
+      {
+        USBD_CtlError (pdev, NULL);
+      }
+      
+      AudioCtlCmd = 0;
+      AudioCtlLen = 0;
+    }
+    else if (AudioCtlUnit == AUDIO_OUT_STREAMING_CTRL)
+    {
+      /* Volume and mute only change the target gain of the sample path:
+         no codec access from the interrupt. The mute silences the media
+         stream alone, not the voice mixed into it. */
+      if (AudioCtlCS == AUDIO_VOLUME_CONTROL)
+      {
+        Audio_Volume_Set(&AudioVolume,
+                         (int16_t)((uint16_t)AudioCtl[0] | ((uint16_t)AudioCtl[1] << 8)));
+      }
+      else
+      {
+        AudioMute = (AudioCtl[0] != 0) ? 1 : 0;
+        Audio_Volume_Mute(&AudioVolume, AudioMute);
+      }
+      
+      /* Reset the AudioCtlCmd variable to prevent re-entering this function */
+      AudioCtlCmd = 0;
+      AudioCtlLen = 0;
+    }
+    else if (AudioCtlUnit == AUDIO_VOICE_STREAMING_CTRL)
+    {
+      if (AudioCtlCS == AUDIO_VOLUME_CONTROL)
+      {
+        Audio_Volume_Set(&VoiceVolume,
+                         (int16_t)((uint16_t)AudioCtl[0] | ((uint16_t)AudioCtl[1] << 8)));
+      }
+      else
+      {
+        VoiceMute = (AudioCtl[0] != 0) ? 1 : 0;
+        Audio_Volume_Mute(&VoiceVolume, VoiceMute);
+      }
+      
+      AudioCtlCmd = 0;
+      AudioCtlLen = 0;
+    }
+  } 
+  else if (AudioCtlCmd == AUDIO_VENDOR_REQ_SET_EQ_BAND)
+  {
+    AUDIO_EqRequest();
+    AudioCtlCmd = 0;
+    AudioCtlLen = 0;
+  }
+  else if (AudioCtlCmd == AUDIO_VENDOR_REQ_SET_LIMITER)
+  {
+    AUDIO_LimiterRequest();
+    AudioCtlCmd = 0;
+    AudioCtlLen = 0;
+  }
+  else if (AudioCtlCmd == AUDIO_VENDOR_REQ_SET_DUCK)
+  {
+    /* Read by the mixer on the next block */
+    Audio_Mixer_SetDuck(&AudioMixer, AudioCtlDuckStream,
+                        (int16_t)((uint16_t)AudioCtl[0] | ((uint16_t)AudioCtl[1] << 8)));
+    AudioCtlCmd = 0;
+    AudioCtlLen = 0;
+  }
+  
+  return USBD_OK;
+}
+
+/**
+  * @brief  usbd_audio_DataIn
+  *         Handles the audio IN data stage.
+  * @param  pdev: instance
+  * @param  epnum: endpoint number
+  * @retval status
+  */
+static uint8_t  usbd_audio_DataIn (void *pdev, uint8_t epnum)
+{
+  if (epnum == (AUDIO_IN_EP & 0x7F))
+  {
+    /* The feedback has been read by the host: queue the latest value */
+    AUDIO_FB_Send(pdev);
+  }
+  return USBD_OK;
+}
+
 /**
   * @brief  usbd_audio_DataOut
-  *         Handles the Audio Out data stage.
+  *         Handles the Audio Out data stage: the received packet is handed to
+  *         the audio task and the endpoint is re-armed on a free slot.
   * @param  pdev: instance
   * @param  epnum: endpoint number
   * @retval status
@@ -504,17 +1314,35 @@ static uint8_t  usbd_audio_DataIn (void *pdev, uint8_t epnum)
 __IO uint32_t DataOutCounter = 0;
 static uint8_t  usbd_audio_DataOut (void *pdev, uint8_t epnum)
 {     
+  uint32_t count;
+  uint32_t slot;
+  
   DataOutCounter++;
   if (epnum == AUDIO_OUT_EP)
   {    
-    /* Increment the Buffer pointer or roll it back when all buffers are full */
-    if (IsocOutWrPtr >= (IsocOutBuff + (AUDIO_OUT_PACKET * OUT_PACKET_NUM)))
-    {/* All buffers are full: roll back */
-      IsocOutWrPtr = IsocOutBuff;
+    /* Number of bytes actually sent by the host in this frame */
+    count = ((USB_OTG_CORE_HANDLE*)pdev)->dev.out_ep[epnum].xfer_count;
+    if (count > AUDIO_OUT_PACKET_MAX)
+    {
+      count = AUDIO_OUT_PACKET_MAX;
+    }
+    
+    slot = IsocOutRxHead % AUDIO_OUT_RX_SLOTS;
+    IsocOutRxLen[slot] = count;
+    IsocOutRxStamp[slot] = DWT->CYCCNT;
+    IsocOutRxFifoStamp[slot] = AudioProbeFifoValid ? AudioProbeFifoStamp : IsocOutRxStamp[slot];
+    AudioProbeFifoValid = 0;
+    
+    /* Hand the slot over, unless the task is so late that no other slot
+       is free to receive the next packet: this one is then dropped */
+    if (((IsocOutRxHead + 1) - IsocOutRxTail) < AUDIO_OUT_RX_SLOTS)
+    {
+      __DMB();
+      IsocOutRxHead++;
     }
     else
-    {/* Increment the buffer pointer */
-      IsocOutWrPtr += AUDIO_OUT_PACKET;
+    {
+      IsocOutRxDrops++;
     }
     
     /* Toggle the frame index */  
@@ -524,15 +1352,40 @@ static uint8_t  usbd_audio_DataOut (void *pdev, uint8_t epnum)
     /* Prepare Out endpoint to receive next audio packet */
     DCD_EP_PrepareRx(pdev,
                      AUDIO_OUT_EP,
-                     (uint8_t*)(IsocOutWrPtr),
-                     AUDIO_OUT_PACKET);
-      
-    /* Trigger the start of streaming only when half buffer is full */
-    if ((PlayFlag == 0) && (IsocOutWrPtr >= (IsocOutBuff + ((AUDIO_OUT_PACKET * OUT_PACKET_NUM) / 2))))
+                     (uint8_t*)(IsocOutRxBuff[IsocOutRxHead % AUDIO_OUT_RX_SLOTS]),
+                     AUDIO_OUT_PACKET_MAX);
+    
+    AUDIO_Notify(AUDIO_EVT_PACKET);
+  }
+  else if (epnum == AUDIO_VOICE_OUT_EP)
+  {
+    count = ((USB_OTG_CORE_HANDLE*)pdev)->dev.out_ep[epnum].xfer_count;
+    if (count > AUDIO_VOICE_PACKET_MAX)
+    {
+      count = AUDIO_VOICE_PACKET_MAX;
+    }
+    
+    slot = VoiceRxHead % AUDIO_OUT_RX_SLOTS;
+    VoiceRxLen[slot] = count;
+    if (((VoiceRxHead + 1) - VoiceRxTail) < AUDIO_OUT_RX_SLOTS)
+    {
+      __DMB();
+      VoiceRxHead++;
+    }
+    else
     {
-      /* Enable start of Streaming */
-      PlayFlag = 1;
+      VoiceRxDrops++;
     }
+    
+    ((USB_OTG_CORE_HANDLE*)pdev)->dev.out_ep[epnum].even_odd_frame = 
+      (((USB_OTG_CORE_HANDLE*)pdev)->dev.out_ep[epnum].even_odd_frame)? 0:1;
+    
+    DCD_EP_PrepareRx(pdev,
+                     AUDIO_VOICE_OUT_EP,
+                     (uint8_t*)(VoiceRxBuff[VoiceRxHead % AUDIO_OUT_RX_SLOTS]),
+                     AUDIO_VOICE_PACKET_MAX);
+    
+    AUDIO_Notify(AUDIO_EVT_VOICE);
   }
   
   return USBD_OK;
@@ -547,96 +1400,1802 @@ static uint8_t  usbd_audio_DataOut (void *pdev, uint8_t epnum)
   */
 static uint8_t  usbd_audio_SOF (void *pdev)
 {     
-  /* Check if there are available data in stream buffer.
-    In this function, a single variable (PlayFlag) is used to avoid software delays.
-    The play operation must be executed as soon as possible after the SOF detection. */
-  if (PlayFlag)
-  {      
-    /* Start playing received packet */
-    AUDIO_OUT_fops.AudioCmd((uint8_t*)(IsocOutRdPtr),  /* Samples buffer pointer */
-                            AUDIO_OUT_PACKET,          /* Number of samples in Bytes */
-                            AUDIO_CMD_PLAY);           /* Command to be processed */
-    
-    /* Increment the Buffer pointer or roll it back when all buffers all full */  
-    if (IsocOutRdPtr >= (IsocOutBuff + (AUDIO_OUT_PACKET * OUT_PACKET_NUM)))
-    {/* Roll back to the start of buffer */
-      IsocOutRdPtr = IsocOutBuff;
-    }
-    else
-    {/* Increment to the next sub-buffer */
-      IsocOutRdPtr += AUDIO_OUT_PACKET;
-    }
-    
-    /* If all available buffers have been consumed, stop playing */
-    if (IsocOutRdPtr == IsocOutWrPtr)
-    {    
-      /* Pause the audio stream */
-      AUDIO_OUT_fops.AudioCmd((uint8_t*)(IsocOutBuff),   /* Samples buffer pointer */
-                              AUDIO_OUT_PACKET,          /* Number of samples in Bytes */
-                              AUDIO_CMD_PAUSE);          /* Command to be processed */
-      
-      /* Stop entering play loop */
-      PlayFlag = 0;
-      
-      /* Reset buffer pointers */
-      IsocOutRdPtr = IsocOutBuff;
-      IsocOutWrPtr = IsocOutBuff;
+#ifdef USB_OTG_FS_SOF_OUTPUT_ENABLED
+  uint32_t capture;
+  
+  /* Track the drift between the host and the crystal */
+  if (USB_OTG_BSP_SofCapture(&capture))
+  {
+    Audio_Drift_Update(&AudioDrift, capture);
+#ifdef USBD_AUDIO_DRIFT_TRACE
+    if (AudioDriftTraceCount < USBD_AUDIO_DRIFT_TRACE)
+    {
+      AudioDriftTrace[AudioDriftTraceCount++] = capture;
     }
+#endif
+  }
+#endif
+  
+  /* Measure the I2S consumption and update the feedback value */
+  AUDIO_FB_Update();
+  
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_AUDIO_Sync
+  *         Called from the I2S DMA half/full transfer interrupts when a half
+  *         of the DMA buffer has been played. The refill is left to the audio
+  *         task, which must complete it before the DMA comes back to it.
+  * @param  offset: AUDIO_OFFSET_HALF when the first half of the DMA buffer has
+  *         been played, AUDIO_OFFSET_FULL when the DMA wrapped to its start.
+  * @retval None
+  */
+void USBD_AUDIO_Sync (AUDIO_OffsetTypeDef offset)
+{
+  if (PlayFlag == 0)
+  {
+    return;
+  }
+  
+  AudioDmaStamp = DWT->CYCCNT;
+  AudioDmaIrqCount++;
+  AudioOutPlayCount += AudioDmaBufSize / 2;
+  
+  AUDIO_Notify((offset == AUDIO_OFFSET_HALF) ? AUDIO_EVT_DMA_HALF : AUDIO_EVT_DMA_FULL);
+}
+
+/**
+  * @brief  USBD_AUDIO_RxFifo
+  *         Called by the OTG interrupt before it reads a packet from the Rx
+  *         FIFO: time stamps the start of the reception of the OUT packets.
+  * @param  epnum: endpoint number of the packet
+  * @retval None
+  */
+void USBD_AUDIO_RxFifo (uint8_t epnum)
+{
+  if ((epnum == (AUDIO_OUT_EP & 0x7F)) && (AudioProbeFifoValid == 0))
+  {
+    AudioProbeFifoStamp = DWT->CYCCNT;
+    AudioProbeFifoValid = 1;
   }
+}
+
+/**
+  * @brief  USBD_AUDIO_GetLatency
+  *         Summarizes the latencies measured for a stage of the audio path.
+  *         The statistics are updated by the audio task: a report read from
+  *         another task may mix two consecutive updates.
+  * @param  stage: AUDIO_PROBE_xxx stage
+  * @param  report: filled with the count and the min/avg/max/p99 latencies,
+  *         in cycles of SystemCoreClock
+  * @retval 0 if the stage has been measured, 1 otherwise
+  */
+uint32_t USBD_AUDIO_GetLatency (uint32_t stage, AUDIO_ProbeReportTypeDef *report)
+{
+  return Audio_Probe_Report(&AudioProbe, stage, report);
+}
+
+/**
+  * @brief  USBD_AUDIO_GetDrift
+  *         Reads the drift of the I2S clock against the host clock, measured
+  *         on the SOFs.
+  * @param  pPpm: drift in ppm (Q16), positive when the I2S runs fast
+  * @param  pBound: 2-sigma confidence bound of the drift (ppm, Q16)
+  * @retval 1 once the estimate has settled, 0 before
+  */
+uint32_t USBD_AUDIO_GetDrift (int32_t *pPpm, int32_t *pBound)
+{
+  uint32_t settled;
+  
+  /* The estimate is updated by the SOF interrupt */
+  taskENTER_CRITICAL();
+  settled = Audio_Drift_Get(&AudioDrift, pPpm, pBound);
+  taskEXIT_CRITICAL();
+  
+  return settled;
+}
+
+/**
+  * @brief  USBD_AUDIO_GetWakeTime
+  *         Reads the time from the start of a stream by the host to the start
+  *         of the I2S output, including the wake up of a sleeping codec and
+  *         the prebuffering of the jitter buffer.
+  * @param  pLast: time measured on the last stream start (us)
+  * @param  pMax: largest time measured (us)
+  * @retval number of codec power downs since the start
+  */
+uint32_t USBD_AUDIO_GetWakeTime (uint32_t *pLast, uint32_t *pMax)
+{
+  /* Both are updated by the audio task */
+  taskENTER_CRITICAL();
+  *pLast = AudioWakeLast;
+  *pMax = AudioWakeMax;
+  taskEXIT_CRITICAL();
+  
+  return AudioPowerDowns;
+}
+
+/**
+  * @brief  USBD_AUDIO_GetClock
+  *         Reads the sampling frequency of the current format and the one the
+  *         I2S clock programmed for it actually produces, the PLLI2S not
+  *         dividing exactly to every rate.
+  * @param  pFreq: nominal sampling frequency (Hz)
+  * @param  pAchieved: sampling frequency of the I2S clock (Hz, rounded)
+  * @retval error of the I2S clock against the nominal frequency (ppb)
+  */
+int32_t USBD_AUDIO_GetClock (uint32_t *pFreq, uint32_t *pAchieved)
+{
+  uint32_t freq;
+  int32_t ppb;
+  
+  /* Both are updated by the audio task on a format change */
+  taskENTER_CRITICAL();
+  freq = usbd_audio_Freq;
+  ppb = AudioClockErrorPpb;
+  taskEXIT_CRITICAL();
+  
+  *pFreq = freq;
+  *pAchieved = (uint32_t)((((int64_t)freq * (1000000000LL + ppb)) + 500000000LL) / 1000000000LL);
+  
+  return ppb;
+}
+
+/**
+  * @brief  USBD_AUDIO_TaskInit
+  *         Creates the audio task. Must be called before the scheduler starts
+  *         and before the USB device is initialized.
+  * @param  None
+  * @retval None
+  */
+void USBD_AUDIO_TaskInit (void)
+{
+  /* The interrupts time stamp their events with the cycle counter */
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  Audio_Probe_Init(&AudioProbe, SystemCoreClock);
+#ifdef USBD_AUDIO_VERIFY
+  Audio_Verify_Init(&AudioVerify);
+#endif
+  
+  /* All the bands off until the host programs them */
+  Audio_Eq_Init(&AudioEq, USBD_AUDIO_FREQ);
+  Audio_Limiter_Init(&AudioLimiter, &AudioLimiterReq, USBD_AUDIO_FREQ);
+  Audio_Dither_Init(&AudioDither, USBD_AUDIO_DITHER_SHAPING, USBD_AUDIO_FREQ);
+  Audio_Mixer_Init(&AudioMixer, (USBD_AUDIO_FREQ * USBD_AUDIO_DUCK_MS) / 1000);
+  Audio_Mixer_SetDuck(&AudioMixer, AUDIO_MIXER_MEDIA, USBD_AUDIO_MEDIA_DUCK);
+  Audio_Mixer_SetDuck(&AudioMixer, AUDIO_MIXER_VOICE, USBD_AUDIO_VOICE_DUCK);
   
+  /* Packet arrivals are time stamped in cycles, one packet per ms */
+  Audio_Jitter_Init(&AudioJitter, USBD_AUDIO_JITTER_PROFILE, SystemCoreClock / 1000);
+  AUDIO_UpdateTarget();
+  
+  AudioTaskHandle = xTaskCreateStatic(AUDIO_Task, "Audio", AUDIO_TASK_STACK_SIZE,
+                                      NULL, AUDIO_TASK_PRIORITY,
+                                      AudioTaskStack, &AudioTaskBuffer);
+}
+
+/**
+  * @brief  usbd_audio_IN_Incplt
+  *         Handles the iso in incomplete event: the host did not poll the
+  *         feedback endpoint in this frame, so the pending value is resent.
+  * @param  pdev: instance
+  * @retval status
+  */
+static uint8_t  usbd_audio_IN_Incplt (void  *pdev)
+{
+  if (usbd_audio_AltSet != 0)
+  {
+    DCD_EP_Flush(pdev, AUDIO_IN_EP);
+    AUDIO_FB_Send(pdev);
+  }
   return USBD_OK;
 }
 
+/**
+  * @brief  AUDIO_OUT_Missed
+  *         Checks whether an iso OUT endpoint is still armed for the frame
+  *         that just ended (EPENA set and EONUM equal to the frame parity),
+  *         in which case its packet was missed. The endpoint is then disabled
+  *         so that it can be re-armed for the next frame parity.
+  * @param  otg: instance
+  * @param  ep: iso OUT endpoint
+  * @param  frame: number of the frame that just ended, read from DSTS
+  * @retval 1 if the endpoint missed its packet and must be re-armed,
+  *         0 if it received it or is not armed
+  */
+static uint8_t  AUDIO_OUT_Missed (USB_OTG_CORE_HANDLE *otg, uint8_t ep, uint32_t frame)
+{
+  USB_OTG_DEPCTL_TypeDef depctl;
+  USB_OTG_DOEPINTn_TypeDef doepint;
+  uint32_t start;
+  
+  ep &= 0x7F;
+  depctl.d32 = USB_OTG_READ_REG32(&otg->regs.OUTEP_REGS[ep]->DOEPCTL);
+  if ((depctl.b.epena == 0) || (depctl.b.dpid != (frame & 1)))
+  {
+    return 0;
+  }
+  
+  /* Discard the transfer: NAK and disable, then wait for EPDISD */
+  depctl.b.snak = 1;
+  depctl.b.epdis = 1;
+  USB_OTG_WRITE_REG32(&otg->regs.OUTEP_REGS[ep]->DOEPCTL, depctl.d32);
+  
+  start = DWT->CYCCNT;
+  do
+  {
+    doepint.d32 = USB_OTG_READ_REG32(&otg->regs.OUTEP_REGS[ep]->DOEPINT);
+  }
+  while ((doepint.b.epdisabled == 0) &&
+         ((DWT->CYCCNT - start) < (AUDIO_OUT_EPDIS_TIMEOUT_US * (SystemCoreClock / 1000000))));
+  
+  doepint.d32 = 0;
+  doepint.b.epdisabled = 1;
+  USB_OTG_WRITE_REG32(&otg->regs.OUTEP_REGS[ep]->DOEPINT, doepint.d32);
+  
+  otg->dev.out_ep[ep].even_odd_frame = (frame + 1) & 1;
+  return 1;
+}
+
 /**
   * @brief  usbd_audio_OUT_Incplt
-  *         Handles the iso out incomplete event.
+  *         Handles the iso out incomplete event: an iso OUT endpoint did not
+  *         receive its packet in the frame that just ended. The event does
+  *         not tell which one, so each endpoint is checked and only the
+  *         one that missed its packet is re-armed for the next frame parity.
+  *         A missing media packet is concealed; the voice converter rides
+  *         over a missing voice packet.
   * @param  pdev: instance
   * @retval status
   */
 static uint8_t  usbd_audio_OUT_Incplt (void  *pdev)
 {
+  USB_OTG_CORE_HANDLE *otg = (USB_OTG_CORE_HANDLE*)pdev;
+  USB_OTG_DSTS_TypeDef dsts;
+  uint32_t slot;
+  
+  /* The frame number must be read before the next SOF */
+  dsts.d32 = USB_OTG_READ_REG32(&otg->regs.DREGS->DSTS);
+  
+  /* A missed voice packet is neither counted nor concealed as a media one */
+  if ((VoiceAltSet != 0) && (AUDIO_OUT_Missed(otg, AUDIO_VOICE_OUT_EP, dsts.b.soffn) != 0))
+  {
+    DCD_EP_PrepareRx(pdev,
+                     AUDIO_VOICE_OUT_EP,
+                     (uint8_t*)(VoiceRxBuff[VoiceRxHead % AUDIO_OUT_RX_SLOTS]),
+                     AUDIO_VOICE_PACKET_MAX);
+  }
+  
+  if ((usbd_audio_AltSet == 0) || (AUDIO_OUT_Missed(otg, AUDIO_OUT_EP, dsts.b.soffn) == 0))
+  {
+    return USBD_OK;
+  }
+  IsocOutIncompleteCount++;
+  AudioProbeFifoValid = 0;
+  
+  /* Hand a slot marked as missing to the task, which fills the gap */
+  if ((PlayFlag != 0) &&
+      (((IsocOutRxHead + 1) - IsocOutRxTail) < AUDIO_OUT_RX_SLOTS))
+  {
+    slot = IsocOutRxHead % AUDIO_OUT_RX_SLOTS;
+    IsocOutRxLen[slot] = AUDIO_OUT_RX_MISSING;
+    IsocOutRxStamp[slot] = DWT->CYCCNT;
+    IsocOutRxFifoStamp[slot] = IsocOutRxStamp[slot];
+    __DMB();
+    IsocOutRxHead++;
+  }
+  
+  DCD_EP_PrepareRx(pdev,
+                   AUDIO_OUT_EP,
+                   (uint8_t*)(IsocOutRxBuff[IsocOutRxHead % AUDIO_OUT_RX_SLOTS]),
+                   AUDIO_OUT_PACKET_MAX);
+  
+  AUDIO_Notify(AUDIO_EVT_PACKET);
+  
   return USBD_OK;
 }
 
 /******************************************************************************
-     AUDIO Class requests management
+     AUDIO feedback management
 ******************************************************************************/
 /**
-  * @brief  AUDIO_Req_GetCurrent
-  *         Handles the GET_CUR Audio control request.
-  * @param  pdev: instance
-  * @param  req: setup class request
-  * @retval status
+  * @brief  AUDIO_FB_GetPlayedBytes
+  *         Returns the number of bytes consumed by the I2S since the start of
+  *         the stream, with the resolution of a single DMA transfer.
+  * @param  None
+  * @retval Played bytes (wraps around 2^32)
   */
-static void AUDIO_Req_GetCurrent(void *pdev, USB_SETUP_REQ *req)
-{  
-  /* Send the current mute state */
-  USBD_CtlSendData (pdev, 
-                    AudioCtl,
-                    req->wLength);
+static uint32_t AUDIO_FB_GetPlayedBytes(void)
+{
+  uint32_t rdcount;
+  uint32_t pos;
+  
+  /* AudioOutPlayCount is updated by the DMA interrupt: read it around the DMA
+     position so that both values belong to the same half of the buffer */
+  do
+  {
+    rdcount = AudioOutPlayCount;
+    pos = AUDIO_OUT_fops.GetPosition();
+  } while (rdcount != AudioOutPlayCount);
+  
+  /* Distance from the last synchronization point. A half/full transfer
+     interrupt still pending is absorbed by the modulo. */
+  return rdcount + ((pos + AudioDmaBufSize - (rdcount % AudioDmaBufSize)) % AudioDmaBufSize);
 }
 
 /**
-  * @brief  AUDIO_Req_SetCurrent
-  *         Handles the SET_CUR Audio control request.
-  * @param  pdev: instance
-  * @param  req: setup class request
-  * @retval status
+  * @brief  AUDIO_FB_Update
+  *         Computes the feedback value from the I2S consumption rate measured
+  *         over 2^AUDIO_FB_PERIOD_LOG2 frames, corrected by the ring fill error.
+  * @param  None
+  * @retval None
   */
-static void AUDIO_Req_SetCurrent(void *pdev, USB_SETUP_REQ *req)
-{ 
-  if (req->wLength)
+static void AUDIO_FB_Update(void)
+{
+  uint32_t played;
+  uint32_t rate;
+  int32_t  fill;
+  int32_t  value;
+  int32_t  nominal = (int32_t)AUDIO_FB_NOMINAL(usbd_audio_Freq);
+  int32_t  ppm;
+  int32_t  bound;
+  
+  if (PlayFlag == 0)
   {
-    /* Prepare the reception of the buffer over EP0 */
-    USBD_CtlPrepareRx (pdev, 
-                       AudioCtl,
-                       req->wLength);
+    /* No measurement while the DMA is stopped: report the nominal rate */
+    FeedbackRefValid = 0;
+    FeedbackSofCount = 0;
+    return;
+  }
+  
+  if (++FeedbackSofCount < (1 << AUDIO_FB_PERIOD_LOG2))
+  {
+    return;
+  }
+  FeedbackSofCount = 0;
+  
+  played = AUDIO_FB_GetPlayedBytes();
+  
+  if (FeedbackRefValid)
+  {
+    /* Frames per 2^AUDIO_FB_PERIOD_LOG2 ms to 10.14 frames per ms */
+    rate = ((played - FeedbackPlayedRef) << (14 - AUDIO_FB_PERIOD_LOG2)) / AudioFrameSize;
     
-    /* Set the global variables indicating current request and its length 
-    to the function usbd_audio_EP0_RxReady() which will process the request */
-    AudioCtlCmd = AUDIO_REQ_SET_CUR;     /* Set the request value */
-    AudioCtlLen = req->wLength;          /* Set the request data length */
-    AudioCtlUnit = HIBYTE(req->wIndex);  /* Set the request target unit */
+    if (FeedbackRate == 0)
+    {
+      FeedbackRate = rate;
+    }
+    else
+    {/* First order low-pass filter on the measured rate */
+      FeedbackRate += ((int32_t)(rate - FeedbackRate)) / 4;
+    }
+  }
+  FeedbackPlayedRef = played;
+  FeedbackRefValid = 1;
+  
+  /* Once settled, the SOF captures give the I2S rate with a far lower
+     jitter than the DMA position read by this interrupt */
+  if (Audio_Drift_Get(&AudioDrift, &ppm, &bound))
+  {
+    FeedbackRate = AUDIO_FB_DriftRate(ppm);
+  }
+  
+  if (FeedbackRate == 0)
+  {
+    return;
+  }
+  
+  /* Steer the host towards a ring holding the jitter buffer depth */
+  fill = (int32_t)(Audio_Ring_Fill(&IsocOutRing) / AudioFrameSize);
+  value = (int32_t)FeedbackRate + 
+    (((int32_t)(AudioTargetFill / AudioFrameSize) - fill) * (1 << (14 - AUDIO_FB_FILL_GAIN_LOG2)));
+  
+  /* Never ask for more than +/- 1/256 of the nominal rate */
+  if (value > nominal + (nominal >> 8))
+  {
+    value = nominal + (nominal >> 8);
+  }
+  else if (value < nominal - (nominal >> 8))
+  {
+    value = nominal - (nominal >> 8);
+  }
+  
+  FeedbackValue = (uint32_t)value;
+}
+
+/**
+  * @brief  AUDIO_FB_DriftRate
+  *         Computes the I2S rate in 10.14 frames per host frame from the
+  *         error of the programmed I2S frequency and the drift of the crystal
+  *         against the host.
+  * @param  ppm: drift of the crystal against the host (ppm, Q16)
+  * @retval Rate in 10.14 format
+  */
+static uint32_t AUDIO_FB_DriftRate(int32_t ppm)
+{
+  int64_t rate;
+  
+  rate = ((int64_t)usbd_audio_Freq << 14) * (1000000000 + (int64_t)AudioClockErrorPpb) /
+         ((int64_t)1000 * 1000000000);
+  rate = (rate * (((int64_t)1000000 << 16) + ppm)) / ((int64_t)1000000 << 16);
+  
+  return (uint32_t)rate;
+}
+
+/**
+  * @brief  AUDIO_FB_Send
+  *         Queues the current feedback value on the feedback endpoint.
+  * @param  pdev: instance
+  * @retval None
+  */
+static void AUDIO_FB_Send(void *pdev)
+{
+  uint32_t value = FeedbackValue;
+  
+  FeedbackBuf[0] = (uint8_t)(value);
+  FeedbackBuf[1] = (uint8_t)(value >> 8);
+  FeedbackBuf[2] = (uint8_t)(value >> 16);
+  
+  DCD_EP_Tx(pdev, AUDIO_IN_EP, FeedbackBuf, AUDIO_FB_PACKET);
+}
+
+/******************************************************************************
+     AUDIO stream rendering
+******************************************************************************/
+/**
+  * @brief  AUDIO_Render
+  *         Copies frames from the ring into a block of the DMA buffer, as
+  *         received: the media endpoint is asynchronous, so the explicit
+  *         feedback already makes the host send at the I2S rate and keeps
+  *         the ring at the jitter buffer depth. No sample rate converter
+  *         steers the same fill error, and the stream stays bit-perfect.
+  *         When the ring runs dry the missing frames are concealed, and the
+  *         stream fades back in once the ring is back at that depth.
+  *         With USBD_AUDIO_VERIFY defined, the frames are also left without
+  *         volume or fade in, and verified.
+  * @param  pdst: destination of the interleaved stereo frames, in the DMA
+  *         buffer layout of the current format
+  * @param  frames: number of frames to produce
+  * @retval Number of frames taken from the stream. The rest of the block is
+  *         concealed.
+  */
+static uint32_t AUDIO_Render(uint8_t *pdst, uint32_t frames)
+{
+  uint32_t done = 0;
+  uint8_t *psrc;
+  uint32_t avail;
+  uint32_t n;
+  
+  Audio_Ring_Probe(&IsocOutRing);
+  
+  /* Resume once the fade out is over and the ring has been refilled */
+  if (AudioRefill && (AudioConceal.gain == 0) &&
+      (Audio_Ring_Fill(&IsocOutRing) >= AudioTargetFill))
+  {
+    AudioRefill = 0;
+  }
+  if (AudioRefill)
+  {
+    Audio_Conceal_Underrun(&AudioConceal, pdst, frames);
+    goto output;
+  }
+  
+  while (done < frames)
+  {
+    /* Copy up to the end of the ring, then continue from its start */
+    psrc = Audio_Ring_Peek(&IsocOutRing, &avail);
+    n = avail / AudioFrameSize;
+    if (n == 0)
+    {/* Ring empty */
+      break;
+    }
+    if (n > (frames - done))
+    {
+      n = frames - done;
+    }
+    memcpy(pdst + (done * AudioFrameSize), psrc, n * AudioFrameSize);
+    
+    Audio_Ring_Consume(&IsocOutRing, n * AudioFrameSize);
+    AUDIO_ProbeRender(n * AudioFrameSize);
+    done += n;
+  }
+  
+#ifndef USBD_AUDIO_VERIFY
+  /* Fade in after an underrun, and keep the last frames played */
+  Audio_Conceal_FadeIn(&AudioConceal, pdst, done);
+#endif
+  Audio_Conceal_Save(&AudioConceal, pdst, done);
+  
+  if (done < frames)
+  {
+    Audio_Ring_Underrun(&IsocOutRing);
+    
+    /* The buffer was too shallow for this host: deepen it before the
+       refill, which resumes at the new depth */
+    Audio_Jitter_Underrun(&AudioJitter);
+    AUDIO_UpdateTarget();
+    Audio_Conceal_Underrun(&AudioConceal, pdst + (done * AudioFrameSize), frames - done);
+    AudioRefill = 1;
+  }
+  
+output:
+#ifndef USBD_AUDIO_VERIFY
+  /* The whole block, concealed frames included, is processed */
+  AUDIO_Process(pdst, frames);
+#endif
+  
+  if (usbd_audio_Resolution != 16)
+  {
+    /* The DMA sends the low half-word of each word first */
+    Audio_Format_S32_I2S_Stereo((int32_t*)pdst, (uint32_t*)pdst, frames);
+  }
+  
+#ifdef USBD_AUDIO_VERIFY
+  /* The frames taken from the stream, as handed to the DMA */
+  Audio_Verify_Output(&AudioVerify, pdst, done * AudioFrameSize,
+                      (usbd_audio_Resolution == 16) ? 0 : 1);
+#endif
+  
+  return done;
+}
+
+#ifndef USBD_AUDIO_VERIFY
+/**
+  * @brief  AUDIO_Process
+  *         Runs the sample processing on a rendered block: equalizer,
+  *         volume, mix of the voice stream and limiter on Q27 samples, with
+  *         4 bits of headroom so that the EQ boosts, the volume and the sum
+  *         of the streams do not clip before the limiter, then the
+  *         requantisation with dither of the 16-bit frames and the ramp of
+  *         the stream transitions on the output samples.
+  *         16-bit frames are processed in AudioWork, 32-bit frames in place.
+  *         The media volume runs the SMULL kernel of Q27 samples whatever
+  *         the stream resolution, keeping the bits below the 16-bit LSB for
+  *         the dither; the packed 16-bit kernel is left to the voice stream.
+  *         Samples at unity gain, the bands off and below the threshold
+  *         come out unchanged, delayed by the look-ahead, and are not
+  *         dithered.
+  * @param  pdst: interleaved stereo frames, in the layout of the current
+  *         format before the half-word swap
+  * @param  frames: number of frames
+  * @retval None
+  */
+static void AUDIO_Process(uint8_t *pdst, uint32_t frames)
+{
+  int16_t *p16 = (int16_t*)pdst;
+  int32_t *p32 = (int32_t*)pdst;
+  int16_t *pvoice = VoiceBlock;
+  int32_t *pwork;
+  uint32_t eq = 0;
+  uint32_t mix = 0;
+  uint32_t lim = 0;
+  uint32_t dit = 0;
+  uint32_t cycles;
+  uint32_t n;
+  
+  /* The voice block of the same length, silent while the voice is idle,
+     and the media stream, playing once its ring is at depth */
+  AUDIO_VoiceRender(frames);
+  Audio_Mixer_SetActive(&AudioMixer, AUDIO_MIXER_MEDIA,
+                        (usbd_audio_AltSet != 0) && (AudioRefill == 0));
+  
+  while (frames != 0)
+  {
+    n = (frames < AUDIO_EQ_BLOCK_MAX) ? frames : AUDIO_EQ_BLOCK_MAX;
+    
+    if (usbd_audio_Resolution == 16)
+    {
+      pwork = AudioWork;
+      Audio_Format_S16_Q27_Stereo(p16, pwork, n);
+    }
+    else
+    {
+      pwork = p32;
+      Audio_Format_S32_Q27_Stereo(p32, pwork, n);
+    }
+    
+    cycles = DWT->CYCCNT;
+    Audio_Eq_Process32(&AudioEq, pwork, n);
+    eq += DWT->CYCCNT - cycles;
+    Audio_Volume_Process32(&AudioVolume, pwork, n);
+    cycles = DWT->CYCCNT;
+    Audio_Mixer_Process(&AudioMixer, pwork, pvoice, n);
+    mix += DWT->CYCCNT - cycles;
+    pvoice += n * 2;
+    cycles = DWT->CYCCNT;
+    Audio_Limiter_Process(&AudioLimiter, pwork, n);
+    lim += DWT->CYCCNT - cycles;
+    
+    /* Back to full scale, the overshoots of the limiter saturated */
+    if (usbd_audio_Resolution == 16)
+    {
+      cycles = DWT->CYCCNT;
+      Audio_Dither_Process(&AudioDither, pwork, p16, n);
+      dit += DWT->CYCCNT - cycles;
+      Audio_Ramp_Process(&AudioRamp, p16, n);
+      p16 += n * 2;
+    }
+    else
+    {
+      Audio_Format_Q27_S32_Stereo(p32, p32, n);
+      Audio_Ramp_Process32(&AudioRamp, p32, n);
+      p32 += n * 2;
+    }
+    frames -= n;
+  }
+  
+  AudioEqCycles = eq;
+  if (eq > AudioEqCyclesMax)
+  {
+    AudioEqCyclesMax = eq;
+  }
+  AudioMixerCycles = mix;
+  if (mix > AudioMixerCyclesMax)
+  {
+    AudioMixerCyclesMax = mix;
+  }
+  AudioLimiterCycles = lim;
+  if (lim > AudioLimiterCyclesMax)
+  {
+    AudioLimiterCyclesMax = lim;
+  }
+  AudioDitherCycles = dit;
+  if (dit > AudioDitherCyclesMax)
+  {
+    AudioDitherCyclesMax = dit;
+  }
+}
+
+/**
+  * @brief  AUDIO_VoiceRender
+  *         Converts the voice frames of a block from the voice ring into
+  *         VoiceBlock and applies the voice volume. The nominal conversion
+  *         ratio is the voice over the output sampling frequency, and is
+  *         steered around from the ring fill error towards the rate the host
+  *         sends at: the voice endpoint is adaptive. Until the ring is at its depth, and after an underrun,
+  *         the block is concealed down to silence.
+  * @param  frames: number of frames to produce
+  * @retval None
+  */
+static void AUDIO_VoiceRender(uint32_t frames)
+{
+  uint8_t *pdst = (uint8_t*)VoiceBlock;
+  uint32_t done = 0;
+  uint8_t *psrc;
+  uint32_t avail;
+  uint32_t in_frames;
+  uint32_t out_frames;
+  uint32_t target = AUDIO_VOICE_TARGET_FILL(VoiceFreq);
+  
+  /* Start once the fade out of the last voice is over and the ring has
+     been filled */
+  if ((VoicePlay == 0) && (VoiceConceal.gain == 0) &&
+      (Audio_Ring_Fill(&VoiceRing) >= target))
+  {
+    Audio_ASRC_Init(&VoiceAsrc);
+    VoicePlay = 1;
+  }
+  
+  if (VoicePlay == 0)
+  {
+    Audio_Conceal_Underrun(&VoiceConceal, pdst, frames);
+  }
+  else
+  {
+    /* Either frequency may change while the voice plays */
+    Audio_ASRC_SetRatio(&VoiceAsrc, VoiceFreq, usbd_audio_Freq);
+    Audio_ASRC_Steer(&VoiceAsrc,
+                     (int32_t)(Audio_Ring_Fill(&VoiceRing) / AUDIO_FRAME_SIZE(16)) -
+                     (int32_t)(target / AUDIO_FRAME_SIZE(16)));
+    
+    while (done < frames)
+    {
+      psrc = Audio_Ring_Peek(&VoiceRing, &avail);
+      in_frames = avail / AUDIO_FRAME_SIZE(16);
+      out_frames = frames - done;
+      Audio_ASRC_Process(&VoiceAsrc,
+                         (const int16_t*)psrc, &in_frames,
+                         (int16_t*)(pdst + (done * AUDIO_FRAME_SIZE(16))), &out_frames);
+      Audio_Ring_Consume(&VoiceRing, in_frames * AUDIO_FRAME_SIZE(16));
+      done += out_frames;
+      
+      if ((in_frames == 0) && (out_frames == 0))
+      {/* Ring empty */
+        break;
+      }
+    }
+    
+    /* Fade in from silence, and keep the last frames played */
+    Audio_Conceal_FadeIn(&VoiceConceal, pdst, done);
+    Audio_Conceal_Save(&VoiceConceal, pdst, done);
+    
+    /* The host stopped the voice, or is late: fade out, then wait for the
+       ring to be at its depth again */
+    if (done < frames)
+    {
+      Audio_Conceal_Underrun(&VoiceConceal, pdst + (done * AUDIO_FRAME_SIZE(16)), frames - done);
+      VoiceUnderruns++;
+      VoicePlay = 0;
+    }
+  }
+  
+  Audio_Volume_Process(&VoiceVolume, VoiceBlock, frames);
+  Audio_Mixer_SetActive(&AudioMixer, AUDIO_MIXER_VOICE, VoicePlay);
+}
+#endif /* USBD_AUDIO_VERIFY */
+
+/**
+  * @brief  AUDIO_Play
+  *         Starts the circular playback of the DMA buffer on silence. From
+  *         now on the DMA runs freely and each half is refilled by the task.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_Play(void)
+{
+  memset(AudioOutDmaBuff, 0, sizeof(AudioOutDmaBuff));
+  AudioOutPlayCount = 0;
+  AudioDmaDoneCount = AudioDmaIrqCount;
+  
+  /* The stream ramps up from silence */
+  Audio_Ramp_Init(&AudioRamp, AUDIO_RAMP_FRAMES(usbd_audio_Freq), USBD_AUDIO_RAMP_SHAPE, 0);
+  taskENTER_CRITICAL();
+  AUDIO_RampUpdate();
+  taskEXIT_CRITICAL();
+  PlayFlag = 1;
+  AUDIO_OUT_fops.AudioCmd((uint8_t*)(AudioOutDmaBuff), /* Samples buffer pointer */
+                          AudioDmaBufSize,             /* Number of samples in Bytes */
+                          AUDIO_CMD_PLAY);             /* Command to be processed */
+  
+  /* Time from the stream start to the I2S output */
+  if (AudioWakePending != 0)
+  {
+    AudioWakePending = 0;
+    AudioWakeLast = (DWT->CYCCNT - AudioWakeStamp) / (SystemCoreClock / 1000000);
+    if (AudioWakeLast > AudioWakeMax)
+    {
+      AudioWakeMax = AudioWakeLast;
+    }
+  }
+}
+
+/**
+  * @brief  AUDIO_StreamReset
+  *         Empties the ring and goes back to prebuffering. The DMA must have
+  *         been stopped or paused by the caller.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_StreamReset(void)
+{
+  /* Stop entering play loop */
+  PlayFlag = 0;
+  AudioRefill = 0;
+  
+  /* Drop the buffered samples and the packets not queued yet: the next
+     resume prebuffers again */
+  IsocOutRxTail = IsocOutRxHead;
+  Audio_Ring_Flush(&IsocOutRing);
+#ifdef USBD_AUDIO_VERIFY
+  Audio_Verify_Flush(&AudioVerify);
+#endif
+  
+  /* The voice prebuffers again as well, from silence */
+  VoiceRxTail = VoiceRxHead;
+  Audio_Ring_Flush(&VoiceRing);
+  VoicePlay = 0;
+#ifndef USBD_AUDIO_VERIFY
+  Audio_Conceal_Init(&VoiceConceal, AUDIO_FRAME_SIZE(16), AUDIO_RAMP_FRAMES(usbd_audio_Freq),
+                     USBD_AUDIO_RAMP_SHAPE);
+#endif
+  
+  /* The flushed packets will never be played out */
+  AudioProbeRendered = AudioProbeHead;
+  AudioProbeTail = AudioProbeHead;
+  AudioProbeRenderedBytes = AudioProbeQueuedBytes;
+}
+
+/**
+  * @brief  AUDIO_UpdateTarget
+  *         Converts the jitter buffer depth into the ring fill level of the
+  *         current format. The ring is sized for half of it to hold the
+  *         deepest profile in every format (usbd_audio_core.h), the other
+  *         half being kept free above it for the fill variations.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_UpdateTarget(void)
+{
+  uint32_t frames;
+  
+  frames = (uint32_t)(((uint64_t)Audio_Jitter_Target(&AudioJitter) * usbd_audio_Freq) / 1000000);
+  AudioTargetFill = frames * AudioFrameSize;
+}
+
+/**
+  * @brief  AUDIO_SetFormat
+  *         Switches the stream to a new sampling frequency and resolution:
+  *         the I2S is reprogrammed and the buffer sizes are recomputed.
+  * @param  freq: sampling frequency requested by the host
+  * @param  res: bits per sample of the active alternate setting
+  * @retval status
+  */
+static uint8_t AUDIO_SetFormat(uint32_t freq, uint32_t res)
+{
+  if ((freq != USBD_AUDIO_FREQ_1) && (freq != USBD_AUDIO_FREQ_2) && 
+      (freq != USBD_AUDIO_FREQ_3))
+  {
+    return USBD_FAIL;
+  }
+  
+  if ((freq == usbd_audio_Freq) && (res == usbd_audio_Resolution))
+  {
+    return USBD_OK;
+  }
+  
+  /* Drop the samples received in the previous format. The DMA is stopped by
+     the audio interface before the I2S is reconfigured, once the output has
+     been ramped down. */
+  AUDIO_FadeOut();
+  AUDIO_StreamReset();
+  if (AUDIO_OUT_fops.SetFormat(freq, res) != AUDIO_OK)
+  {
+    /* The stream stays stopped: the interface refuses to play */
+    AudioFormatErrors++;
+    return USBD_FAIL;
+  }
+  
+  /* The OUT and SOF interrupts read the format and the feedback state */
+  taskENTER_CRITICAL();
+  usbd_audio_Freq = freq;
+  usbd_audio_Resolution = res;
+  AudioFrameSize = AUDIO_FRAME_SIZE(res);
+  AudioDmaHalfFrames = AUDIO_DMA_HALF_FRAMES(freq);
+  AudioDmaBufSize = AUDIO_DMA_BUF_SIZE(freq, res);
+  Audio_Ring_Init(&IsocOutRing, IsocOutBuff, AUDIO_OUT_RING_SIZE_MAX);
+  Audio_Conceal_Init(&AudioConceal, AudioFrameSize, AUDIO_RAMP_FRAMES(freq),
+                     USBD_AUDIO_RAMP_SHAPE);
+  Audio_Volume_SetRamp(&AudioVolume, AUDIO_RAMP_FRAMES(freq));
+  Audio_Volume_SetRamp(&VoiceVolume, AUDIO_RAMP_FRAMES(freq));
+#ifndef USBD_AUDIO_VERIFY
+  Audio_Conceal_Init(&VoiceConceal, AUDIO_FRAME_SIZE(16), AUDIO_RAMP_FRAMES(freq),
+                     USBD_AUDIO_RAMP_SHAPE);
+#endif
+  Audio_Mixer_SetRamp(&AudioMixer, (freq * USBD_AUDIO_DUCK_MS) / 1000);
+  Audio_Ramp_SetLength(&AudioRamp, AUDIO_RAMP_FRAMES(freq));
+  Audio_Eq_SetRate(&AudioEq, freq);
+  Audio_Eq_Commit(&AudioEq);
+  Audio_Limiter_SetRate(&AudioLimiter, freq);
+  Audio_Dither_SetRate(&AudioDither, freq);
+#ifdef USBD_AUDIO_VERIFY
+  Audio_Verify_Flush(&AudioVerify);
+#endif
+  Audio_Jitter_Restart(&AudioJitter);
+  AUDIO_UpdateTarget();
+  AudioClockErrorPpb = AUDIO_OUT_fops.GetClockError();
+  
+  /* Restart the feedback measurement from the new nominal rate */
+  AudioMissingAcc = 0;
+  AudioMissingRun = 0;
+  FeedbackValue = AUDIO_FB_NOMINAL(freq);
+  FeedbackRate = 0;
+  FeedbackSofCount = 0;
+  FeedbackRefValid = 0;
+  taskEXIT_CRITICAL();
+  
+  return USBD_OK;
+}
+
+/**
+  * @brief  AUDIO_RequestFormat
+  *         Records the format requested by the host and lets the audio task
+  *         apply it: reprogramming the I2S does not belong in the interrupt.
+  * @param  freq: sampling frequency requested by the host
+  * @param  res: bits per sample of the active alternate setting
+  * @retval status
+  */
+static uint8_t AUDIO_RequestFormat(uint32_t freq, uint32_t res)
+{
+  if ((freq != USBD_AUDIO_FREQ_1) && (freq != USBD_AUDIO_FREQ_2) && 
+      (freq != USBD_AUDIO_FREQ_3))
+  {
+    return USBD_FAIL;
+  }
+  
+  AudioReqFreq = freq;
+  AudioReqResolution = res;
+  AUDIO_Notify(AUDIO_EVT_FORMAT);
+  
+  return USBD_OK;
+}
+
+/******************************************************************************
+     AUDIO task
+******************************************************************************/
+/**
+  * @brief  AUDIO_Task
+  *         Runs the stream processing at the highest task priority: format
+  *         changes, ring management, rendering of the DMA buffer halves.
+  *         The interrupts only record their events and notify it.
+  * @param  pvParameters: not used
+  * @retval None
+  */
+static void AUDIO_Task(void *pvParameters)
+{
+  AUDIO_LimiterConfigTypeDef limiter;
+  uint32_t events;
+  TickType_t wait;
+  
+  (void)pvParameters;
+  
+  for (;;)
+  {
+    /* Wait for the events, or for the end of the idle timeout */
+    wait = portMAX_DELAY;
+    if (AudioIdleArmed != 0)
+    {
+      wait = AudioIdleDeadline - xTaskGetTickCount();
+      if ((int32_t)wait < 0)
+      {
+        wait = 0;
+      }
+    }
+    
+    if (xTaskNotifyWait(0, 0xFFFFFFFF, &events, wait) != pdTRUE)
+    {
+      AUDIO_Idle();
+      continue;
+    }
+    
+    /* A stream start wakes the codec up before its format is applied */
+    if (events & AUDIO_EVT_STREAM)
+    {
+      AUDIO_StreamChange();
+    }
+    
+    if (events & AUDIO_EVT_FORMAT)
+    {
+      AUDIO_SetFormat(AudioReqFreq, AudioReqResolution);
+    }
+    
+    if (events & AUDIO_EVT_EQ)
+    {
+      AUDIO_EqUpdate();
+    }
+    
+    if (events & AUDIO_EVT_LIMITER)
+    {
+      /* The request may be overwritten by the control interrupt */
+      taskENTER_CRITICAL();
+      limiter = AudioLimiterReq;
+      taskEXIT_CRITICAL();
+      Audio_Limiter_Config(&AudioLimiter, &limiter);
+    }
+    
+    if (events & AUDIO_EVT_PROFILE)
+    {
+      Audio_Jitter_SetProfile(&AudioJitter, AudioReqProfile);
+      AudioProfileCur = (uint8_t)AudioJitter.profileIndex;
+      AUDIO_UpdateTarget();
+    }
+    
+    if (events & AUDIO_EVT_PACKET)
+    {
+      AUDIO_QueuePackets();
+    }
+    
+    if (events & AUDIO_EVT_VOICE)
+    {
+      AUDIO_VoiceQueue();
+    }
+    
+    AUDIO_RenderEvents(events);
+  }
+}
+
+/**
+  * @brief  AUDIO_RenderEvents
+  *         Refills the DMA buffer halves left by the DMA events.
+  * @param  events: AUDIO_EVT_xxx flags
+  * @retval None
+  */
+static void AUDIO_RenderEvents(uint32_t events)
+{
+  if (((events & (AUDIO_EVT_DMA_HALF | AUDIO_EVT_DMA_FULL)) == 0) || (PlayFlag == 0))
+  {
+    return;
+  }
+  
+  AUDIO_TaskLatency(AudioDmaStamp);
+  
+  /* More than one event since the last pass: a half has been played
+     before it could be refilled */
+  if ((AudioDmaIrqCount - AudioDmaDoneCount) > 1)
+  {
+    AudioDmaMissed++;
+  }
+  AudioDmaDoneCount = AudioDmaIrqCount;
+  AUDIO_ProbeDrain();
+  
+  /* The DMA now plays the other half: refill the one it has just left */
+  if (events & AUDIO_EVT_DMA_HALF)
+  {
+    AUDIO_Render((uint8_t*)AudioOutDmaBuff, AudioDmaHalfFrames);
+  }
+  if (events & AUDIO_EVT_DMA_FULL)
+  {
+    AUDIO_Render((uint8_t*)AudioOutDmaBuff + (AudioDmaBufSize / 2), AudioDmaHalfFrames);
+  }
+}
+
+/**
+  * @brief  AUDIO_RampUpdate
+  *         Points the output ramp to silence while stopping, to unity
+  *         otherwise. Called from the task within a critical section.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_RampUpdate(void)
+{
+  Audio_Ramp_Start(&AudioRamp, (AudioStopping != 0) ? 0 : AUDIO_RAMP_UNITY);
+}
+
+/**
+  * @brief  AUDIO_FadeOut
+  *         Ramps a running stream down to silence before its DMA is stopped.
+  *         The DMA halves keep being rendered until the end of the ramp has
+  *         been played and the DMA plays a silent half. The packets received
+  *         meanwhile are queued, the other events are notified again.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_FadeOut(void)
+{
+  uint32_t events;
+  uint32_t pending = 0;
+  uint32_t silent = 0;
+  uint32_t passes = 0;
+  
+  if (PlayFlag == 0)
+  {
+    return;
+  }
+  
+  taskENTER_CRITICAL();
+  AudioStopping = 1;
+  AUDIO_RampUpdate();
+  taskEXIT_CRITICAL();
+  
+  /* Once the ramp is over, the half rendered last holds its end: the DMA
+     plays silence from the second half rendered after it */
+  while ((silent < 3) && (passes < AUDIO_FADE_OUT_PASSES))
+  {
+    if (xTaskNotifyWait(0, 0xFFFFFFFF, &events, pdMS_TO_TICKS(AUDIO_FADE_OUT_WAIT_MS)) != pdTRUE)
+    {
+      break;
+    }
+    pending |= events & ~(AUDIO_EVT_PACKET | AUDIO_EVT_VOICE |
+                          AUDIO_EVT_DMA_HALF | AUDIO_EVT_DMA_FULL);
+    
+    if (events & AUDIO_EVT_PACKET)
+    {
+      AUDIO_QueuePackets();
+    }
+    if (events & AUDIO_EVT_VOICE)
+    {
+      AUDIO_VoiceQueue();
+    }
+    if (events & (AUDIO_EVT_DMA_HALF | AUDIO_EVT_DMA_FULL))
+    {
+      AUDIO_RenderEvents(events);
+      passes++;
+      if (Audio_Ramp_Done(&AudioRamp))
+      {
+        silent++;
+      }
+    }
+  }
+  
+  AudioStopping = 0;
+  if (pending != 0)
+  {
+    xTaskNotify(AudioTaskHandle, pending, eSetBits);
+  }
+}
+
+/**
+  * @brief  AUDIO_EqRequest
+  *         Records the equalizer band received with a vendor request, for
+  *         the channels of its mask, and lets the audio task design it.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_EqRequest(void)
+{
+  AUDIO_EqBandTypeDef band;
+  uint32_t index = LOBYTE(AudioCtlEqBand);
+  uint32_t mask = HIBYTE(AudioCtlEqBand);
+  uint32_t ch;
+  
+  band.type = AudioCtl[0];
+  band.freq = (uint16_t)(AudioCtl[2] | ((uint16_t)AudioCtl[3] << 8));
+  band.gain = (int16_t)(AudioCtl[4] | ((uint16_t)AudioCtl[5] << 8));
+  band.q = (uint16_t)(AudioCtl[6] | ((uint16_t)AudioCtl[7] << 8));
+  if (band.type >= AUDIO_EQ_TYPE_NUM)
+  {
+    return;
+  }
+  
+  for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+  {
+    if (mask & (1 << ch))
+    {
+      AudioEqReq[ch][index] = band;
+      AudioEqDirty |= (uint32_t)1 << ((16 * ch) + index);
+    }
+  }
+  AUDIO_Notify(AUDIO_EVT_EQ);
+}
+
+/**
+  * @brief  AUDIO_EqUpdate
+  *         Designs the equalizer bands requested by the host and swaps the
+  *         new cascades in before the next block is rendered.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_EqUpdate(void)
+{
+  AUDIO_EqBandTypeDef band;
+  uint32_t dirty, ch, i;
+  
+  for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+  {
+    for (i = 0; i < AUDIO_EQ_BANDS_MAX; i++)
+    {
+      /* The request may be overwritten by the control interrupt */
+      taskENTER_CRITICAL();
+      dirty = AudioEqDirty & ((uint32_t)1 << ((16 * ch) + i));
+      AudioEqDirty &= ~dirty;
+      band = AudioEqReq[ch][i];
+      taskEXIT_CRITICAL();
+      
+      if (dirty != 0)
+      {
+        Audio_Eq_SetBand(&AudioEq, ch, i, &band);
+      }
+    }
+  }
+  
+  Audio_Eq_Commit(&AudioEq);
+}
+
+/**
+  * @brief  AUDIO_LimiterRequest
+  *         Records the limiter configuration received with a vendor request
+  *         and lets the audio task apply it.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_LimiterRequest(void)
+{
+  AudioLimiterReq.threshold = (int16_t)(AudioCtl[0] | ((uint16_t)AudioCtl[1] << 8));
+  AudioLimiterReq.ratio = (uint16_t)(AudioCtl[2] | ((uint16_t)AudioCtl[3] << 8));
+  AudioLimiterReq.attackUs = (uint16_t)(AudioCtl[4] | ((uint16_t)AudioCtl[5] << 8));
+  AudioLimiterReq.releaseMs = (uint16_t)(AudioCtl[6] | ((uint16_t)AudioCtl[7] << 8));
+  AudioLimiterReq.lookaheadUs = (uint16_t)(AudioCtl[8] | ((uint16_t)AudioCtl[9] << 8));
+  AUDIO_Notify(AUDIO_EVT_LIMITER);
+}
+
+/**
+  * @brief  AUDIO_StreamChange
+  *         Follows the alternate settings selected by the host: the start of
+  *         either stream wakes up a sleeping codec, the end of both arms the
+  *         idle timeout. The voice alone sets the output sampling frequency.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_StreamChange(void)
+{
+  if ((usbd_audio_AltSet != 0) || (VoiceAltSet != 0))
+  {
+    AudioIdleArmed = 0;
+    if (AUDIO_OUT_fops.GetState() == AUDIO_STATE_SLEEPING)
+    {
+      AUDIO_OUT_fops.AudioCmd(NULL, 0, AUDIO_CMD_WAKE);
+    }
+    if ((usbd_audio_AltSet == 0) && (VoiceFreq != usbd_audio_Freq))
+    {
+      AUDIO_SetFormat(VoiceFreq, usbd_audio_Resolution);
+    }
+  }
+  else if (USBD_AUDIO_IDLE_TIMEOUT_MS != 0)
+  {
+    AudioIdleDeadline = xTaskGetTickCount() + pdMS_TO_TICKS(USBD_AUDIO_IDLE_TIMEOUT_MS);
+    AudioIdleArmed = 1;
+  }
+}
+
+/**
+  * @brief  AUDIO_Idle
+  *         Puts the codec and the I2S clocks to sleep once the zero bandwidth
+  *         alternate setting has been kept for the idle timeout.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_Idle(void)
+{
+  AudioIdleArmed = 0;
+  if ((usbd_audio_AltSet != 0) || (VoiceAltSet != 0))
+  {
+    return;
+  }
+  
+  /* Stop the playback of the last stream and drop what is left of it */
+  AUDIO_FadeOut();
+  if (AUDIO_OUT_fops.GetState() == AUDIO_STATE_PLAYING)
+  {
+    AUDIO_OUT_fops.AudioCmd(NULL, 0, AUDIO_CMD_STOP);
+  }
+  AUDIO_StreamReset();
+  
+  if ((AUDIO_OUT_fops.GetState() != AUDIO_STATE_SLEEPING) &&
+      (AUDIO_OUT_fops.AudioCmd(NULL, 0, AUDIO_CMD_SLEEP) == AUDIO_OK))
+  {
+    AudioPowerDowns++;
+  }
+}
+
+/**
+  * @brief  AUDIO_Notify
+  *         Notifies events to the audio task from an interrupt handler.
+  * @param  events: AUDIO_EVT_xxx flags
+  * @retval None
+  */
+static void AUDIO_Notify(uint32_t events)
+{
+  BaseType_t woken = pdFALSE;
+  
+  if (AudioTaskHandle != NULL)
+  {
+    xTaskNotifyFromISR(AudioTaskHandle, events, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
+
+/**
+  * @brief  AUDIO_QueueMissing
+  *         Queues a synthesized packet in place of one the device missed.
+  *         Its length is the one the host sent on average since the feedback
+  *         value was last read, so that the ring keeps its fill level.
+  * @param  pkt: reception slot to synthesize the packet into
+  * @retval None
+  */
+static void AUDIO_QueueMissing(uint8_t *pkt)
+{
+  uint32_t frames;
+  uint32_t count;
+  
+  AudioMissingAcc += FeedbackValue;
+  frames = AudioMissingAcc >> 14;
+  AudioMissingAcc &= (1U << 14) - 1;
+  count = frames * AudioFrameSize;
+  if (count > AUDIO_OUT_PACKET_MAX)
+  {
+    count = AUDIO_OUT_PACKET_MAX - (AUDIO_OUT_PACKET_MAX % AudioFrameSize);
+  }
+  
+  if ((AudioMissingRun >= AUDIO_OUT_MISSING_MAX) ||
+      (Audio_Ring_Space(&IsocOutRing) < count))
+  {
+#ifdef USBD_AUDIO_VERIFY
+    Audio_Verify_Missing(&AudioVerify, 0);
+#endif
+    return;
+  }
+  AudioMissingRun++;
+  
+  /* A second missed packet continues the first one */
+  Audio_Conceal_Missing(&AudioConceal, pkt, count);
+  Audio_Ring_Write(&IsocOutRing, pkt, count);
+  Audio_Conceal_Queued(&AudioConceal, pkt, count);
+#ifdef USBD_AUDIO_VERIFY
+  Audio_Verify_Missing(&AudioVerify, count);
+#endif
+  
+  /* Not tracked by the latency probes, but part of the stream */
+  AudioProbeQueuedBytes += count;
+}
+
+/**
+  * @brief  AUDIO_QueuePackets
+  *         Copies the packets received by the interrupt into the ring, and
+  *         starts the playback once the ring holds the jitter buffer depth.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_QueuePackets(void)
+{
+  uint32_t slot;
+  uint32_t count;
+  uint8_t *pkt;
+  
+  while (IsocOutRxTail != IsocOutRxHead)
+  {
+    __DMB();
+    slot = IsocOutRxTail % AUDIO_OUT_RX_SLOTS;
+    pkt = IsocOutRxBuff[slot];
+    count = IsocOutRxLen[slot];
+    AUDIO_TaskLatency(IsocOutRxStamp[slot]);
+    Audio_Jitter_Arrival(&AudioJitter, IsocOutRxStamp[slot]);
+    
+    if (count == AUDIO_OUT_RX_MISSING)
+    {
+      AUDIO_QueueMissing(pkt);
+      __DMB();
+      IsocOutRxTail++;
+      continue;
+    }
+    AudioMissingRun = 0;
+    Audio_Probe_Record(&AudioProbe, AUDIO_PROBE_FIFO,
+                       IsocOutRxStamp[slot] - IsocOutRxFifoStamp[slot]);
+    Audio_Probe_Record(&AudioProbe, AUDIO_PROBE_HANDOFF,
+                       DWT->CYCCNT - IsocOutRxStamp[slot]);
+    
+    /* Copy the packet after the previous one, unless it would overwrite
+       samples the DMA has not played yet: the packet is then dropped, and
+       crossfaded into the next one to hide the gap */
+    if (Audio_Ring_Space(&IsocOutRing) >= count)
+    {
+#ifdef USBD_AUDIO_VERIFY
+      Audio_Verify_Input(&AudioVerify, pkt, count);
+#endif
+      Audio_Conceal_Resume(&AudioConceal, pkt, count);
+    }
+    if (Audio_Ring_Write(&IsocOutRing, pkt, count) == 0)
+    {
+#ifdef USBD_AUDIO_VERIFY
+      Audio_Verify_Drop(&AudioVerify);
+#endif
+      Audio_Conceal_Overrun(&AudioConceal, pkt, count);
+    }
+    else
+    {
+      Audio_Conceal_Queued(&AudioConceal, pkt, count);
+      AUDIO_ProbeQueue(slot, count);
+    }
+    
+    /* Give the slot back to the interrupt */
+    __DMB();
+    IsocOutRxTail++;
+  }
+  AUDIO_UpdateTarget();
+  
+  /* Start the playback once the ring holds the jitter buffer depth */
+  if ((PlayFlag == 0) && (Audio_Ring_Fill(&IsocOutRing) >= AudioTargetFill))
+  {
+    AUDIO_Play();
+  }
+}
+
+/**
+  * @brief  AUDIO_VoiceQueue
+  *         Copies the voice packets received by the interrupt into the voice
+  *         ring, at the voice sampling frequency whatever the output one:
+  *         AUDIO_VoiceRender() converts them. The voice alone starts the playback, the media stream
+  *         being concealed as silence until it has been prebuffered.
+  *         With USBD_AUDIO_VERIFY defined, the voice packets are dropped.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_VoiceQueue(void)
+{
+#ifndef USBD_AUDIO_VERIFY
+  uint32_t slot;
+#endif
+  
+  while (VoiceRxTail != VoiceRxHead)
+  {
+    __DMB();
+#ifndef USBD_AUDIO_VERIFY
+    slot = VoiceRxTail % AUDIO_OUT_RX_SLOTS;
+    if (VoiceAltSet != 0)
+    {
+      /* Dropped on an overrun: the converter catches up on the fill */
+      Audio_Ring_Write(&VoiceRing, VoiceRxBuff[slot], VoiceRxLen[slot]);
+    }
+#endif
+    __DMB();
+    VoiceRxTail++;
+  }
+  
+  if ((PlayFlag == 0) && (usbd_audio_AltSet == 0) &&
+      (Audio_Ring_Fill(&VoiceRing) >= AUDIO_VOICE_TARGET_FILL(VoiceFreq)))
+  {
+    /* The media stream starts concealed, from a clean history */
+    Audio_Conceal_Init(&AudioConceal, AudioFrameSize, AUDIO_RAMP_FRAMES(usbd_audio_Freq),
+                       USBD_AUDIO_RAMP_SHAPE);
+    AudioRefill = 1;
+    AUDIO_Play();
+  }
+}
+
+/**
+  * @brief  AUDIO_TaskLatency
+  *         Tracks the largest delay between an interrupt and its processing.
+  * @param  stamp: DWT cycle count recorded by the interrupt
+  * @retval None
+  */
+static void AUDIO_TaskLatency(uint32_t stamp)
+{
+  uint32_t latency = DWT->CYCCNT - stamp;
+  
+  if (latency > AudioTaskLatencyMax)
+  {
+    AudioTaskLatencyMax = latency;
+  }
+}
+
+/**
+  * @brief  AUDIO_ProbeQueue
+  *         Starts tracking a packet queued into the ring. Packets are not
+  *         tracked while AUDIO_PROBE_PACKETS of them are in flight.
+  * @param  slot: reception slot of the packet
+  * @param  queued: packet length in bytes
+  * @retval None
+  */
+static void AUDIO_ProbeQueue(uint32_t slot, uint32_t queued)
+{
+  AUDIO_ProbePacketTypeDef *p;
+  
+  if ((AudioProbeHead - AudioProbeTail) < AUDIO_PROBE_PACKETS)
+  {
+    p = &AudioProbePkt[AudioProbeHead % AUDIO_PROBE_PACKETS];
+    p->fifo = IsocOutRxFifoStamp[slot];
+    p->queued = DWT->CYCCNT;
+    p->offset = AudioProbeQueuedBytes;
+    AudioProbeHead++;
+  }
+  AudioProbeQueuedBytes += queued;
+}
+
+/**
+  * @brief  AUDIO_ProbeRender
+  *         Time stamps the packets whose first sample has just been rendered
+  *         into the DMA buffer half the DMA left at event AudioDmaDoneCount.
+  *         That half is played during the next event and has been played
+  *         out at the one after.
+  * @param  bytes: number of bytes just consumed from the ring
+  * @retval None
+  */
+static void AUDIO_ProbeRender(uint32_t bytes)
+{
+  AUDIO_ProbePacketTypeDef *p;
+  uint32_t now = DWT->CYCCNT;
+  
+  AudioProbeRenderedBytes += bytes;
+  while (AudioProbeRendered != AudioProbeHead)
+  {
+    p = &AudioProbePkt[AudioProbeRendered % AUDIO_PROBE_PACKETS];
+    if ((int32_t)(AudioProbeRenderedBytes - p->offset) <= 0)
+    {
+      break;
+    }
+    p->render = now;
+    p->drainEvent = AudioDmaDoneCount + 2;
+    AudioProbeRendered++;
+  }
+}
+
+/**
+  * @brief  AUDIO_ProbeDrain
+  *         Records the latencies of the packets played out by the I2S at the
+  *         DMA event being handled.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_ProbeDrain(void)
+{
+  AUDIO_ProbePacketTypeDef *p;
+  
+  while (AudioProbeTail != AudioProbeRendered)
+  {
+    p = &AudioProbePkt[AudioProbeTail % AUDIO_PROBE_PACKETS];
+    if ((int32_t)(AudioDmaDoneCount - p->drainEvent) < 0)
+    {
+      break;
+    }
+    Audio_Probe_Record(&AudioProbe, AUDIO_PROBE_RING, p->render - p->queued);
+    Audio_Probe_Record(&AudioProbe, AUDIO_PROBE_DMA, AudioDmaStamp - p->render);
+    Audio_Probe_Record(&AudioProbe, AUDIO_PROBE_TOTAL, AudioDmaStamp - p->fifo);
+    AudioProbeTail++;
+  }
+}
+
+/******************************************************************************
+     AUDIO Class requests management
+******************************************************************************/
+/**
+  * @brief  AUDIO_Req_GetCurrent
+  *         Handles the GET_CUR Audio control request.
+  * @param  pdev: instance
+  * @param  req: setup class request
+  * @retval status
+  */
+static void AUDIO_Req_GetCurrent(void *pdev, USB_SETUP_REQ *req)
+{  
+  uint32_t voice = (HIBYTE(req->wIndex) == AUDIO_VOICE_STREAMING_CTRL) ? 1 : 0;
+  uint32_t freq;
+  
+  if (((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_ENDPOINT) &&
+      (HIBYTE(req->wValue) == AUDIO_SAMPLING_FREQ_CONTROL))
+  {
+    /* Send the current sampling frequency on 3 bytes */
+    freq = (LOBYTE(req->wIndex) == AUDIO_VOICE_OUT_EP) ? VoiceFreq : usbd_audio_Freq;
+    AudioCtl[0] = (uint8_t)(freq);
+    AudioCtl[1] = (uint8_t)(freq >> 8);
+    AudioCtl[2] = (uint8_t)(freq >> 16);
+    USBD_CtlSendData (pdev, 
+                      AudioCtl,
+                      MIN(req->wLength, 3));
+    return;
+  }
+  
+  if (HIBYTE(req->wValue) == AUDIO_VOLUME_CONTROL)
+  {
+    /* Send the current volume on 2 bytes */
+    AudioCtl[0] = (uint8_t)(voice ? VoiceVolume.volume : AudioVolume.volume);
+    AudioCtl[1] = (uint8_t)((uint16_t)(voice ? VoiceVolume.volume : AudioVolume.volume) >> 8);
+    USBD_CtlSendData (pdev, 
+                      AudioCtl,
+                      MIN(req->wLength, 2));
+    return;
+  }
+  
+  /* Send the current mute state */
+  AudioCtl[0] = voice ? VoiceMute : AudioMute;
+  USBD_CtlSendData (pdev, 
+                    AudioCtl,
+                    MIN(req->wLength, 1));
+}
+
+/**
+  * @brief  AUDIO_Req_GetRange
+  *         Handles the GET_MIN, GET_MAX and GET_RES Audio control requests.
+  *         Only the volume control has a range.
+  * @param  pdev: instance
+  * @param  req: setup class request
+  * @retval status
+  */
+static void AUDIO_Req_GetRange(void *pdev, USB_SETUP_REQ *req)
+{
+  int16_t value;
+  
+  if (((req->bmRequest & USB_REQ_RECIPIENT_MASK) != USB_REQ_RECIPIENT_INTERFACE) ||
+      ((HIBYTE(req->wIndex) != AUDIO_OUT_STREAMING_CTRL) &&
+       (HIBYTE(req->wIndex) != AUDIO_VOICE_STREAMING_CTRL)) ||
+      (HIBYTE(req->wValue) != AUDIO_VOLUME_CONTROL))
+  {
+    USBD_CtlError (pdev, req);
+    return;
+  }
+  
+  switch (req->bRequest)
+  {
+  case AUDIO_REQ_GET_MIN:
+    value = AUDIO_VOLUME_MIN;
+    break;
+    
+  case AUDIO_REQ_GET_MAX:
+    value = AUDIO_VOLUME_MAX;
+    break;
+    
+  default:
+    value = AUDIO_VOLUME_RES;
+    break;
+  }
+  
+  AudioCtl[0] = (uint8_t)(value);
+  AudioCtl[1] = (uint8_t)((uint16_t)value >> 8);
+  USBD_CtlSendData (pdev, 
+                    AudioCtl,
+                    MIN(req->wLength, 2));
+}
+
+/**
+  * @brief  AUDIO_Req_SetCurrent
+  *         Handles the SET_CUR Audio control request.
+  * @param  pdev: instance
+  * @param  req: setup class request
+  * @retval status
+  */
+static void AUDIO_Req_SetCurrent(void *pdev, USB_SETUP_REQ *req)
+{ 
+  if (req->wLength)
+  {
+    /* Prepare the reception of the buffer over EP0 */
+    USBD_CtlPrepareRx (pdev, 
+                       AudioCtl,
+                       req->wLength);
+    
+    /* Set the global variables indicating current request and its length 
+    to the function usbd_audio_EP0_RxReady() which will process the request */
+    AudioCtlCmd = AUDIO_REQ_SET_CUR;     /* Set the request value */
+    AudioCtlLen = req->wLength;          /* Set the request data length */
+    if ((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_ENDPOINT)
+    {
+      AudioCtlEp = LOBYTE(req->wIndex);  /* Set the request target endpoint */
+      AudioCtlUnit = 0;
+    }
+    else
+    {
+      AudioCtlEp = 0;
+      AudioCtlUnit = HIBYTE(req->wIndex);/* Set the request target unit */
+    }
+    AudioCtlCS = HIBYTE(req->wValue);    /* Set the request control selector */
+  }
+}
+
+/**
+  * @brief  AUDIO_Req_Vendor
+  *         Handles the vendor requests of the AudioControl interface: the
+  *         selection of the latency profile, the equalizer bands and the
+  *         limiter configuration are applied by the audio task, the ducking
+  *         depths by the mixer.
+  * @param  pdev: instance
+  * @param  req: setup class request
+  * @retval status
+  */
+static void AUDIO_Req_Vendor(void *pdev, USB_SETUP_REQ *req)
+{
+  const AUDIO_EqBandTypeDef *band;
+  int32_t gain;
+  
+  /* Only addressed to the AudioControl interface */
+  if (((req->bmRequest & USB_REQ_RECIPIENT_MASK) != USB_REQ_RECIPIENT_INTERFACE) ||
+      (LOBYTE(req->wIndex) != AUDIO_CONTROL_INTERFACE))
+  {
+    USBD_CtlError (pdev, req);
+    return;
+  }
+  
+  switch (req->bRequest)
+  {
+  case AUDIO_VENDOR_REQ_SET_PROFILE:
+    if ((req->wLength != 0) || (req->wValue >= AUDIO_JITTER_PROFILE_NUM))
+    {
+      USBD_CtlError (pdev, req);
+      break;
+    }
+    AudioReqProfile = req->wValue;
+    AUDIO_Notify(AUDIO_EVT_PROFILE);
+    break;
+    
+  case AUDIO_VENDOR_REQ_GET_PROFILE:
+    USBD_CtlSendData (pdev, &AudioProfileCur, MIN(req->wLength, 1));
+    break;
+    
+  case AUDIO_VENDOR_REQ_SET_EQ_BAND:
+    if ((req->wLength != AUDIO_VENDOR_EQ_BAND_SIZE) ||
+        (LOBYTE(req->wValue) >= AUDIO_EQ_BANDS_MAX) ||
+        (HIBYTE(req->wValue) == 0) ||
+        (HIBYTE(req->wValue) >= (1 << AUDIO_EQ_CHANNELS)))
+    {
+      USBD_CtlError (pdev, req);
+      break;
+    }
+    
+    /* The band is recorded by usbd_audio_EP0_RxReady() */
+    USBD_CtlPrepareRx (pdev, AudioCtl, req->wLength);
+    AudioCtlCmd = AUDIO_VENDOR_REQ_SET_EQ_BAND;
+    AudioCtlLen = req->wLength;
+    AudioCtlEqBand = req->wValue;
+    break;
+    
+  case AUDIO_VENDOR_REQ_GET_EQ_BAND:
+    if ((LOBYTE(req->wValue) >= AUDIO_EQ_BANDS_MAX) ||
+        (HIBYTE(req->wValue) >= AUDIO_EQ_CHANNELS))
+    {
+      USBD_CtlError (pdev, req);
+      break;
+    }
+    band = &AudioEqReq[HIBYTE(req->wValue)][LOBYTE(req->wValue)];
+    AudioCtl[0] = band->type;
+    AudioCtl[1] = 0;
+    AudioCtl[2] = LOBYTE(band->freq);
+    AudioCtl[3] = HIBYTE(band->freq);
+    AudioCtl[4] = LOBYTE((uint16_t)band->gain);
+    AudioCtl[5] = HIBYTE((uint16_t)band->gain);
+    AudioCtl[6] = LOBYTE(band->q);
+    AudioCtl[7] = HIBYTE(band->q);
+    USBD_CtlSendData (pdev, AudioCtl, MIN(req->wLength, AUDIO_VENDOR_EQ_BAND_SIZE));
+    break;
+    
+  case AUDIO_VENDOR_REQ_GET_EQ_LOAD:
+    memcpy(AudioCtl, &AudioEqCycles, 4);
+    memcpy(AudioCtl + 4, &AudioEqCyclesMax, 4);
+    USBD_CtlSendData (pdev, AudioCtl, MIN(req->wLength, 8));
+    break;
+    
+  case AUDIO_VENDOR_REQ_SET_LIMITER:
+    if (req->wLength != AUDIO_VENDOR_LIMITER_SIZE)
+    {
+      USBD_CtlError (pdev, req);
+      break;
+    }
+    
+    /* The configuration is recorded by usbd_audio_EP0_RxReady() */
+    USBD_CtlPrepareRx (pdev, AudioCtl, req->wLength);
+    AudioCtlCmd = AUDIO_VENDOR_REQ_SET_LIMITER;
+    AudioCtlLen = req->wLength;
+    break;
+    
+  case AUDIO_VENDOR_REQ_GET_LIMITER:
+    AudioCtl[0] = LOBYTE((uint16_t)AudioLimiter.cfg.threshold);
+    AudioCtl[1] = HIBYTE((uint16_t)AudioLimiter.cfg.threshold);
+    AudioCtl[2] = LOBYTE(AudioLimiter.cfg.ratio);
+    AudioCtl[3] = HIBYTE(AudioLimiter.cfg.ratio);
+    AudioCtl[4] = LOBYTE(AudioLimiter.cfg.attackUs);
+    AudioCtl[5] = HIBYTE(AudioLimiter.cfg.attackUs);
+    AudioCtl[6] = LOBYTE(AudioLimiter.cfg.releaseMs);
+    AudioCtl[7] = HIBYTE(AudioLimiter.cfg.releaseMs);
+    AudioCtl[8] = LOBYTE(AudioLimiter.cfg.lookaheadUs);
+    AudioCtl[9] = HIBYTE(AudioLimiter.cfg.lookaheadUs);
+    USBD_CtlSendData (pdev, AudioCtl, MIN(req->wLength, AUDIO_VENDOR_LIMITER_SIZE));
+    break;
+    
+  case AUDIO_VENDOR_REQ_GET_LIMITER_LOAD:
+    gain = Audio_Limiter_GainMin(&AudioLimiter);
+    memcpy(AudioCtl, &AudioLimiterCycles, 4);
+    memcpy(AudioCtl + 4, &AudioLimiterCyclesMax, 4);
+    memcpy(AudioCtl + 8, &gain, 4);
+    USBD_CtlSendData (pdev, AudioCtl, MIN(req->wLength, 12));
+    break;
+    
+  case AUDIO_VENDOR_REQ_GET_DITHER_LOAD:
+    memcpy(AudioCtl, &AudioDitherCycles, 4);
+    memcpy(AudioCtl + 4, &AudioDitherCyclesMax, 4);
+    USBD_CtlSendData (pdev, AudioCtl, MIN(req->wLength, 8));
+    break;
+    
+  case AUDIO_VENDOR_REQ_SET_DUCK:
+    if ((req->wLength != 2) || (req->wValue >= AUDIO_MIXER_STREAMS))
+    {
+      USBD_CtlError (pdev, req);
+      break;
+    }
+    
+    /* The depth is recorded by usbd_audio_EP0_RxReady() */
+    USBD_CtlPrepareRx (pdev, AudioCtl, req->wLength);
+    AudioCtlCmd = AUDIO_VENDOR_REQ_SET_DUCK;
+    AudioCtlLen = req->wLength;
+    AudioCtlDuckStream = req->wValue;
+    break;
+    
+  case AUDIO_VENDOR_REQ_GET_DUCK:
+    if (req->wValue >= AUDIO_MIXER_STREAMS)
+    {
+      USBD_CtlError (pdev, req);
+      break;
+    }
+    AudioCtl[0] = LOBYTE((uint16_t)AudioMixer.duck[req->wValue]);
+    AudioCtl[1] = HIBYTE((uint16_t)AudioMixer.duck[req->wValue]);
+    USBD_CtlSendData (pdev, AudioCtl, MIN(req->wLength, 2));
+    break;
+    
+  case AUDIO_VENDOR_REQ_GET_MIXER_LOAD:
+    memcpy(AudioCtl, &AudioMixerCycles, 4);
+    memcpy(AudioCtl + 4, &AudioMixerCyclesMax, 4);
+    memcpy(AudioCtl + 8, &VoiceUnderruns, 4);
+    USBD_CtlSendData (pdev, AudioCtl, MIN(req->wLength, 12));
+    break;
+    
+  default:
+    USBD_CtlError (pdev, req);
+    break;
   }
 }
 
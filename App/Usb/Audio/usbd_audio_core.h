@@ -27,6 +27,8 @@
 #include "usbd_ioreq.h"
 #include "usbd_req.h"
 #include "usbd_desc.h"
+#include "audio_probe.h"
+#include "audio_jitter.h"
 
 
 
@@ -45,16 +47,80 @@
   * @{
   */ 
 
-/* AudioFreq * DataSize (2 bytes) * NumChannels (Stereo: 2) */
-#define AUDIO_OUT_PACKET                              (uint32_t)(((USBD_AUDIO_FREQ * 2 * 2) /1000)) 
-
-/* Number of sub-packets in the audio transfer buffer. You can modify this value but always make sure
-  that it is an even number and higher than 3 */
-#define OUT_PACKET_NUM                                   4
-/* Total size of the audio transfer buffer */
-#define TOTAL_OUT_BUF_SIZE                           ((uint32_t)(AUDIO_OUT_PACKET * OUT_PACKET_NUM))
-
-#define AUDIO_CONFIG_DESC_SIZE                        109
+/* SubFrameSize (2 bytes for 16-bit, 4 bytes for 24-in-32 and 32-bit) * NumChannels (Stereo: 2) */
+#define AUDIO_FRAME_SIZE(res)                         (uint32_t)(((res) > 16) ? 8 : 4)
+#define AUDIO_FRAME_SIZE_MAX                          AUDIO_FRAME_SIZE(32)
+
+/* AudioFreq * SubFrameSize * NumChannels (Stereo: 2) */
+#define AUDIO_OUT_PACKET(frq, res)                    (uint32_t)((((frq) * AUDIO_FRAME_SIZE(res)) /1000)) 
+
+/* Largest packet the host may send in asynchronous mode: one extra frame */
+#define AUDIO_OUT_PACKET_MAX                          (uint32_t)(AUDIO_OUT_PACKET(USBD_AUDIO_FREQ_MAX, 32) + AUDIO_FRAME_SIZE_MAX)
+
+/* Storage of the OUT ring, a power of two. The deepest jitter buffer of all
+   the profiles fits in half of it in every format: 16 ms at 96 kHz 32-bit
+   are 12288 bytes, half of the ring holds 21 ms. */
+#define AUDIO_OUT_RING_SIZE_MAX                       32768
+#if (((USBD_AUDIO_FREQ_MAX / 1000) * 8 * AUDIO_JITTER_DEPTH_MAX_US) / 1000) > \
+    (AUDIO_OUT_RING_SIZE_MAX / 2)
+#error "AUDIO_OUT_RING_SIZE_MAX must hold twice the deepest jitter buffer"
+#endif
+
+/* Voice stream: 16-bit stereo only, its largest packet with one extra
+   frame, and the storage of its ring, a power of two */
+#define AUDIO_VOICE_PACKET_MAX                        (uint32_t)(AUDIO_OUT_PACKET(USBD_AUDIO_VOICE_FREQ_MAX, 16) + AUDIO_FRAME_SIZE(16))
+#define AUDIO_VOICE_RING_SIZE                         4096
+
+/* Both packets of a frame, with their status words, must fit in the RX FIFO:
+   10 words for SETUP packets, 1 for the global OUT NAK, 1 transfer complete
+   status per OUT endpoint (3), then (packet / 4) + 1 for each packet */
+#if defined(USB_OTG_FS_CORE) && \
+    ((10 + 1 + 3 + ((((USBD_AUDIO_FREQ_MAX * 8) / 1000) + 8) / 4) + 1 + \
+      ((((USBD_AUDIO_VOICE_FREQ_MAX * 4) / 1000) + 4) / 4) + 1) > RX_FIFO_FS_SIZE)
+#error "The largest media and voice packets of a frame do not fit in RX_FIFO_FS_SIZE"
+#endif
+
+/* Ring fill at which the voice stream plays, in bytes */
+#define AUDIO_VOICE_TARGET_FILL(frq)                  (uint32_t)((((frq) * USBD_AUDIO_VOICE_DEPTH_MS) / 1000) * AUDIO_FRAME_SIZE(16))
+#if (USBD_AUDIO_VOICE_DEPTH_MS < 1) || \
+    (((USBD_AUDIO_FREQ_MAX * USBD_AUDIO_VOICE_DEPTH_MS) / 1000) * 4 > (AUDIO_VOICE_RING_SIZE / 2))
+#error "USBD_AUDIO_VOICE_DEPTH_MS must be at least 1 ms and fit in half of the voice ring"
+#endif
+
+/* Reception slots between the OUT endpoint interrupts and the audio task */
+#define AUDIO_OUT_RX_SLOTS                            4
+
+/* Packets tracked by the latency probes between the ring and the I2S */
+#define AUDIO_PROBE_PACKETS                           32
+
+/* Frames converted into each half of the I2S DMA buffer (1 ms of audio) */
+#define AUDIO_DMA_HALF_FRAMES(frq)                    (uint32_t)((frq) / 1000)
+
+/* Length of the gain ramps: stream start and stop, mute, volume steps and
+   underrun fades */
+#define AUDIO_RAMP_FRAMES(frq)                        (uint32_t)(((frq) * USBD_AUDIO_RAMP_MS) / 1000)
+#if (USBD_AUDIO_RAMP_MS < 1) || (USBD_AUDIO_RAMP_MS > 20)
+#error "USBD_AUDIO_RAMP_MS must be from 1 to 20 ms"
+#endif
+/* Total size of the I2S DMA buffer in bytes (two halves) */
+#define AUDIO_DMA_BUF_SIZE(frq, res)                  (uint32_t)(AUDIO_DMA_HALF_FRAMES(frq) * AUDIO_FRAME_SIZE(res) * 2)
+
+/* Alternate settings of the streaming interface: zero bandwidth, then one
+   per sample format */
+#define AUDIO_OUT_ALT_NUM                             4
+#define AUDIO_OUT_ALT_16B                             1    /* 16-bit PCM */
+#define AUDIO_OUT_ALT_24B                             2    /* 24-bit PCM in 32-bit subframes */
+#define AUDIO_OUT_ALT_32B                             3    /* 32-bit PCM */
+
+/* AudioControl interface, the recipient of the vendor requests */
+#define AUDIO_CONTROL_INTERFACE                       0x00
+
+/* Alternate settings of the voice streaming interface: zero bandwidth, then
+   16-bit PCM */
+#define AUDIO_VOICE_INTERFACE                         0x02
+#define AUDIO_VOICE_ALT_NUM                           2
+
+#define AUDIO_CONFIG_DESC_SIZE                        331
 #define AUDIO_INTERFACE_DESC_SIZE                     9
 #define USB_AUDIO_DESC_SIZ                            0x09
 #define AUDIO_STANDARD_ENDPOINT_DESC_SIZE             0x09
@@ -76,24 +142,78 @@
 #define AUDIO_CONTROL_HEADER                          0x01
 #define AUDIO_CONTROL_INPUT_TERMINAL                  0x02
 #define AUDIO_CONTROL_OUTPUT_TERMINAL                 0x03
+#define AUDIO_CONTROL_MIXER_UNIT                      0x04
 #define AUDIO_CONTROL_FEATURE_UNIT                    0x06
 
 #define AUDIO_INPUT_TERMINAL_DESC_SIZE                0x0C
 #define AUDIO_OUTPUT_TERMINAL_DESC_SIZE               0x09
 #define AUDIO_STREAMING_INTERFACE_DESC_SIZE           0x07
+#define AUDIO_MIXER_UNIT_DESC_SIZE                    0x0D /* 2 input pins, 2 channels, no programmable control */
 
 #define AUDIO_CONTROL_MUTE                            0x0001
+#define AUDIO_CONTROL_VOLUME                          0x0002
 
 #define AUDIO_FORMAT_TYPE_I                           0x01
 #define AUDIO_FORMAT_TYPE_III                         0x03
 
 #define USB_ENDPOINT_TYPE_ISOCHRONOUS                 0x01
+#define USB_ENDPOINT_SYNC_ASYNCHRONOUS                0x04
+#define USB_ENDPOINT_SYNC_ADAPTIVE                    0x08
 #define AUDIO_ENDPOINT_GENERAL                        0x01
+#define AUDIO_ENDPOINT_SAMPLING_FREQ                  0x01 /* bmAttributes of the class-specific endpoint */
+
+/* Endpoint control selectors */
+#define AUDIO_SAMPLING_FREQ_CONTROL                   0x01
+
+/* Feature Unit control selectors */
+#define AUDIO_MUTE_CONTROL                            0x01
+#define AUDIO_VOLUME_CONTROL                          0x02
 
 #define AUDIO_REQ_GET_CUR                             0x81
+#define AUDIO_REQ_GET_MIN                             0x82
+#define AUDIO_REQ_GET_MAX                             0x83
+#define AUDIO_REQ_GET_RES                             0x84
 #define AUDIO_REQ_SET_CUR                             0x01
 
+/* Vendor requests to the AudioControl interface (recipient interface,
+   wIndex AUDIO_CONTROL_INTERFACE), stalled otherwise */
+#define AUDIO_VENDOR_REQ_SET_PROFILE                  0x01 /* wValue: AUDIO_JITTER_PROFILE_xxx, no data */
+#define AUDIO_VENDOR_REQ_GET_PROFILE                  0x81 /* 1 byte: current AUDIO_JITTER_PROFILE_xxx */
+#define AUDIO_VENDOR_REQ_SET_EQ_BAND                  0x02 /* wValue: channel mask << 8 | band, AUDIO_VENDOR_EQ_BAND_SIZE bytes */
+#define AUDIO_VENDOR_REQ_GET_EQ_BAND                  0x82 /* wValue: channel << 8 | band, AUDIO_VENDOR_EQ_BAND_SIZE bytes */
+#define AUDIO_VENDOR_REQ_GET_EQ_LOAD                  0x83 /* 8 bytes: EQ cycles of the last 1 ms block, largest */
+#define AUDIO_VENDOR_REQ_SET_LIMITER                  0x03 /* AUDIO_VENDOR_LIMITER_SIZE bytes */
+#define AUDIO_VENDOR_REQ_GET_LIMITER                  0x84 /* AUDIO_VENDOR_LIMITER_SIZE bytes */
+#define AUDIO_VENDOR_REQ_GET_LIMITER_LOAD             0x85 /* 12 bytes: limiter cycles of the last 1 ms block, largest,
+                                                              smallest gain (Q16) since the last request */
+#define AUDIO_VENDOR_REQ_GET_DITHER_LOAD              0x86 /* 8 bytes: requantisation cycles of the last 1 ms block, largest */
+#define AUDIO_VENDOR_REQ_SET_DUCK                     0x04 /* wValue: AUDIO_MIXER_xxx stream, 2 bytes: ducking depth (1/256 dB) */
+#define AUDIO_VENDOR_REQ_GET_DUCK                     0x87 /* wValue: AUDIO_MIXER_xxx stream, 2 bytes: ducking depth (1/256 dB) */
+#define AUDIO_VENDOR_REQ_GET_MIXER_LOAD               0x88 /* 12 bytes: mixer cycles of the last 1 ms block, largest,
+                                                              voice ring underruns */
+
+/* Equalizer band of the vendor requests, little endian: type (AUDIO_EQ_xxx),
+   reserved, frequency (Hz, 2 bytes), gain (1/256 dB, 2 bytes), quality
+   factor (1/256, 2 bytes). Channel mask: bit 0 left, bit 1 right. */
+#define AUDIO_VENDOR_EQ_BAND_SIZE                     8
+
+/* Limiter configuration of the vendor requests, little endian, 2 bytes
+   each: threshold (1/256 dBFS), ratio (1/256, 0 for a limiter), attack
+   (us), release (ms), look-ahead (us) */
+#define AUDIO_VENDOR_LIMITER_SIZE                     10
+
+/* Units of the AudioControl interface: the Feature Units of the media and
+   voice streams, summed by the Mixer Unit into the Output Terminal */
 #define AUDIO_OUT_STREAMING_CTRL                      0x02
+#define AUDIO_VOICE_STREAMING_CTRL                    0x05
+#define AUDIO_OUT_MIXER_UNIT                          0x06
+
+/* Explicit feedback endpoint (asynchronous mode) */
+#define AUDIO_FB_PACKET                               3    /* 10.14 format on 3 bytes (Full Speed) */
+#define AUDIO_FB_REFRESH                              4    /* bRefresh: feedback polled every 2^4 ms */
+#define AUDIO_FB_PERIOD_LOG2                          6    /* I2S rate measured over 2^6 SOFs */
+#define AUDIO_FB_FILL_GAIN_LOG2                       7    /* 1 frame of fill error moves the feedback by 1/128 frame */
+#define AUDIO_FB_NOMINAL(frq)                         ((uint32_t)((((frq) << 14) + 500) / 1000))
 
 /**
   * @}
@@ -112,7 +232,18 @@ typedef struct _Audio_Fops
     uint8_t  (*MuteCtl)      (uint8_t cmd);
     uint8_t  (*PeriodicTC)   (uint8_t cmd);
     uint8_t  (*GetState)     (void);
+    uint32_t (*GetPosition)  (void);
+    uint8_t  (*SetFormat)    (uint32_t AudioFreq, uint32_t Resolution);
+    int32_t  (*GetClockError)(void);
 }AUDIO_FOPS_TypeDef;
+
+/* Position reported by the I2S DMA to the streaming ring */
+typedef enum
+{
+  AUDIO_OFFSET_NONE = 0,
+  AUDIO_OFFSET_HALF,
+  AUDIO_OFFSET_FULL,
+}AUDIO_OffsetTypeDef;
 /**
   * @}
   */ 
@@ -122,8 +253,9 @@ typedef struct _Audio_Fops
 /** @defgroup USBD_CORE_Exported_Macros
   * @{
   */ 
-#define AUDIO_PACKET_SZE(frq)          (uint8_t)(((frq * 2 * 2)/1000) & 0xFF), \
-                                       (uint8_t)((((frq * 2 * 2)/1000) >> 8) & 0xFF)
+/* One extra frame is allowed: the host adjusts its packet size to the feedback */
+#define AUDIO_PACKET_SZE(frq, res)     (uint8_t)((((frq/1000) + 1) * AUDIO_FRAME_SIZE(res)) & 0xFF), \
+                                       (uint8_t)(((((frq/1000) + 1) * AUDIO_FRAME_SIZE(res)) >> 8) & 0xFF)
 #define SAMPLE_FREQ(frq)               (uint8_t)(frq), (uint8_t)((frq >> 8)), (uint8_t)((frq >> 16))
 /**
   * @}
@@ -142,6 +274,13 @@ extern USBD_Class_cb_TypeDef  AUDIO_cb;
 /** @defgroup USB_CORE_Exported_Functions
   * @{
   */
+void USBD_AUDIO_Sync (AUDIO_OffsetTypeDef offset);
+void USBD_AUDIO_TaskInit (void);
+void USBD_AUDIO_RxFifo (uint8_t epnum);
+uint32_t USBD_AUDIO_GetLatency (uint32_t stage, AUDIO_ProbeReportTypeDef *report);
+uint32_t USBD_AUDIO_GetDrift (int32_t *pPpm, int32_t *pBound);
+uint32_t USBD_AUDIO_GetWakeTime (uint32_t *pLast, uint32_t *pMax);
+int32_t  USBD_AUDIO_GetClock (uint32_t *pFreq, uint32_t *pAchieved);
 /**
   * @}
   */ 
@@ -68,6 +68,9 @@ static uint8_t  VolumeCtl    (uint8_t vol);
 static uint8_t  MuteCtl      (uint8_t cmd);
 static uint8_t  PeriodicTC   (uint8_t cmd);
 static uint8_t  GetState     (void);
+static uint32_t GetPosition  (void);
+static uint8_t  SetFormat    (uint32_t AudioFreq, uint32_t Resolution);
+static int32_t  GetClockError(void);
 
 /**
   * @}
@@ -84,7 +87,10 @@ AUDIO_FOPS_TypeDef  AUDIO_OUT_fops =
   VolumeCtl,
   MuteCtl,
   PeriodicTC,
-  GetState
+  GetState,
+  GetPosition,
+  SetFormat,
+  GetClockError
 };
 
 static uint8_t AudioState = AUDIO_STATE_INACTIVE;
@@ -129,8 +135,12 @@ static uint8_t  Init         (uint32_t AudioFreq,
     Initialized = 1;
   }
   
-  /* Update the Audio state machine */
-  AudioState = AUDIO_STATE_ACTIVE;
+  /* Update the Audio state machine. A sleeping interface is woken up by
+     AUDIO_CMD_WAKE when a stream starts. */
+  if (AudioState != AUDIO_STATE_SLEEPING)
+  {
+    AudioState = AUDIO_STATE_ACTIVE;
+  }
     
   return AUDIO_OK;
 }
@@ -143,19 +153,25 @@ static uint8_t  Init         (uint32_t AudioFreq,
   */
 static uint8_t  DeInit       (uint32_t options)
 {
-  /* Update the Audio state machine */
-  AudioState = AUDIO_STATE_INACTIVE;
+  /* Update the Audio state machine: a sleeping interface has already
+     released its clocks and is still to be woken up */
+  if (AudioState != AUDIO_STATE_SLEEPING)
+  {
+    AudioState = AUDIO_STATE_INACTIVE;
+  }
   
   return AUDIO_OK;
 }
 
 /**
   * @brief  AudioCmd 
-  *         Play, Stop, Pause or Resume current file.
+  *         Play, Stop, Pause or Resume current file, or put the audio
+  *         interface to sleep and wake it up.
   * @param  pbuf: address from which file should be played.
   * @param  size: size of the current buffer/file.
   * @param  cmd: command to be executed, can be AUDIO_CMD_PLAY , AUDIO_CMD_PAUSE, 
-  *              AUDIO_CMD_RESUME or AUDIO_CMD_STOP.
+  *              AUDIO_CMD_RESUME, AUDIO_CMD_STOP, AUDIO_CMD_SLEEP or
+  *              AUDIO_CMD_WAKE.
   * @retval AUDIO_OK if all operations succeed, AUDIO_FAIL else.
   */
 static uint8_t  AudioCmd(uint8_t* pbuf, 
@@ -245,6 +261,41 @@ static uint8_t  AudioCmd(uint8_t* pbuf,
       return AUDIO_OK;
     } 
     
+    /* Process the SLEEP command ---------------------------*/
+  case AUDIO_CMD_SLEEP:
+    if (AudioState == AUDIO_STATE_SLEEPING)
+    {
+      return AUDIO_OK;
+    }
+    else if (EVAL_AUDIO_PowerDown() != 0)
+    {
+      AudioState = AUDIO_STATE_ERROR;
+      return AUDIO_FAIL;
+    }
+    else
+    {
+      AudioState = AUDIO_STATE_SLEEPING;
+      return AUDIO_OK;
+    }
+    
+    /* Process the WAKE command ----------------------------*/
+  case AUDIO_CMD_WAKE:
+    if (AudioState != AUDIO_STATE_SLEEPING)
+    {
+      /* Unsupported command */
+      return AUDIO_FAIL;
+    }
+    else if (EVAL_AUDIO_PowerUp() != 0)
+    {
+      AudioState = AUDIO_STATE_ERROR;
+      return AUDIO_FAIL;
+    }
+    else
+    {
+      AudioState = AUDIO_STATE_STOPPED;
+      return AUDIO_OK;
+    }
+    
     /* Unsupported command ---------------------------------*/
   default:
     return AUDIO_FAIL;
@@ -313,6 +364,77 @@ static uint8_t  GetState   (void)
   return AudioState;
 }
 
+/**
+  * @brief  GetPosition
+  *         Return the read position of the audio output in the played buffer
+  * @param  None
+  * @retval Number of bytes already sent to the codec in the current buffer pass.
+  */
+static uint32_t GetPosition (void)
+{
+  if (AudioState != AUDIO_STATE_PLAYING)
+  {
+    return 0;
+  }
+  
+  return Audio_MAL_GetPosition();
+}
+
+/**
+  * @brief  SetFormat
+  *         Change the audio frequency and sample resolution. A running stream
+  *         is stopped and has to be restarted with AUDIO_CMD_PLAY. A sleeping
+  *         interface has to be woken up first.
+  * @param  AudioFreq: new audio frequency in Hz.
+  * @param  Resolution: bits per sample (16, 24 or 32).
+  * @retval AUDIO_OK if all operations succeed, AUDIO_FAIL else. The interface
+  *         goes to the error state if the I2S clock did not lock.
+  */
+static uint8_t  SetFormat    (uint32_t AudioFreq, uint32_t Resolution)
+{
+  uint32_t status;
+  
+  if ((AudioState == AUDIO_STATE_INACTIVE) || (AudioState == AUDIO_STATE_ERROR) ||
+      (AudioState == AUDIO_STATE_SLEEPING))
+  {
+    return AUDIO_FAIL;
+  }
+  
+  status = EVAL_AUDIO_SetFormat(AudioFreq, Resolution);
+  if (status == 2)
+  {
+    /* The I2S has been stopped and cannot run without its clock */
+    AudioState = AUDIO_STATE_ERROR;
+    return AUDIO_FAIL;
+  }
+  else if (status != 0)
+  {
+    return AUDIO_FAIL;
+  }
+  
+  if ((AudioState == AUDIO_STATE_PLAYING) || (AudioState == AUDIO_STATE_PAUSED))
+  {
+    AudioState = AUDIO_STATE_STOPPED;
+  }
+  
+  return AUDIO_OK;
+}
+
+/**
+  * @brief  GetClockError
+  *         Return the error of the I2S sampling frequency programmed for the
+  *         current format, the PLLI2S not dividing exactly to every rate.
+  * @param  None
+  * @retval (achieved - requested) / requested frequency, in 1e-9.
+  */
+static int32_t  GetClockError(void)
+{
+  AUDIO_ClockPlanTypeDef plan;
+  
+  EVAL_AUDIO_GetClockPlan(&plan);
+  return plan.ErrorPpb;
+}
+
 /**
   * @}
   */ 
@@ -44,6 +44,8 @@ typedef enum
   AUDIO_CMD_PLAY = 1,
   AUDIO_CMD_PAUSE,
   AUDIO_CMD_STOP,
+  AUDIO_CMD_SLEEP,
+  AUDIO_CMD_WAKE,
 }AUDIO_CMD_TypeDef;
 
 /* Mute commands */
@@ -61,6 +63,7 @@ typedef enum
 #define AUDIO_STATE_PAUSED              0x03
 #define AUDIO_STATE_STOPPED             0x04
 #define AUDIO_STATE_ERROR               0x05
+#define AUDIO_STATE_SLEEPING            0x06
 
 /**
   * @}
@@ -23,6 +23,7 @@
 /* Includes ------------------------------------------------------------------ */
 #include "usb_bsp.h"
 #include "usbd_conf.h"
+#include "FreeRTOSConfig.h"
 
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
 * @{
@@ -227,6 +228,10 @@ void USB_OTG_BSP_Init(USB_OTG_CORE_HANDLE * pdev)
 
 #endif                          /* USB_OTG_HS */
 #endif                          /* USE_STM3210C_EVAL */
+
+#ifdef USB_OTG_FS_SOF_OUTPUT_ENABLED
+  USB_OTG_BSP_SofCaptureInit();
+#endif
 }
 
 /**
@@ -239,33 +244,107 @@ void USB_OTG_BSP_EnableInterrupt(USB_OTG_CORE_HANDLE * pdev)
 {
   NVIC_InitTypeDef NVIC_InitStructure;
 
-  NVIC_PriorityGroupConfig(NVIC_PriorityGroup_1);
+  /* NVIC_PriorityGroup_4 is set by main(): the OTG interrupt stays inside the
+     range allowed to call FreeRTOS FromISR functions */
 #ifdef USE_USB_OTG_HS
   NVIC_InitStructure.NVIC_IRQChannel = OTG_HS_IRQn;
 #else
   NVIC_InitStructure.NVIC_IRQChannel = OTG_FS_IRQn;
 #endif
-  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 1;
-  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 3;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = configUSB_OTG_INTERRUPT_PRIORITY;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
   NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
   NVIC_Init(&NVIC_InitStructure);
 #ifdef USB_OTG_HS_DEDICATED_EP1_ENABLED
-  NVIC_PriorityGroupConfig(NVIC_PriorityGroup_1);
   NVIC_InitStructure.NVIC_IRQChannel = OTG_HS_EP1_OUT_IRQn;
-  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 1;
-  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 2;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = configUSB_OTG_INTERRUPT_PRIORITY;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
   NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
   NVIC_Init(&NVIC_InitStructure);
 
-  NVIC_PriorityGroupConfig(NVIC_PriorityGroup_1);
   NVIC_InitStructure.NVIC_IRQChannel = OTG_HS_EP1_IN_IRQn;
-  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 1;
-  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 1;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = configUSB_OTG_INTERRUPT_PRIORITY;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
   NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
   NVIC_Init(&NVIC_InitStructure);
 #endif
 }
 
+#ifdef USB_OTG_FS_SOF_OUTPUT_ENABLED
+/**
+* @brief  USB_OTG_BSP_SofCaptureInit
+*         Configures TIM2 as a free running 32-bit counter whose channel 1
+*         captures every USB_SOF_CAPTURE_DIV-th SOF of the OTG FS core,
+*         routed internally to ITR1. The counter runs from the crystal, like
+*         the PLLI2S: the captures measure the host clock against the I2S one.
+* @param  None
+* @retval None
+*/
+void USB_OTG_BSP_SofCaptureInit(void)
+{
+  TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure;
+  TIM_ICInitTypeDef TIM_ICInitStructure;
+
+  RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, ENABLE);
+
+  TIM_TimeBaseStructInit(&TIM_TimeBaseStructure);
+  TIM_TimeBaseStructure.TIM_Prescaler = 0;
+  TIM_TimeBaseStructure.TIM_Period = 0xFFFFFFFF;
+  TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
+  TIM_TimeBaseInit(TIM2, &TIM_TimeBaseStructure);
+
+  /* ITR1 = OTG FS SOF, captured by channel 1 through TRC */
+  TIM_RemapConfig(TIM2, TIM2_USBFS_SOF);
+  TIM_SelectInputTrigger(TIM2, TIM_TS_ITR1);
+
+  TIM_ICInitStructure.TIM_Channel = TIM_Channel_1;
+  TIM_ICInitStructure.TIM_ICPolarity = TIM_ICPolarity_Rising;
+  TIM_ICInitStructure.TIM_ICSelection = TIM_ICSelection_TRC;
+  TIM_ICInitStructure.TIM_ICPrescaler = USB_SOF_CAPTURE_PSC;
+  TIM_ICInitStructure.TIM_ICFilter = 0;
+  TIM_ICInit(TIM2, &TIM_ICInitStructure);
+
+  TIM_Cmd(TIM2, ENABLE);
+}
+
+/**
+* @brief  USB_OTG_BSP_SofCapture
+*         Reads the last SOF capture of TIM2, if a new one is available.
+* @param  pCapture: receives the counter value latched by the SOF
+* @retval 1 if a new capture has been read, 0 otherwise
+*/
+uint32_t USB_OTG_BSP_SofCapture(uint32_t *pCapture)
+{
+  if ((TIM2->SR & TIM_SR_CC1IF) == 0)
+  {
+    return 0;
+  }
+
+  /* Reading CCR1 clears CC1IF. A capture overwritten before it could be
+     read shows up as a period too long and is rejected by the estimator. */
+  *pCapture = TIM2->CCR1;
+  TIM2->SR = (uint16_t)~TIM_SR_CC1OF;
+
+  return 1;
+}
+
+/**
+* @brief  USB_OTG_BSP_SofTimerFreq
+*         Returns the frequency of the TIM2 counter.
+* @param  None
+* @retval Frequency in Hz
+*/
+uint32_t USB_OTG_BSP_SofTimerFreq(void)
+{
+  RCC_ClocksTypeDef clocks;
+
+  /* The APB1 timers run at twice PCLK1 when APB1 is divided */
+  RCC_GetClocksFreq(&clocks);
+  return (clocks.HCLK_Frequency == clocks.PCLK1_Frequency) ?
+         clocks.PCLK1_Frequency : (2 * clocks.PCLK1_Frequency);
+}
+#endif
+
 /**
 * @brief  USB_OTG_BSP_uDelay
 *         This function provides delay time in micro sec
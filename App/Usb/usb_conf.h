@@ -126,14 +126,26 @@
 *******************************************************************************/
   
 /****************** USB OTG CONFIGURATION **********************************/
+/* The 320 words of the FS core are shared as follows. Worst case of the RX
+   FIFO in a frame, by the RM0368 formula: 10 words for SETUP packets, 1 for
+   the global OUT NAK, 1 transfer complete status per OUT endpoint (EP0, the
+   media EP1 and the voice EP2), and (packet / 4) + 1 for each iso packet:
+   195 for the largest media packet (96 kHz 32-bit plus one frame, 776 B)
+   and 50 for the largest voice packet (48 kHz 16-bit plus one frame, 196 B,
+   the voice stream being limited to 48 kHz for this). That is 259 words, so
+   the RX FIFO takes 272 and TX0 holds a single 64-byte control packet.
+   usbd_audio_core.h checks the budget against the packet sizes. */
 #ifdef USB_OTG_FS_CORE
- #define RX_FIFO_FS_SIZE                          256
- #define TX0_FIFO_FS_SIZE                          64
- #define TX1_FIFO_FS_SIZE                           0
- #define TX2_FIFO_FS_SIZE                           0
+ #define RX_FIFO_FS_SIZE                          272
+ #define TX0_FIFO_FS_SIZE                          16 /* One control packet (USB_OTG_MAX_EP0_SIZE) */
+ #define TX1_FIFO_FS_SIZE                          16 /* Unused, but TX2 is: keep the minimum size */
+ #define TX2_FIFO_FS_SIZE                          16 /* Audio feedback endpoint (AUDIO_IN_EP) */
  #define TX3_FIFO_FS_SIZE                           0
 
-/* #define USB_OTG_FS_SOF_OUTPUT_ENABLED */
+/* The SOF pulse also triggers the TIM2 capture measuring the clock drift */
+ #define USB_OTG_FS_SOF_OUTPUT_ENABLED
+ #define USB_SOF_CAPTURE_DIV                        8 /* One capture every 8 SOFs */
+ #define USB_SOF_CAPTURE_PSC               TIM_ICPSC_DIV8
 #endif
 
 /****************** USB OTG MISC CONFIGURATION ********************************/
@@ -205,6 +217,9 @@
 /** @defgroup USB_CONF_Exported_Macros
   * @{
   */ 
+/* Called by the device interrupt before it reads an OUT packet from the Rx
+   FIFO: the audio class time stamps the reception of its packets */
+#define USB_OTG_RX_FIFO_HOOK(epnum)    USBD_AUDIO_RxFifo(epnum)
 /**
   * @}
   */ 
@@ -219,6 +234,12 @@
 /** @defgroup USB_CONF_Exported_FunctionsPrototype
   * @{
   */ 
+void USBD_AUDIO_RxFifo (uint8_t epnum);
+#ifdef USB_OTG_FS_SOF_OUTPUT_ENABLED
+void     USB_OTG_BSP_SofCaptureInit (void);
+uint32_t USB_OTG_BSP_SofCapture (uint32_t *pCapture);
+uint32_t USB_OTG_BSP_SofTimerFreq (void);
+#endif
 /**
   * @}
   */ 
@@ -49,6 +49,74 @@
                                                   is used. */
 #endif /* EXTERNAL_CRYSTAL_25MHz */
 
+/* Discrete sampling frequencies advertised to the host, in increasing order.
+   USBD_AUDIO_FREQ is used until the host selects one of them. */
+#define USBD_AUDIO_FREQ_1               44100
+#define USBD_AUDIO_FREQ_2               48000
+#define USBD_AUDIO_FREQ_3               96000
+#define USBD_AUDIO_FREQ_NUM             3
+#define USBD_AUDIO_FREQ_MAX             USBD_AUDIO_FREQ_3
+
+/* Audio task: it refills each half of the I2S DMA buffer within 1 ms of the
+   DMA leaving it, so it runs above every other task */
+#define AUDIO_TASK_PRIORITY             (configMAX_PRIORITIES - 1)
+#define AUDIO_TASK_STACK_SIZE           512    /* In words */
+
+/* Latency profile of the jitter buffer at startup (AUDIO_JITTER_PROFILE_xxx),
+   selectable by the host with AUDIO_VENDOR_REQ_SET_PROFILE */
+#define USBD_AUDIO_JITTER_PROFILE       AUDIO_JITTER_PROFILE_LOW_LATENCY
+
+/* Gain ramps on play start, stop, mute, volume steps and underruns: length
+   in ms (1 to 20) and shape (AUDIO_RAMP_LINEAR or AUDIO_RAMP_COSINE) */
+#define USBD_AUDIO_RAMP_MS              5
+#define USBD_AUDIO_RAMP_SHAPE           AUDIO_RAMP_COSINE
+
+/* Limiter at the end of the processing chain: threshold (1/256 dBFS), ratio
+   (1/256, AUDIO_LIMITER_RATIO_INF for a limiter), attack (us, at most the
+   look-ahead), release (ms) and look-ahead (us, 1000 to 2000), which adds
+   to the output latency. Changed by the host with
+   AUDIO_VENDOR_REQ_SET_LIMITER. */
+#define USBD_AUDIO_LIMITER_THRESHOLD    ((int16_t)-0x0100) /* -1 dBFS */
+#define USBD_AUDIO_LIMITER_RATIO        AUDIO_LIMITER_RATIO_INF
+#define USBD_AUDIO_LIMITER_ATTACK_US    300
+#define USBD_AUDIO_LIMITER_RELEASE_MS   100
+#define USBD_AUDIO_LIMITER_LOOKAHEAD_US 1500
+
+/* Requantisation of the 16-bit output: AUDIO_DITHER_FLAT for TPDF dither
+   alone, or the order of the noise shaping (2 to 5), which moves the noise
+   above 12 kHz */
+#define USBD_AUDIO_DITHER_SHAPING       AUDIO_DITHER_FLAT
+
+/* Voice stream of the second streaming interface, mixed with the media
+   stream: jitter buffer depth (ms), and depth by which each stream ducks
+   the other while it plays (1/256 dB, AUDIO_MIXER_DUCK_NONE down to
+   AUDIO_MIXER_DUCK_MIN), reached over USBD_AUDIO_DUCK_MS. Changed by the
+   host with AUDIO_VENDOR_REQ_SET_DUCK. */
+#define USBD_AUDIO_VOICE_DEPTH_MS       4
+#define USBD_AUDIO_VOICE_DUCK           ((int16_t)-0x0C00) /* -12 dB */
+#define USBD_AUDIO_MEDIA_DUCK           AUDIO_MIXER_DUCK_NONE
+#define USBD_AUDIO_DUCK_MS              50
+
+/* Sampling frequencies of the voice stream: the first ones of the table, up
+   to 48 kHz, so that a voice packet fits in the RX FIFO next to the largest
+   media packet (usb_conf.h). The voice is converted to the output sampling
+   frequency whichever the media stream runs at. */
+#define USBD_AUDIO_VOICE_FREQ_NUM       2
+#define USBD_AUDIO_VOICE_FREQ_MAX       USBD_AUDIO_FREQ_2
+
+/* Time on the zero bandwidth alternate setting after which the codec and
+   the I2S clocks are powered down, in ms (0: never powered down) */
+#define USBD_AUDIO_IDLE_TIMEOUT_MS      3000
+
+/* Keep the first SOF captures of the drift estimator, to be dumped and
+   replayed on a host (Tools/audio_drift_replay.c) */
+/* #define USBD_AUDIO_DRIFT_TRACE          1024 */
+
+/* Verify that the samples handed to the I2S DMA are bit-identical to the
+   packets received (audio_verify.c). The stream then bypasses the volume;
+   the results are in AudioVerify */
+/* #define USBD_AUDIO_VERIFY */
+
 #define DEFAULT_VOLUME                  100    /* Default volume in % (Mute=0%, Max = 100%) in Logarithmic values.
                                                  To get accurate volume variations, it is possible to use a logarithmic
                                                  conversion table to convert from percentage to logarithmic law.
@@ -57,9 +125,9 @@
 /* Use this section to modify the number of supported interfaces and configurations.
    Note that if you modify these parameters, you have to modify the descriptors
    accordingly in usbd_audio_core.c file */
-#define AUDIO_TOTAL_IF_NUM              0x02
+#define AUDIO_TOTAL_IF_NUM              0x03
 #define USBD_CFG_MAX_NUM                1
-#define USBD_ITF_MAX_NUM                1
+#define USBD_ITF_MAX_NUM                2
 #define USB_MAX_STR_DESC_SIZ            200
 
 #define USBD_SELF_POWERED
@@ -73,6 +141,7 @@
   */
 #define AUDIO_OUT_EP                    0x01
 #define AUDIO_IN_EP                     0x82
+#define AUDIO_VOICE_OUT_EP              0x02
 /**
   * @}
   */
@@ -22,6 +22,7 @@
 /* Includes ------------------------------------------------------------------ */
 #include "usbd_usr.h"
 #include "usbd_ioreq.h"
+#include "usbd_audio_core.h"
 
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
 * @{
@@ -201,11 +202,26 @@ void USBD_USR_DeviceDisconnected(void)
 
 /**
   * @brief  EVAL_AUDIO_TransferComplete_CallBack
-  * @param  None
+  *         The circular DMA wrapped to the start of the streaming ring.
+  * @param  pBuffer: base address of the ring
+  * @param  Size: size of the ring (half-words)
   * @retval None
   */
 void EVAL_AUDIO_TransferComplete_CallBack(uint32_t pBuffer, uint32_t Size)
 {
+  USBD_AUDIO_Sync(AUDIO_OFFSET_FULL);
+}
+
+/**
+  * @brief  EVAL_AUDIO_HalfTransfer_CallBack
+  *         The circular DMA finished playing the first half of the ring.
+  * @param  pBuffer: base address of the ring
+  * @param  Size: size of the ring (half-words)
+  * @retval None
+  */
+void EVAL_AUDIO_HalfTransfer_CallBack(uint32_t pBuffer, uint32_t Size)
+{
+  USBD_AUDIO_Sync(AUDIO_OFFSET_HALF);
 }
 
 
@@ -33,6 +33,15 @@ int main(void)
 
   init_USART2();
 
+  /* All the priority bits are preemption bits, as required by FreeRTOS.
+     See the interrupt priority map in FreeRTOSConfig.h */
+  NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
+  /* Create the audio task first: until the scheduler starts, the kernel
+     keeps the audio interrupts masked, so that they never notify a task
+     that does not exist yet */
+  USBD_AUDIO_TaskInit();
+
   USBD_Init(&USB_OTG_dev,
 #ifdef USE_USB_OTG_HS
             USB_OTG_HS_CORE_ID,
@@ -40,7 +49,6 @@ int main(void)
             USB_OTG_FS_CORE_ID,
 #endif
             &USR_desc, &AUDIO_cb, &USR_cb);
-  NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
   // Create a task
   // Stack and TCB are placed in CCM of STM32F4
   // The CCM block is connected directly to the core, which leads to zero wait states
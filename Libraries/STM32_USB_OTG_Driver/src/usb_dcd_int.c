@@ -594,6 +594,9 @@ static uint32_t DCD_HandleRxStatusQueueLevel_ISR(USB_OTG_CORE_HANDLE *pdev)
   case STS_DATA_UPDT:
     if (status.b.bcnt)
     {
+#ifdef USB_OTG_RX_FIFO_HOOK
+      USB_OTG_RX_FIFO_HOOK(status.b.epnum);
+#endif
       USB_OTG_ReadPacket(pdev,ep->xfer_buff, status.b.bcnt);
       ep->xfer_buff += status.b.bcnt;
       ep->xfer_count += status.b.bcnt;
@@ -131,6 +131,7 @@
 #define INCLUDE_vTaskSuspend   1
 #define INCLUDE_vTaskDelayUntil   1
 #define INCLUDE_vTaskDelay    1
+#define INCLUDE_xTaskGetSchedulerState 1
 
 /* Cortex-M specific definitions. */
 #ifdef __NVIC_PRIO_BITS
@@ -157,6 +158,18 @@
    See http://www.FreeRTOS.org/RTOS-Cortex-M3-M4.html. */
 #define configMAX_SYSCALL_INTERRUPT_PRIORITY  ( configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY << (8 - configPRIO_BITS) )
 
+/* Application interrupt priority map. NVIC_PriorityGroup_4 is used, so all the
+   priority bits are preemption bits. The audio interrupts call FromISR
+   functions: they must not be given a higher priority (lower value) than
+   configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY.
+     5   I2S DMA half/transfer complete: refill deadline of half a DMA buffer
+     6   USB OTG: packet reception, SOF feedback and control requests
+     8   Codec control interface (I2C): queued register writes
+     15  Kernel (PendSV, SysTick) */
+#define configAUDIO_DMA_INTERRUPT_PRIORITY    ( configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY )
+#define configUSB_OTG_INTERRUPT_PRIORITY      ( configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1 )
+#define configCODEC_I2C_INTERRUPT_PRIORITY    ( configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 3 )
+
 /* Normal assert() semantics without relying on the provision of an assert.h
    header file. */
 #define configASSERT( x ) if( ( x ) == 0 ) { taskDISABLE_INTERRUPTS(); for( ;; ); }
@@ -31,15 +31,33 @@
 
 /* Includes ------------------------------------------------------------------ */
 #include "audio_codec.h"
+#include "FreeRTOS.h"
+#include "task.h"
 
 /* Private typedef ----------------------------------------------------------- */
+/* Codec register write queued for the control interface */
+typedef struct
+{
+  uint8_t reg;
+  uint8_t value;
+} CODEC_WriteTypeDef;
+
 /* Private define ------------------------------------------------------------ */
 
 /* Mask for the bit EN of the I2S CFGR register */
 #define I2S_ENABLE_MASK                 0x0400
 
-/* Delay for the Codec to be correctly reset */
-#define CODEC_RESET_DELAY               0x4FFF
+/* Delay for the Codec to be correctly reset (ms) */
+#define CODEC_RESET_DELAY_MS            1
+
+/* Delay for the Codec outputs to settle after leaving the power down (ms) */
+#define CODEC_POWERUP_DELAY_MS          10
+
+/* Iterations of Delay() in 1 ms at 84 MHz, used before the scheduler runs */
+#define CODEC_DELAY_LOOPS_MS            0x4FFF
+
+/* Timeout for the PLLI2S to lock, in ms when the scheduler runs */
+#define PLLI2S_LOCK_TIMEOUT_MS          2
 
 /* Codec audio Standards */
 #ifdef I2S_STANDARD_PHILLIPS
@@ -58,8 +76,26 @@
 /* The 7 bits Codec address (sent through I2C interface) */
 #define CODEC_ADDRESS                   0x94  /* b00100111 */
 
+/* Register address auto-increment flag of the MAP byte */
+#define CODEC_MAP_INCR                  0x80
+
+/* Time after which a transfer that has not completed is dropped and the
+ * control interface reset (ms): a burst lasts well under 1 ms */
+#define CODEC_I2C_STALL_MS              10
+
+/* SCL clocks sent to release a slave holding SDA low, and Delay()
+ * iterations in half a clock (about 5 us) */
+#define CODEC_I2C_CLEAR_CLOCKS          9
+#define CODEC_I2C_CLEAR_LOOPS           100
+
 /* Private macro ------------------------------------------------------------- */
 /* Private variables --------------------------------------------------------- */
+/* I2S clock settings applied for the current audio frequency */
+static AUDIO_ClockPlanTypeDef CodecClockPlan;
+
+/* I2S data format of the current stream */
+static uint16_t CodecDataFormat = I2S_DataFormat_16b;
+
 /* This structure is declared global because it is handled by two different
  * functions */
 static DMA_InitTypeDef DMA_InitStructure;
@@ -75,6 +111,38 @@ uint16_t *CurrentPos;           /* This variable holds the current position of
 
 __IO uint32_t CODECTimeout = CODEC_LONG_TIMEOUT;
 
+/* Register writes queued for the control interface interrupts, from
+ * CodecI2cTail to CodecI2cHead. The transfer in progress sends the first
+ * CodecI2cBurst of them, CodecI2cIndex values being sent so far; no transfer
+ * is in progress while CodecI2cBurst is 0. */
+static CODEC_WriteTypeDef CodecI2cQueue[CODEC_I2C_QUEUE_SIZE];
+static __IO uint32_t CodecI2cHead = 0;
+static __IO uint32_t CodecI2cTail = 0;
+static __IO uint32_t CodecI2cBurst = 0;
+static uint32_t CodecI2cIndex = 0;
+
+/* Tick count at the start of the transfer in progress */
+static TickType_t CodecI2cStartTick = 0;
+
+/* Transfers completed, transfers dropped on a bus error or a NACK, and
+ * transfers dropped as stalled, the control interface being reset */
+__IO uint32_t CodecI2cBursts = 0;
+__IO uint32_t CodecI2cErrors = 0;
+__IO uint32_t CodecI2cStalls = 0;
+
+/* Shadow of the codec register map: last value written to each register,
+ * valid once written. Writes of the value a register already holds are
+ * skipped, and the registers are read from the shadow. */
+static uint8_t CodecShadow[CODEC_REG_NUM];
+static uint8_t CodecShadowValid[CODEC_REG_NUM];
+
+/* Register writes sent to the codec and skipped as unchanged */
+__IO uint32_t CodecRegWrites = 0;
+__IO uint32_t CodecRegSkipped = 0;
+
+/* Power control register value restored when leaving the power down */
+static uint8_t CodecPowerCtl = 0x9E;
+
 /* Private function prototypes ----------------------------------------------- */
 /* Private functions --------------------------------------------------------- */
 
@@ -84,17 +152,26 @@ __IO uint32_t CODECTimeout = CODEC_LONG_TIMEOUT;
 /* Low layer codec functions */
 static void Codec_CtrlInterface_Init(void);
 static void Codec_CtrlInterface_DeInit(void);
-static void Codec_AudioInterface_Init(uint32_t AudioFreq);
+static void Codec_CtrlConfig(void);
+static uint32_t Codec_AudioInterface_Init(uint32_t AudioFreq);
+static uint32_t Codec_ClockPlan(uint32_t AudioFreq, uint16_t DataFormat,
+                                AUDIO_ClockPlanTypeDef *plan);
+static uint32_t Codec_PLLI2S_Config(uint32_t AudioFreq);
 static void Codec_AudioInterface_DeInit(void);
 static void Codec_Reset(void);
 static uint32_t Codec_WriteRegister(uint32_t RegisterAddr,
                                     uint32_t RegisterValue);
+static void Codec_CtrlStart(void);
+static void Codec_CtrlNext(void);
+static void Codec_CtrlDrop(void);
+static void Codec_CtrlWatch(void);
+static void Codec_CtrlBusClear(void);
+static void Codec_ShadowInvalidate(void);
+static uint32_t Codec_PowerCtrl(uint32_t Cmd);
 static void Codec_GPIO_Init(void);
 static void Codec_GPIO_DeInit(void);
+static void Codec_Delay(uint32_t ms);
 static void Delay(__IO uint32_t nCount);
-#ifdef VERIFY_WRITTENDATA
-static uint32_t Codec_ReadRegister(uint32_t RegisterAddr);
-#endif                          /* VERIFY_WRITTENDATA */
 /*----------------------------------------------------------------------------*/
 
 /**
@@ -157,7 +234,7 @@ uint32_t EVAL_AUDIO_Play(uint16_t * pBuffer, uint32_t Size)
   Codec_Play();
 
   /* Update the Media layer and enable it for play */
-  Audio_MAL_Play((uint32_t) pBuffer, (uint32_t) (DMA_MAX(AudioTotalSize / 2)));
+  Audio_MAL_Play((uint32_t) pBuffer, (uint32_t) (DMA_MAX(AudioTotalSize)));
 
   /* Update the remaining number of data to be played */
   AudioRemSize = (Size / 2) - DMA_MAX(AudioTotalSize);
@@ -165,8 +242,6 @@ uint32_t EVAL_AUDIO_Play(uint16_t * pBuffer, uint32_t Size)
   /* Update the current audio pointer position */
   CurrentPos = pBuffer + DMA_MAX(AudioTotalSize);
 
-  printf("EVAL_AUDIO_Play:%d\r\n",Size);
-
   return 0;
 }
 
@@ -238,7 +313,6 @@ uint32_t EVAL_AUDIO_Stop(uint32_t Option)
   }
   else
   {
-	  printf("EVAL_AUDIO_Stop:%d\r\n",Option);
     /* Call Media layer Stop function */
     Audio_MAL_Stop();
 
@@ -250,6 +324,119 @@ uint32_t EVAL_AUDIO_Stop(uint32_t Option)
   }
 }
 
+/**
+  * @brief Stops the audio stream and puts the audio interface in its low
+  *        power state: codec powered down, I2S and PLLI2S stopped. The codec
+  *        keeps its registers, so that EVAL_AUDIO_PowerUp() restarts it
+  *        without a reset.
+  * @param None.
+  * @retval 0 if correct communication, else wrong communication
+  */
+uint32_t EVAL_AUDIO_PowerDown(void)
+{
+  uint32_t counter;
+
+  /* The codec is powered down while its I2S clock still runs */
+  counter = Codec_PowerCtrl(CODEC_PDWN_SW);
+
+  /* Stop the DMA stream */
+  DMA_Cmd(AUDIO_MAL_DMA_STREAM, DISABLE);
+  while (DMA_GetCmdStatus(AUDIO_MAL_DMA_STREAM) != DISABLE)
+  {
+  }
+  DMA_ClearFlag(AUDIO_MAL_DMA_STREAM, AUDIO_MAL_DMA_FLAG_ALL);
+
+  /* Stop the I2S and its clock */
+  Codec_AudioInterface_DeInit();
+  RCC_PLLI2SCmd(DISABLE);
+
+  AudioRemSize = AudioTotalSize;
+
+  return counter;
+}
+
+/**
+  * @brief Leaves the low power state entered by EVAL_AUDIO_PowerDown(): the
+  *        PLLI2S and the I2S are configured again for the current format
+  *        and the codec is powered up with its registers kept. The stream
+  *        has to be restarted with EVAL_AUDIO_Play() or Audio_MAL_Play().
+  * @note  The waits for the PLLI2S lock and the codec power up block the
+  *        calling task.
+  * @param None.
+  * @retval 0 if correct communication, else wrong communication or PLLI2S
+  *         not locked
+  */
+uint32_t EVAL_AUDIO_PowerUp(void)
+{
+  if (Codec_AudioInterface_Init(I2S_InitStructure.I2S_AudioFreq) != 0)
+  {
+    return 1;
+  }
+
+  return Codec_PowerCtrl(AUDIO_RESUME);
+}
+
+/**
+  * @brief Changes the audio frequency and sample resolution of the I2S
+  *        interface. The DMA transfer is stopped and the PLLI2S is
+  *        reprogrammed: the stream has to be restarted with EVAL_AUDIO_Play()
+  *        or Audio_MAL_Play().
+  * @note  24-bit and 32-bit samples are read from memory as 32-bit words
+  *        whose two half-words are swapped (most significant half first),
+  *        because the DMA feeds the 16-bit I2S data register low half first.
+  * @param AudioFreq: new audio frequency in Hz.
+  * @param Resolution: bits per sample, 16, 24 or 32.
+  * @retval 0 if the format is supported, 1 if it is not (nothing changed),
+  *         2 if the PLLI2S did not lock: the I2S is then left stopped and
+  *         unconfigured.
+  */
+uint32_t EVAL_AUDIO_SetFormat(uint32_t AudioFreq, uint32_t Resolution)
+{
+  AUDIO_ClockPlanTypeDef plan;
+  uint16_t format;
+
+  switch (Resolution)
+  {
+  case 16:
+    format = I2S_DataFormat_16b;
+    break;
+  case 24:
+    format = I2S_DataFormat_24b;
+    break;
+  case 32:
+    format = I2S_DataFormat_32b;
+    break;
+  default:
+    return 1;
+  }
+
+  if (Codec_ClockPlan(AudioFreq, format, &plan) != 0)
+  {
+    return 1;
+  }
+
+  /* Audio_MAL_Stop() re-initializes the I2S with the stored format */
+  CodecDataFormat = format;
+  I2S_InitStructure.I2S_AudioFreq = AudioFreq;
+  if (Audio_MAL_Stop() != 0)
+  {
+    return 2;
+  }
+
+  return 0;
+}
+
+/**
+  * @brief Returns the I2S clock settings in use, with the sampling frequency
+  *        they actually produce and its error against the requested one.
+  * @param plan: filled with the current clock plan.
+  * @retval None
+  */
+void EVAL_AUDIO_GetClockPlan(AUDIO_ClockPlanTypeDef *plan)
+{
+  *plan = CodecClockPlan;
+}
+
 /**
   * @brief Controls the current audio volume level. 
   * @param Volume: Volume level to be set in percentage from 0% to 100% (0 for 
@@ -259,7 +446,6 @@ uint32_t EVAL_AUDIO_Stop(uint32_t Option)
 uint32_t EVAL_AUDIO_VolumeCtl(uint8_t Volume)
 {
   /* Call the codec volume control function with converted volume value */
-	printf("Vol Change:%d\r\n",Volume);
   return (Codec_VolumeCtrl(VOLUME_CONVERT(Volume)));
 }
 
@@ -272,8 +458,6 @@ uint32_t EVAL_AUDIO_VolumeCtl(uint8_t Volume)
 uint32_t EVAL_AUDIO_Mute(uint32_t Cmd)
 {
   /* Call the Codec Mute function */
-	printf("Vol Mute:%d\r\n",Cmd);
-
   return (Codec_Mute(Cmd));
 }
 
@@ -285,8 +469,9 @@ uint32_t EVAL_AUDIO_Mute(uint32_t Cmd)
 void Audio_MAL_IRQHandler(void)
 {
 #ifndef AUDIO_MAL_MODE_NORMAL
-  uint16_t *pAddr = (uint16_t *) CurrentPos;
-  uint32_t Size = AudioRemSize;
+  /* In circular mode the whole buffer is replayed: report its base and size */
+  uint32_t pAddr = DMA_InitStructure.DMA_Memory0BaseAddr;
+  uint32_t Size = DMA_InitStructure.DMA_BufferSize;
 #endif                          /* AUDIO_MAL_MODE_NORMAL */
 
 #ifdef AUDIO_MAL_DMA_IT_TC_EN
@@ -354,7 +539,7 @@ void Audio_MAL_IRQHandler(void)
     /* Manage the remaining file size and new address offset: This function
      * should be coded by user (its prototype is already declared in
      * stm32_eval_audio_codec.h) */
-    EVAL_AUDIO_HalfTransfer_CallBack((uint32_t) pAddr, Size);
+    EVAL_AUDIO_HalfTransfer_CallBack(pAddr, Size);
 
     /* Clear the Interrupt flag */
     DMA_ClearFlag(AUDIO_MAL_DMA_STREAM, AUDIO_MAL_DMA_FLAG_HT);
@@ -373,7 +558,6 @@ void Audio_MAL_IRQHandler(void)
     /* Manage the error generated on DMA FIFO: This function should be coded
      * by user (its prototype is already declared in stm32_eval_audio_codec.h) */
     //EVAL_AUDIO_Error_CallBack((uint32_t *) & pAddr);
-    printf("DMA Error.\r\n");
 
     /* Clear the Interrupt flag */
     DMA_ClearFlag(AUDIO_MAL_DMA_STREAM,
@@ -399,9 +583,21 @@ void Audio_MAL_IRQHandler(void)
 uint32_t Codec_Init(uint16_t OutputDevice, uint8_t Volume, uint32_t AudioFreq)
 {
   uint32_t counter = 0;
+  uint32_t reg;
 
-  /* Reset the Codec Registers */
-  Codec_Reset();
+  /* Reset the Codec Registers, unless they are known: a re-init then only
+   * sends the registers whose value changes */
+  for (reg = 0; reg < CODEC_REG_NUM; reg++)
+  {
+    if (CodecShadowValid[reg])
+    {
+      break;
+    }
+  }
+  if (reg == CODEC_REG_NUM)
+  {
+    Codec_Reset();
+  }
 
   /* Configure the Codec related IOs */
   Codec_GPIO_Init();
@@ -489,7 +685,7 @@ uint32_t Codec_Init(uint16_t OutputDevice, uint8_t Volume, uint32_t AudioFreq)
   counter += Codec_WriteRegister(0x1B, 0x0A);
 #endif
   /* Configure the I2S peripheral */
-  Codec_AudioInterface_Init(AudioFreq);
+  counter += Codec_AudioInterface_Init(AudioFreq);
 
   /* Return communication control value */
   return counter;
@@ -681,12 +877,54 @@ static void Codec_Reset(void)
  // IOE_WriteIOPin(AUDIO_RESET_PIN, BitReset);
 
   /* wait for a delay to insure registers erasing */
-  Delay(CODEC_RESET_DELAY);
+  Codec_Delay(CODEC_RESET_DELAY_MS);
+
+  /* The registers are back to their reset values */
+  Codec_ShadowInvalidate();
 
   /* Power on the codec */
   //IOE_WriteIOPin(AUDIO_RESET_PIN, BitSet);
 }
 
+/**
+  * @brief Powers the codec down or up through its power control register,
+  *        the other registers being kept. Nothing is sent while the register
+  *        has never been written: the codec is then not controlled.
+  * @param Cmd: CODEC_PDWN_SW to power down, AUDIO_RESUME to power up.
+  * @retval 0 if correct communication, else wrong communication
+  */
+static uint32_t Codec_PowerCtrl(uint32_t Cmd)
+{
+  uint32_t counter = 0;
+  uint8_t value;
+
+  if (Codec_ReadRegister(0x02, &value) != 0)
+  {
+    return 0;
+  }
+
+  if (Cmd == CODEC_PDWN_SW)
+  {
+    /* Mute the output first, then power down the DAC */
+    counter += Codec_WriteRegister(0x04, 0xFF);
+    if (value != 0x9F)
+    {
+      CodecPowerCtl = value;
+    }
+    counter += Codec_WriteRegister(0x02, 0x9F);
+  }
+  else
+  {
+    counter += Codec_WriteRegister(0x02, CodecPowerCtl);
+    counter += Codec_WriteRegister(0x04, OutputDev);
+
+    /* Let the outputs settle */
+    Codec_Delay(CODEC_POWERUP_DELAY_MS);
+  }
+
+  return counter;
+}
+
 /**
   * @brief Switch dynamically (while audio file is played) the output target (speaker or headphone).
   *
@@ -736,207 +974,348 @@ uint32_t Codec_SwitchOutput(uint8_t Output)
 }
 
 /**
-  * @brief Writes a Byte to a given register into the audio codec through the 
-           control interface (I2C)
+  * @brief Queues a write of a byte to a codec register. The write is performed
+  *        by the control interface (I2C) interrupts: the function returns
+  *        immediately. A write to the register queued last, not being sent
+  *        yet, replaces it, and a write of the value the register already
+  *        holds is skipped.
   * @param RegisterAddr: The address (location) of the register to be written.
   * @param RegisterValue: the Byte value to be written into destination register.
-  * @retval o if correct communication, else wrong communication
+  * @retval 0 if the write is queued or skipped, 1 if the queue is full.
   */
 static uint32_t Codec_WriteRegister(uint32_t RegisterAddr,
                                     uint32_t RegisterValue)
 {
+  CODEC_WriteTypeDef *pwrite;
+  UBaseType_t mask;
   uint32_t result = 0;
 
-  /* !< While the bus is busy */
-  CODECTimeout = CODEC_LONG_TIMEOUT;
-  while (I2C_GetFlagStatus(CODEC_I2C, I2C_FLAG_BUSY))
-  {
-    if ((CODECTimeout--) == 0)
-      return 0;//Codec_TIMEOUT_UserCallback();
-  }
+  /* Masks the interrupts up to configMAX_SYSCALL_INTERRUPT_PRIORITY only:
+   * the callers may run in the audio task or in the USB interrupt */
+  mask = taskENTER_CRITICAL_FROM_ISR();
 
-  /* Start the config sequence */
-  I2C_GenerateSTART(CODEC_I2C, ENABLE);
+  Codec_CtrlWatch();
 
-  /* Test on EV5 and clear it */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (!I2C_CheckEvent(CODEC_I2C, I2C_EVENT_MASTER_MODE_SELECT))
+  pwrite = &CodecI2cQueue[(CodecI2cHead - 1) % CODEC_I2C_QUEUE_SIZE];
+  if ((RegisterAddr < CODEC_REG_NUM) && CodecShadowValid[RegisterAddr] &&
+      (CodecShadow[RegisterAddr] == (uint8_t)RegisterValue))
   {
-    if ((CODECTimeout--) == 0)
-      return 0;//Codec_TIMEOUT_UserCallback();
+    CodecRegSkipped++;
   }
+  else if ((CodecI2cHead != (CodecI2cTail + CodecI2cBurst)) &&
+      (pwrite->reg == (uint8_t)RegisterAddr))
+  {
+    pwrite->value = (uint8_t)RegisterValue;
+  }
+  else if ((CodecI2cHead - CodecI2cTail) < CODEC_I2C_QUEUE_SIZE)
+  {
+    pwrite = &CodecI2cQueue[CodecI2cHead % CODEC_I2C_QUEUE_SIZE];
+    pwrite->reg = (uint8_t)RegisterAddr;
+    pwrite->value = (uint8_t)RegisterValue;
+    CodecI2cHead++;
 
-  /* Transmit the slave address and enable writing operation */
-  I2C_Send7bitAddress(CODEC_I2C, CODEC_ADDRESS, I2C_Direction_Transmitter);
+    if (CodecI2cBurst == 0)
+    {
+      Codec_CtrlStart();
+    }
+  }
+  else
+  {
+    result = 1;
+  }
 
-  /* Test on EV6 and clear it */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (!I2C_CheckEvent(CODEC_I2C, I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED))
+  if ((result == 0) && (RegisterAddr < CODEC_REG_NUM))
   {
-    if ((CODECTimeout--) == 0)
-      return 0;//Codec_TIMEOUT_UserCallback();
+    CodecShadow[RegisterAddr] = (uint8_t)RegisterValue;
+    CodecShadowValid[RegisterAddr] = 1;
   }
 
-  /* Transmit the first address for write operation */
-  I2C_SendData(CODEC_I2C, RegisterAddr);
+  taskEXIT_CRITICAL_FROM_ISR(mask);
 
-  /* Test on EV8 and clear it */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (!I2C_CheckEvent(CODEC_I2C, I2C_EVENT_MASTER_BYTE_TRANSMITTING))
+  return result;
+}
+
+/**
+  * @brief Reads a codec register from the shadow of the register map.
+  * @param RegisterAddr: Address of the register to be read.
+  * @param pValue: value written last to the register.
+  * @retval 0 if the value is known, 1 if the register has not been written
+  *         since the last reset.
+  */
+uint32_t Codec_ReadRegister(uint32_t RegisterAddr, uint8_t *pValue)
+{
+  if ((RegisterAddr >= CODEC_REG_NUM) || !CodecShadowValid[RegisterAddr])
   {
-    if ((CODECTimeout--) == 0)
-      return 0;//Codec_TIMEOUT_UserCallback();
+    return 1;
   }
 
-  /* Disable the interrupts mechanism to prevent the I2C communication from
-   * corruption */
-  __disable_irq();
+  *pValue = CodecShadow[RegisterAddr];
+
+  return 0;
+}
 
-  /* Prepare the register value to be sent */
-  I2C_SendData(CODEC_I2C, RegisterValue);
+/**
+  * @brief Forgets the shadow of the register map: the next write to each
+  *        register is sent.
+  * @param None.
+  * @retval None.
+  */
+static void Codec_ShadowInvalidate(void)
+{
+  uint32_t reg;
 
-  /* !< Wait till all data have been physically transferred on the bus */
-  CODECTimeout = CODEC_LONG_TIMEOUT;
-  while (!I2C_GetFlagStatus(CODEC_I2C, I2C_FLAG_BTF))
+  for (reg = 0; reg < CODEC_REG_NUM; reg++)
   {
-    if ((CODECTimeout--) == 0);
-      //Codec_TIMEOUT_UserCallback();
+    CodecShadowValid[reg] = 0;
   }
+}
 
-  /* End the configuration sequence */
-  I2C_GenerateSTOP(CODEC_I2C, ENABLE);
-
-#ifdef VERIFY_WRITTENDATA
-  /* Verify that the data has been correctly written */
-  result = (Codec_ReadRegister(RegisterAddr) == RegisterValue) ? 0 : 1;
-#endif                          /* VERIFY_WRITTENDATA */
+/**
+  * @brief Returns the number of register writes not completed yet. A stalled
+  *        transfer is dropped first.
+  * @param None.
+  * @retval Number of writes queued or in progress.
+  */
+uint32_t Codec_CtrlPending(void)
+{
+  UBaseType_t mask;
 
-  /* Re-enable the interrupt mechanism */
-  __enable_irq();
+  mask = taskENTER_CRITICAL_FROM_ISR();
+  Codec_CtrlWatch();
+  taskEXIT_CRITICAL_FROM_ISR(mask);
 
-  /* Return the verifying value: 0 (Passed) or 1 (Failed) */
-  return result;
+  return CodecI2cHead - CodecI2cTail;
 }
 
-#ifdef VERIFY_WRITTENDATA
 /**
-  * @brief Reads and returns te value of an audio codec register through the 
-  *        control interface (I2C).
-  * @param RegisterAddr: Address of the register to be read.
-  * @retval Value of the register to be read or dummy value if the communication
-  *         fails.
+  * @brief Starts the transfer of the writes at the head of the queue: the
+  *        writes to consecutive registers are sent in one auto-increment
+  *        burst. Called with the I2C interrupts masked.
+  * @param None.
+  * @retval None.
   */
-static uint32_t Codec_ReadRegister(uint32_t RegisterAddr)
+static void Codec_CtrlStart(void)
 {
-  uint32_t result = 0;
+  CODEC_WriteTypeDef *pwrite;
+  uint32_t timeout;
 
-  /* !< While the bus is busy */
-  CODECTimeout = CODEC_LONG_TIMEOUT;
-  while (I2C_GetFlagStatus(CODEC_I2C, I2C_FLAG_BUSY))
+  CodecI2cBurst = 1;
+  pwrite = &CodecI2cQueue[CodecI2cTail % CODEC_I2C_QUEUE_SIZE];
+  while ((CodecI2cBurst < CODEC_I2C_BURST_MAX) &&
+         ((CodecI2cTail + CodecI2cBurst) != CodecI2cHead))
   {
-    if ((CODECTimeout--) == 0)
-      return Codec_TIMEOUT_UserCallback();
+    if (CodecI2cQueue[(CodecI2cTail + CodecI2cBurst) % CODEC_I2C_QUEUE_SIZE].reg !=
+        (uint8_t)(pwrite->reg + CodecI2cBurst))
+    {
+      break;
+    }
+    CodecI2cBurst++;
   }
+  CodecI2cIndex = 0;
+  CodecI2cStartTick = xTaskGetTickCountFromISR();
 
-  /* Start the config sequence */
-  I2C_GenerateSTART(CODEC_I2C, ENABLE);
-
-  /* Test on EV5 and clear it */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (!I2C_CheckEvent(CODEC_I2C, I2C_EVENT_MASTER_MODE_SELECT))
+  /* CR1 must not be written while the STOP of the previous transfer is
+   * pending: it only lasts until the end of the current SCL period */
+  timeout = CODEC_FLAG_TIMEOUT;
+  while ((CODEC_I2C->CR1 & I2C_CR1_STOP) && (timeout != 0))
   {
-    if ((CODECTimeout--) == 0)
-      return Codec_TIMEOUT_UserCallback();
+    timeout--;
   }
 
-  /* Transmit the slave address and enable writing operation */
-  I2C_Send7bitAddress(CODEC_I2C, CODEC_ADDRESS, I2C_Direction_Transmitter);
+  I2C_ITConfig(CODEC_I2C, I2C_IT_EVT | I2C_IT_BUF | I2C_IT_ERR, ENABLE);
+  I2C_GenerateSTART(CODEC_I2C, ENABLE);
+}
 
-  /* Test on EV6 and clear it */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (!I2C_CheckEvent(CODEC_I2C, I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED))
-  {
-    if ((CODECTimeout--) == 0)
-      return Codec_TIMEOUT_UserCallback();
-  }
+/**
+  * @brief Ends the transfer in progress and starts the next one, through a
+  *        repeated start, or releases the bus.
+  * @param None.
+  * @retval None.
+  */
+static void Codec_CtrlNext(void)
+{
+  UBaseType_t mask;
 
-  /* Transmit the register address to be read */
-  I2C_SendData(CODEC_I2C, RegisterAddr);
+  /* A write may be queued from a higher priority interrupt */
+  mask = taskENTER_CRITICAL_FROM_ISR();
 
-  /* Test on EV8 and clear it */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (I2C_GetFlagStatus(CODEC_I2C, I2C_FLAG_BTF) == RESET)
+  CodecI2cTail += CodecI2cBurst;
+  if (CodecI2cTail != CodecI2cHead)
+  {
+    Codec_CtrlStart();
+  }
+  else
   {
-    if ((CODECTimeout--) == 0)
-      return Codec_TIMEOUT_UserCallback();
+    CodecI2cBurst = 0;
+    I2C_ITConfig(CODEC_I2C, I2C_IT_EVT | I2C_IT_BUF | I2C_IT_ERR, DISABLE);
+    I2C_GenerateSTOP(CODEC_I2C, ENABLE);
   }
 
-  /* !< Send START condition a second time */
-  I2C_GenerateSTART(CODEC_I2C, ENABLE);
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+/**
+  * @brief  Handles the events of the codec control interface (I2C): sends
+  *         the address, the register address and the values of a burst.
+  * @param  None.
+  * @retval None.
+  */
+void Codec_I2C_EV_IRQHandler(void)
+{
+  CODEC_WriteTypeDef *pwrite;
+  uint32_t sr1 = CODEC_I2C->SR1;
 
-  /* !< Test on EV5 and clear it (cleared by reading SR1 then writing to DR) */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (!I2C_CheckEvent(CODEC_I2C, I2C_EVENT_MASTER_MODE_SELECT))
+  if (sr1 & I2C_SR1_SB)
+  {
+    /* EV5: start sent */
+    I2C_Send7bitAddress(CODEC_I2C, CODEC_ADDRESS, I2C_Direction_Transmitter);
+  }
+  else if (sr1 & I2C_SR1_ADDR)
   {
-    if ((CODECTimeout--) == 0)
-      return Codec_TIMEOUT_UserCallback();
+    /* EV6: address acknowledged, cleared by reading SR2. The MAP byte
+     * selects the first register, auto-incremented for a burst */
+    (void)CODEC_I2C->SR2;
+    pwrite = &CodecI2cQueue[CodecI2cTail % CODEC_I2C_QUEUE_SIZE];
+    I2C_SendData(CODEC_I2C, pwrite->reg | ((CodecI2cBurst > 1) ? CODEC_MAP_INCR : 0));
   }
+  else if ((sr1 & I2C_SR1_TXE) && (CodecI2cIndex < CodecI2cBurst))
+  {
+    /* EV8: next value of the burst */
+    pwrite = &CodecI2cQueue[(CodecI2cTail + CodecI2cIndex) % CODEC_I2C_QUEUE_SIZE];
+    I2C_SendData(CODEC_I2C, pwrite->value);
+    CodecI2cIndex++;
+    if (CodecI2cIndex == CodecI2cBurst)
+    {
+      /* Wait for the last byte to be sent */
+      I2C_ITConfig(CODEC_I2C, I2C_IT_BUF, DISABLE);
+    }
+  }
+  else if (sr1 & I2C_SR1_BTF)
+  {
+    /* EV8_2: burst sent */
+    CodecI2cBursts++;
+    CodecRegWrites += CodecI2cBurst;
+    Codec_CtrlNext();
+  }
+}
+
+/**
+  * @brief  Handles the errors of the codec control interface (I2C): the
+  *         burst in progress is dropped and the next one started.
+  * @param  None.
+  * @retval None.
+  */
+void Codec_I2C_ER_IRQHandler(void)
+{
+  CodecI2cErrors++;
+  I2C_ClearFlag(CODEC_I2C, I2C_FLAG_AF | I2C_FLAG_ARLO | I2C_FLAG_BERR | I2C_FLAG_OVR);
 
-  __disable_irq();
+  Codec_CtrlDrop();
+  Codec_CtrlNext();
+}
 
-  /* !< Send Codec address for read */
-  I2C_Send7bitAddress(CODEC_I2C, CODEC_ADDRESS, I2C_Direction_Receiver);
+/**
+  * @brief Removes the registers of the burst in progress from the shadow:
+  *        their values are unknown once the burst is dropped, so the next
+  *        write to each of them is sent.
+  * @param None.
+  * @retval None.
+  */
+static void Codec_CtrlDrop(void)
+{
+  uint32_t i;
+  uint8_t reg;
 
-  /* Wait on ADDR flag to be set (ADDR is still not cleared at this level */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (I2C_GetFlagStatus(CODEC_I2C, I2C_FLAG_ADDR) == RESET)
+  for (i = 0; i < CodecI2cBurst; i++)
   {
-    if ((CODECTimeout--) == 0)
-      return Codec_TIMEOUT_UserCallback();
+    reg = CodecI2cQueue[(CodecI2cTail + i) % CODEC_I2C_QUEUE_SIZE].reg;
+    if (reg < CODEC_REG_NUM)
+    {
+      CodecShadowValid[reg] = 0;
+    }
   }
+}
 
-  /* !< Disable Acknowledgement */
-  I2C_AcknowledgeConfig(CODEC_I2C, DISABLE);
+/**
+  * @brief Drops the transfer in progress when it has not completed within
+  *        CODEC_I2C_STALL_MS, as when the codec holds the bus or an event is
+  *        lost: the bus is released, the control interface reset and the
+  *        next transfer started. Called with the I2C interrupts masked.
+  * @param None.
+  * @retval None.
+  */
+static void Codec_CtrlWatch(void)
+{
+  if ((CodecI2cBurst == 0) ||
+      ((xTaskGetTickCountFromISR() - CodecI2cStartTick) < pdMS_TO_TICKS(CODEC_I2C_STALL_MS)))
+  {
+    return;
+  }
 
-  /* Clear ADDR register by reading SR1 then SR2 register (SR1 has already been 
-   * read) */
-  (void)CODEC_I2C->SR2;
+  CodecI2cStalls++;
+  Codec_CtrlDrop();
 
-  /* !< Send STOP Condition */
-  I2C_GenerateSTOP(CODEC_I2C, ENABLE);
+  I2C_ITConfig(CODEC_I2C, I2C_IT_EVT | I2C_IT_BUF | I2C_IT_ERR, DISABLE);
+  I2C_SoftwareResetCmd(CODEC_I2C, ENABLE);
+  Codec_CtrlBusClear();
+  I2C_SoftwareResetCmd(CODEC_I2C, DISABLE);
+  Codec_CtrlConfig();
 
-  /* Wait for the byte to be received */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (I2C_GetFlagStatus(CODEC_I2C, I2C_FLAG_RXNE) == RESET)
+  CodecI2cTail += CodecI2cBurst;
+  CodecI2cBurst = 0;
+  if (CodecI2cTail != CodecI2cHead)
   {
-    if ((CODECTimeout--) == 0)
-      return Codec_TIMEOUT_UserCallback();
+    Codec_CtrlStart();
   }
+}
 
-  /* !< Read the byte received from the Codec */
-  result = I2C_ReceiveData(CODEC_I2C);
+/**
+  * @brief Releases the bus when a slave holds SDA low, left in the middle of
+  *        a byte: SCL is clocked by hand until SDA is released, then a STOP
+  *        is sent. Called while the I2C peripheral is held in reset.
+  * @param None.
+  * @retval None.
+  */
+static void Codec_CtrlBusClear(void)
+{
+  GPIO_InitTypeDef GPIO_InitStructure;
+  uint32_t i;
 
-  /* Wait to make sure that STOP flag has been cleared */
-  CODECTimeout = CODEC_FLAG_TIMEOUT;
-  while (CODEC_I2C->CR1 & I2C_CR1_STOP)
+  if (GPIO_ReadInputDataBit(CODEC_I2C_GPIO, CODEC_I2C_SDA_PIN) != Bit_RESET)
   {
-    if ((CODECTimeout--) == 0)
-      return Codec_TIMEOUT_UserCallback();
+    return;
   }
 
-  /* !< Re-Enable Acknowledgement to be ready for another reception */
-  I2C_AcknowledgeConfig(CODEC_I2C, ENABLE);
+  GPIO_SetBits(CODEC_I2C_GPIO, CODEC_I2C_SCL_PIN | CODEC_I2C_SDA_PIN);
+  GPIO_InitStructure.GPIO_Pin = CODEC_I2C_SCL_PIN | CODEC_I2C_SDA_PIN;
+  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_OUT;
+  GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+  GPIO_InitStructure.GPIO_OType = GPIO_OType_OD;
+  GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_NOPULL;
+  GPIO_Init(CODEC_I2C_GPIO, &GPIO_InitStructure);
 
-  /* Clear AF flag for next communication */
-  I2C_ClearFlag(CODEC_I2C, I2C_FLAG_AF);
+  for (i = 0; (i < CODEC_I2C_CLEAR_CLOCKS) &&
+       (GPIO_ReadInputDataBit(CODEC_I2C_GPIO, CODEC_I2C_SDA_PIN) == Bit_RESET); i++)
+  {
+    GPIO_ResetBits(CODEC_I2C_GPIO, CODEC_I2C_SCL_PIN);
+    Delay(CODEC_I2C_CLEAR_LOOPS);
+    GPIO_SetBits(CODEC_I2C_GPIO, CODEC_I2C_SCL_PIN);
+    Delay(CODEC_I2C_CLEAR_LOOPS);
+  }
 
-  /* Re-enable the interrupt mechanism */
-  __enable_irq();
+  /* STOP: SDA rising while SCL is high */
+  GPIO_ResetBits(CODEC_I2C_GPIO, CODEC_I2C_SCL_PIN);
+  Delay(CODEC_I2C_CLEAR_LOOPS);
+  GPIO_ResetBits(CODEC_I2C_GPIO, CODEC_I2C_SDA_PIN);
+  Delay(CODEC_I2C_CLEAR_LOOPS);
+  GPIO_SetBits(CODEC_I2C_GPIO, CODEC_I2C_SCL_PIN);
+  Delay(CODEC_I2C_CLEAR_LOOPS);
+  GPIO_SetBits(CODEC_I2C_GPIO, CODEC_I2C_SDA_PIN);
+  Delay(CODEC_I2C_CLEAR_LOOPS);
 
-  /* Return the byte read from Codec */
-  return result;
+  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
+  GPIO_Init(CODEC_I2C_GPIO, &GPIO_InitStructure);
 }
-#endif                          /* VERIFY_WRITTENDATA */
 
 /**
   * @brief Initializes the Audio Codec control interface (I2C).
@@ -945,29 +1324,50 @@ static uint32_t Codec_ReadRegister(uint32_t RegisterAddr)
   */
 static void Codec_CtrlInterface_Init(void)
 {
-  I2C_InitTypeDef I2C_InitStructure;
+  NVIC_InitTypeDef NVIC_InitStructure;
 
   /* Enable the CODEC_I2C peripheral clock */
   RCC_APB1PeriphClockCmd(CODEC_I2C_CLK, ENABLE);
 
   /* If the I2C peripheral is already enabled, don't reconfigure it */
-  if (CODEC_I2C->CR1 & I2C_CR1_PE)
+  if ((CODEC_I2C->CR1 & I2C_CR1_PE) == 0)
   {
-    /* CODEC_I2C peripheral configuration */
     I2C_DeInit(CODEC_I2C);
-    I2C_InitStructure.I2C_Mode = I2C_Mode_I2C;
-    I2C_InitStructure.I2C_DutyCycle = I2C_DutyCycle_2;
-    I2C_InitStructure.I2C_OwnAddress1 = 0x33;
-    I2C_InitStructure.I2C_Ack = I2C_Ack_Enable;
-    I2C_InitStructure.I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit;
-    I2C_InitStructure.I2C_ClockSpeed = I2C_SPEED;
+    Codec_CtrlConfig();
+  }
 
-    /* Enable the I2C peripheral */
-    I2C_Cmd(CODEC_I2C, ENABLE);
+  /* The register writes are sent by the I2C event and error interrupts */
+  NVIC_InitStructure.NVIC_IRQChannel = CODEC_I2C_EV_IRQ;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = CODEC_I2C_IRQ_PREPRIO;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+  NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+  NVIC_Init(&NVIC_InitStructure);
+  NVIC_InitStructure.NVIC_IRQChannel = CODEC_I2C_ER_IRQ;
+  NVIC_Init(&NVIC_InitStructure);
+}
 
-    /* Initialize the I2C peripheral */
-    I2C_Init(CODEC_I2C, &I2C_InitStructure);
-  }
+/**
+  * @brief Configures and enables the Audio Codec control interface (I2C).
+  * @param  None.
+  * @retval None.
+  */
+static void Codec_CtrlConfig(void)
+{
+  I2C_InitTypeDef I2C_InitStructure;
+
+  /* CODEC_I2C peripheral configuration */
+  I2C_InitStructure.I2C_Mode = I2C_Mode_I2C;
+  I2C_InitStructure.I2C_DutyCycle = I2C_DutyCycle_2;
+  I2C_InitStructure.I2C_OwnAddress1 = 0x33;
+  I2C_InitStructure.I2C_Ack = I2C_Ack_Enable;
+  I2C_InitStructure.I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit;
+  I2C_InitStructure.I2C_ClockSpeed = I2C_SPEED;
+
+  /* Enable the I2C peripheral */
+  I2C_Cmd(CODEC_I2C, ENABLE);
+
+  /* Initialize the I2C peripheral */
+  I2C_Init(CODEC_I2C, &I2C_InitStructure);
 }
 
 /**
@@ -990,11 +1390,18 @@ static void Codec_CtrlInterface_DeInit(void)
   *         Devices RevA/Z and through dedicated PLLI2S_R in Devices RevB/Y)
   *         is already configured and ready to be used.    
   * @param  AudioFreq: Audio frequency to be configured for the I2S peripheral. 
-  * @retval None.
+  * @retval 0 if the I2S is configured, 1 if the PLLI2S did not lock: the I2S
+  *         is then left unconfigured.
   */
-static void Codec_AudioInterface_Init(uint32_t AudioFreq)
+static uint32_t Codec_AudioInterface_Init(uint32_t AudioFreq)
 {
-	printf("Codec_AudioInterface_Init\r\n");
+  /* Select the I2S clock for this frequency. The I2S cannot run from an
+     unlocked PLLI2S. */
+  if (Codec_PLLI2S_Config(AudioFreq) != 0)
+  {
+    return 1;
+  }
+
   /* Enable the CODEC_I2S peripheral clock */
   RCC_APB1PeriphClockCmd(CODEC_I2S_CLK, ENABLE);
   RCC->APB1ENR |= RCC_APB1Periph_SPI2 | RCC_APB1Periph_SPI3;
@@ -1003,7 +1410,7 @@ static void Codec_AudioInterface_Init(uint32_t AudioFreq)
   SPI_I2S_DeInit(CODEC_I2S);
   I2S_InitStructure.I2S_AudioFreq = AudioFreq;
   I2S_InitStructure.I2S_Standard = I2S_STANDARD;
-  I2S_InitStructure.I2S_DataFormat = I2S_DataFormat_16b;
+  I2S_InitStructure.I2S_DataFormat = CodecDataFormat;
   I2S_InitStructure.I2S_CPOL = I2S_CPOL_Low;
   I2S_InitStructure.I2S_Mode = I2S_Mode_MasterTx;
 #ifdef CODEC_MCLK_ENABLED
@@ -1017,11 +1424,21 @@ static void Codec_AudioInterface_Init(uint32_t AudioFreq)
   /* Initialize the I2S peripheral with the structure above */
   I2S_Init(CODEC_I2S, &I2S_InitStructure);
 
+  /* Replace the prescaler computed by I2S_Init() by the planned one */
+  if (CodecClockPlan.PLLI2SN != 0)
+  {
+    CODEC_I2S->I2SPR = (uint16_t)(CodecClockPlan.I2SDIV |
+                                  ((uint16_t)CodecClockPlan.I2SODD << 8) |
+                                  (CodecClockPlan.MCLKOutput ? SPI_I2SPR_MCKOE : 0));
+  }
+
   /* Enable the I2S DMA TX request */
   SPI_I2S_DMACmd(CODEC_I2S, SPI_I2S_DMAReq_Tx, ENABLE);
 
   /* The I2S peripheral will be enabled only in the EVAL_AUDIO_Play() function
    * or by user functions if DMA mode not enabled */
+
+  return 0;
 }
 
 /**
@@ -1031,7 +1448,6 @@ static void Codec_AudioInterface_Init(uint32_t AudioFreq)
   */
 static void Codec_AudioInterface_DeInit(void)
 {
-	printf("Codec_AudioInterface_DeInit\r\n");
   /* Disable the CODEC_I2S peripheral (in case it hasn't already been disabled) 
    */
   I2S_Cmd(CODEC_I2S, DISABLE);
@@ -1043,6 +1459,93 @@ static void Codec_AudioInterface_DeInit(void)
   RCC_APB1PeriphClockCmd(CODEC_I2S_CLK, DISABLE);
 }
 
+/**
+  * @brief  Computes the I2S clock settings closest to an audio frequency for
+  *         the current PLL input and MCLK configuration.
+  * @param  AudioFreq: Audio frequency to be played.
+  * @param  DataFormat: I2S data format (I2S_DataFormat_xxx).
+  * @param  plan: filled with the settings found.
+  * @retval 0 if the frequency can be generated, else 1.
+  */
+static uint32_t Codec_ClockPlan(uint32_t AudioFreq, uint16_t DataFormat,
+                                AUDIO_ClockPlanTypeDef *plan)
+{
+  uint32_t chbits;
+  uint32_t pllin;
+  uint32_t pllm = RCC->PLLCFGR & RCC_PLLCFGR_PLLM;
+
+  if (pllm == 0)
+  {
+    return 1;
+  }
+
+  /* The PLLI2S shares its input divider with the main PLL */
+  if ((RCC->PLLCFGR & RCC_PLLCFGR_PLLSRC) != 0)
+  {
+    pllin = HSE_VALUE / pllm;
+  }
+  else
+  {
+    pllin = HSI_VALUE / pllm;
+  }
+
+  /* Only 16-bit samples are sent in 16-bit channels */
+  chbits = (DataFormat == I2S_DataFormat_16b) ? 16 : 32;
+
+#ifdef CODEC_MCLK_ENABLED
+  return Audio_Clock_Plan(pllin, AudioFreq, chbits, 1, plan);
+#else
+  return Audio_Clock_Plan(pllin, AudioFreq, chbits, 0, plan);
+#endif                          /* CODEC_MCLK_ENABLED */
+}
+
+/**
+  * @brief  Reprograms the PLLI2S with the lowest error setting for the given
+  *         audio frequency. The PLLI2S is left untouched if it already runs
+  *         with this setting or if the frequency cannot be generated.
+  * @note   The I2S must not be running while the PLLI2S is reconfigured.
+  * @param  AudioFreq: Audio frequency to be played.
+  * @retval 0 if the PLLI2S runs with the setting, 1 if the frequency cannot
+  *         be generated (the PLLI2S may be off after a power down) or if it
+  *         did not lock within PLLI2S_LOCK_TIMEOUT_MS.
+  */
+static uint32_t Codec_PLLI2S_Config(uint32_t AudioFreq)
+{
+  uint32_t cfgr;
+  uint32_t timeout = PLLI2S_LOCK_TIMEOUT_MS;
+
+  if (Codec_ClockPlan(AudioFreq, CodecDataFormat, &CodecClockPlan) != 0)
+  {
+    CodecClockPlan.PLLI2SN = 0;
+    return 1;
+  }
+
+  cfgr = ((uint32_t)CodecClockPlan.PLLI2SN << 6) |
+         ((uint32_t)CodecClockPlan.PLLI2SR << 28);
+  if (((RCC->PLLI2SCFGR & (RCC_PLLI2SCFGR_PLLI2SN | RCC_PLLI2SCFGR_PLLI2SR)) == cfgr) &&
+      ((RCC->CR & RCC_CR_PLLI2SRDY) != 0))
+  {
+    return 0;
+  }
+
+  RCC_PLLI2SCmd(DISABLE);
+  RCC_PLLI2SConfig(CodecClockPlan.PLLI2SN, CodecClockPlan.PLLI2SR);
+  RCC_PLLI2SCmd(ENABLE);
+
+  /* Wait for the PLLI2S to lock */
+  while (RCC_GetFlagStatus(RCC_FLAG_PLLI2SRDY) == RESET)
+  {
+    if (timeout == 0)
+    {
+      return 1;
+    }
+    Codec_Delay(1);
+    timeout--;
+  }
+
+  return 0;
+}
+
 /**
   * @brief Initializes IOs used by the Audio Codec (on the control and audio 
   *        interfaces).
@@ -1052,7 +1555,6 @@ static void Codec_AudioInterface_DeInit(void)
 static void Codec_GPIO_Init(void)
 {
   GPIO_InitTypeDef GPIO_InitStructure;
-	printf("Codec_GPIO_Init\r\n");
 
   /* Enable I2S and I2C GPIO clocks */
   RCC_AHB1PeriphClockCmd(CODEC_I2C_GPIO_CLOCK | CODEC_I2S_GPIO_CLOCK, ENABLE);
@@ -1060,7 +1562,7 @@ static void Codec_GPIO_Init(void)
   /* CODEC_I2C SCL and SDA pins configuration
    * ------------------------------------- */
   /* If the I2C peripheral is already enabled, don't reconfigure it */
-  if (CODEC_I2C->CR1 & I2C_CR1_PE)
+  if ((CODEC_I2C->CR1 & I2C_CR1_PE) == 0)
   {
     GPIO_InitStructure.GPIO_Pin = CODEC_I2C_SCL_PIN | CODEC_I2C_SDA_PIN;
     GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
@@ -1109,7 +1611,6 @@ static void Codec_GPIO_Init(void)
 static void Codec_GPIO_DeInit(void)
 {
   GPIO_InitTypeDef GPIO_InitStructure;
-  printf("Codec_GPIO_DeInit\r\n");
 
   /* Deinitialize all the GPIOs used by the driver (EXCEPT the I2C IOs since
    * they are used by the IOExpander as well) */
@@ -1144,6 +1645,25 @@ static void Delay(__IO uint32_t nCount)
   for (; nCount != 0; nCount--);
 }
 
+/**
+  * @brief  Waits for a number of milliseconds: the calling task is blocked
+  *         when the scheduler runs, the CPU spins before it starts or in an
+  *         interrupt.
+  * @param  ms: delay in milliseconds.
+  * @retval None.
+  */
+static void Codec_Delay(uint32_t ms)
+{
+  if ((xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) && (__get_IPSR() == 0))
+  {
+    vTaskDelay(pdMS_TO_TICKS(ms) + 1);
+  }
+  else
+  {
+    Delay(ms * CODEC_DELAY_LOOPS_MS);
+  }
+}
+
 #ifdef USE_DEFAULT_TIMEOUT_CALLBACK
 /**
   * @brief  Basic management of the timeout situation.
@@ -1175,7 +1695,6 @@ void Audio_MAL_Init(void)
 #if defined(AUDIO_MAL_DMA_IT_TC_EN) || defined(AUDIO_MAL_DMA_IT_HT_EN) || defined(AUDIO_MAL_DMA_IT_TE_EN)
   NVIC_InitTypeDef NVIC_InitStructure;
 #endif
-  printf("Audio_MAL_Init\r\n");
   /* Enable the DMA clock */
   RCC_AHB1PeriphClockCmd(AUDIO_MAL_DMA_CLOCK, ENABLE);
 
@@ -1253,7 +1772,6 @@ void Audio_MAL_DeInit(void)
   NVIC_InitStructure.NVIC_IRQChannelCmd = DISABLE;
   NVIC_Init(&NVIC_InitStructure);
 #endif
-  printf("Audio_MAL_DeInit\r\n");
   /* Disable the DMA stream before the deinit */
   DMA_Cmd(AUDIO_MAL_DMA_STREAM, DISABLE);
 
@@ -1267,26 +1785,39 @@ void Audio_MAL_DeInit(void)
 /**
   * @brief  Starts playing audio stream from the audio Media.
   * @param  Addr: Pointer to the audio stream buffer
-  * @param  Size: Number of data in the audio stream buffer
+  * @param  Size: Number of data (half-words) in the audio stream buffer
+  * @note   In circular mode the DMA replays the whole buffer until it is
+  *         paused or stopped. Calling this function again with the same
+  *         buffer while the stream is running has no effect.
   * @retval None.
   */
 void Audio_MAL_Play(uint32_t Addr, uint32_t Size)
 {
+#ifdef AUDIO_MAL_MODE_CIRCULAR
+  /* The stream is already running over this buffer: nothing to reconfigure */
+  if ((DMA_GetCmdStatus(AUDIO_MAL_DMA_STREAM) != DISABLE) &&
+      (DMA_InitStructure.DMA_Memory0BaseAddr == Addr) &&
+      (DMA_InitStructure.DMA_BufferSize == Size))
+  {
+    return;
+  }
+#endif                          /* AUDIO_MAL_MODE_CIRCULAR */
+
 #ifndef AUDIO_USE_MACROS
-  /* Enable the I2S DMA Stream */
+  /* Disable the I2S DMA Stream */
   DMA_Cmd(AUDIO_MAL_DMA_STREAM, DISABLE);
 
-  /* Clear the Interrupt flag */
-  DMA_ClearFlag(AUDIO_MAL_DMA_STREAM, AUDIO_MAL_DMA_FLAG_TC);
-
   /* Wait the DMA Stream to be effectively disabled */
   while (DMA_GetCmdStatus(AUDIO_MAL_DMA_STREAM) != DISABLE)
   {
   }
 
+  /* Clear the Interrupt flags */
+  DMA_ClearFlag(AUDIO_MAL_DMA_STREAM, AUDIO_MAL_DMA_FLAG_ALL);
+
   /* Configure the buffer address and size */
   DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t) Addr;
-  DMA_InitStructure.DMA_BufferSize = (uint32_t) (Size * 2);
+  DMA_InitStructure.DMA_BufferSize = (uint32_t) Size;
 
   /* Configure the DMA Stream with the new parameters */
   DMA_Init(AUDIO_MAL_DMA_STREAM, &DMA_InitStructure);
@@ -1303,18 +1834,20 @@ void Audio_MAL_Play(uint32_t Addr, uint32_t Size)
   /* Disable the I2S DMA Stream */
   AUDIO_MAL_DMA_STREAM->CR &= ~(uint32_t) DMA_SxCR_EN;
 
-  /* Clear the Interrupt flag */
-  AUDIO_MAL_DMA->AUDIO_MAL_DMA_IFCR =
-    (uint32_t) (AUDIO_MAL_DMA_FLAG_TC & 0x0F7D0F7D);
-
   /* Wait the DMA Stream to be effectively disabled */
   while ((AUDIO_MAL_DMA_STREAM->CR & (uint32_t) DMA_SxCR_EN) != 0)
   {
   }
 
+  /* Clear the Interrupt flags */
+  AUDIO_MAL_DMA->AUDIO_MAL_DMA_IFCR =
+    (uint32_t) (AUDIO_MAL_DMA_FLAG_ALL & 0x0F7D0F7D);
+
   /* Configure the buffer address and size */
+  DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t) Addr;
+  DMA_InitStructure.DMA_BufferSize = (uint32_t) Size;
   AUDIO_MAL_DMA_STREAM->M0AR = (uint32_t) Addr;
-  AUDIO_MAL_DMA_STREAM->NDTR = (uint32_t) (Size * 2);
+  AUDIO_MAL_DMA_STREAM->NDTR = (uint32_t) Size;
 
   /* Enable the I2S DMA Stream */
   AUDIO_MAL_DMA_STREAM->CR |= (uint32_t) DMA_SxCR_EN;
@@ -1348,11 +1881,8 @@ void Audio_MAL_PauseResume(uint32_t Cmd, uint32_t Addr, uint32_t Size)
     DMA_Cmd(AUDIO_MAL_DMA_STREAM, DISABLE);
 
 #else                           /* #if !defined(USE_DMA_PAUSE_FEATURE) */
-    /* Stop the current DMA request by resetting the I2S cell */
-    Codec_AudioInterface_DeInit();
-
-    /* Re-configure the I2S interface for the next resume operation */
-    Codec_AudioInterface_Init(I2S_InitStructure.I2S_AudioFreq);
+    /* Only the DMA stream is stopped: the I2S cell keeps its configuration
+     * and clocks so that the resume does not have to re-initialize it */
 
     /* Disable the DMA Stream */
     DMA_Cmd(AUDIO_MAL_DMA_STREAM, DISABLE);
@@ -1379,7 +1909,7 @@ void Audio_MAL_PauseResume(uint32_t Cmd, uint32_t Addr, uint32_t Size)
 #else
     /* Configure the buffer address and size */
     DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t) Addr;
-    DMA_InitStructure.DMA_BufferSize = (uint32_t) (Size * 2);
+    DMA_InitStructure.DMA_BufferSize = (uint32_t) Size;
 
     /* Configure the DMA Stream with the new parameters */
     DMA_Init(AUDIO_MAL_DMA_STREAM, &DMA_InitStructure);
@@ -1399,11 +1929,11 @@ void Audio_MAL_PauseResume(uint32_t Cmd, uint32_t Addr, uint32_t Size)
 /**
   * @brief  Stops audio stream playing on the used Media.
   * @param  None.
-  * @retval None.
+  * @retval 0 if the I2S has been configured again for the next play, 1 if
+  *         the PLLI2S did not lock.
   */
-void Audio_MAL_Stop(void)
+uint32_t Audio_MAL_Stop(void)
 {
-	  printf("Audio_MAL_Stop\r\n");
   /* Stop the Transfer on the I2S side: Stop and disable the DMA stream */
   DMA_Cmd(AUDIO_MAL_DMA_STREAM, DISABLE);
 
@@ -1421,7 +1951,28 @@ void Audio_MAL_Stop(void)
   Codec_AudioInterface_DeInit();
 
   /* Re-configure the I2S interface for the next paly operation */
-  Codec_AudioInterface_Init(I2S_InitStructure.I2S_AudioFreq);
+  return Codec_AudioInterface_Init(I2S_InitStructure.I2S_AudioFreq);
+}
+
+/**
+  * @brief  Returns the read position of the DMA inside the buffer being played.
+  * @param  None.
+  * @retval Number of bytes already transferred to the I2S in the current pass
+  *         over the buffer (0 when the stream is not running).
+  */
+uint32_t Audio_MAL_GetPosition(void)
+{
+  uint32_t remaining;
+
+  if (DMA_GetCmdStatus(AUDIO_MAL_DMA_STREAM) == DISABLE)
+  {
+    return 0;
+  }
+
+  remaining = DMA_GetCurrDataCounter(AUDIO_MAL_DMA_STREAM);
+
+  /* The DMA counts in peripheral data units (half-words) */
+  return (DMA_InitStructure.DMA_BufferSize - remaining) * 2;
 }
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -36,6 +36,8 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx.h"
+#include "audio_clock.h"
+#include "FreeRTOSConfig.h"
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
@@ -46,14 +48,17 @@
 //#define AUDIO_USE_MACROS
 
 /* Audio Transfer mode (DMA, Interrupt or Polling) */
-#define AUDIO_MAL_MODE_NORMAL         /* Uncomment this line to enable the audio \
-                                         Transfer using DMA */
-/* #define AUDIO_MAL_MODE_CIRCULAR */ /* Uncomment this line to enable the audio
+/* #define AUDIO_MAL_MODE_NORMAL */   /* Uncomment this line to enable the audio \
                                          Transfer using DMA */
+#define AUDIO_MAL_MODE_CIRCULAR       /* Uncomment this line to enable the audio
+                                         Transfer using DMA. The stream then runs
+                                         freely over the whole buffer passed to
+                                         Audio_MAL_Play() and is never reconfigured
+                                         while playing. */
 
 /* For the DMA modes select the interrupt that will be used */
-/* #define AUDIO_MAL_DMA_IT_TC_EN */ /* Uncomment this line to enable DMA Transfer Complete interrupt */
-/* #define AUDIO_MAL_DMA_IT_HT_EN */ /* Uncomment this line to enable DMA Half Transfer Complete interrupt */
+#define AUDIO_MAL_DMA_IT_TC_EN /* Uncomment this line to enable DMA Transfer Complete interrupt */
+#define AUDIO_MAL_DMA_IT_HT_EN /* Uncomment this line to enable DMA Half Transfer Complete interrupt */
 #define AUDIO_MAL_DMA_IT_TE_EN /* Uncomment this line to enable DMA Transfer Error interrupt */
 
 /* #define USE_DMA_PAUSE_FEATURE */ /* Uncomment this line to enable the use of DMA Pause Feature
@@ -63,7 +68,7 @@
                                  available after resume. */
 
 /* Select the interrupt preemption priority and subpriority for the DMA interrupt */
-#define EVAL_AUDIO_IRQ_PREPRIO 0 /* Select the preemption priority level(0 is the highest) */
+#define EVAL_AUDIO_IRQ_PREPRIO configAUDIO_DMA_INTERRUPT_PRIORITY /* Select the preemption priority level(0 is the highest) */
 #define EVAL_AUDIO_IRQ_SUBRIO 0  /* Select the sub-priority level (0 is the highest) */
 
 /* Uncomment the following line to use the default Codec_TIMEOUT_UserCallback() 
@@ -96,9 +101,16 @@
 //#define CODEC_MCLK_ENABLED
 #define CODEC_MCLK_DISABLED
 
-/* Uncomment this line to enable verifying data sent to codec after each write 
-  operation */
-/* #define VERIFY_WRITTENDATA */
+/* Codec register writes queued for the control interface interrupts, and
+  longest burst of writes to consecutive registers sent in one transfer */
+#define CODEC_I2C_QUEUE_SIZE 32
+#define CODEC_I2C_BURST_MAX 8
+
+/* Size of the codec register map kept in RAM (registers 0x00 to 0x34) */
+#define CODEC_REG_NUM 0x35
+
+/* Select the interrupt preemption priority for the I2C event and error interrupts */
+#define CODEC_I2C_IRQ_PREPRIO configCODEC_I2C_INTERRUPT_PRIORITY
 /*----------------------------------------------------------------------------*/
 
 /*-----------------------------------
@@ -152,6 +164,11 @@
 #define CODEC_I2C_SDA_PIN GPIO_Pin_7
 #define CODEC_I2S_SCL_PINSRC GPIO_PinSource6
 #define CODEC_I2S_SDA_PINSRC GPIO_PinSource7
+#define CODEC_I2C_EV_IRQ I2C1_EV_IRQn
+#define CODEC_I2C_ER_IRQ I2C1_ER_IRQn
+
+#define Codec_I2C_EV_IRQHandler I2C1_EV_IRQHandler
+#define Codec_I2C_ER_IRQHandler I2C1_ER_IRQHandler
 
 /* Maximum Timeout values for flags and events waiting loops. These timeouts are
    not based on accurate values, they just guarantee that the application will 
@@ -203,6 +220,10 @@ uint32_t EVAL_AUDIO_PauseResume(uint32_t Cmd, uint32_t Addr, uint32_t Size);
 uint32_t EVAL_AUDIO_Stop(uint32_t CodecPowerDown_Mode);
 uint32_t EVAL_AUDIO_VolumeCtl(uint8_t Volume);
 uint32_t EVAL_AUDIO_Mute(uint32_t Command);
+uint32_t EVAL_AUDIO_SetFormat(uint32_t AudioFreq, uint32_t Resolution);
+uint32_t EVAL_AUDIO_PowerDown(void);
+uint32_t EVAL_AUDIO_PowerUp(void);
+void EVAL_AUDIO_GetClockPlan(AUDIO_ClockPlanTypeDef *plan);
 uint32_t Codec_SwitchOutput(uint8_t Output);
 
 /*-----------------------------------
@@ -216,7 +237,11 @@ uint32_t Codec_PauseResume(uint32_t Cmd);
 uint32_t Codec_Stop(uint32_t Cmd);
 uint32_t Codec_VolumeCtrl(uint8_t Volume);
 uint32_t Codec_Mute(uint32_t Cmd);
+uint32_t Codec_CtrlPending(void);
+uint32_t Codec_ReadRegister(uint32_t RegisterAddr, uint8_t *pValue);
 void Audio_MAL_IRQHandler(void);
+void Codec_I2C_EV_IRQHandler(void);
+void Codec_I2C_ER_IRQHandler(void);
 
 /*-----------------------------------
                    MAL (Media Access Layer) functions 
@@ -225,7 +250,8 @@ void Audio_MAL_Init(void);
 void Audio_MAL_DeInit(void);
 void Audio_MAL_Play(uint32_t Addr, uint32_t Size);
 void Audio_MAL_PauseResume(uint32_t Cmd, uint32_t Addr, uint32_t Size);
-void Audio_MAL_Stop(void);
+uint32_t Audio_MAL_Stop(void);
+uint32_t Audio_MAL_GetPosition(void);
 
 /* User Callbacks: user has to implement these functions in his code if
   they are needed. -----------------------------------------------------------*/
@@ -0,0 +1,487 @@
+/**
+  ******************************************************************************
+  * @file    audio_asrc_check.c
+  * @brief   Host check of the asynchronous sample rate converter.
+  *
+  *          Converts sines with Audio_ASRC_Process() and Audio_ASRC_Process32()
+  *          at the ratio limits, -1000, 0 and +1000 ppm, in 1 ms output
+  *          blocks, and compares every output sample with the same cubic
+  *          Hermite interpolator computed in double precision at the exact
+  *          Q30 phase. The SNR against this reference measures the fixed
+  *          point error alone; the SNR against the ideal sine at the output
+  *          instant, which includes the error of the interpolator itself, is
+  *          printed for information. The frames consumed are checked against
+  *          the ratio, and at a ratio of exactly 1.0 random full scale frames,
+  *          extremes included, must come out bit for bit. The same frames
+  *          are then converted while Audio_ASRC_Steer() is fed a fill error
+  *          that drives the ratio away from 1.0 and back: once the ratio is
+  *          1.0 again, the phase must return to 0 within the time allowed by
+  *          AUDIO_ASRC_SETTLE_PPM, and every frame from there on must be an
+  *          input frame, bit for bit. The voice frequencies are also
+  *          converted to the output ones, 44.1 kHz to 48 kHz and back and
+  *          both to 96 kHz, through Audio_ASRC_SetRatio(), and checked the
+  *          same way in 16 bits. Then times the processing of 1 ms blocks
+  *          at +1000 ppm.
+  *
+  *          Build and run on the host:
+  *
+  *            gcc -O2 -I../App/Audio -o audio_asrc_check \
+  *                audio_asrc_check.c ../App/Audio/audio_asrc.c -lm
+  *            ./audio_asrc_check [fs [cpu_mhz]]
+  *
+  *          fs defaults to 48000 Hz. With cpu_mhz, the time per block is also
+  *          given in host cycles. The exit status is 1 if an SNR against the
+  *          reference is below its limit, the frame count drifts from the
+  *          ratio, or the ratio 1.0 is not bit-transparent, from the start
+  *          or after a correction.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "audio_asrc.h"
+
+/* Private define ------------------------------------------------------------*/
+#define CHECK_FS                        48000
+#define CHECK_FS_MAX                    192000
+#define CHECK_SECONDS                   1
+#define CHECK_FRAMES_MAX                (CHECK_FS_MAX * CHECK_SECONDS)
+#define CHECK_IN_FRAMES_MAX             (CHECK_FRAMES_MAX + (CHECK_FRAMES_MAX / 500) + 8)
+#define CHECK_SETTLE_FRAMES             4       /* Input frames before the history is full */
+#define CHECK_AMPLITUDE                 0.5     /* Of full scale */
+#define CHECK_SNR16_DB                  80.0    /* Output rounding: 92 dB at -6 dBFS */
+#define CHECK_SNR32_DB                  95.0    /* Bound by the Q16 position */
+#define CHECK_DRIFT_FRAMES              1.0
+#define CHECK_TIMED_BLOCKS              200000
+#define CHECK_STEER_BLOCKS              100     /* 1 ms blocks steered away */
+#define CHECK_STEER_ERROR               40      /* Fill error, in frames */
+
+/* Private variables ---------------------------------------------------------*/
+static const int32_t CheckPpm[] = { -AUDIO_ASRC_MAX_PPM, 0, AUDIO_ASRC_MAX_PPM };
+static const double CheckTones[] = { 997.0, 9973.0 };
+
+/* Voice frequencies converted to the output ones: input, output (Hz) */
+static const uint32_t CheckVoiceRates[][2] =
+{
+  { 44100, 48000 }, { 48000, 44100 }, { 44100, 96000 }, { 48000, 96000 }
+};
+
+static AUDIO_ASRC_TypeDef CheckAsrc;
+static int16_t CheckIn16[CHECK_IN_FRAMES_MAX * AUDIO_ASRC_CHANNELS];
+static int16_t CheckOut16[CHECK_FRAMES_MAX * AUDIO_ASRC_CHANNELS];
+static int32_t CheckIn32[CHECK_IN_FRAMES_MAX * AUDIO_ASRC_CHANNELS];
+static int32_t CheckOut32[CHECK_FRAMES_MAX * AUDIO_ASRC_CHANNELS];
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Cubic Hermite interpolation in double precision.
+  * @param  x: x[-1], x[0], x[1], x[2].
+  * @param  t: position between x[0] and x[1], from 0 to 1.
+  * @retval Interpolated sample.
+  */
+static double CHECK_Hermite(const double *x, double t)
+{
+  double c1 = 0.5 * (x[2] - x[0]);
+  double c2 = x[0] - 2.5 * x[1] + 2.0 * x[2] - 0.5 * x[3];
+  double c3 = 0.5 * (x[3] - x[0]) + 1.5 * (x[1] - x[2]);
+
+  return ((c3 * t + c2) * t + c1) * t + x[1];
+}
+
+/**
+  * @brief  Converts CHECK_SECONDS of input in 1 ms blocks.
+  * @param  bits: 16 for Audio_ASRC_Process(), 32 for Audio_ASRC_Process32().
+  * @param  ppm: ratio deviation.
+  * @param  inFs: input frames per second.
+  * @param  fs: output frames per second.
+  * @retval Input frames consumed.
+  */
+static uint32_t CHECK_Convert(uint32_t bits, int32_t ppm, uint32_t inFs, uint32_t fs)
+{
+  uint32_t total = fs * CHECK_SECONDS;
+  uint32_t block = fs / 1000;
+  uint32_t in = 0, out = 0;
+  uint32_t nin, nout;
+
+  Audio_ASRC_Init(&CheckAsrc);
+  Audio_ASRC_SetRatio(&CheckAsrc, inFs, fs);
+  CheckAsrc.adjust = AUDIO_ASRC_PPM(ppm);
+
+  while (out < total)
+  {
+    nin = CHECK_IN_FRAMES_MAX - in;
+    nout = ((total - out) < block) ? (total - out) : block;
+    if (bits == 16)
+    {
+      Audio_ASRC_Process(&CheckAsrc, &CheckIn16[in * AUDIO_ASRC_CHANNELS], &nin,
+                         &CheckOut16[out * AUDIO_ASRC_CHANNELS], &nout);
+    }
+    else
+    {
+      Audio_ASRC_Process32(&CheckAsrc, &CheckIn32[in * AUDIO_ASRC_CHANNELS], &nin,
+                           &CheckOut32[out * AUDIO_ASRC_CHANNELS], &nout);
+    }
+    in += nin;
+    out += nout;
+  }
+
+  return in;
+}
+
+/**
+  * @brief  Converts a sine and measures the output against the double
+  *         precision interpolator and against the ideal sine.
+  * @param  bits: 16 or 32.
+  * @param  ppm: ratio deviation.
+  * @param  inFs: input sampling frequency (Hz).
+  * @param  fs: output sampling frequency (Hz).
+  * @param  f: tone frequency (Hz).
+  * @param  pSnrRef: SNR against the double precision interpolator (dB).
+  * @param  pSnrIdeal: SNR against the ideal sine (dB).
+  * @param  pDrift: input frames consumed minus the frames due at the ratio
+  *         by the last output frame.
+  * @retval None
+  */
+static void CHECK_Accuracy(uint32_t bits, int32_t ppm, uint32_t inFs, uint32_t fs, double f,
+                           double *pSnrRef, double *pSnrIdeal, double *pDrift)
+{
+  uint32_t total = fs * CHECK_SECONDS;
+  double scale = (bits == 16) ? 32768.0 : 2147483648.0;
+  double x[4][AUDIO_ASRC_CHANNELS];
+  double sig = 0.0, noise = 0.0, ideal = 0.0, ref, y, pos, t;
+  uint32_t step;
+  uint32_t phase = 0, m = 0;
+  uint32_t i, k, ch, used;
+
+  /* Left channel in phase, right channel in quadrature */
+  for (i = 0; i < CHECK_IN_FRAMES_MAX; i++)
+  {
+    for (ch = 0; ch < AUDIO_ASRC_CHANNELS; ch++)
+    {
+      y = CHECK_AMPLITUDE * sin(2.0 * M_PI * f * i / inFs + ch * M_PI / 2.0);
+      CheckIn16[i * AUDIO_ASRC_CHANNELS + ch] = (int16_t)lrint(y * 32768.0);
+      CheckIn32[i * AUDIO_ASRC_CHANNELS + ch] = (int32_t)lrint(y * 2147483648.0);
+    }
+  }
+
+  used = CHECK_Convert(bits, ppm, inFs, fs);
+  step = CheckAsrc.ratio + (uint32_t)AUDIO_ASRC_PPM(ppm);
+
+  /* Same state machine, exact phase and double precision arithmetic */
+  memset(x, 0, sizeof(x));
+  for (k = 0; k < total; k++)
+  {
+    while (phase >= AUDIO_ASRC_ONE)
+    {
+      memmove(x[0], x[1], 3 * sizeof(x[0]));
+      for (ch = 0; ch < AUDIO_ASRC_CHANNELS; ch++)
+      {
+        x[3][ch] = (bits == 16) ? (double)CheckIn16[m * AUDIO_ASRC_CHANNELS + ch] :
+                                  (double)CheckIn32[m * AUDIO_ASRC_CHANNELS + ch];
+      }
+      m++;
+      phase -= AUDIO_ASRC_ONE;
+    }
+    t = (double)phase / AUDIO_ASRC_ONE;
+
+    if (m >= CHECK_SETTLE_FRAMES)
+    {
+      /* x[1] is input frame m - 3 */
+      pos = ((double)m - 3.0) + t;
+      for (ch = 0; ch < AUDIO_ASRC_CHANNELS; ch++)
+      {
+        double col[4] = { x[0][ch], x[1][ch], x[2][ch], x[3][ch] };
+
+        ref = CHECK_Hermite(col, t);
+        y = (bits == 16) ? (double)CheckOut16[k * AUDIO_ASRC_CHANNELS + ch] :
+                           (double)CheckOut32[k * AUDIO_ASRC_CHANNELS + ch];
+        sig += ref * ref;
+        noise += (y - ref) * (y - ref);
+        ref = scale * CHECK_AMPLITUDE * sin(2.0 * M_PI * f * pos / inFs + ch * M_PI / 2.0);
+        ideal += (y - ref) * (y - ref);
+      }
+    }
+    phase += step;
+  }
+
+  *pSnrRef = (noise > 0.0) ? (10.0 * log10(sig / noise)) : INFINITY;
+  *pSnrIdeal = (ideal > 0.0) ? (10.0 * log10(sig / ideal)) : INFINITY;
+  *pDrift = (double)used - ((double)(total - 1) * step / AUDIO_ASRC_ONE);
+}
+
+/**
+  * @brief  Fills the input with random full scale frames, extremes included.
+  * @param  None.
+  * @retval None
+  */
+static void CHECK_Noise(void)
+{
+  uint32_t seed = 0x2545F491;
+  uint32_t i;
+
+  for (i = 0; i < (CHECK_IN_FRAMES_MAX * AUDIO_ASRC_CHANNELS); i++)
+  {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    CheckIn32[i] = (int32_t)seed;
+    CheckIn16[i] = (int16_t)(seed >> 16);
+  }
+  /* Extremes next to each other, the largest interpolator steps */
+  for (i = 0; i < 64; i++)
+  {
+    CheckIn32[1000 + i] = (i & 1) ? INT32_MAX : INT32_MIN;
+    CheckIn16[1000 + i] = (i & 1) ? INT16_MAX : INT16_MIN;
+  }
+}
+
+/**
+  * @brief  Converts random full scale frames at a ratio of exactly 1.0.
+  * @param  bits: 16 or 32.
+  * @param  fs: sampling frequency (Hz).
+  * @retval Number of output samples that differ from the delayed input.
+  */
+static uint32_t CHECK_Transparency(uint32_t bits, uint32_t fs)
+{
+  uint32_t total = fs * CHECK_SECONDS;
+  uint32_t errors = 0;
+  uint32_t i;
+  int64_t expect, got;
+
+  CHECK_Noise();
+  CHECK_Convert(bits, 0, fs, fs);
+
+  /* Output frame k is input frame k - 3, the first three are silent */
+  for (i = 0; i < (total * AUDIO_ASRC_CHANNELS); i++)
+  {
+    if (i < (3 * AUDIO_ASRC_CHANNELS))
+    {
+      expect = 0;
+    }
+    else
+    {
+      expect = (bits == 16) ? CheckIn16[i - (3 * AUDIO_ASRC_CHANNELS)] :
+                              CheckIn32[i - (3 * AUDIO_ASRC_CHANNELS)];
+    }
+    got = (bits == 16) ? CheckOut16[i] : CheckOut32[i];
+    if (got != expect)
+    {
+      errors++;
+    }
+  }
+
+  return errors;
+}
+
+/**
+  * @brief  Converts random full scale frames in 1 ms blocks, steering the
+  *         ratio away from 1.0 for CHECK_STEER_BLOCKS, then back to it, and
+  *         checks that the output becomes bit-perfect again.
+  * @param  bits: 16 or 32.
+  * @param  fs: sampling frequency (Hz).
+  * @param  pPeak: largest ratio deviation reached (ppm).
+  * @param  pSettle: output frames from the return of the ratio to 1.0 to the
+  *         first bit-perfect block, or -1 if it never comes.
+  * @retval Number of samples that differ from the input once bit-perfect.
+  */
+static uint32_t CHECK_Return(uint32_t bits, uint32_t fs, double *pPeak, int32_t *pSettle)
+{
+  uint32_t total = CHECK_FRAMES_MAX;
+  uint32_t block = fs / 1000;
+  uint32_t in = 0, out = 0, n, nin, nout, i;
+  int32_t zero = -1, exact = -1, offset = 0, peak = 0;
+  uint32_t errors = 0;
+  int64_t expect, got;
+
+  CHECK_Noise();
+  Audio_ASRC_Init(&CheckAsrc);
+
+  for (n = 0; out < total; n++)
+  {
+    Audio_ASRC_Steer(&CheckAsrc, (n < CHECK_STEER_BLOCKS) ? CHECK_STEER_ERROR : 0);
+    if (CheckAsrc.adjust > peak)
+    {
+      peak = CheckAsrc.adjust;
+    }
+    if ((zero < 0) && (n >= CHECK_STEER_BLOCKS) && (CheckAsrc.adjust == 0))
+    {
+      zero = (int32_t)out;
+    }
+    if ((zero >= 0) && (exact < 0) && ((CheckAsrc.phase & (AUDIO_ASRC_ONE - 1)) == 0))
+    {
+      /* The next output frame is the history x[0], after the shifts due */
+      exact = (int32_t)out;
+      offset = (int32_t)(in + (CheckAsrc.phase >> 30)) - 3 - (int32_t)out;
+    }
+
+    nin = CHECK_IN_FRAMES_MAX - in;
+    nout = ((total - out) < block) ? (total - out) : block;
+    if (bits == 16)
+    {
+      Audio_ASRC_Process(&CheckAsrc, &CheckIn16[in * AUDIO_ASRC_CHANNELS], &nin,
+                         &CheckOut16[out * AUDIO_ASRC_CHANNELS], &nout);
+    }
+    else
+    {
+      Audio_ASRC_Process32(&CheckAsrc, &CheckIn32[in * AUDIO_ASRC_CHANNELS], &nin,
+                           &CheckOut32[out * AUDIO_ASRC_CHANNELS], &nout);
+    }
+    in += nin;
+    out += nout;
+  }
+
+  *pPeak = peak / 1073.741824;
+  *pSettle = (exact >= 0) ? (exact - zero) : -1;
+  if (exact < 0)
+  {
+    return 0;
+  }
+
+  for (i = (uint32_t)exact * AUDIO_ASRC_CHANNELS; i < (total * AUDIO_ASRC_CHANNELS); i++)
+  {
+    expect = (bits == 16) ? CheckIn16[i + (offset * AUDIO_ASRC_CHANNELS)] :
+                            CheckIn32[i + (offset * AUDIO_ASRC_CHANNELS)];
+    got = (bits == 16) ? CheckOut16[i] : CheckOut32[i];
+    if (got != expect)
+    {
+      errors++;
+    }
+  }
+
+  return errors;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Checks and times the converter.
+  * @param  argc, argv: sampling frequency, host CPU frequency in MHz.
+  * @retval 0 if every check passes, 1 otherwise.
+  */
+int main(int argc, char **argv)
+{
+  uint32_t fs = (argc > 1) ? (uint32_t)atoi(argv[1]) : CHECK_FS;
+  double mhz = (argc > 2) ? atof(argv[2]) : 0.0;
+  static const uint32_t bits[] = { 16, 32 };
+  double snr, ideal, drift, limit, ns, peak;
+  struct timespec t0, t1;
+  uint32_t errors = 0;
+  uint32_t b, p, k, v, diff, frames, nin, nout;
+  int32_t settle, settleMax;
+
+  if ((fs < 8000) || (fs > CHECK_FS_MAX))
+  {
+    fprintf(stderr, "fs must be from 8000 to %u Hz\n", CHECK_FS_MAX);
+    return 1;
+  }
+
+  printf("fs %u Hz, amplitude %.1f dBFS\n", fs, 20.0 * log10(CHECK_AMPLITUDE));
+  printf("bits      ppm     tone |  SNR ref  SNR ideal  drift\n");
+  for (b = 0; b < (sizeof(bits) / sizeof(bits[0])); b++)
+  {
+    limit = (bits[b] == 16) ? CHECK_SNR16_DB : CHECK_SNR32_DB;
+    for (p = 0; p < (sizeof(CheckPpm) / sizeof(CheckPpm[0])); p++)
+    {
+      for (k = 0; k < (sizeof(CheckTones) / sizeof(CheckTones[0])); k++)
+      {
+        CHECK_Accuracy(bits[b], CheckPpm[p], fs, fs, CheckTones[k], &snr, &ideal, &drift);
+        printf("%4u %8d %8.0f | %8.1f %10.1f %6.2f%s\n", bits[b], (int)CheckPpm[p],
+               CheckTones[k], snr, ideal, drift,
+               ((snr < limit) || (fabs(drift) > CHECK_DRIFT_FRAMES)) ? "  FAIL" : "");
+        if ((snr < limit) || (fabs(drift) > CHECK_DRIFT_FRAMES))
+        {
+          errors++;
+        }
+      }
+    }
+  }
+
+  /* The voice stream, 16-bit, converted to the output frequency */
+  printf("voice in -> out     ppm     tone |  SNR ref  SNR ideal  drift\n");
+  for (v = 0; v < (sizeof(CheckVoiceRates) / sizeof(CheckVoiceRates[0])); v++)
+  {
+    for (p = 0; p < (sizeof(CheckPpm) / sizeof(CheckPpm[0])); p++)
+    {
+      for (k = 0; k < (sizeof(CheckTones) / sizeof(CheckTones[0])); k++)
+      {
+        CHECK_Accuracy(16, CheckPpm[p], CheckVoiceRates[v][0], CheckVoiceRates[v][1],
+                       CheckTones[k], &snr, &ideal, &drift);
+        printf("%5u -> %5u %8d %8.0f | %8.1f %10.1f %6.2f%s\n", CheckVoiceRates[v][0],
+               CheckVoiceRates[v][1], (int)CheckPpm[p], CheckTones[k], snr, ideal, drift,
+               ((snr < CHECK_SNR16_DB) || (fabs(drift) > CHECK_DRIFT_FRAMES)) ? "  FAIL" : "");
+        if ((snr < CHECK_SNR16_DB) || (fabs(drift) > CHECK_DRIFT_FRAMES))
+        {
+          errors++;
+        }
+      }
+    }
+  }
+
+  for (b = 0; b < (sizeof(bits) / sizeof(bits[0])); b++)
+  {
+    diff = CHECK_Transparency(bits[b], fs);
+    printf("%u-bit ratio 1.0: %s", bits[b], (diff == 0) ? "bit-transparent\n" : "");
+    if (diff != 0)
+    {
+      printf("%u samples differ\n", diff);
+      errors++;
+    }
+  }
+
+  /* Half a frame of phase at AUDIO_ASRC_SETTLE_PPM, rounded up to blocks */
+  settleMax = (int32_t)((AUDIO_ASRC_ONE / 2) / AUDIO_ASRC_PPM(AUDIO_ASRC_SETTLE_PPM)) +
+              (int32_t)(2 * (fs / 1000));
+  for (b = 0; b < (sizeof(bits) / sizeof(bits[0])); b++)
+  {
+    diff = CHECK_Return(bits[b], fs, &peak, &settle);
+    printf("%u-bit steered to %.0f ppm and back: ", bits[b], peak);
+    if ((settle < 0) || (settle > settleMax) || (diff != 0))
+    {
+      printf("phase at 0 after %d frames (limit %d), %u samples differ  FAIL\n",
+             (int)settle, (int)settleMax, diff);
+      errors++;
+    }
+    else
+    {
+      printf("bit-perfect %d frames after the ratio is 1.0\n", (int)settle);
+    }
+  }
+
+  /* Timing: 1 ms output blocks at the largest deviation */
+  frames = fs / 1000;
+  for (b = 0; b < (sizeof(bits) / sizeof(bits[0])); b++)
+  {
+    Audio_ASRC_Init(&CheckAsrc);
+    CheckAsrc.adjust = AUDIO_ASRC_PPM(AUDIO_ASRC_MAX_PPM);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (k = 0; k < CHECK_TIMED_BLOCKS; k++)
+    {
+      nin = frames + 2;
+      nout = frames;
+      if (bits[b] == 16)
+      {
+        Audio_ASRC_Process(&CheckAsrc, CheckIn16, &nin, CheckOut16, &nout);
+      }
+      else
+      {
+        Audio_ASRC_Process32(&CheckAsrc, CheckIn32, &nin, CheckOut32, &nout);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / CHECK_TIMED_BLOCKS;
+    printf("%u-bit: %.0f ns per 1 ms block", bits[b], ns);
+    if (mhz > 0.0)
+    {
+      printf(", %.0f host cycles", ns * mhz / 1000.0);
+    }
+    printf("\n");
+  }
+
+  printf("%s\n", (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+/**
+  ******************************************************************************
+  * @file    audio_clock_check.c
+  * @brief   Host check of the I2S clock planner.
+  *
+  *          Runs Audio_Clock_Plan() over the rate table of the device, 44.1,
+  *          48 and 96 kHz, with 16-bit and 32-bit channels, MCLK output on
+  *          and off. Each plan is checked against the PLLI2S and I2S
+  *          prescaler limits, its sampling frequency and error are
+  *          recomputed from the registers, and an exhaustive search over
+  *          every prescaler confirms that no setting has a lower error. The
+  *          plans are printed as a table.
+  *
+  *          Build and run on the host:
+  *
+  *            gcc -O2 -I../App/Audio -o audio_clock_check \
+  *                audio_clock_check.c ../App/Audio/audio_clock.c -lm
+  *            ./audio_clock_check [pll_input_hz]
+  *
+  *          pll_input_hz defaults to 1000000 (25 MHz HSE / PLLM 25). The
+  *          exit status is 1 if a plan is out of range, misreports its
+  *          frequency or error, or is not the best one.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "audio_clock.h"
+
+/* Private define ------------------------------------------------------------*/
+#define CHECK_PLL_INPUT                 1000000
+
+/* Private variables ---------------------------------------------------------*/
+static const uint32_t CheckFreqs[] = { 44100, 48000, 96000 };
+static const uint32_t CheckBits[] = { 16, 32 };
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Searches the lowest relative error reachable for a frequency by
+  *         trying every PLLI2SN, PLLI2SR and prescaler.
+  * @param  pllin: PLL input frequency in Hz.
+  * @param  freq: target sampling frequency in Hz.
+  * @param  bitdiv: 256 with MCLK, 2 * channel bits without.
+  * @retval Lowest |achieved - target| / target, or -1 if none.
+  */
+static double CHECK_BestError(uint32_t pllin, uint32_t freq, uint32_t bitdiv)
+{
+  double best = -1.0;
+  double fs, err;
+  uint32_t n, r, k, vco;
+
+  for (r = AUDIO_CLOCK_PLLI2SR_MIN; r <= AUDIO_CLOCK_PLLI2SR_MAX; r++)
+  {
+    for (n = AUDIO_CLOCK_PLLI2SN_MIN; n <= AUDIO_CLOCK_PLLI2SN_MAX; n++)
+    {
+      vco = pllin * n;
+      if ((vco < AUDIO_CLOCK_VCO_MIN) || (vco > AUDIO_CLOCK_VCO_MAX) ||
+          ((vco / r) > AUDIO_CLOCK_I2SCLK_MAX))
+      {
+        continue;
+      }
+      for (k = 2 * AUDIO_CLOCK_I2SDIV_MIN; k <= (2 * AUDIO_CLOCK_I2SDIV_MAX) + 1; k++)
+      {
+        fs = (double)vco / ((double)r * bitdiv * k);
+        err = fabs(fs - freq) / freq;
+        if ((best < 0.0) || (err < best))
+        {
+          best = err;
+        }
+      }
+    }
+  }
+
+  return best;
+}
+
+/**
+  * @brief  Checks one plan against the hardware limits and recomputes its
+  *         frequency and error from its registers.
+  * @param  pllin: PLL input frequency in Hz.
+  * @param  freq: target sampling frequency in Hz.
+  * @param  bits: channel length, 16 or 32.
+  * @param  mclk: MCLK output of the plan.
+  * @param  plan: plan returned by Audio_Clock_Plan().
+  * @retval Number of errors found.
+  */
+static uint32_t CHECK_Plan(uint32_t pllin, uint32_t freq, uint32_t bits, uint32_t mclk,
+                           const AUDIO_ClockPlanTypeDef *plan)
+{
+  uint32_t errors = 0;
+  uint32_t bitdiv = mclk ? 256 : (2 * bits);
+  uint32_t vco = pllin * plan->PLLI2SN;
+  uint32_t k = (2 * plan->I2SDIV) + plan->I2SODD;
+  double fs, ppb, best;
+
+  if ((plan->PLLI2SN < AUDIO_CLOCK_PLLI2SN_MIN) || (plan->PLLI2SN > AUDIO_CLOCK_PLLI2SN_MAX) ||
+      (plan->PLLI2SR < AUDIO_CLOCK_PLLI2SR_MIN) || (plan->PLLI2SR > AUDIO_CLOCK_PLLI2SR_MAX) ||
+      (plan->I2SDIV < AUDIO_CLOCK_I2SDIV_MIN) || (plan->I2SODD > 1))
+  {
+    printf("  register out of range\n");
+    errors++;
+  }
+  if ((vco < AUDIO_CLOCK_VCO_MIN) || (vco > AUDIO_CLOCK_VCO_MAX) ||
+      ((vco / plan->PLLI2SR) > AUDIO_CLOCK_I2SCLK_MAX))
+  {
+    printf("  VCO %u Hz or I2SCLK out of range\n", (unsigned int)vco);
+    errors++;
+  }
+  if (plan->MCLKOutput != mclk)
+  {
+    printf("  MCLK output %u, expected %u\n", plan->MCLKOutput, (unsigned int)mclk);
+    errors++;
+  }
+
+  /* Reported frequency, rounded, and error, truncated towards 0 */
+  fs = (double)vco / ((double)plan->PLLI2SR * bitdiv * k);
+  ppb = ((fs - freq) / freq) * 1e9;
+  if (plan->AchievedFreq != (uint32_t)floor(fs + 0.5))
+  {
+    printf("  achieved %u Hz, recomputed %.3f Hz\n", (unsigned int)plan->AchievedFreq, fs);
+    errors++;
+  }
+  if (fabs(plan->ErrorPpb - ppb) > 1.0)
+  {
+    printf("  error %d ppb, recomputed %.1f ppb\n", (int)plan->ErrorPpb, ppb);
+    errors++;
+  }
+
+  best = CHECK_BestError(pllin, freq, bitdiv) * 1e9;
+  if (fabs(ppb) > (best + 1e-3))
+  {
+    printf("  error %.1f ppb, best setting %.1f ppb\n", fabs(ppb), best);
+    errors++;
+  }
+
+  return errors;
+}
+
+/**
+  * @brief  Plans every format of the rate table and prints the settings.
+  * @param  argc, argv: optional PLL input frequency in Hz.
+  * @retval 0 if every plan passes, 1 otherwise.
+  */
+int main(int argc, char *argv[])
+{
+  AUDIO_ClockPlanTypeDef plan;
+  uint32_t pllin = CHECK_PLL_INPUT;
+  uint32_t errors = 0;
+  uint32_t f, b, mclk;
+
+  if (argc > 1)
+  {
+    pllin = (uint32_t)strtoul(argv[1], NULL, 0);
+  }
+
+  printf("PLL input %u Hz\n", (unsigned int)pllin);
+  printf("%8s %4s %4s | %7s %5s %6s %4s | %11s %9s\n",
+         "Fs", "bits", "MCLK", "PLLI2SN", "R", "I2SDIV", "ODD", "achieved Hz", "ppb");
+
+  for (f = 0; f < (sizeof(CheckFreqs) / sizeof(CheckFreqs[0])); f++)
+  {
+    for (b = 0; b < (sizeof(CheckBits) / sizeof(CheckBits[0])); b++)
+    {
+      for (mclk = 0; mclk < 2; mclk++)
+      {
+        if (Audio_Clock_Plan(pllin, CheckFreqs[f], CheckBits[b], mclk, &plan) != 0)
+        {
+          printf("%8u %4u %4s | no setting\n", (unsigned int)CheckFreqs[f],
+                 (unsigned int)CheckBits[b], mclk ? "on" : "off");
+          errors++;
+          continue;
+        }
+        printf("%8u %4u %4s | %7u %5u %6u %4u | %11u %9d\n",
+               (unsigned int)CheckFreqs[f], (unsigned int)CheckBits[b],
+               mclk ? "on" : "off", plan.PLLI2SN, plan.PLLI2SR, plan.I2SDIV,
+               plan.I2SODD, (unsigned int)plan.AchievedFreq, (int)plan.ErrorPpb);
+        errors += CHECK_Plan(pllin, CheckFreqs[f], CheckBits[b], mclk, &plan);
+      }
+    }
+  }
+
+  printf("%s\n", (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
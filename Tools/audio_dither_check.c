@@ -0,0 +1,368 @@
+/**
+  ******************************************************************************
+  * @file    audio_dither_check.c
+  * @brief   Host check of the requantisation to 16 bits.
+  *
+  *          Requantises a 997 Hz sine at -90 dBFS, about 1 LSB, off the grid,
+  *          with plain rounding, flat TPDF dither and each noise shaping
+  *          order, and measures on averaged Blackman-Harris spectra:
+  *            - the THD: harmonics 2 to 9, less the noise floor around
+  *              them, relative to the fundamental,
+  *            - the noise in bands, in dB relative to full scale.
+  *          Then checks that a block on the 16-bit grid comes out
+  *          bit-perfect, and times the processing of 1 ms blocks.
+  *
+  *          Build and run on the host:
+  *
+  *            gcc -O2 -I../App/Audio -o audio_dither_check \
+  *                audio_dither_check.c ../App/Audio/audio_dither.c \
+  *                ../App/Audio/audio_format.c -lm
+  *            ./audio_dither_check [fs]
+  *
+  *          fs defaults to 48000 Hz. The exit status is 1 if the dither
+  *          does not take the THD 20 dB below the plain rounding, if the
+  *          flat TPDF noise is more than 1 dB away from theory, if a
+  *          noise shaping does not lower the 1-6 kHz noise by 6 dB, or if
+  *          the bypass is not bit-perfect.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "audio_dither.h"
+#include "audio_format.h"
+
+/* Private define ------------------------------------------------------------*/
+#define CHECK_FS                        48000
+#define CHECK_FFT_BITS                  15
+#define CHECK_FFT_SIZE                  (1 << CHECK_FFT_BITS)
+#define CHECK_AVERAGES                  8
+#define CHECK_TONE_HZ                   997.0
+#define CHECK_TONE_DBFS                 -90.0
+#define CHECK_HARMONICS                 9
+#define CHECK_LOBE_BINS                 6       /* Half width of a tone */
+#define CHECK_FLOOR_BINS                64      /* Noise floor next to a tone */
+#define CHECK_TIMED_BLOCKS              200000
+#define CHECK_PI                        3.14159265358979323846
+
+/* Modes after the orders of the requantiser */
+#define CHECK_MODE_ROUND                (AUDIO_DITHER_ORDER_MAX + 1)
+
+/* Private types -------------------------------------------------------------*/
+typedef struct
+{
+  double lo, hi;                /* Hz */
+} CHECK_BandTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+static const CHECK_BandTypeDef CheckBands[] =
+{
+  { 20.0, 1000.0 }, { 1000.0, 6000.0 }, { 6000.0, 12000.0 },
+  { 12000.0, 20000.0 }, { 20000.0, 48000.0 },
+};
+#define CHECK_BAND_NUM                  (sizeof(CheckBands) / sizeof(CheckBands[0]))
+
+static const uint32_t CheckModes[] =
+{
+  CHECK_MODE_ROUND, AUDIO_DITHER_FLAT, 2, 3, 4, 5,
+};
+#define CHECK_MODE_NUM                  (sizeof(CheckModes) / sizeof(CheckModes[0]))
+
+static int32_t CheckQ27[CHECK_FFT_SIZE * 2];
+static int16_t CheckOut[CHECK_FFT_SIZE * 2];
+static double  CheckRe[CHECK_FFT_SIZE];
+static double  CheckIm[CHECK_FFT_SIZE];
+static double  CheckWin[CHECK_FFT_SIZE];
+static double  CheckPower[CHECK_FFT_SIZE / 2];
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  In place radix-2 FFT.
+  */
+static void CHECK_Fft(double *re, double *im)
+{
+  uint32_t i, j, k, len;
+  double t;
+
+  for (i = 1, j = 0; i < CHECK_FFT_SIZE; i++)
+  {
+    for (k = CHECK_FFT_SIZE >> 1; j & k; k >>= 1)
+    {
+      j ^= k;
+    }
+    j ^= k;
+    if (i < j)
+    {
+      t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+
+  for (len = 2; len <= CHECK_FFT_SIZE; len <<= 1)
+  {
+    double a = -2.0 * CHECK_PI / len;
+
+    for (i = 0; i < CHECK_FFT_SIZE; i += len)
+    {
+      for (k = 0; k < (len / 2); k++)
+      {
+        double wr = cos(a * k), wi = sin(a * k);
+        double xr = (re[i + k + (len / 2)] * wr) - (im[i + k + (len / 2)] * wi);
+        double xi = (re[i + k + (len / 2)] * wi) + (im[i + k + (len / 2)] * wr);
+
+        re[i + k + (len / 2)] = re[i + k] - xr;
+        im[i + k + (len / 2)] = im[i + k] - xi;
+        re[i + k] += xr;
+        im[i + k] += xi;
+      }
+    }
+  }
+}
+
+/**
+  * @brief  Sum of the power of the bins from lo to hi, in full scale units.
+  */
+static double CHECK_Sum(int32_t lo, int32_t hi)
+{
+  double p = 0.0;
+  int32_t k;
+
+  for (k = (lo < 1) ? 1 : lo; (k <= hi) && (k < (CHECK_FFT_SIZE / 2)); k++)
+  {
+    p += CheckPower[k];
+  }
+  return p;
+}
+
+/**
+  * @brief  Tells whether a bin belongs to the tone or to one of its
+  *         harmonics.
+  */
+static int CHECK_IsTone(int32_t k, double bin)
+{
+  int h;
+
+  for (h = 1; h <= CHECK_HARMONICS; h++)
+  {
+    if (fabs(k - (h * bin)) <= CHECK_LOBE_BINS)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+  * @brief  Requantises the tone in 1 ms blocks in a mode and measures the
+  *         averaged spectrum of the left channel.
+  */
+static void CHECK_Run(uint32_t mode, uint32_t fs, double *pThd, double *pBand)
+{
+  static AUDIO_DitherTypeDef dither;
+  uint32_t block = fs / 1000;
+  double amp = pow(10.0, CHECK_TONE_DBFS / 20.0) * (double)(1UL << AUDIO_FORMAT_Q27_BITS);
+  double wsum = 0.0, bin = (CHECK_TONE_HZ * CHECK_FFT_SIZE) / fs;
+  double tone, harm, noise;
+  uint32_t a, i, n, b;
+  int32_t k;
+  uint64_t t = 0;
+
+  Audio_Dither_Init(&dither, (mode == CHECK_MODE_ROUND) ? AUDIO_DITHER_FLAT : (uint8_t)mode, fs);
+  memset(CheckPower, 0, sizeof(CheckPower));
+  for (i = 0; i < CHECK_FFT_SIZE; i++)
+  {
+    wsum += CheckWin[i] * CheckWin[i];
+  }
+
+  for (a = 0; a < CHECK_AVERAGES; a++)
+  {
+    for (i = 0; i < CHECK_FFT_SIZE; i++, t++)
+    {
+      double x = amp * sin((2.0 * CHECK_PI * CHECK_TONE_HZ * t) / fs);
+
+      CheckQ27[2 * i] = (int32_t)lrint(x);
+      CheckQ27[(2 * i) + 1] = (int32_t)lrint(-x);
+    }
+    for (i = 0; i < CHECK_FFT_SIZE; i += n)
+    {
+      n = ((CHECK_FFT_SIZE - i) < block) ? (CHECK_FFT_SIZE - i) : block;
+      if (mode == CHECK_MODE_ROUND)
+      {
+        Audio_Format_Q27_S16_Stereo(&CheckQ27[2 * i], &CheckOut[2 * i], n);
+      }
+      else
+      {
+        Audio_Dither_Process(&dither, &CheckQ27[2 * i], &CheckOut[2 * i], n);
+      }
+    }
+
+    for (i = 0; i < CHECK_FFT_SIZE; i++)
+    {
+      CheckRe[i] = (CheckOut[2 * i] / 32768.0) * CheckWin[i];
+      CheckIm[i] = 0.0;
+    }
+    CHECK_Fft(CheckRe, CheckIm);
+
+    /* One-sided power, normalised so that white noise sums to its variance */
+    for (i = 1; i < (CHECK_FFT_SIZE / 2); i++)
+    {
+      CheckPower[i] += (2.0 * ((CheckRe[i] * CheckRe[i]) + (CheckIm[i] * CheckIm[i]))) /
+                       (CHECK_FFT_SIZE * wsum * CHECK_AVERAGES);
+    }
+  }
+
+  tone = CHECK_Sum((int32_t)bin - CHECK_LOBE_BINS, (int32_t)bin + CHECK_LOBE_BINS);
+  harm = 0.0;
+  for (i = 2; i <= CHECK_HARMONICS; i++)
+  {
+    int32_t lo = (int32_t)(i * bin) - CHECK_LOBE_BINS, hi = (int32_t)(i * bin) + CHECK_LOBE_BINS;
+
+    /* Less the noise in the lobe, from the bins on each side */
+    noise = (CHECK_Sum(lo - CHECK_FLOOR_BINS, lo - 1) + CHECK_Sum(hi + 1, hi + CHECK_FLOOR_BINS)) /
+            (2 * CHECK_FLOOR_BINS);
+    harm += fmax(CHECK_Sum(lo, hi) - (noise * ((2 * CHECK_LOBE_BINS) + 1)), 0.0);
+  }
+  *pThd = (harm > 0.0) ? (10.0 * log10(harm / tone)) : -999.0;
+
+  for (b = 0; b < CHECK_BAND_NUM; b++)
+  {
+    noise = 0.0;
+    for (k = (int32_t)((CheckBands[b].lo * CHECK_FFT_SIZE) / fs);
+         (k < (int32_t)((CheckBands[b].hi * CHECK_FFT_SIZE) / fs)) && (k < (CHECK_FFT_SIZE / 2));
+         k++)
+    {
+      if ((k > 0) && !CHECK_IsTone(k, bin))
+      {
+        noise += CheckPower[k];
+      }
+    }
+    pBand[b] = (noise > 0.0) ? (10.0 * log10(noise)) : -999.0;
+  }
+}
+
+/**
+  * @brief  Checks the requantisation and times it.
+  * @param  argc: number of arguments.
+  * @param  argv: [fs].
+  * @retval 0 if the checks pass, 1 otherwise.
+  */
+int main(int argc, char *argv[])
+{
+  static AUDIO_DitherTypeDef dither;
+  uint32_t fs = (argc > 1) ? (uint32_t)atoi(argv[1]) : CHECK_FS;
+  uint32_t block = fs / 1000;
+  double thd, band[CHECK_BAND_NUM], thdRound = 0.0, flatMid = 0.0, total;
+  struct timespec t0, t1;
+  uint32_t m, mode, b, i, errors = 0;
+  int16_t ref[192];
+
+  for (i = 0; i < CHECK_FFT_SIZE; i++)
+  {
+    double x = (2.0 * CHECK_PI * i) / CHECK_FFT_SIZE;
+
+    CheckWin[i] = 0.35875 - (0.48829 * cos(x)) + (0.14128 * cos(2 * x)) - (0.01168 * cos(3 * x));
+  }
+
+  printf("fs %u Hz, %.0f Hz at %.0f dBFS\n", (unsigned)fs, CHECK_TONE_HZ, CHECK_TONE_DBFS);
+  printf("%-8s %8s %8s", "mode", "THD dB", "total");
+  for (b = 0; b < CHECK_BAND_NUM; b++)
+  {
+    printf("  %5.0f-%-5.0f", CheckBands[b].lo / 1000, CheckBands[b].hi / 1000);
+  }
+  printf("  (noise dBFS, kHz)\n");
+
+  for (m = 0; m < CHECK_MODE_NUM; m++)
+  {
+    mode = CheckModes[m];
+    CHECK_Run(mode, fs, &thd, band);
+
+    total = 0.0;
+    for (b = 0; b < CHECK_BAND_NUM; b++)
+    {
+      if (band[b] > -999.0)
+      {
+        total += pow(10.0, band[b] / 10.0);
+      }
+    }
+    if (mode == CHECK_MODE_ROUND)
+    {
+      printf("%-8s", "round");
+    }
+    else if (mode == AUDIO_DITHER_FLAT)
+    {
+      printf("%-8s", "tpdf");
+    }
+    else
+    {
+      printf("order %u ", (unsigned)mode);
+    }
+    printf(" %8.1f %8.1f", thd, 10.0 * log10(total));
+    for (b = 0; b < CHECK_BAND_NUM; b++)
+    {
+      printf("  %11.1f", band[b]);
+    }
+    printf("\n");
+
+    if (mode == CHECK_MODE_ROUND)
+    {
+      thdRound = thd;
+      continue;
+    }
+    if (thd > (thdRound - 20.0))
+    {
+      printf("  THD not lowered by the dither\n");
+      errors++;
+    }
+    if (mode == AUDIO_DITHER_FLAT)
+    {
+      /* Rounding and TPDF: 3 LSB^2 / 12 over the band analysed */
+      double theory = 10.0 * log10(3.0 / (12.0 * 32768.0 * 32768.0)) +
+                      10.0 * log10((fmin(48000.0, fs / 2.0) - 20.0) / (fs / 2.0));
+
+      if (fabs(10.0 * log10(total) - theory) > 1.0)
+      {
+        printf("  noise %.1f dBFS, %.1f dBFS expected\n", 10.0 * log10(total), theory);
+        errors++;
+      }
+      flatMid = band[1];
+    }
+    else if (band[1] > (flatMid - 6.0))
+    {
+      printf("  1-6 kHz noise not lowered by the noise shaping\n");
+      errors++;
+    }
+  }
+
+  /* A block on the 16-bit grid is not dithered */
+  Audio_Dither_Init(&dither, AUDIO_DITHER_ORDER_MAX, fs);
+  for (i = 0; i < (block * 2); i++)
+  {
+    ref[i] = (int16_t)rand();
+    CheckQ27[i] = (int32_t)ref[i] * (1 << (AUDIO_FORMAT_Q27_BITS - 15));
+  }
+  if ((Audio_Dither_Process(&dither, CheckQ27, CheckOut, block) != 0) ||
+      (memcmp(CheckOut, ref, block * 2 * sizeof(int16_t)) != 0))
+  {
+    printf("bypass: not bit-perfect\n");
+    errors++;
+  }
+
+  /* Time per 1 ms block, 5th order */
+  CheckQ27[0] |= 1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < CHECK_TIMED_BLOCKS; i++)
+  {
+    Audio_Dither_Process(&dither, CheckQ27, CheckOut, block);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  printf("%.0f ns per 1 ms block\n",
+         (((t1.tv_sec - t0.tv_sec) * 1e9) + (t1.tv_nsec - t0.tv_nsec)) / CHECK_TIMED_BLOCKS);
+
+  printf("%s\n", (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
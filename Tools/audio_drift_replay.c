@@ -0,0 +1,184 @@
+/**
+  ******************************************************************************
+  * @file    audio_drift_replay.c
+  * @brief   Host replay of the clock drift estimator.
+  *
+  *          Runs audio_drift.c on a trace of TIM2 SOF captures and prints the
+  *          estimate after each capture. A trace is recorded on the target
+  *          with USBD_AUDIO_DRIFT_TRACE defined in usbd_conf.h, then dumped
+  *          with the debugger, e.g. in gdb:
+  *
+  *            dump binary value drift.bin AudioDriftTrace
+  *
+  *          Without a trace, checks the estimator on synthesized traces of
+  *          known drift: the captures of a timer off by each of
+  *          ReplayOffsets, with SOF jitter, a counter wrap and missed
+  *          captures. Once settled, the estimate must lie within its
+  *          confidence bound of the offset, the bound must be below
+  *          REPLAY_BOUND_MAX_PPM, and the period across each run of missed
+  *          captures must be rejected.
+  *
+  *          Build and run on the host (little-endian, like the target):
+  *
+  *            gcc -O2 -I../App/Audio -o audio_drift_replay \
+  *                audio_drift_replay.c ../App/Audio/audio_drift.c -lm
+  *            ./audio_drift_replay
+  *            ./audio_drift_replay drift.bin [timer_hz [sof_per_capture]]
+  *
+  *          The timer runs at 84 MHz and captures every 8th SOF by default.
+  *          Trailing zero words (trace not full) are ignored. The exit
+  *          status of the synthesized check is 1, with a FAIL line, if any
+  *          trace misses its bounds.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "audio_drift.h"
+
+/* Private define ------------------------------------------------------------*/
+#define REPLAY_TIMER_FREQ               84000000
+#define REPLAY_SOF_PER_CAPTURE          8
+#define REPLAY_CAPTURES                 1024
+#define REPLAY_JITTER_TICKS             2       /* SOF capture jitter, +/- */
+#define REPLAY_MISSED_ONE_IN            97      /* Captures lost, as suspended */
+#define REPLAY_BOUND_MAX_PPM            1.0
+
+/* Private variables ---------------------------------------------------------*/
+/* Drift of the synthesized timers against the SOF (ppm) */
+static const double ReplayOffsets[] = { 0.0, 47.3, -183.6, 499.0, -20.25 };
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Runs the estimator on a synthesized trace of known drift.
+  * @param  ppm: drift of the timer (ppm), positive when it runs fast.
+  * @param  seed: seed of the jitter.
+  * @retval 0 if the estimate and its bound are right, 1 otherwise.
+  */
+static uint32_t REPLAY_Synth(double ppm, uint32_t seed)
+{
+  AUDIO_DriftTypeDef drift;
+  uint32_t nominal = (REPLAY_TIMER_FREQ / 1000) * REPLAY_SOF_PER_CAPTURE;
+  double period = nominal * (1.0 + (ppm * 1e-6));
+  double t = 4294967296.0 - (200.5 * nominal);  /* Wraps after 200 captures */
+  uint32_t k, capture, missed = 0, gaps = 0, settled, errors = 0;
+  uint32_t lost = 0;
+  int32_t jitter, est, bound;
+
+  Audio_Drift_Init(&drift, nominal);
+  for (k = 0; k < REPLAY_CAPTURES; k++)
+  {
+    t += period;
+    seed = (seed * 1664525) + 1013904223;
+    if ((k != 0) && ((seed >> 8) % REPLAY_MISSED_ONE_IN) == 0)
+    {
+      /* Consecutive missed captures make a single long period */
+      gaps += (lost == 0) ? 1 : 0;
+      lost = 1;
+      missed++;
+      continue;
+    }
+    lost = 0;
+    jitter = (int32_t)((seed >> 16) % ((2 * REPLAY_JITTER_TICKS) + 1)) - REPLAY_JITTER_TICKS;
+    capture = (uint32_t)(uint64_t)(t + jitter);
+    Audio_Drift_Update(&drift, capture);
+  }
+  settled = Audio_Drift_Get(&drift, &est, &bound);
+
+  printf("%9.3f %9.3f %7.3f %7u %7u %7u", ppm, est / 65536.0, bound / 65536.0,
+         (unsigned)settled, (unsigned)missed, (unsigned)drift.rejects);
+  if (!settled || (drift.rejects != gaps))
+  {
+    errors++;
+  }
+  if ((fabs((est / 65536.0) - ppm) > (bound / 65536.0)) ||
+      ((bound / 65536.0) > REPLAY_BOUND_MAX_PPM))
+  {
+    errors++;
+  }
+  printf("%s\n", (errors != 0) ? "  !" : "");
+
+  return (errors != 0) ? 1 : 0;
+}
+
+/**
+  * @brief  Checks the estimator on the synthesized traces.
+  * @param  None.
+  * @retval 0 if every trace passes, 1 otherwise.
+  */
+static int REPLAY_Check(void)
+{
+  uint32_t i, errors = 0;
+
+  printf("%9s %9s %7s %7s %7s %7s\n", "ppm", "estimate", "+/-", "settled",
+         "missed", "rejects");
+  for (i = 0; i < (sizeof(ReplayOffsets) / sizeof(ReplayOffsets[0])); i++)
+  {
+    errors += REPLAY_Synth(ReplayOffsets[i], 0x2545F491 + i);
+  }
+
+  printf("%s\n", (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Replays a capture trace and prints the estimates, or checks the
+  *         estimator on synthesized traces without a trace.
+  * @param  argc, argv: trace file name, timer frequency, SOFs per capture.
+  * @retval 0 on success, 1 on error.
+  */
+int main(int argc, char **argv)
+{
+  AUDIO_DriftTypeDef drift;
+  uint32_t freq = REPLAY_TIMER_FREQ;
+  uint32_t div = REPLAY_SOF_PER_CAPTURE;
+  uint32_t capture, index = 0, settled;
+  int32_t ppm, bound;
+  FILE *f;
+
+  if (argc < 2)
+  {
+    return REPLAY_Check();
+  }
+  if (argc > 2)
+  {
+    freq = (uint32_t)strtoul(argv[2], NULL, 0);
+  }
+  if (argc > 3)
+  {
+    div = (uint32_t)strtoul(argv[3], NULL, 0);
+  }
+
+  f = fopen(argv[1], "rb");
+  if (f == NULL)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+
+  Audio_Drift_Init(&drift, (freq / 1000) * div);
+  printf("%8s %12s %12s %10s %8s\n", "capture", "value", "ppm", "+/- ppm", "settled");
+  while (fread(&capture, sizeof(capture), 1, f) == 1)
+  {
+    if ((capture == 0) && (index != 0))
+    {
+      break;
+    }
+    Audio_Drift_Update(&drift, capture);
+    settled = Audio_Drift_Get(&drift, &ppm, &bound);
+    printf("%8u %12u %12.3f %10.3f %8u\n", (unsigned)index, (unsigned)capture,
+           ppm / 65536.0, bound / 65536.0, (unsigned)settled);
+    index++;
+  }
+  fclose(f);
+
+  printf("\n%u captures, %u accepted, %u rejected\n", (unsigned)index,
+         (unsigned)drift.samples, (unsigned)drift.rejects);
+
+  return 0;
+}
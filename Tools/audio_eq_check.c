@@ -0,0 +1,331 @@
+/**
+  ******************************************************************************
+  * @file    audio_eq_check.c
+  * @brief   Host check of the parametric equalizer.
+  *
+  *          Programs 10 bands on the left channel and 3 on the right one,
+  *          measures the response of audio_eq.c with sines from 20 Hz to
+  *          20 kHz and compares it with the response of the same bands
+  *          designed in double precision. Then counts the cycles spent on
+  *          1 ms blocks with all the bands enabled on both channels.
+  *
+  *          Build and run on the host:
+  *
+  *            gcc -O2 -I../App/Audio -o audio_eq_check \
+  *                audio_eq_check.c ../App/Audio/audio_eq.c -lm
+  *            ./audio_eq_check [fs [cpu_mhz]]
+  *
+  *          fs defaults to 48000 Hz. The cycles per block are read from the
+  *          time stamp counter on x86 hosts, and derived from the time with
+  *          cpu_mhz, which then overrides the counter, on other hosts. On the
+  *          target, the cycles spent per block are read with the
+  *          AUDIO_VENDOR_REQ_GET_EQ_LOAD vendor request. The exit status is
+  *          1, with a FAIL line, if the response differs from the reference
+  *          by more than CHECK_TOLERANCE_DB at any point.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CHECK_HAS_TSC
+#endif
+#include "audio_eq.h"
+
+/* Private define ------------------------------------------------------------*/
+#define CHECK_FS                        48000
+#define CHECK_POINTS                    31      /* 1/3 octave from 20 Hz */
+#define CHECK_SETTLE_S                  0.5
+#define CHECK_MEASURE_S                 0.5
+#define CHECK_AMPLITUDE                 0.05    /* Of full scale */
+#define CHECK_TOLERANCE_DB              0.1
+#define CHECK_TIMED_BLOCKS              200000
+
+/* Private variables ---------------------------------------------------------*/
+static const AUDIO_EqBandTypeDef CheckLeft[AUDIO_EQ_BANDS_MAX] =
+{
+  /* type,              freq,  gain (1/256 dB), q (1/256) */
+  { AUDIO_EQ_LOW_SHELF,    80,  6 * 256,  181 },
+  { AUDIO_EQ_PEAK,         40, -4 * 256,  512 },
+  { AUDIO_EQ_PEAK,        160,  3 * 256,  256 },
+  { AUDIO_EQ_PEAK,        315, -6 * 256,  768 },
+  { AUDIO_EQ_PEAK,        630,  2 * 256,  363 },
+  { AUDIO_EQ_PEAK,       1250, -3 * 256, 1024 },
+  { AUDIO_EQ_PEAK,       2500,  5 * 256,  512 },
+  { AUDIO_EQ_PEAK,       5000, -2 * 256,  256 },
+  { AUDIO_EQ_PEAK,      10000,  4 * 256, 2560 },
+  { AUDIO_EQ_HIGH_SHELF, 12000, -8 * 256,  181 },
+};
+
+static const AUDIO_EqBandTypeDef CheckRight[3] =
+{
+  { AUDIO_EQ_LOW_SHELF,   200, -6 * 256,  181 },
+  { AUDIO_EQ_PEAK,       3000, 12 * 256,  724 },
+  { AUDIO_EQ_HIGH_SHELF,  8000,  6 * 256,  181 },
+};
+
+static AUDIO_EqTypeDef CheckEq;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Magnitude of a band designed in double precision.
+  * @param  b: band parameters.
+  * @param  fs: sampling frequency (Hz).
+  * @param  f: frequency of the response (Hz).
+  * @retval Gain in dB.
+  */
+static double Check_Reference(const AUDIO_EqBandTypeDef *b, double fs, double f)
+{
+  double w0 = 2.0 * M_PI * b->freq / fs;
+  double cs = cos(w0), alpha = sin(w0) / (2.0 * b->q / 256.0);
+  double A = pow(10.0, b->gain / (256.0 * 40.0));
+  double sa = 2.0 * sqrt(A) * alpha;
+  double bb[3], aa[3];
+  double w = 2.0 * M_PI * f / fs;
+  double nr = 0, ni = 0, dr = 0, di = 0;
+  int k;
+
+  if ((b->type == AUDIO_EQ_OFF) || (b->gain == 0) || ((2.0 * b->freq) >= fs))
+  {
+    return 0.0;
+  }
+
+  switch (b->type)
+  {
+  case AUDIO_EQ_PEAK:
+    bb[0] = 1 + alpha * A; bb[1] = -2 * cs; bb[2] = 1 - alpha * A;
+    aa[0] = 1 + alpha / A; aa[1] = -2 * cs; aa[2] = 1 - alpha / A;
+    break;
+  case AUDIO_EQ_LOW_SHELF:
+    bb[0] = A * ((A + 1) - (A - 1) * cs + sa);
+    bb[1] = 2 * A * ((A - 1) - (A + 1) * cs);
+    bb[2] = A * ((A + 1) - (A - 1) * cs - sa);
+    aa[0] = (A + 1) + (A - 1) * cs + sa;
+    aa[1] = -2 * ((A - 1) + (A + 1) * cs);
+    aa[2] = (A + 1) + (A - 1) * cs - sa;
+    break;
+  default:
+    bb[0] = A * ((A + 1) + (A - 1) * cs + sa);
+    bb[1] = -2 * A * ((A - 1) + (A + 1) * cs);
+    bb[2] = A * ((A + 1) + (A - 1) * cs - sa);
+    aa[0] = (A + 1) - (A - 1) * cs + sa;
+    aa[1] = 2 * ((A - 1) - (A + 1) * cs);
+    aa[2] = (A + 1) - (A - 1) * cs - sa;
+    break;
+  }
+
+  for (k = 0; k < 3; k++)
+  {
+    nr += bb[k] * cos(-k * w);
+    ni += bb[k] * sin(-k * w);
+    dr += aa[k] * cos(-k * w);
+    di += aa[k] * sin(-k * w);
+  }
+  return 10.0 * log10((nr * nr + ni * ni) / (dr * dr + di * di));
+}
+
+/**
+  * @brief  Measures the gain of both channels at a frequency.
+  * @param  fs: sampling frequency (Hz).
+  * @param  f: frequency (Hz).
+  * @param  pGain: gain of each channel (dB).
+  * @retval None
+  */
+static void Check_Measure(uint32_t fs, double f, double *pGain)
+{
+  int32_t buf[AUDIO_EQ_BLOCK_MAX * AUDIO_EQ_CHANNELS];
+  uint32_t settle = (uint32_t)(CHECK_SETTLE_S * fs);
+  uint32_t total = settle + (uint32_t)(CHECK_MEASURE_S * fs);
+  uint32_t block = fs / 1000;
+  double re[AUDIO_EQ_CHANNELS] = { 0 }, im[AUDIO_EQ_CHANNELS] = { 0 };
+  double amp = CHECK_AMPLITUDE * 2147483648.0, ph;
+  uint32_t n = 0, i, ch, count = 0;
+
+  /* Restart from silence */
+  memset(CheckEq.state, 0, sizeof(CheckEq.state));
+
+  while (n < total)
+  {
+    for (i = 0; i < block; i++)
+    {
+      ph = 2.0 * M_PI * f * (n + i) / fs;
+      for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+      {
+        buf[i * AUDIO_EQ_CHANNELS + ch] = (int32_t)lrint(amp * sin(ph));
+      }
+    }
+
+    Audio_Eq_Process32(&CheckEq, buf, block);
+
+    for (i = 0; i < block; i++, n++)
+    {
+      if (n < settle)
+      {
+        continue;
+      }
+      ph = 2.0 * M_PI * f * n / fs;
+      for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+      {
+        re[ch] += buf[i * AUDIO_EQ_CHANNELS + ch] * sin(ph);
+        im[ch] += buf[i * AUDIO_EQ_CHANNELS + ch] * cos(ph);
+      }
+      count++;
+    }
+  }
+
+  for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+  {
+    pGain[ch] = 20.0 * log10(2.0 * sqrt(re[ch] * re[ch] + im[ch] * im[ch]) /
+                             (count * amp));
+  }
+}
+
+/**
+  * @brief  Times the processing of 1 ms blocks and prints the cycles spent
+  *         per block.
+  * @param  name: label of the format.
+  * @param  p16: 16-bit block, or NULL.
+  * @param  p32: 32-bit block, used when p16 is NULL.
+  * @param  frames: frames per block.
+  * @param  mhz: host CPU frequency in MHz, 0 to use the time stamp counter.
+  * @retval None
+  */
+static void Check_Time(const char *name, int16_t *p16, int32_t *p32, uint32_t frames,
+                       double mhz)
+{
+  struct timespec t0, t1;
+  double ns, cycles = 0.0;
+#ifdef CHECK_HAS_TSC
+  uint64_t c0, c1;
+#endif
+  uint32_t k;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+#ifdef CHECK_HAS_TSC
+  c0 = __rdtsc();
+#endif
+  for (k = 0; k < CHECK_TIMED_BLOCKS; k++)
+  {
+    if (p16 != NULL)
+    {
+      Audio_Eq_Process(&CheckEq, p16, frames);
+    }
+    else
+    {
+      Audio_Eq_Process32(&CheckEq, p32, frames);
+    }
+  }
+#ifdef CHECK_HAS_TSC
+  c1 = __rdtsc();
+  cycles = (double)(c1 - c0) / CHECK_TIMED_BLOCKS;
+#endif
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / CHECK_TIMED_BLOCKS;
+
+  if (mhz > 0.0)
+  {
+    cycles = ns * mhz / 1000.0;
+  }
+  if (cycles > 0.0)
+  {
+    printf("%s: %.0f cycles per 1 ms block (%.0f ns)\n", name, cycles, ns);
+  }
+  else
+  {
+    printf("%s: %.0f ns per 1 ms block, give cpu_mhz for the cycles\n", name, ns);
+  }
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Checks the response and times the equalizer.
+  * @param  argc, argv: sampling frequency, host CPU frequency in MHz.
+  * @retval 0 if the response matches the reference, 1 otherwise.
+  */
+int main(int argc, char **argv)
+{
+  uint32_t fs = (argc > 1) ? (uint32_t)atoi(argv[1]) : CHECK_FS;
+  double mhz = (argc > 2) ? atof(argv[2]) : 0.0;
+  const AUDIO_EqBandTypeDef *bands[AUDIO_EQ_CHANNELS] = { CheckLeft, CheckRight };
+  uint32_t counts[AUDIO_EQ_CHANNELS] = { AUDIO_EQ_BANDS_MAX, 3 };
+  int16_t block16[AUDIO_EQ_BLOCK_MAX * AUDIO_EQ_CHANNELS];
+  int32_t block32[AUDIO_EQ_BLOCK_MAX * AUDIO_EQ_CHANNELS];
+  double gain[AUDIO_EQ_CHANNELS], ref, err, worst = 0.0, f;
+  uint32_t ch, i, k, frames;
+
+  if ((fs < 8000) || (fs > (AUDIO_EQ_BLOCK_MAX * 1000)))
+  {
+    fprintf(stderr, "fs must be from 8000 to %u Hz\n", AUDIO_EQ_BLOCK_MAX * 1000);
+    return 1;
+  }
+
+  Audio_Eq_Init(&CheckEq, fs);
+  for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+  {
+    for (i = 0; i < counts[ch]; i++)
+    {
+      Audio_Eq_SetBand(&CheckEq, ch, i, &bands[ch][i]);
+    }
+  }
+  Audio_Eq_Commit(&CheckEq);
+
+  printf("fs %u Hz, %u + %u bands\n", fs, CheckEq.set[CheckEq.active].stages[0],
+         CheckEq.set[CheckEq.active].stages[1]);
+  printf("    freq     left      ref    right      ref\n");
+  for (k = 0; k < CHECK_POINTS; k++)
+  {
+    f = 20.0 * pow(2.0, k / 3.0);
+    if (f >= (0.45 * fs))
+    {
+      break;
+    }
+    Check_Measure(fs, f, gain);
+
+    printf("%8.1f", f);
+    for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+    {
+      ref = 0.0;
+      for (i = 0; i < AUDIO_EQ_BANDS_MAX; i++)
+      {
+        ref += Check_Reference(&CheckEq.bands[ch][i], fs, f);
+      }
+      err = fabs(gain[ch] - ref);
+      if (err > worst)
+      {
+        worst = err;
+      }
+      printf(" %8.3f %8.3f%c", gain[ch], ref, (err > CHECK_TOLERANCE_DB) ? '!' : ' ');
+    }
+    printf("\n");
+  }
+  printf("largest error %.4f dB (limit %.1f dB)\n", worst, CHECK_TOLERANCE_DB);
+
+  /* Timing: every band on both channels, 1 ms blocks */
+  for (ch = 0; ch < AUDIO_EQ_CHANNELS; ch++)
+  {
+    for (i = 0; i < AUDIO_EQ_BANDS_MAX; i++)
+    {
+      Audio_Eq_SetBand(&CheckEq, ch, i, &CheckLeft[i]);
+    }
+  }
+  Audio_Eq_Commit(&CheckEq);
+  frames = fs / 1000;
+  for (i = 0; i < (frames * AUDIO_EQ_CHANNELS); i++)
+  {
+    block16[i] = (int16_t)((i * 7919) & 0x3FFF);
+    block32[i] = (int32_t)block16[i] << 16;
+  }
+
+  Check_Time("16-bit", block16, NULL, frames, mhz);
+  Check_Time("32-bit", NULL, block32, frames, mhz);
+
+  printf("%s\n", (worst > CHECK_TOLERANCE_DB) ? "FAIL" : "PASS");
+  return (worst > CHECK_TOLERANCE_DB) ? 1 : 0;
+}
@@ -0,0 +1,284 @@
+/**
+  ******************************************************************************
+  * @file    audio_format_bench.c
+  * @brief   Host check and benchmark of the sample format conversions.
+  *
+  *          Runs every kernel of audio_format.c on random subframes, at an
+  *          odd byte offset to exercise the unaligned loads, and compares
+  *          its output with scalar code reading one byte at a time and
+  *          testing the format of each sample. Then times both on 1 ms
+  *          blocks at 96 kHz.
+  *
+  *          Build and run on the host:
+  *
+  *            gcc -O2 -I../App/Audio -o audio_format_bench \
+  *                audio_format_bench.c ../App/Audio/audio_format.c
+  *            ./audio_format_bench [blocks]
+  *
+  *          The exit status is 1 if a kernel differs from the scalar code.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "audio_format.h"
+
+/* Private define ------------------------------------------------------------*/
+#define BENCH_FRAMES                    96      /* 1 ms at 96 kHz */
+#define BENCH_BLOCKS                    200000
+
+/* Formats of the scalar code */
+#define BENCH_S16                       0
+#define BENCH_S16BE                     1
+#define BENCH_S24P                      2
+#define BENCH_S24PBE                    3
+
+/* Private types -------------------------------------------------------------*/
+typedef void (*BENCH_InFunc)(const void *pSrc, int32_t *pDst, uint32_t frames);
+typedef void (*BENCH_OutFunc)(const int32_t *pSrc, void *pDst, uint32_t frames);
+
+typedef struct
+{
+  const char  *name;
+  BENCH_InFunc func;
+  uint32_t     format;
+  uint32_t     channels;
+  uint32_t     shift;           /* Output full scale at 2^(15 + shift) */
+} BENCH_InTypeDef;
+
+typedef struct
+{
+  const char   *name;
+  BENCH_OutFunc func;
+  uint32_t      shift;          /* Input full scale at 2^(15 + shift) */
+} BENCH_OutTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+static const BENCH_InTypeDef BenchIn[] =
+{
+  { "S16 -> Q31 mono",     Audio_Format_S16_Q31_Mono,       BENCH_S16,    1, 16 },
+  { "S16 -> Q31 stereo",   Audio_Format_S16_Q31_Stereo,     BENCH_S16,    2, 16 },
+  { "S16BE -> Q31 mono",   Audio_Format_S16BE_Q31_Mono,     BENCH_S16BE,  1, 16 },
+  { "S16BE -> Q31 stereo", Audio_Format_S16BE_Q31_Stereo,   BENCH_S16BE,  2, 16 },
+  { "S16 -> Q27 stereo",   Audio_Format_S16_Q27_Stereo,     BENCH_S16,    2, 12 },
+  { "S24P -> S32 mono",    Audio_Format_S24P_S32_Mono,      BENCH_S24P,   1, 16 },
+  { "S24P -> S32 stereo",  Audio_Format_S24P_S32_Stereo,    BENCH_S24P,   2, 16 },
+  { "S24PBE -> S32 mono",  Audio_Format_S24PBE_S32_Mono,    BENCH_S24PBE, 1, 16 },
+  { "S24PBE -> S32 stereo",Audio_Format_S24PBE_S32_Stereo,  BENCH_S24PBE, 2, 16 },
+};
+
+static const BENCH_OutTypeDef BenchOut[] =
+{
+  { "Q31 -> S16 stereo",   Audio_Format_Q31_S16_Stereo, 16 },
+  { "Q27 -> S16 stereo",   Audio_Format_Q27_S16_Stereo, 12 },
+};
+
+static uint8_t BenchSrc[(BENCH_FRAMES * 2 * 4) + 1];
+static int32_t BenchQ[BENCH_FRAMES * 2];
+static int32_t BenchDst[BENCH_FRAMES * 2];
+static int32_t BenchRef[BENCH_FRAMES * 2];
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Scalar conversion of one subframe at a time.
+  */
+static void BENCH_ScalarIn(const uint8_t *p, int32_t *pDst, uint32_t frames,
+                           uint32_t format, uint32_t channels, uint32_t shift)
+{
+  uint32_t i, c;
+  int32_t s;
+
+  for (i = 0; i < frames; i++)
+  {
+    for (c = 0; c < 2; c++)
+    {
+      const uint8_t *q;
+
+      switch (format)
+      {
+      case BENCH_S16:
+        q = p + (2 * ((i * channels) + ((channels == 2) ? c : 0)));
+        s = (int16_t)(q[0] | (q[1] << 8));
+        s = (int32_t)((uint32_t)s << shift);
+        break;
+      case BENCH_S16BE:
+        q = p + (2 * ((i * channels) + ((channels == 2) ? c : 0)));
+        s = (int16_t)((q[0] << 8) | q[1]);
+        s = (int32_t)((uint32_t)s << shift);
+        break;
+      case BENCH_S24P:
+        q = p + (3 * ((i * channels) + ((channels == 2) ? c : 0)));
+        s = (int32_t)(((uint32_t)q[0] << 8) | ((uint32_t)q[1] << 16) | ((uint32_t)q[2] << 24));
+        break;
+      default:
+        q = p + (3 * ((i * channels) + ((channels == 2) ? c : 0)));
+        s = (int32_t)(((uint32_t)q[2] << 8) | ((uint32_t)q[1] << 16) | ((uint32_t)q[0] << 24));
+        break;
+      }
+      pDst[(2 * i) + c] = s;
+    }
+  }
+}
+
+/**
+  * @brief  Scalar rounding and saturation to 16 bits.
+  */
+static void BENCH_ScalarOut(const int32_t *pSrc, int16_t *pDst, uint32_t frames,
+                            uint32_t shift)
+{
+  uint32_t i;
+  int64_t s;
+
+  for (i = 0; i < (frames * 2); i++)
+  {
+    s = ((int64_t)pSrc[i] + (1 << (shift - 1))) >> shift;
+    if (s > 32767)
+    {
+      s = 32767;
+    }
+    else if (s < -32768)
+    {
+      s = -32768;
+    }
+    pDst[i] = (int16_t)s;
+  }
+}
+
+static double BENCH_Elapsed(const struct timespec *t0, const struct timespec *t1)
+{
+  return (double)(t1->tv_sec - t0->tv_sec) + ((double)(t1->tv_nsec - t0->tv_nsec) * 1e-9);
+}
+
+/**
+  * @brief  Prints the throughput of a kernel and of the scalar code.
+  */
+static void BENCH_Report(const char *name, double tk, double ts, uint32_t blocks)
+{
+  double msamples = (double)blocks * BENCH_FRAMES * 2 * 1e-6;
+
+  printf("%-22s %8.1f Msamples/s %8.1f Msamples/s  x%.1f\n",
+         name, msamples / tk, msamples / ts, ts / tk);
+}
+
+/**
+  * @brief  Checks and times the conversions.
+  * @param  argc: number of arguments.
+  * @param  argv: [blocks].
+  * @retval 0 if all the kernels match the scalar code, 1 otherwise.
+  */
+int main(int argc, char *argv[])
+{
+  uint32_t blocks = (argc > 1) ? (uint32_t)atoi(argv[1]) : BENCH_BLOCKS;
+  const uint8_t *psrc = BenchSrc + 1;
+  volatile int32_t sink = 0;
+  struct timespec t0, t1;
+  double tk, ts;
+  uint32_t i, k, errors = 0;
+
+  srand(1);
+  for (i = 0; i < sizeof(BenchSrc); i++)
+  {
+    BenchSrc[i] = (uint8_t)rand();
+  }
+  for (i = 0; i < (BENCH_FRAMES * 2); i++)
+  {
+    /* Q27 samples up to twice the full scale, to exercise the saturation */
+    BenchQ[i] = (int32_t)((uint32_t)rand() << 1) >> 3;
+  }
+  BenchQ[0] = INT32_MAX;
+  BenchQ[1] = INT32_MIN;
+
+  printf("%-22s %19s %19s\n", "kernel", "kernel", "scalar");
+  for (k = 0; k < (sizeof(BenchIn) / sizeof(BenchIn[0])); k++)
+  {
+    const BENCH_InTypeDef *b = &BenchIn[k];
+
+    /* Odd frame counts exercise the tails */
+    for (i = BENCH_FRAMES - 3; i <= BENCH_FRAMES; i++)
+    {
+      memset(BenchDst, 0, sizeof(BenchDst));
+      memset(BenchRef, 0, sizeof(BenchRef));
+      b->func(psrc, BenchDst, i);
+      BENCH_ScalarIn(psrc, BenchRef, i, b->format, b->channels, b->shift);
+      if (memcmp(BenchDst, BenchRef, sizeof(BenchDst)) != 0)
+      {
+        printf("%s: mismatch at %u frames\n", b->name, (unsigned)i);
+        errors++;
+      }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < blocks; i++)
+    {
+      b->func(psrc, BenchDst, BENCH_FRAMES);
+      sink += BenchDst[i % (BENCH_FRAMES * 2)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    tk = BENCH_Elapsed(&t0, &t1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < blocks; i++)
+    {
+      BENCH_ScalarIn(psrc, BenchRef, BENCH_FRAMES, b->format, b->channels, b->shift);
+      sink += BenchRef[i % (BENCH_FRAMES * 2)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ts = BENCH_Elapsed(&t0, &t1);
+    BENCH_Report(b->name, tk, ts, blocks);
+  }
+
+  for (k = 0; k < (sizeof(BenchOut) / sizeof(BenchOut[0])); k++)
+  {
+    const BENCH_OutTypeDef *b = &BenchOut[k];
+    int16_t *pdst = (int16_t*)BenchDst;
+    int16_t *pref = (int16_t*)BenchRef;
+
+    b->func(BenchQ, pdst, BENCH_FRAMES);
+    BENCH_ScalarOut(BenchQ, pref, BENCH_FRAMES, b->shift);
+    if (memcmp(pdst, pref, BENCH_FRAMES * 2 * sizeof(int16_t)) != 0)
+    {
+      printf("%s: mismatch\n", b->name);
+      errors++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < blocks; i++)
+    {
+      b->func(BenchQ, pdst, BENCH_FRAMES);
+      sink += pdst[i % (BENCH_FRAMES * 2)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    tk = BENCH_Elapsed(&t0, &t1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < blocks; i++)
+    {
+      BENCH_ScalarOut(BenchQ, pref, BENCH_FRAMES, b->shift);
+      sink += pref[i % (BENCH_FRAMES * 2)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ts = BENCH_Elapsed(&t0, &t1);
+    BENCH_Report(b->name, tk, ts, blocks);
+  }
+
+  /* Round trips through the processing format */
+  memcpy(BenchRef, BenchSrc, sizeof(BenchRef));
+  Audio_Format_S32_Q27_Stereo(BenchRef, BenchDst, BENCH_FRAMES);
+  Audio_Format_Q27_S32_Stereo(BenchDst, BenchDst, BENCH_FRAMES);
+  for (i = 0; i < (BENCH_FRAMES * 2); i++)
+  {
+    if (BenchDst[i] != (int32_t)((uint32_t)BenchRef[i] & 0xFFFFFFF0UL))
+    {
+      printf("S32 -> Q27 -> S32: mismatch\n");
+      errors++;
+      break;
+    }
+  }
+
+  printf("%s\n", (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
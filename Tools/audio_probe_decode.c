@@ -0,0 +1,140 @@
+/**
+  ******************************************************************************
+  * @file    audio_probe_decode.c
+  * @brief   Host decoder of the audio latency statistics.
+  *
+  *          Turns a dump of the AudioProbe variable of the firmware into a
+  *          latency report. The dump is taken with the debugger, e.g. in gdb:
+  *
+  *            dump binary value probe.bin AudioProbe
+  *
+  *          Build and run on the host (little-endian, like the target):
+  *
+  *            gcc -O2 -I../App/Audio -o audio_probe_decode \
+  *                audio_probe_decode.c ../App/Audio/audio_probe.c
+  *            ./audio_probe_decode probe.bin [-h]
+  *
+  *          -h also prints the histogram of each stage.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include "audio_probe.h"
+
+/* Private variables ---------------------------------------------------------*/
+static const char * const StageName[AUDIO_PROBE_STAGES] =
+{
+  "FIFO read -> DataOut",
+  "DataOut   -> queued",
+  "Queued    -> rendered",
+  "Rendered  -> played",
+  "FIFO read -> played",
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Converts cycles to microseconds.
+  * @param  cycles: cycle count.
+  * @param  freq: cycle counter frequency in Hz.
+  * @retval Microseconds.
+  */
+static double Cycles_To_Us(uint32_t cycles, uint32_t freq)
+{
+  return ((double)cycles * 1e6) / (double)freq;
+}
+
+/**
+  * @brief  Prints the non empty bins of the histogram of a stage.
+  * @param  probe: statistics.
+  * @param  stage: AUDIO_PROBE_xxx stage.
+  * @retval None
+  */
+static void Print_Histogram(const AUDIO_ProbeTypeDef *probe, uint32_t stage)
+{
+  const AUDIO_ProbeStageTypeDef *s = &probe->stage[stage];
+  uint32_t bin, low = 0;
+
+  for (bin = 0; bin < AUDIO_PROBE_BINS; bin++)
+  {
+    if (s->hist[bin] != 0)
+    {
+      printf("    %10.2f .. %10.2f us  %10u  %6.2f%%\n",
+             Cycles_To_Us(low, probe->cpuFreq),
+             Cycles_To_Us(Audio_Probe_BinLimit(bin), probe->cpuFreq),
+             (unsigned)s->hist[bin], (100.0 * s->hist[bin]) / s->count);
+    }
+    low = Audio_Probe_BinLimit(bin) + 1;
+  }
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Decodes a dump and prints the report.
+  * @param  argc, argv: dump file name, then -h to print the histograms.
+  * @retval 0 on success, 1 on error.
+  */
+int main(int argc, char **argv)
+{
+  AUDIO_ProbeTypeDef probe;
+  AUDIO_ProbeReportTypeDef report;
+  FILE *f;
+  uint32_t stage;
+  int hist = (argc > 2) && (strcmp(argv[2], "-h") == 0);
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s probe.bin [-h]\n", argv[0]);
+    return 1;
+  }
+
+  f = fopen(argv[1], "rb");
+  if (f == NULL)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  if (fread(&probe, sizeof(probe), 1, f) != 1)
+  {
+    fprintf(stderr, "%s: short dump, %u bytes expected\n", argv[1],
+            (unsigned)sizeof(probe));
+    fclose(f);
+    return 1;
+  }
+  fclose(f);
+
+  if ((probe.magic != AUDIO_PROBE_MAGIC) || (probe.version != AUDIO_PROBE_VERSION) ||
+      (probe.stages != AUDIO_PROBE_STAGES) || (probe.cpuFreq == 0))
+  {
+    fprintf(stderr, "%s: not an audio probe dump (version %u)\n", argv[1],
+            (unsigned)AUDIO_PROBE_VERSION);
+    return 1;
+  }
+
+  printf("Cycle counter: %u Hz\n\n", (unsigned)probe.cpuFreq);
+  printf("%-24s %10s %10s %10s %10s %10s\n", "Stage (us)", "count", "min", "avg",
+         "max", "p99");
+  for (stage = 0; stage < AUDIO_PROBE_STAGES; stage++)
+  {
+    if (Audio_Probe_Report(&probe, stage, &report) != 0)
+    {
+      printf("%-24s %10s\n", StageName[stage], "-");
+      continue;
+    }
+    printf("%-24s %10u %10.2f %10.2f %10.2f %10.2f\n", StageName[stage],
+           (unsigned)report.count,
+           Cycles_To_Us(report.min, probe.cpuFreq),
+           Cycles_To_Us(report.avg, probe.cpuFreq),
+           Cycles_To_Us(report.max, probe.cpuFreq),
+           Cycles_To_Us(report.p99, probe.cpuFreq));
+    if (hist)
+    {
+      Print_Histogram(&probe, stage);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,295 @@
+/**
+  ******************************************************************************
+  * @file    audio_ring_stress.c
+  * @brief   Host stress test of the lock-free single producer, single
+  *          consumer ring.
+  *
+  *          A producer thread writes blocks of random length, as the OUT
+  *          endpoint does with the packets, and a consumer thread peeks and
+  *          consumes blocks of random length, as the converter does, each
+  *          side yielding at random to vary the interleaving. The stream
+  *          bytes are a function of their position, so that the consumer
+  *          checks every byte it reads: a byte read before it was published,
+  *          or overwritten before it was consumed, breaks the sequence. At
+  *          the end, the overrun and underrun counts, the fill extremes and
+  *          the histogram of the ring are checked against the counts kept by
+  *          each thread.
+  *
+  *          The host build of audio_ring.c uses __sync_synchronize() for
+  *          its barriers.
+  *
+  *          Build and run on the host:
+  *
+  *            gcc -O2 -pthread -I../App/Audio -o audio_ring_stress \
+  *                audio_ring_stress.c ../App/Audio/audio_ring.c
+  *            ./audio_ring_stress [megabytes [ring_size]]
+  *
+  *          megabytes defaults to 256, ring_size to 256 bytes, rounded up
+  *          to a power of two, so that the ring wraps and fills up often.
+  *          The exit status is 1 on any corrupted byte or counter mismatch.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "audio_ring.h"
+
+/* Private define ------------------------------------------------------------*/
+#define STRESS_MEGABYTES                256
+#define STRESS_RING_SIZE                256
+#define STRESS_RING_SIZE_MAX            65536
+#define STRESS_YIELD_ONE_IN             64
+
+/* Private types -------------------------------------------------------------*/
+typedef struct
+{
+  uint64_t written;             /* Bytes written */
+  uint64_t writes;              /* Blocks written */
+  uint64_t drops;               /* Blocks that did not fit */
+} STRESS_ProducerTypeDef;
+
+typedef struct
+{
+  uint64_t read;                /* Bytes read and checked */
+  uint64_t blocks;              /* Blocks requested */
+  uint64_t shorts;              /* Blocks that found too few bytes */
+  uint64_t errors;              /* Bytes out of sequence */
+  uint32_t maxFill;             /* Highest fill seen */
+} STRESS_ConsumerTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+static AUDIO_RingTypeDef StressRing;
+static uint8_t StressBuff[STRESS_RING_SIZE_MAX];
+static uint64_t StressTotal;
+static volatile uint32_t StressDone = 0;
+static STRESS_ProducerTypeDef StressProducer;
+static STRESS_ConsumerTypeDef StressConsumer;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Byte of the stream at a position.
+  */
+static inline uint8_t STRESS_Byte(uint64_t pos)
+{
+  return (uint8_t)((pos * 2654435761ULL) >> 13);
+}
+
+/**
+  * @brief  xorshift32 generator, one state per thread.
+  */
+static inline uint32_t STRESS_Rand(uint32_t *state)
+{
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/**
+  * @brief  Producer thread: writes blocks of 1 to size / 2 bytes until the
+  *         total has been written, retrying nothing: a block that does not
+  *         fit is dropped, as a packet on an overrun.
+  */
+static void *STRESS_ProducerThread(void *arg)
+{
+  STRESS_ProducerTypeDef *p = (STRESS_ProducerTypeDef*)arg;
+  uint8_t block[STRESS_RING_SIZE_MAX / 2];
+  uint32_t seed = 0x12345678;
+  uint32_t len, i;
+
+  while (p->written < StressTotal)
+  {
+    len = 1 + (STRESS_Rand(&seed) % (StressRing.size / 2));
+    if (len > (StressTotal - p->written))
+    {
+      len = (uint32_t)(StressTotal - p->written);
+    }
+    for (i = 0; i < len; i++)
+    {
+      block[i] = STRESS_Byte(p->written + i);
+    }
+
+    if (Audio_Ring_Write(&StressRing, block, len) == len)
+    {
+      p->written += len;
+      p->writes++;
+    }
+    else
+    {
+      p->drops++;
+    }
+
+    if ((STRESS_Rand(&seed) % STRESS_YIELD_ONE_IN) == 0)
+    {
+      sched_yield();
+    }
+  }
+
+  __sync_synchronize();
+  StressDone = 1;
+  return NULL;
+}
+
+/**
+  * @brief  Consumer thread: reads blocks of 1 to size / 2 bytes, through one
+  *         or two Peek/Consume pairs when the block wraps, and checks every
+  *         byte. A block that finds too few bytes is counted as an underrun
+  *         and what it found is consumed.
+  */
+static void *STRESS_ConsumerThread(void *arg)
+{
+  STRESS_ConsumerTypeDef *c = (STRESS_ConsumerTypeDef*)arg;
+  uint32_t seed = 0x9E3779B9;
+  uint32_t want, avail, n, fill, i;
+  uint32_t done;
+  uint8_t *p;
+
+  for (;;)
+  {
+    done = StressDone;
+    __sync_synchronize();
+
+    want = 1 + (STRESS_Rand(&seed) % (StressRing.size / 2));
+    fill = Audio_Ring_Fill(&StressRing);
+    if (fill > StressRing.size)
+    {
+      printf("fill %u above the ring size\n", (unsigned int)fill);
+      c->errors++;
+    }
+    if (fill > c->maxFill)
+    {
+      c->maxFill = fill;
+    }
+    Audio_Ring_Probe(&StressRing);
+    c->blocks++;
+
+    while (want != 0)
+    {
+      p = Audio_Ring_Peek(&StressRing, &avail);
+      if (avail == 0)
+      {
+        break;
+      }
+      n = (avail < want) ? avail : want;
+      for (i = 0; i < n; i++)
+      {
+        if (p[i] != STRESS_Byte(c->read + i))
+        {
+          c->errors++;
+        }
+      }
+      Audio_Ring_Consume(&StressRing, n);
+      c->read += n;
+      want -= n;
+    }
+    if (want != 0)
+    {
+      Audio_Ring_Underrun(&StressRing);
+      c->shorts++;
+    }
+
+    /* Everything written has been read once the producer is done */
+    if (done && (c->read == StressTotal))
+    {
+      break;
+    }
+
+    if ((STRESS_Rand(&seed) % STRESS_YIELD_ONE_IN) == 0)
+    {
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  * @brief  Runs both threads and checks the ring telemetry against them.
+  * @param  argc, argv: optional megabytes to stream and ring size.
+  * @retval 0 if the stream is intact and the counters match, 1 otherwise.
+  */
+int main(int argc, char *argv[])
+{
+  pthread_t producer, consumer;
+  uint64_t hist = 0;
+  uint32_t size = STRESS_RING_SIZE;
+  uint32_t errors = 0;
+  uint32_t i;
+
+  StressTotal = (uint64_t)STRESS_MEGABYTES << 20;
+  if (argc > 1)
+  {
+    StressTotal = (uint64_t)strtoul(argv[1], NULL, 0) << 20;
+  }
+  if (argc > 2)
+  {
+    size = (uint32_t)strtoul(argv[2], NULL, 0);
+  }
+  size = Audio_Ring_RoundUp(size);
+  if ((size > STRESS_RING_SIZE_MAX) || (Audio_Ring_Init(&StressRing, StressBuff, size) != 0))
+  {
+    printf("ring size up to %u bytes\n", STRESS_RING_SIZE_MAX);
+    return 1;
+  }
+
+  pthread_create(&consumer, NULL, STRESS_ConsumerThread, &StressConsumer);
+  pthread_create(&producer, NULL, STRESS_ProducerThread, &StressProducer);
+  pthread_join(producer, NULL);
+  pthread_join(consumer, NULL);
+
+  printf("ring %u bytes, %llu bytes in %llu writes\n", (unsigned int)size,
+         (unsigned long long)StressProducer.written,
+         (unsigned long long)StressProducer.writes);
+  printf("overruns %llu (ring %u), underruns %llu (ring %u) in %llu reads\n",
+         (unsigned long long)StressProducer.drops, (unsigned int)StressRing.overruns,
+         (unsigned long long)StressConsumer.shorts, (unsigned int)StressRing.underruns,
+         (unsigned long long)StressConsumer.blocks);
+  printf("fill min %u max %u (seen by the consumer %u)\n",
+         (unsigned int)StressRing.minFill, (unsigned int)StressRing.maxFill,
+         (unsigned int)StressConsumer.maxFill);
+
+  if (StressConsumer.errors != 0)
+  {
+    printf("%llu bytes out of sequence\n", (unsigned long long)StressConsumer.errors);
+    errors++;
+  }
+  if ((StressConsumer.read != StressTotal) || (Audio_Ring_Fill(&StressRing) != 0))
+  {
+    printf("%llu bytes read, %u left in the ring\n", (unsigned long long)StressConsumer.read,
+           (unsigned int)Audio_Ring_Fill(&StressRing));
+    errors++;
+  }
+  if ((StressRing.overruns != (uint32_t)StressProducer.drops) ||
+      (StressRing.underruns != (uint32_t)StressConsumer.shorts))
+  {
+    printf("ring counters differ from the threads\n");
+    errors++;
+  }
+  if ((StressRing.maxFill > size) || (StressConsumer.maxFill > StressRing.maxFill) ||
+      (StressRing.minFill > StressRing.maxFill))
+  {
+    printf("fill extremes inconsistent\n");
+    errors++;
+  }
+  for (i = 0; i < AUDIO_RING_HIST_BINS; i++)
+  {
+    hist += StressRing.histogram[i];
+  }
+  if (hist != StressConsumer.blocks)
+  {
+    printf("histogram holds %llu probes for %llu reads\n", (unsigned long long)hist,
+           (unsigned long long)StressConsumer.blocks);
+    errors++;
+  }
+
+  printf("%s\n", (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,489 @@
+/**
+  ******************************************************************************
+  * @file    audio_volume_bench.c
+  * @brief   Host check and benchmark of the digital volume stage.
+  *
+  *          Runs Audio_Volume_Process() and Audio_Volume_Process32() on
+  *          random full scale frames, extremes included, through a sequence
+  *          of volume and mute changes: a ramp down into the attenuation
+  *          path, a ramp up across unity into the boost path, a change in
+  *          the middle of a ramp, a mute, a ramp back to 0 dB, where the
+  *          samples must be left untouched, and silence. Blocks of odd
+  *          lengths make the ramps start and end inside a block. Each block
+  *          is compared with scalar code computing one sample at a time with
+  *          the gain of its frame, and the gain reached at the end of each
+  *          block is compared with the scalar ramp. The distance of each
+  *          sample to the exact product, saturated, is also bounded. Then
+  *          times both on 1 ms blocks at 96 kHz, at constant attenuation,
+  *          at constant boost and on a ramp, keeping the fastest of
+  *          BENCH_ROUNDS interleaved rounds of each.
+  *
+  *          Build and run on the host:
+  *
+  *            gcc -O2 -I../App/Audio -o audio_volume_bench \
+  *                audio_volume_bench.c ../App/Audio/audio_volume.c
+  *            ./audio_volume_bench [blocks]
+  *
+  *          The exit status is 1 if a sample or a gain differs from the
+  *          scalar code, or if a kernel is not faster than the scalar code.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "audio_volume.h"
+
+/* Private define ------------------------------------------------------------*/
+#define BENCH_FRAMES                    96      /* 1 ms at 96 kHz */
+#define BENCH_BLOCKS                    200000
+#define BENCH_RAMP_FRAMES               480     /* 5 ms at 96 kHz */
+#define BENCH_ERROR16_LSB               3       /* Half gain then doubled */
+#define BENCH_ERROR32_LSB               1
+#define BENCH_ROUNDS                    5
+#define BENCH_SPEEDUP_MIN               1.0
+
+/* Mute and unmute events, outside the volume range */
+#define BENCH_MUTE                      ((int16_t)0x7FFF)
+#define BENCH_UNMUTE                    ((int16_t)0x7FFE)
+
+/* Private types -------------------------------------------------------------*/
+typedef struct
+{
+  int32_t gain;
+  int32_t rampTarget;
+  int32_t step;
+} BENCH_RampTypeDef;
+
+typedef struct
+{
+  int16_t     volume;           /* 1/256 dB, or BENCH_MUTE/BENCH_UNMUTE */
+  uint32_t    blocks;           /* Blocks processed after the change */
+  const char *name;
+} BENCH_EventTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+static const BENCH_EventTypeDef BenchEvents[] =
+{
+  { -20 * 256,            40, "ramp down to -20 dB" },
+  {  6 * 256,             40, "ramp up to +6 dB" },
+  { -3 * 256,              3, "ramp to -3 dB" },
+  {  4 * 256,             40, "+4 dB within the ramp" },
+  { BENCH_MUTE,           40, "mute" },
+  { BENCH_UNMUTE,          5, "unmute" },
+  {  0,                   40, "ramp to 0 dB" },
+  { AUDIO_VOLUME_MIN,     40, "ramp to -96 dB" },
+  { AUDIO_VOLUME_SILENCE, 40, "silence" },
+};
+
+/* Block lengths, cycled, so that the ramps start and end inside blocks */
+static const uint32_t BenchLengths[] = { 96, 1, 47, 13, 96, 64, 2 };
+
+static AUDIO_VolumeTypeDef BenchVol;
+static int16_t BenchSrc16[BENCH_FRAMES * 2];
+static int32_t BenchSrc32[BENCH_FRAMES * 2];
+static int16_t BenchDst16[BENCH_FRAMES * 2];
+static int32_t BenchDst32[BENCH_FRAMES * 2];
+static int16_t BenchRef16[BENCH_FRAMES * 2];
+static int32_t BenchRef32[BENCH_FRAMES * 2];
+
+/* Private functions ---------------------------------------------------------*/
+
+static double BENCH_Elapsed(const struct timespec *t0, const struct timespec *t1)
+{
+  return (double)(t1->tv_sec - t0->tv_sec) + ((double)(t1->tv_nsec - t0->tv_nsec) * 1e-9);
+}
+
+static void BENCH_Report(const char *name, double tk, double ts, uint32_t blocks)
+{
+  double msamples = (double)blocks * BENCH_FRAMES * 2 * 1e-6;
+
+  printf("%-22s %8.1f Msamples/s %8.1f Msamples/s  x%.2f%s\n",
+         name, msamples / tk, msamples / ts, ts / tk,
+         ((ts / tk) > BENCH_SPEEDUP_MIN) ? "" : "  not faster");
+}
+
+/**
+  * @brief  Starts a scalar ramp when the target changes: the gain steps by
+  *         1/rampFrames of the distance, at least 1, per frame.
+  */
+static void BENCH_ScalarRamp(BENCH_RampTypeDef *r, int32_t target)
+{
+  if (target != r->rampTarget)
+  {
+    r->rampTarget = target;
+    r->step = (target - r->gain) / BENCH_RAMP_FRAMES;
+    if (r->step == 0)
+    {
+      r->step = (target > r->gain) ? 1 : -1;
+    }
+  }
+}
+
+/**
+  * @brief  Moves the scalar gain one frame towards the target.
+  */
+static void BENCH_ScalarStep(BENCH_RampTypeDef *r, int32_t target)
+{
+  if (r->gain == target)
+  {
+    return;
+  }
+  r->gain += r->step;
+  if (((r->step > 0) && (r->gain > target)) || ((r->step < 0) && (r->gain < target)))
+  {
+    r->gain = target;
+  }
+}
+
+/**
+  * @brief  Scalar 16-bit volume, one sample at a time. Blocks that start or
+  *         end above unity apply half the gain and double the result.
+  */
+static void BENCH_Scalar16(BENCH_RampTypeDef *r, int32_t target, int16_t *p, uint32_t frames)
+{
+  uint32_t boost = (r->gain > AUDIO_VOLUME_UNITY) || (target > AUDIO_VOLUME_UNITY);
+  uint32_t i, c;
+  int32_t y;
+
+  if ((r->gain == AUDIO_VOLUME_UNITY) && (target == AUDIO_VOLUME_UNITY))
+  {
+    return;
+  }
+  BENCH_ScalarRamp(r, target);
+
+  for (i = 0; i < frames; i++)
+  {
+    for (c = 0; c < 2; c++)
+    {
+      if (boost)
+      {
+        y = 2 * (int32_t)(((int64_t)(r->gain >> 1) * p[(2 * i) + c]) >> 16);
+        y = (y > 32767) ? 32767 : ((y < -32768) ? -32768 : y);
+      }
+      else
+      {
+        y = (int32_t)(((int64_t)r->gain * p[(2 * i) + c]) >> 16);
+      }
+      p[(2 * i) + c] = (int16_t)y;
+    }
+    BENCH_ScalarStep(r, target);
+  }
+}
+
+/**
+  * @brief  Scalar 32-bit volume, one sample at a time.
+  */
+static void BENCH_Scalar32(BENCH_RampTypeDef *r, int32_t target, int32_t *p, uint32_t frames)
+{
+  uint32_t i, c;
+  int64_t y;
+
+  if ((r->gain == AUDIO_VOLUME_UNITY) && (target == AUDIO_VOLUME_UNITY))
+  {
+    return;
+  }
+  BENCH_ScalarRamp(r, target);
+
+  for (i = 0; i < frames; i++)
+  {
+    for (c = 0; c < 2; c++)
+    {
+      y = ((int64_t)r->gain * p[(2 * i) + c]) >> 16;
+      y = (y > INT32_MAX) ? INT32_MAX : ((y < INT32_MIN) ? INT32_MIN : y);
+      p[(2 * i) + c] = (int32_t)y;
+    }
+    BENCH_ScalarStep(r, target);
+  }
+}
+
+/**
+  * @brief  Largest distance of a block to the exact product with the gain of
+  *         each frame, saturated to the sample range.
+  */
+static int64_t BENCH_Error(const int64_t *pIn, const int64_t *pOut, const int32_t *pGain,
+                           uint32_t frames, int64_t max)
+{
+  int64_t worst = 0, exact, d;
+  uint32_t i;
+
+  for (i = 0; i < (frames * 2); i++)
+  {
+    /* floor(x * g / 2^16), saturated */
+    exact = (pIn[i] * pGain[i >> 1]) >> 16;
+    exact = (exact > max) ? max : ((exact < (-max - 1)) ? (-max - 1) : exact);
+    d = (pOut[i] > exact) ? (pOut[i] - exact) : (exact - pOut[i]);
+    if (d > worst)
+    {
+      worst = d;
+    }
+  }
+  return worst;
+}
+
+/**
+  * @brief  Applies a volume event to the stage.
+  */
+static void BENCH_Apply(AUDIO_VolumeTypeDef *vol, int16_t volume)
+{
+  if (volume == BENCH_MUTE)
+  {
+    Audio_Volume_Mute(vol, 1);
+  }
+  else if (volume == BENCH_UNMUTE)
+  {
+    Audio_Volume_Mute(vol, 0);
+  }
+  else
+  {
+    Audio_Volume_Set(vol, volume);
+  }
+}
+
+/**
+  * @brief  Runs the event sequence on one sample size and compares every
+  *         block with the scalar code.
+  * @param  bits: 16 or 32.
+  * @retval Number of errors found.
+  */
+static uint32_t BENCH_Check(uint32_t bits)
+{
+  BENCH_RampTypeDef ref;
+  int64_t in[BENCH_FRAMES * 2], out[BENCH_FRAMES * 2];
+  int32_t gains[BENCH_FRAMES];
+  int64_t err, worst = 0;
+  int64_t limit = (bits == 16) ? BENCH_ERROR16_LSB : BENCH_ERROR32_LSB;
+  uint32_t errors = 0;
+  uint32_t e, b, i, n = 0, frames, boost;
+  BENCH_RampTypeDef probe;
+
+  BenchVol.rampFrames = 0;
+  Audio_Volume_Init(&BenchVol);
+  Audio_Volume_SetRamp(&BenchVol, BENCH_RAMP_FRAMES);
+  ref.gain = AUDIO_VOLUME_UNITY;
+  ref.rampTarget = AUDIO_VOLUME_UNITY;
+  ref.step = 0;
+
+  for (e = 0; e < (sizeof(BenchEvents) / sizeof(BenchEvents[0])); e++)
+  {
+    BENCH_Apply(&BenchVol, BenchEvents[e].volume);
+
+    for (b = 0; b < BenchEvents[e].blocks; b++, n++)
+    {
+      frames = BenchLengths[n % (sizeof(BenchLengths) / sizeof(BenchLengths[0]))];
+
+      /* Gain of each frame, from a copy of the scalar ramp */
+      probe = ref;
+      BENCH_ScalarRamp(&probe, BenchVol.target);
+      boost = (probe.gain > AUDIO_VOLUME_UNITY) || (BenchVol.target > AUDIO_VOLUME_UNITY);
+      for (i = 0; i < frames; i++)
+      {
+        gains[i] = probe.gain;
+        BENCH_ScalarStep(&probe, BenchVol.target);
+      }
+
+      if (bits == 16)
+      {
+        memcpy(BenchDst16, BenchSrc16, sizeof(BenchDst16));
+        memcpy(BenchRef16, BenchSrc16, sizeof(BenchRef16));
+        BENCH_Scalar16(&ref, BenchVol.target, BenchRef16, frames);
+        Audio_Volume_Process(&BenchVol, BenchDst16, frames);
+        if (memcmp(BenchDst16, BenchRef16, sizeof(BenchDst16)) != 0)
+        {
+          printf("16-bit %s: block %u of %u frames differs\n",
+                 BenchEvents[e].name, (unsigned)b, (unsigned)frames);
+          errors++;
+        }
+        for (i = 0; i < (frames * 2); i++)
+        {
+          in[i] = BenchSrc16[i];
+          out[i] = BenchDst16[i];
+        }
+      }
+      else
+      {
+        memcpy(BenchDst32, BenchSrc32, sizeof(BenchDst32));
+        memcpy(BenchRef32, BenchSrc32, sizeof(BenchRef32));
+        BENCH_Scalar32(&ref, BenchVol.target, BenchRef32, frames);
+        Audio_Volume_Process32(&BenchVol, BenchDst32, frames);
+        if (memcmp(BenchDst32, BenchRef32, sizeof(BenchDst32)) != 0)
+        {
+          printf("32-bit %s: block %u of %u frames differs\n",
+                 BenchEvents[e].name, (unsigned)b, (unsigned)frames);
+          errors++;
+        }
+        for (i = 0; i < (frames * 2); i++)
+        {
+          in[i] = BenchSrc32[i];
+          out[i] = BenchDst32[i];
+        }
+      }
+
+      if (BenchVol.gain != ref.gain)
+      {
+        printf("%u-bit %s: gain %d after block %u, scalar %d\n", (unsigned)bits,
+               BenchEvents[e].name, (int)BenchVol.gain, (unsigned)b, (int)ref.gain);
+        errors++;
+      }
+
+      /* Untouched at unity, within the rounding of the path otherwise */
+      err = BENCH_Error(in, out, gains, frames, (bits == 16) ? INT16_MAX : INT32_MAX);
+      if ((bits == 32) || boost)
+      {
+        if (err > worst)
+        {
+          worst = err;
+        }
+        if (err > limit)
+        {
+          printf("%u-bit %s: %lld LSB from the exact product\n", (unsigned)bits,
+                 BenchEvents[e].name, (long long)err);
+          errors++;
+        }
+      }
+      else if (err > 0)
+      {
+        printf("16-bit %s: attenuation %lld LSB from the exact product\n",
+               BenchEvents[e].name, (long long)err);
+        errors++;
+      }
+    }
+
+    if ((BenchEvents[e].blocks >= 40) && (BenchVol.gain != BenchVol.target))
+    {
+      printf("%u-bit %s: gain %d has not reached %d\n", (unsigned)bits,
+             BenchEvents[e].name, (int)BenchVol.gain, (int)BenchVol.target);
+      errors++;
+    }
+  }
+
+  printf("%u-bit: %u blocks match the scalar code, largest error %lld LSB\n",
+         (unsigned)bits, (unsigned)n, (long long)worst);
+  return errors;
+}
+
+/**
+  * @brief  Times the kernels and the scalar code at one setting.
+  * @param  name: setting.
+  * @param  bits: 16 or 32.
+  * @param  from: volume before each block.
+  * @param  to: volume of each block: equal to from for a constant gain.
+  * @param  blocks: number of blocks, split into BENCH_ROUNDS rounds.
+  * @retval 1 if the kernel is not faster than the scalar code, 0 otherwise.
+  */
+static uint32_t BENCH_Time(const char *name, uint32_t bits, int16_t from, int16_t to,
+                           uint32_t blocks)
+{
+  BENCH_RampTypeDef ref;
+  volatile int32_t sink = 0;
+  struct timespec t0, t1;
+  int32_t gfrom, gto;
+  double tk = 0.0, ts = 0.0, t;
+  uint32_t i, r, count = blocks / BENCH_ROUNDS;
+
+  BenchVol.rampFrames = 0;
+  Audio_Volume_Init(&BenchVol);
+  Audio_Volume_SetRamp(&BenchVol, BENCH_RAMP_FRAMES);
+  Audio_Volume_Set(&BenchVol, from);
+  gfrom = BenchVol.target;
+  Audio_Volume_Set(&BenchVol, to);
+  gto = BenchVol.target;
+  BenchVol.gain = gto;
+  BenchVol.rampTarget = gto;
+  ref.gain = gto;
+  ref.rampTarget = gto;
+  ref.step = 0;
+
+  for (r = 0; r < BENCH_ROUNDS; r++)
+  {
+    /* On a ramp, every block turns back towards the other volume */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++)
+    {
+      BenchVol.target = (i & 1) ? gto : gfrom;
+      if (bits == 16)
+      {
+        Audio_Volume_Process(&BenchVol, BenchDst16, BENCH_FRAMES);
+        sink += BenchDst16[i % (BENCH_FRAMES * 2)];
+      }
+      else
+      {
+        Audio_Volume_Process32(&BenchVol, BenchDst32, BENCH_FRAMES);
+        sink += BenchDst32[i % (BENCH_FRAMES * 2)];
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    t = BENCH_Elapsed(&t0, &t1);
+    tk = ((r == 0) || (t < tk)) ? t : tk;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++)
+    {
+      if (bits == 16)
+      {
+        BENCH_Scalar16(&ref, (i & 1) ? gto : gfrom, BenchRef16, BENCH_FRAMES);
+        sink += BenchRef16[i % (BENCH_FRAMES * 2)];
+      }
+      else
+      {
+        BENCH_Scalar32(&ref, (i & 1) ? gto : gfrom, BenchRef32, BENCH_FRAMES);
+        sink += BenchRef32[i % (BENCH_FRAMES * 2)];
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    t = BENCH_Elapsed(&t0, &t1);
+    ts = ((r == 0) || (t < ts)) ? t : ts;
+  }
+  (void)sink;
+
+  BENCH_Report(name, tk, ts, count);
+  return ((ts / tk) > BENCH_SPEEDUP_MIN) ? 0 : 1;
+}
+
+/**
+  * @brief  Checks and times the volume stage.
+  * @param  argc: number of arguments.
+  * @param  argv: [blocks].
+  * @retval 0 if the kernels match the scalar code and are faster, 1 otherwise.
+  */
+int main(int argc, char *argv[])
+{
+  uint32_t blocks = (argc > 1) ? (uint32_t)atoi(argv[1]) : BENCH_BLOCKS;
+  uint32_t i, errors = 0;
+
+  srand(1);
+  for (i = 0; i < (BENCH_FRAMES * 2); i++)
+  {
+    BenchSrc32[i] = (int32_t)(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+    BenchSrc16[i] = (int16_t)(BenchSrc32[i] >> 16);
+  }
+  /* Extremes saturate in the boost path */
+  BenchSrc16[0] = INT16_MAX;
+  BenchSrc16[1] = INT16_MIN;
+  BenchSrc16[2] = INT16_MIN;
+  BenchSrc16[3] = INT16_MAX;
+  BenchSrc32[0] = INT32_MAX;
+  BenchSrc32[1] = INT32_MIN;
+  BenchSrc32[2] = INT32_MIN;
+  BenchSrc32[3] = INT32_MAX;
+
+  errors += BENCH_Check(16);
+  errors += BENCH_Check(32);
+
+  memcpy(BenchDst16, BenchSrc16, sizeof(BenchDst16));
+  memcpy(BenchDst32, BenchSrc32, sizeof(BenchDst32));
+  memcpy(BenchRef16, BenchSrc16, sizeof(BenchRef16));
+  memcpy(BenchRef32, BenchSrc32, sizeof(BenchRef32));
+  printf("%-22s %19s %19s\n", "setting", "kernel", "scalar");
+  errors += BENCH_Time("16-bit -20 dB", 16, -20 * 256, -20 * 256, blocks);
+  errors += BENCH_Time("16-bit +6 dB", 16, 6 * 256, 6 * 256, blocks);
+  errors += BENCH_Time("16-bit ramp", 16, -20 * 256, -6 * 256, blocks);
+  errors += BENCH_Time("32-bit -20 dB", 32, -20 * 256, -20 * 256, blocks);
+  errors += BENCH_Time("32-bit +6 dB", 32, 6 * 256, 6 * 256, blocks);
+  errors += BENCH_Time("32-bit ramp", 32, -20 * 256, -6 * 256, blocks);
+
+  printf("%s\n", (errors == 0) ? "PASS" : "FAIL");
+  return (errors == 0) ? 0 : 1;
+}
@@ -27,6 +27,7 @@ SRC  += $(STM32F4_SRC_DIR)/stm32f4xx_tim.c
 SRC  += $(STM32F4_SRC_DIR)/stm32f4xx_spi.c
 SRC  += $(STM32F4_SRC_DIR)/stm32f4xx_i2c.c
 SRC  += $(STM32F4_SRC_DIR)/stm32f4xx_dma.c
+SRC  += $(STM32F4_SRC_DIR)/stm32f4xx_crc.c
 SRC  += $(STM32F4_SRC_DIR)/misc.c
 SRC  += $(STM32F4_USB_SRC_DIR)/usbd_core.c
 SRC  += $(STM32F4_USB_SRC_DIR)/usbd_ioreq.c